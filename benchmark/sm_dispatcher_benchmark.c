@@ -0,0 +1,183 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_dispatcher_benchmark.c
+ *
+ * \brief		Aggregate throughput of the sharded dispatcher
+ *
+ * For 1, 2, 4, ... up to the given number of shards (64 by default), as many
+ * producer threads post toggle events to a fleet of state machines, and the
+ * aggregate number of events handled per second is printed.
+ *
+ * Usage: state-machine-dispatcher-benchmark [max_shards] [events_per_producer]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_dispatcher.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MACHINES_PER_SHARD 1024u
+
+enum { event_toggle };
+
+/*******************************************************************************
+ * State machine definition
+ ******************************************************************************/
+extern const struct sm_state s_on;
+extern const struct sm_state s_off;
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_off)
+SM_STATE_MACHINE_TRANSITION_ADD(event_toggle, NULL, NULL, &s_on)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_off)
+const struct sm_state s_off = {
+	SM_STATE_MACHINE_STATE_NAME(s_off),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_off),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_on)
+SM_STATE_MACHINE_TRANSITION_ADD(event_toggle, NULL, NULL, &s_off)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_on)
+const struct sm_state s_on = {
+	SM_STATE_MACHINE_STATE_NAME(s_on),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_on),
+};
+
+static const struct sm_state s_error = {
+	SM_STATE_MACHINE_STATE_NAME(s_error),
+};
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+struct producer_args {
+	struct sm_dispatcher_producer *producer;
+	size_t index;
+	size_t num_producers;
+	size_t num_machines;
+	size_t num_events;
+};
+
+static struct sm_state_machine *resolve(void *context, size_t shard,
+										uint64_t key) {
+	(void)shard;
+	return &((struct sm_state_machine *)context)[key];
+}
+
+static void *produce(void *arg) {
+	const struct producer_args *args = arg;
+	const struct sm_event event = {event_toggle, NULL};
+
+	for (size_t i = 0; i < args->num_events; ++i) {
+		uint64_t key =
+			(i * args->num_producers + args->index) % args->num_machines;
+		while (!sm_dispatcher_post(args->producer, key, &event)) {
+			sched_yield();
+		}
+	}
+	sm_dispatcher_flush(args->producer);
+	return NULL;
+}
+
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+static int run(size_t num_shards, size_t num_events) {
+	const size_t num_producers = num_shards;
+	const size_t num_machines = num_shards * MACHINES_PER_SHARD;
+
+	struct sm_state_machine *machines =
+		calloc(num_machines, sizeof(*machines));
+	struct producer_args *args = calloc(num_producers, sizeof(*args));
+	pthread_t *threads = calloc(num_producers, sizeof(*threads));
+	if (!machines || !args || !threads) {
+		return -1;
+	}
+	struct sm_state_machine_hooks hooks = {0};
+	for (size_t i = 0; i < num_machines; ++i) {
+		sm_state_machine_init(&machines[i], NULL, &s_off, &s_error, &hooks,
+							  NULL, NULL);
+	}
+
+	struct sm_dispatcher dispatcher;
+	const struct sm_dispatcher_config config = {
+		.num_shards = num_shards,
+		.num_producers = num_producers,
+		.ring_size = 1024,
+		.batch_size = 64,
+		.pin_threads = true,
+		.resolve = resolve,
+		.context = machines,
+	};
+	if (!sm_dispatcher_init(&dispatcher, &config)) {
+		return -1;
+	}
+
+	struct timespec begin;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (!sm_dispatcher_start(&dispatcher)) {
+		return -1;
+	}
+	for (size_t i = 0; i < num_producers; ++i) {
+		args[i] = (struct producer_args){
+			.producer = sm_dispatcher_get_producer(&dispatcher, i),
+			.index = i,
+			.num_producers = num_producers,
+			.num_machines = num_machines,
+			.num_events = num_events,
+		};
+		pthread_create(&threads[i], NULL, produce, &args[i]);
+	}
+	for (size_t i = 0; i < num_producers; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	sm_dispatcher_stop(&dispatcher);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	uint64_t handled = 0;
+	for (size_t i = 0; i < num_shards; ++i) {
+		handled += sm_dispatcher_events_handled(&dispatcher, i);
+	}
+	double seconds = elapsed_seconds(&begin, &end);
+	printf("%3zu shards: %12.0f events/s (%llu events in %.3f s)\n",
+		   num_shards, (double)handled / seconds, (unsigned long long)handled,
+		   seconds);
+
+	sm_dispatcher_deinit(&dispatcher);
+	free(threads);
+	free(args);
+	free(machines);
+	return handled == num_producers * num_events ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+	size_t max_shards = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+	size_t num_events = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+
+	for (size_t num_shards = 1; num_shards <= max_shards; num_shards *= 2) {
+		if (run(num_shards, num_events) != 0) {
+			fprintf(stderr, "benchmark failed with %zu shards\n", num_shards);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
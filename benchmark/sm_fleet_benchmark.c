@@ -0,0 +1,180 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_fleet_benchmark.c
+ *
+ * \brief		False sharing between threads driving neighbouring machines
+ *
+ * Each thread toggles its own state machines. With a plain array, the state
+ * machines are assigned to the threads round robin, so that neighbouring state
+ * machines (and their cache lines) are written by different threads; with a
+ * fleet, each thread owns a partition. The aggregate number of events handled
+ * per second is printed for both layouts.
+ *
+ * Usage: state-machine-fleet-benchmark [threads] [machines_per_thread]
+ *        [rounds]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_fleet.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { event_toggle };
+
+/*******************************************************************************
+ * State machine definition
+ ******************************************************************************/
+extern const struct sm_state s_on;
+extern const struct sm_state s_off;
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_off)
+SM_STATE_MACHINE_TRANSITION_ADD(event_toggle, NULL, NULL, &s_on)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_off)
+const struct sm_state s_off = {
+	SM_STATE_MACHINE_STATE_NAME(s_off),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_off),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_on)
+SM_STATE_MACHINE_TRANSITION_ADD(event_toggle, NULL, NULL, &s_off)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_on)
+const struct sm_state s_on = {
+	SM_STATE_MACHINE_STATE_NAME(s_on),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_on),
+};
+
+static const struct sm_state s_error = {
+	SM_STATE_MACHINE_STATE_NAME(s_error),
+};
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+struct worker_args {
+	/* First state machine of the thread, and distance to the next one */
+	struct sm_state_machine *first;
+	size_t step;
+	size_t num_machines;
+	size_t num_rounds;
+	/* Set for the fleet: the partition is initialised by its owner */
+	struct sm_fleet *fleet;
+	size_t partition;
+};
+
+static void *work(void *arg) {
+	const struct worker_args *args = arg;
+	const struct sm_event event = {event_toggle, NULL};
+	struct sm_state_machine_hooks hooks = {0};
+
+	if (args->fleet) {
+		sm_fleet_touch(args->fleet, args->partition);
+	}
+	for (size_t i = 0; i < args->num_machines; ++i) {
+		sm_state_machine_init(&args->first[i * args->step], NULL, &s_off,
+							  &s_error, &hooks, NULL, NULL);
+	}
+	for (size_t round = 0; round < args->num_rounds; ++round) {
+		for (size_t i = 0; i < args->num_machines; ++i) {
+			sm_state_machine_handle_event(&args->first[i * args->step],
+										  &event);
+		}
+	}
+	return NULL;
+}
+
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+static int run(const char *layout, struct worker_args *args,
+			   size_t num_threads) {
+	pthread_t *threads = calloc(num_threads, sizeof(*threads));
+	if (!threads) {
+		return -1;
+	}
+
+	struct timespec begin;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (size_t i = 0; i < num_threads; ++i) {
+		pthread_create(&threads[i], NULL, work, &args[i]);
+	}
+	for (size_t i = 0; i < num_threads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double events = (double)num_threads * (double)args[0].num_machines *
+					(double)args[0].num_rounds;
+	double seconds = elapsed_seconds(&begin, &end);
+	printf("%-12s %3zu threads: %12.0f events/s (%.3f s)\n", layout,
+		   num_threads, events / seconds, seconds);
+	free(threads);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	size_t num_threads = argc > 1 ? strtoul(argv[1], NULL, 0) : 4;
+	size_t num_machines = argc > 2 ? strtoul(argv[2], NULL, 0) : 64;
+	size_t num_rounds = argc > 3 ? strtoul(argv[3], NULL, 0) : 100000;
+
+	struct worker_args *args = calloc(num_threads, sizeof(*args));
+	struct sm_state_machine *array =
+		calloc(num_threads * num_machines, sizeof(*array));
+	struct sm_fleet fleet;
+	const struct sm_fleet_config config = {
+		.num_partitions = num_threads,
+		.partition_size = num_machines,
+		.numa_local = true,
+	};
+	if (!args || !array || !sm_fleet_init(&fleet, &config)) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Before: neighbouring state machines belong to different threads */
+	for (size_t i = 0; i < num_threads; ++i) {
+		args[i] = (struct worker_args){
+			.first = &array[i],
+			.step = num_threads,
+			.num_machines = num_machines,
+			.num_rounds = num_rounds,
+		};
+	}
+	int result = run("interleaved", args, num_threads);
+
+	/* After: one partition per thread */
+	for (size_t i = 0; i < num_threads; ++i) {
+		args[i] = (struct worker_args){
+			.first = sm_fleet_partition(&fleet, i),
+			.step = 1,
+			.num_machines = num_machines,
+			.num_rounds = num_rounds,
+			.fleet = &fleet,
+			.partition = i,
+		};
+	}
+	result |= run("fleet", args, num_threads);
+
+	sm_fleet_deinit(&fleet);
+	free(array);
+	free(args);
+	return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,15 @@
+# Write the C source of a generated state machine to a file
+#
+# cmake -DGENERATOR=<state-machine-scale-benchmark> -DMODE=table|functions
+#	-DOUTPUT=<file> -P sm_generate_source.cmake
+get_filename_component(OUTPUT_DIR ${OUTPUT} DIRECTORY)
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+execute_process(
+	COMMAND ${GENERATOR} --source ${MODE}
+	OUTPUT_FILE ${OUTPUT}
+	RESULT_VARIABLE RESULT
+	)
+if (RESULT)
+	file(REMOVE ${OUTPUT})
+	message(FATAL_ERROR "${GENERATOR} --source ${MODE} failed: ${RESULT}")
+endif()
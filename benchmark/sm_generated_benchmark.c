@@ -0,0 +1,88 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_generated_benchmark.c
+ *
+ * \brief		Dispatch of a generated state machine compiled from its source
+ *
+ * The build generates the source of the baseline state machine of
+ * state-machine-scale-benchmark (1000 states, flat, 4 transitions per state out
+ * of 16 event types, no guards) with `--source table` and
+ * `--source functions`, and compiles this file once with each. Uniform random
+ * events are dispatched to it, and the average latency of an event is printed.
+ * Unlike the definition in memory of state-machine-scale-benchmark, this also
+ * works with #SM_STATE_MACHINE_OPTIMIZE_RAM.
+ *
+ * Usage: state-machine-generated-benchmark-table|functions [events]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* Defines GENERATED_INITIAL_STATE, from the include directory of the mode */
+#include "sm_generated_machine.c"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* sm_generator_options::num_event_types of the generated source */
+#define NUM_EVENT_TYPES 16
+
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+/* xorshift64: the events are drawn before the measure */
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+int main(int argc, char **argv) {
+	size_t num_events = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+
+	struct sm_event *events = malloc(num_events * sizeof(*events));
+	if (!events) {
+		return EXIT_FAILURE;
+	}
+	uint64_t random = 1;
+	for (size_t i = 0; i < num_events; ++i) {
+		events[i].type = (int)(next_random(&random) % NUM_EVENT_TYPES);
+		events[i].data = NULL;
+	}
+
+	struct sm_state_machine state_machine;
+	struct sm_state_machine_hooks hooks = {0};
+	sm_state_machine_init(&state_machine, NULL, &GENERATED_INITIAL_STATE,
+						  &generated_error, &hooks, NULL, NULL);
+
+	size_t errors = 0;
+	struct timespec begin;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (size_t i = 0; i < num_events; ++i) {
+		errors += sm_state_machine_handle_event(&state_machine, &events[i]) < 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(events);
+
+	double seconds = elapsed_seconds(&begin, &end);
+	printf("%-10s %8.2f ns/event\n", SM_GENERATED_MODE,
+		   seconds * 1e9 / (double)num_events);
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_inline_benchmark.c
+ *
+ * \brief		Dispatch through the library vs the single header build
+ *
+ * A traffic light cycles through its states, counting the cycles in a
+ * transition action, while the events are dispatched to it one at a time.
+ * This file is built twice: linked to the state-machine library, and with
+ * SM_BENCHMARK_SINGLE_HEADER, including sm_state_machine_single.h, so that the
+ * dispatch is inlined in the loop (the guards and actions are still called
+ * through the transition tables). The number of events handled per second is
+ * printed.
+ *
+ * Usage: state-machine-inline-benchmark[-single-header] [events]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#if SM_BENCHMARK_SINGLE_HEADER
+#include "sm_state_machine_single.h"
+#define LAYOUT "single header"
+#else
+#include "sm_state_machine.h"
+#define LAYOUT "library"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { event_timer, event_fault };
+
+/*******************************************************************************
+ * State machine definition
+ ******************************************************************************/
+static bool is_powered(void *sm_user_data, const struct sm_state *current_state,
+					   void *current_state_data, const struct sm_event *event,
+					   const struct sm_state *next_state,
+					   void *next_state_data) {
+	(void)current_state;
+	(void)current_state_data;
+	(void)event;
+	(void)next_state;
+	(void)next_state_data;
+	return sm_user_data != NULL;
+}
+
+static void count_cycle(void *sm_user_data, const struct sm_state *current_state,
+						void *current_state_data, const struct sm_event *event,
+						const struct sm_state *next_state,
+						void *next_state_data) {
+	(void)current_state;
+	(void)current_state_data;
+	(void)event;
+	(void)next_state;
+	(void)next_state_data;
+	++*(unsigned long *)sm_user_data;
+}
+
+extern const struct sm_state s_red;
+extern const struct sm_state s_green;
+extern const struct sm_state s_yellow;
+static const struct sm_state s_error = {
+	SM_STATE_MACHINE_STATE_NAME(s_error),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_red)
+SM_STATE_MACHINE_TRANSITION_ADD(event_fault, NULL, NULL, &s_error)
+SM_STATE_MACHINE_TRANSITION_ADD(event_timer, is_powered, NULL, &s_green)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_red)
+const struct sm_state s_red = {
+	SM_STATE_MACHINE_STATE_NAME(s_red),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_red),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_green)
+SM_STATE_MACHINE_TRANSITION_ADD(event_fault, NULL, NULL, &s_error)
+SM_STATE_MACHINE_TRANSITION_ADD(event_timer, is_powered, NULL, &s_yellow)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_green)
+const struct sm_state s_green = {
+	SM_STATE_MACHINE_STATE_NAME(s_green),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_green),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_yellow)
+SM_STATE_MACHINE_TRANSITION_ADD(event_fault, NULL, NULL, &s_error)
+SM_STATE_MACHINE_TRANSITION_ADD(event_timer, is_powered, count_cycle, &s_red)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_yellow)
+const struct sm_state s_yellow = {
+	SM_STATE_MACHINE_STATE_NAME(s_yellow),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_yellow),
+};
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv) {
+	size_t num_events = argc > 1 ? strtoul(argv[1], NULL, 0) : 50000000;
+
+	unsigned long cycles = 0;
+	struct sm_state_machine state_machine;
+	struct sm_state_machine_hooks hooks = {0};
+	sm_state_machine_init(&state_machine, NULL, &s_red, &s_error, &hooks,
+						  &cycles, NULL);
+
+	const struct sm_event event = {event_timer, NULL};
+	struct timespec begin;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (size_t i = 0; i < num_events; ++i) {
+		sm_state_machine_handle_event(&state_machine, &event);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = elapsed_seconds(&begin, &end);
+	printf("%-14s %12.0f events/s (%.3f s, %lu cycles)\n", LAYOUT,
+		   (double)num_events / seconds, seconds, cycles);
+	return cycles == num_events / 3 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
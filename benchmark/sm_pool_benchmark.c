@@ -0,0 +1,155 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_pool_benchmark.c
+ *
+ * \brief		Connections created and destroyed: malloc and init vs pool
+ *
+ * Each connection is created, opened and closed (a final state) by three
+ * events, while a window of connections is kept open. The connections are
+ * either allocated with malloc() and initialised with sm_state_machine_init(),
+ * or acquired from a #sm_pool and recycled when they reach the final state.
+ * The number of connections per second is printed.
+ *
+ * Usage: state-machine-pool-benchmark [connections] [window]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { event_open, event_close };
+
+/*******************************************************************************
+ * State machine definition
+ ******************************************************************************/
+extern const struct sm_state s_idle;
+extern const struct sm_state s_open;
+static const struct sm_state s_closed = {
+	SM_STATE_MACHINE_STATE_NAME(s_closed),
+};
+static const struct sm_state s_error = {
+	SM_STATE_MACHINE_STATE_NAME(s_error),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_idle)
+SM_STATE_MACHINE_TRANSITION_ADD(event_open, NULL, NULL, &s_open)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_idle)
+const struct sm_state s_idle = {
+	SM_STATE_MACHINE_STATE_NAME(s_idle),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_idle),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_open)
+SM_STATE_MACHINE_TRANSITION_ADD(event_close, NULL, NULL, &s_closed)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_open)
+const struct sm_state s_open = {
+	SM_STATE_MACHINE_STATE_NAME(s_open),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_open),
+};
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+static const struct sm_event open_event = {event_open, NULL};
+static const struct sm_event close_event = {event_close, NULL};
+
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+/* Returns the number of connections closed */
+static size_t run_malloc(size_t num_connections, size_t window) {
+	struct sm_state_machine **open = calloc(window, sizeof(*open));
+	struct sm_state_machine_hooks hooks = {0};
+	size_t closed = 0;
+	for (size_t i = 0; i < num_connections; ++i) {
+		struct sm_state_machine **slot = &open[i % window];
+		if (*slot) {
+			closed += sm_state_machine_handle_event(*slot, &close_event) ==
+					  sm_state_machine_final_state_reached;
+			free(*slot);
+		}
+		*slot = malloc(sizeof(**slot));
+		sm_state_machine_init(*slot, "connection", &s_idle, &s_error, &hooks,
+							  NULL, NULL);
+		sm_state_machine_handle_event(*slot, &open_event);
+	}
+	for (size_t i = 0; i < window; ++i) {
+		free(open[i]);
+	}
+	free(open);
+	return closed;
+}
+
+static size_t run_pool(size_t num_connections, size_t window) {
+	struct sm_state_machine **open = calloc(window, sizeof(*open));
+	struct sm_state_machine_hooks hooks = {0};
+	struct sm_state_machine prototype;
+	sm_state_machine_init(&prototype, "connection", &s_idle, &s_error, &hooks,
+						  NULL, NULL);
+	struct sm_pool pool;
+	if (!open || !sm_pool_init(&pool, &prototype, window)) {
+		return 0;
+	}
+	size_t closed = 0;
+	for (size_t i = 0; i < num_connections; ++i) {
+		struct sm_state_machine **slot = &open[i % window];
+		if (*slot) {
+			closed += sm_pool_handle_event(&pool, *slot, &close_event) ==
+					  sm_state_machine_final_state_reached;
+		}
+		*slot = sm_pool_acquire(&pool, NULL, NULL);
+		sm_pool_handle_event(&pool, *slot, &open_event);
+	}
+	sm_pool_deinit(&pool);
+	free(open);
+	return closed;
+}
+
+int main(int argc, char **argv) {
+	size_t num_connections = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+	size_t window = argc > 2 ? strtoul(argv[2], NULL, 0) : 100000;
+	if (window == 0 || window > num_connections) {
+		fprintf(stderr, "the window must be between 1 and the connections\n");
+		return EXIT_FAILURE;
+	}
+
+	static const struct {
+		const char *name;
+		size_t (*run)(size_t num_connections, size_t window);
+	} layouts[] = {
+		{"malloc + init", run_malloc},
+		{"pool", run_pool},
+	};
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+		struct timespec begin;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		size_t closed = layouts[i].run(num_connections, window);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double seconds = elapsed_seconds(&begin, &end);
+		printf("%-14s %12.0f connections/s (%.3f s)\n", layouts[i].name,
+			   (double)num_connections / seconds, seconds);
+		ok = ok && closed == num_connections - window;
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_scale_benchmark.cpp
+ *
+ * \brief		Dispatch latency against the shape of generated state machines
+ *
+ * Each dimension of sm_generator_options is swept in turn, the others keeping
+ * their baseline value: 1000 states, flat, 4 transitions per state out of 16
+ * event types, no guards, uniform events. The average latency of an event is
+ * printed as CSV (dimension,value,ns_per_event), ready to be plotted, e.g.
+ * with gnuplot.
+ *
+ * With --source, the C source of a generated state machine is printed
+ * instead: the build compiles it into state-machine-generated-benchmark-table
+ * and state-machine-generated-benchmark-functions.
+ *
+ * Usage: state-machine-scale-benchmark [events]
+ *        state-machine-scale-benchmark --source table|functions [states]
+ *        [depth] [transitions] [guard_density]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "sm_generator.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+double ns_per_event(const sm_generator_options &options,
+					std::size_t num_events) {
+	const sm_generated_machine machine(options);
+	const std::vector<int> types = machine.events(num_events, options.seed);
+	std::vector<sm_event> events;
+	events.reserve(types.size());
+	for (int type : types) {
+		events.push_back({type, nullptr});
+	}
+
+	sm_state_machine state_machine;
+	sm_state_machine_hooks hooks = {};
+	sm_state_machine_init(&state_machine, nullptr, machine.initial_state(),
+						  machine.error_state(), &hooks, nullptr, nullptr);
+	const auto begin = std::chrono::steady_clock::now();
+	for (const sm_event &event : events) {
+		sm_state_machine_handle_event(&state_machine, &event);
+	}
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - begin).count() /
+		   static_cast<double>(num_events);
+}
+
+void print(const char *dimension, double value, double ns) {
+	std::printf("%s,%g,%.2f\n", dimension, value, ns);
+}
+#endif
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc > 2 && std::strcmp(argv[1], "--source") == 0) {
+		sm_generator_options options;
+		options.num_states = argc > 3 ? std::strtoul(argv[3], nullptr, 0) : 1000;
+		options.depth = argc > 4 ? std::strtoul(argv[4], nullptr, 0) : 1;
+		options.transitions_per_state =
+			argc > 5 ? std::strtoul(argv[5], nullptr, 0) : 4;
+		options.guard_density = argc > 6 ? std::strtod(argv[6], nullptr) : 0;
+		const sm_generated_machine machine(options);
+		std::fputs(machine
+					   .c_source("generated",
+								 std::strcmp(argv[2], "functions") == 0)
+					   .c_str(),
+				   stdout);
+		return EXIT_SUCCESS;
+	}
+
+#if SM_STATE_MACHINE_OPTIMIZE_RAM
+	std::fputs("Generated definitions in memory need transition tables: use "
+			   "--source, or state-machine-generated-benchmark-*\n",
+			   stderr);
+	return EXIT_FAILURE;
+#else
+	const std::size_t num_events =
+		argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 2000000;
+	const sm_generator_options baseline = [] {
+		sm_generator_options options;
+		options.num_states = 1000;
+		options.transitions_per_state = 4;
+		options.num_event_types = 16;
+		return options;
+	}();
+
+	std::printf("dimension,value,ns_per_event\n");
+	for (std::size_t states : {10, 100, 1000, 10000}) {
+		sm_generator_options options = baseline;
+		options.num_states = states;
+		print("states", states, ns_per_event(options, num_events));
+	}
+	for (std::size_t depth : {1, 2, 4, 8, 16}) {
+		sm_generator_options options = baseline;
+		options.depth = depth;
+		print("depth", depth, ns_per_event(options, num_events));
+	}
+	for (std::size_t transitions : {1, 2, 4, 8, 16}) {
+		sm_generator_options options = baseline;
+		options.transitions_per_state = transitions;
+		print("transitions", transitions, ns_per_event(options, num_events));
+	}
+	for (double density : {0.0, 0.25, 0.5, 0.75, 1.0}) {
+		sm_generator_options options = baseline;
+		options.guard_density = density;
+		print("guard_density", density, ns_per_event(options, num_events));
+	}
+	for (double exponent : {0.0, 0.5, 1.0, 1.5, 2.0}) {
+		/* An exponent of 0 is the uniform distribution */
+		sm_generator_options options = baseline;
+		options.distribution = sm_event_distribution::zipf;
+		options.zipf_exponent = exponent;
+		print("zipf_exponent", exponent, ns_per_event(options, num_events));
+	}
+	return EXIT_SUCCESS;
+#endif
+}
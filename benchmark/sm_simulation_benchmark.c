@@ -0,0 +1,156 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_simulation_benchmark.c
+ *
+ * \brief		Discrete-event simulation of many instances
+ *
+ * A city of traffic lights: each light cycles through its states, and the
+ * transition action schedules its next timer event, after the duration of the
+ * new state plus some jitter, in virtual milliseconds. All the lights start
+ * within the first cycle. The number of simulated events dispatched per second
+ * of wall clock time is printed.
+ *
+ * Usage: state-machine-simulation-benchmark [instances] [events]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_simulation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+enum { event_timer };
+
+/* Shared by all the instances */
+struct city {
+	struct sm_simulation simulation;
+	uint64_t random;
+};
+
+/*******************************************************************************
+ * State machine definition
+ ******************************************************************************/
+extern const struct sm_state s_red;
+extern const struct sm_state s_green;
+extern const struct sm_state s_yellow;
+static const struct sm_state s_error = {
+	SM_STATE_MACHINE_STATE_NAME(s_error),
+};
+
+/* xorshift64 */
+static uint64_t next_random(struct city *city) {
+	city->random ^= city->random << 13;
+	city->random ^= city->random >> 7;
+	city->random ^= city->random << 17;
+	return city->random;
+}
+
+static void schedule_timer(void *sm_user_data,
+						   const struct sm_state *current_state,
+						   void *current_state_data,
+						   const struct sm_event *event,
+						   const struct sm_state *next_state,
+						   void *next_state_data) {
+	(void)current_state;
+	(void)current_state_data;
+	(void)next_state_data;
+	struct city *city = sm_user_data;
+	const uint64_t duration = next_state == &s_red		? 30000
+							  : next_state == &s_green	? 25000
+														: 5000;
+	const uint64_t time = sm_simulation_now(&city->simulation) + duration +
+						  next_random(city) % 1000;
+	sm_simulation_schedule(&city->simulation, time,
+						   sm_simulation_current_instance(&city->simulation),
+						   event);
+}
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_red)
+SM_STATE_MACHINE_TRANSITION_ADD(event_timer, NULL, schedule_timer, &s_green)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_red)
+const struct sm_state s_red = {
+	SM_STATE_MACHINE_STATE_NAME(s_red),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_red),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_green)
+SM_STATE_MACHINE_TRANSITION_ADD(event_timer, NULL, schedule_timer, &s_yellow)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_green)
+const struct sm_state s_green = {
+	SM_STATE_MACHINE_STATE_NAME(s_green),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_green),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_yellow)
+SM_STATE_MACHINE_TRANSITION_ADD(event_timer, NULL, schedule_timer, &s_red)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_yellow)
+const struct sm_state s_yellow = {
+	SM_STATE_MACHINE_STATE_NAME(s_yellow),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_yellow),
+};
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+int main(int argc, char **argv) {
+	size_t num_instances = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	size_t num_events = argc > 2 ? strtoul(argv[2], NULL, 0) : 20000000;
+
+	struct city city = {.random = 88172645463325252u};
+	struct sm_state_machine *instances =
+		malloc(num_instances * sizeof(*instances));
+	if (!instances ||
+		!sm_simulation_init(&city.simulation, instances, num_instances)) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+	struct sm_state_machine_hooks hooks = {0};
+	const struct sm_event event = {event_timer, NULL};
+	for (size_t i = 0; i < num_instances; ++i) {
+		sm_state_machine_init(&instances[i], NULL, &s_red, &s_error, &hooks,
+							  &city, NULL);
+		if (!sm_simulation_schedule(&city.simulation,
+									next_random(&city) % 60000, i, &event)) {
+			fprintf(stderr, "out of memory\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct timespec begin;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (size_t i = 0; i < num_events && sm_simulation_step(&city.simulation);
+		 ++i) {
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = elapsed_seconds(&begin, &end);
+	uint64_t dispatched = sm_simulation_dispatched(&city.simulation);
+	printf("%zu instances %12.0f events/s (%.3f s, %.1f simulated s)\n",
+		   num_instances, (double)dispatched / seconds, seconds,
+		   (double)sm_simulation_now(&city.simulation) * 1e-3);
+	bool ok = dispatched == num_events &&
+			  sm_simulation_pending(&city.simulation) == num_instances;
+	sm_simulation_deinit(&city.simulation);
+	free(instances);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
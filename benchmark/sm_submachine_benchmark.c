@@ -0,0 +1,210 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_submachine_benchmark.c
+ *
+ * \brief		Dispatch through a shared submachine vs copied states
+ *
+ * Two links run the same handshake protocol (wait <-> ready), and a "next"
+ * event moves from one link to the other. The handshake states are either
+ * copied under each link, with their own transition tables, or defined once
+ * as a submachine used by both links. Three events out of four are handled
+ * within the handshake, the fourth by the link. The number of events handled
+ * per second and the size of the states are printed.
+ *
+ * Usage: state-machine-submachine-benchmark [events]
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_state_machine_single.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if !SM_STATE_MACHINE_ENABLE_SUBMACHINES
+#error "SM_STATE_MACHINE_ENABLE_SUBMACHINES must be set"
+#endif
+
+enum { event_ack, event_next };
+
+static const struct sm_state s_error = {
+	SM_STATE_MACHINE_STATE_NAME(s_error),
+};
+
+/*******************************************************************************
+ * Copied states
+ ******************************************************************************/
+extern const struct sm_state s_link_a;
+extern const struct sm_state s_link_b;
+extern const struct sm_state s_a_wait;
+extern const struct sm_state s_a_ready;
+extern const struct sm_state s_b_wait;
+extern const struct sm_state s_b_ready;
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_link_a)
+SM_STATE_MACHINE_TRANSITION_ADD(event_next, NULL, NULL, &s_link_b)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_link_a)
+const struct sm_state s_link_a = {
+	SM_STATE_MACHINE_STATE_NAME(s_link_a),
+	.entry_state = &s_a_wait,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_link_a),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_a_wait)
+SM_STATE_MACHINE_TRANSITION_ADD(event_ack, NULL, NULL, &s_a_ready)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_a_wait)
+const struct sm_state s_a_wait = {
+	SM_STATE_MACHINE_STATE_NAME(s_a_wait),
+	.parent_state = &s_link_a,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_a_wait),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_a_ready)
+SM_STATE_MACHINE_TRANSITION_ADD(event_ack, NULL, NULL, &s_a_wait)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_a_ready)
+const struct sm_state s_a_ready = {
+	SM_STATE_MACHINE_STATE_NAME(s_a_ready),
+	.parent_state = &s_link_a,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_a_ready),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_link_b)
+SM_STATE_MACHINE_TRANSITION_ADD(event_next, NULL, NULL, &s_link_a)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_link_b)
+const struct sm_state s_link_b = {
+	SM_STATE_MACHINE_STATE_NAME(s_link_b),
+	.entry_state = &s_b_wait,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_link_b),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_b_wait)
+SM_STATE_MACHINE_TRANSITION_ADD(event_ack, NULL, NULL, &s_b_ready)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_b_wait)
+const struct sm_state s_b_wait = {
+	SM_STATE_MACHINE_STATE_NAME(s_b_wait),
+	.parent_state = &s_link_b,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_b_wait),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_b_ready)
+SM_STATE_MACHINE_TRANSITION_ADD(event_ack, NULL, NULL, &s_b_wait)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_b_ready)
+const struct sm_state s_b_ready = {
+	SM_STATE_MACHINE_STATE_NAME(s_b_ready),
+	.parent_state = &s_link_b,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_b_ready),
+};
+
+/*******************************************************************************
+ * Shared submachine
+ ******************************************************************************/
+extern const struct sm_state s_wait;
+extern const struct sm_state s_ready;
+extern const struct sm_state s_shared_a;
+extern const struct sm_state s_shared_b;
+static const struct sm_submachine handshake = {.initial_state = &s_wait};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_wait)
+SM_STATE_MACHINE_TRANSITION_ADD(event_ack, NULL, NULL, &s_ready)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_wait)
+const struct sm_state s_wait = {
+	SM_STATE_MACHINE_STATE_NAME(s_wait),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_wait),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_ready)
+SM_STATE_MACHINE_TRANSITION_ADD(event_ack, NULL, NULL, &s_wait)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_ready)
+const struct sm_state s_ready = {
+	SM_STATE_MACHINE_STATE_NAME(s_ready),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_ready),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_shared_a)
+SM_STATE_MACHINE_TRANSITION_ADD(event_next, NULL, NULL, &s_shared_b)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_shared_a)
+const struct sm_state s_shared_a = {
+	SM_STATE_MACHINE_STATE_NAME(s_shared_a),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_shared_a),
+	.submachine = &handshake,
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s_shared_b)
+SM_STATE_MACHINE_TRANSITION_ADD(event_next, NULL, NULL, &s_shared_a)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s_shared_b)
+const struct sm_state s_shared_b = {
+	SM_STATE_MACHINE_STATE_NAME(s_shared_b),
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s_shared_b),
+	.submachine = &handshake,
+};
+
+/*******************************************************************************
+ * Benchmark
+ ******************************************************************************/
+static double elapsed_seconds(const struct timespec *begin,
+							  const struct timespec *end) {
+	return (double)(end->tv_sec - begin->tv_sec) +
+		   (double)(end->tv_nsec - begin->tv_nsec) * 1e-9;
+}
+
+/* Returns the number of events that changed state */
+static size_t run(const struct sm_state *initial_state, size_t num_events) {
+	struct sm_state_machine state_machine;
+	struct sm_state_machine_hooks hooks = {0};
+	sm_state_machine_init(&state_machine, NULL, initial_state, &s_error,
+						  &hooks, NULL, NULL);
+	/* Enter the handshake of the first link */
+	const struct sm_event next = {event_next, NULL};
+	sm_state_machine_handle_event(&state_machine, &next);
+
+	const struct sm_event events[4] = {
+		{event_ack, NULL}, {event_ack, NULL}, {event_ack, NULL}, next};
+	size_t changed = 0;
+	for (size_t i = 0; i < num_events; ++i) {
+		changed += sm_state_machine_handle_event(&state_machine,
+												 &events[i % 4]) ==
+				   sm_state_machine_state_changed;
+	}
+	return changed;
+}
+
+int main(int argc, char **argv) {
+	size_t num_events = argc > 1 ? strtoul(argv[1], NULL, 0) : 50000000;
+
+	static const struct {
+		const char *name;
+		const struct sm_state *initial_state;
+		size_t num_states;
+	} layouts[] = {
+		/* The links enter their handshake through "next" */
+		{"copied", &s_link_b, 6},
+		{"submachine", &s_shared_b, 4},
+	};
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+		struct timespec begin;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		size_t changed = run(layouts[i].initial_state, num_events);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double seconds = elapsed_seconds(&begin, &end);
+		printf("%-10s %12.0f events/s (%.3f s, %zu states of %zu bytes)\n",
+			   layouts[i].name, (double)num_events / seconds, seconds,
+			   layouts[i].num_states, sizeof(struct sm_state));
+		ok = ok && changed == num_events;
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
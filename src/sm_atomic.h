@@ -0,0 +1,35 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_atomic.h
+ *
+ * \brief		atomic types usable in headers shared between C and C++
+ *
+ * C11 `_Atomic` types can't be parsed by a C++ compiler, while public structs
+ * must be visible from both languages. On the supported compilers
+ * `std::atomic<T>` and `_Atomic(T)` have the same size and layout, so the
+ * members are declared with #SM_ATOMIC and only ever accessed from C.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#ifndef SM_ATOMIC_H_
+#define SM_ATOMIC_H_
+
+#ifdef __cplusplus
+#include <atomic>
+/**
+ * \brief Declare an atomic member of type \p _type_
+ */
+#define SM_ATOMIC(_type_) std::atomic<_type_>
+#else
+#include <stdatomic.h>
+#define SM_ATOMIC(_type_) _Atomic(_type_)
+#endif
+
+#endif /* ifndef SM_ATOMIC_H_ */
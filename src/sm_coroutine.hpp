@@ -0,0 +1,454 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_coroutine.hpp
+ *
+ * \brief		C++20 coroutine support - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#ifndef SM_COROUTINE_HPP_
+#define SM_COROUTINE_HPP_
+
+#include "sm_state_machine.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+
+/**
+ * \brief Description of a transition, as seen by
+ * sm_awaitable_state_machine::next_transition()
+ */
+struct sm_transition_info {
+	/** \brief State before the transition */
+	const struct sm_state *previous_state = nullptr;
+	/** \brief State after the transition */
+	const struct sm_state *current_state = nullptr;
+	/** \brief Type of the event that triggered the transition */
+	int event_type = 0;
+	/** \brief What sm_state_machine_handle_event() returned */
+	enum sm_state_machine_handle_event_status status =
+		sm_state_machine_no_state_change;
+};
+
+/**
+ * \brief Coroutine front-end of a state machine
+ *
+ * Lets coroutines wait for a state machine to reach a state, or to take its
+ * next transition, without polling:
+ *
+ * \code
+ * co_await machine.until(&s_ready);
+ * sm_transition_info transition = co_await machine.next_transition();
+ * \endcode
+ *
+ * With #SM_STATE_MACHINE_ENABLE_TRACE, the wrapper installs its own tracer,
+ * which forwards every callback to the tracer the state machine had, and
+ * selects the awaiters from sm_state_machine_tracer::state_changed. Every
+ * change of state is seen, whoever causes it: handle_event(),
+ * sm_state_machine_handle_event(), sm_state_machine_complete_async_action(),
+ * a dispatcher, a simulation or a pool. The selected coroutines are resumed
+ * right after the outermost event has been dispatched, or right after the
+ * state has changed if no event is being dispatched (an asynchronous action
+ * that completes). Re-initialising the state machine, or copying a prototype
+ * over it (sm_pool_reset()), removes the tracer: create the wrapper after.
+ *
+ * Without tracing, suspended coroutines are resumed by handle_event(), right
+ * after the event has been dispatched. Events dispatched in any other way
+ * must be followed by a call to notify().
+ *
+ * Coroutines are resumed in the order in which they started waiting.
+ * Nothing is allocated: every awaiter lives in the frame of the awaiting
+ * coroutine and is linked into an intrusive list while suspended. Destroying
+ * a suspended coroutine unlinks its awaiter.
+ *
+ * Not thread-safe: events must be dispatched, and awaiters created, by the
+ * same thread.
+ */
+class sm_awaitable_state_machine {
+	struct waiter_list;
+
+	struct waiter {
+		waiter *previous = nullptr;
+		waiter *next = nullptr;
+		waiter_list *list = nullptr;
+		std::coroutine_handle<> handle;
+		/* NULL when waiting for the next transition */
+		const struct sm_state *state = nullptr;
+		sm_transition_info *transition = nullptr;
+
+		waiter() = default;
+		waiter(const waiter &) = delete;
+		waiter &operator=(const waiter &) = delete;
+		~waiter() {
+			if (list) {
+				list->remove(this);
+			}
+		}
+	};
+
+	struct waiter_list {
+		waiter *head = nullptr;
+		waiter *tail = nullptr;
+
+		void push_back(waiter *w) {
+			w->list = this;
+			w->previous = tail;
+			w->next = nullptr;
+			if (tail) {
+				tail->next = w;
+			} else {
+				head = w;
+			}
+			tail = w;
+		}
+		void remove(waiter *w) {
+			(w->previous ? w->previous->next : head) = w->next;
+			(w->next ? w->next->previous : tail) = w->previous;
+			w->previous = w->next = nullptr;
+			w->list = nullptr;
+		}
+	};
+
+  public:
+	/**
+	 * \brief Awaiter returned by until()
+	 */
+	class until_awaiter {
+	  public:
+		bool await_ready() const noexcept {
+			return machine_.in_state(waiter_.state);
+		}
+		void await_suspend(std::coroutine_handle<> handle) noexcept {
+			waiter_.handle = handle;
+			machine_.waiting_.push_back(&waiter_);
+		}
+		void await_resume() const noexcept {}
+
+	  private:
+		friend class sm_awaitable_state_machine;
+		until_awaiter(sm_awaitable_state_machine &machine,
+					  const struct sm_state *state)
+			: machine_(machine) {
+			waiter_.state = state;
+		}
+
+		sm_awaitable_state_machine &machine_;
+		waiter waiter_;
+	};
+
+	/**
+	 * \brief Awaiter returned by next_transition()
+	 */
+	class transition_awaiter {
+	  public:
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) noexcept {
+			waiter_.handle = handle;
+			machine_.waiting_.push_back(&waiter_);
+		}
+		sm_transition_info await_resume() const noexcept { return info_; }
+
+	  private:
+		friend class sm_awaitable_state_machine;
+		explicit transition_awaiter(sm_awaitable_state_machine &machine)
+			: machine_(machine) {
+			waiter_.transition = &info_;
+		}
+
+		sm_awaitable_state_machine &machine_;
+		waiter waiter_;
+		sm_transition_info info_;
+	};
+
+	/**
+	 * \param [in] state_machine an initialised state machine. It must
+	 * outlive this object.
+	 */
+	explicit sm_awaitable_state_machine(struct sm_state_machine &state_machine)
+		: state_machine_(state_machine) {
+#if SM_STATE_MACHINE_ENABLE_TRACE
+		chained_ = state_machine_.hooks.tracer;
+		tracer_.context = this;
+		tracer_.event_begin = event_begin;
+		tracer_.transition_taken = transition_taken;
+		tracer_.event_end = event_end;
+		tracer_.state_changed = state_changed;
+		state_machine_.hooks.tracer = &tracer_;
+#endif
+	}
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	/** \brief Gives the state machine its own tracer back */
+	~sm_awaitable_state_machine() {
+		if (state_machine_.hooks.tracer == &tracer_) {
+			state_machine_.hooks.tracer = chained_;
+		}
+	}
+#endif
+	sm_awaitable_state_machine(const sm_awaitable_state_machine &) = delete;
+	sm_awaitable_state_machine &
+	operator=(const sm_awaitable_state_machine &) = delete;
+
+	/** \brief The wrapped state machine */
+	struct sm_state_machine &state_machine() { return state_machine_; }
+
+	/**
+	 * \brief Dispatch an event and resume the coroutines it satisfies
+	 *
+	 * \returns what sm_state_machine_handle_event() returned
+	 */
+	int handle_event(const struct sm_event *event) {
+#if SM_STATE_MACHINE_ENABLE_TRACE
+		return sm_state_machine_handle_event(&state_machine_, event);
+#else
+		const struct sm_state *previous_state = state_machine_.current_state;
+		int status = sm_state_machine_handle_event(&state_machine_, event);
+		notify(previous_state, event, status);
+		return status;
+#endif
+	}
+
+	/**
+	 * \brief Resume the coroutines satisfied by an event that has been
+	 * dispatched without handle_event()
+	 *
+	 * Does nothing with #SM_STATE_MACHINE_ENABLE_TRACE: the coroutines have
+	 * already been resumed.
+	 *
+	 * \param [in] previous_state the current state before the dispatch
+	 * \param [in] event the event that was dispatched
+	 * \param [in] status what sm_state_machine_handle_event() returned
+	 */
+	void notify(const struct sm_state *previous_state,
+				const struct sm_event *event, int status) {
+#if SM_STATE_MACHINE_ENABLE_TRACE
+		(void)previous_state;
+		(void)event;
+		(void)status;
+#else
+		if (is_transition(status)) {
+			select(previous_state, event ? event->type : 0,
+				   static_cast<sm_state_machine_handle_event_status>(status));
+		} else {
+			select_states();
+		}
+		resume();
+#endif
+	}
+
+	/**
+	 * \brief Wait until the state machine is in a state
+	 *
+	 * The state machine is in \p state if \p state is the current state or
+	 * one of its ancestors. Doesn't suspend if that is already the case.
+	 */
+	until_awaiter until(const struct sm_state *state) {
+		return until_awaiter(*this, state);
+	}
+
+	/**
+	 * \brief Wait for the next transition
+	 *
+	 * Events that don't cause a transition (no matching transition, or
+	 * transition rejected by its guard) don't resume the coroutine.
+	 */
+	transition_awaiter next_transition() { return transition_awaiter(*this); }
+
+  private:
+	/*
+	 * The current state, its ancestors and, within submachines, the
+	 * submachine states it is nested in and their ancestors
+	 */
+	bool in_state(const struct sm_state *state) const {
+		const struct sm_state *s = state_machine_.current_state;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+		size_t depth = 0;
+		const struct sm_state *const *submachine_states =
+			sm_state_machine_submachine_states(&state_machine_, &depth);
+#endif
+		for (;;) {
+			for (; s; s = s->parent_state) {
+				if (s == state) {
+					return true;
+				}
+			}
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+			if (depth) {
+				s = submachine_states[--depth];
+				continue;
+			}
+#endif
+			return false;
+		}
+	}
+
+	/*
+	 * Select first, resume later: resumed coroutines are free to dispatch
+	 * events or start waiting again
+	 */
+	void select(const struct sm_state *previous_state, int event_type,
+				enum sm_state_machine_handle_event_status status) {
+		waiter *next;
+		for (waiter *w = waiting_.head; w; w = next) {
+			next = w->next;
+			if (!w->state || in_state(w->state)) {
+				if (w->transition) {
+					w->transition->previous_state = previous_state;
+					w->transition->current_state =
+						state_machine_.current_state;
+					w->transition->event_type = event_type;
+					w->transition->status = status;
+				}
+				waiting_.remove(w);
+				ready_.push_back(w);
+			}
+		}
+	}
+
+#if !SM_STATE_MACHINE_ENABLE_TRACE
+	/* Only the coroutines waiting for a state */
+	void select_states() {
+		waiter *next;
+		for (waiter *w = waiting_.head; w; w = next) {
+			next = w->next;
+			if (w->state && in_state(w->state)) {
+				waiting_.remove(w);
+				ready_.push_back(w);
+			}
+		}
+	}
+#endif
+
+	void resume() {
+		while (waiter *w = ready_.head) {
+			ready_.remove(w);
+			w->handle.resume();
+		}
+	}
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	static void event_begin(void *context,
+							const struct sm_state_machine *state_machine,
+							const struct sm_event *event) {
+		auto *self = static_cast<sm_awaitable_state_machine *>(context);
+		++self->dispatching_;
+		self->event_type_ = event->type;
+		if (self->chained_ && self->chained_->event_begin) {
+			self->chained_->event_begin(self->chained_->context, state_machine,
+										event);
+		}
+	}
+
+	static void transition_taken(void *context,
+								 const struct sm_state_machine *state_machine,
+								 const struct sm_event *event,
+								 const struct sm_state *state,
+								 const struct sm_transition *transition) {
+		auto *self = static_cast<sm_awaitable_state_machine *>(context);
+		if (self->chained_ && self->chained_->transition_taken) {
+			self->chained_->transition_taken(self->chained_->context,
+											 state_machine, event, state,
+											 transition);
+		}
+	}
+
+	static void event_end(void *context,
+						  const struct sm_state_machine *state_machine,
+						  const struct sm_event *event, int status) {
+		auto *self = static_cast<sm_awaitable_state_machine *>(context);
+		if (self->chained_ && self->chained_->event_end) {
+			self->chained_->event_end(self->chained_->context, state_machine,
+									  event, status);
+		}
+		if (--self->dispatching_) {
+			return;
+		}
+		/* Like handle_event(): the state and the status at the end of the
+		 * dispatch, completion transitions included */
+		if (is_transition(status)) {
+			for (waiter *w = self->ready_.head; w; w = w->next) {
+				if (w->transition) {
+					w->transition->current_state = state_machine->current_state;
+					w->transition->status =
+						static_cast<sm_state_machine_handle_event_status>(
+							status);
+				}
+			}
+		}
+		self->resume();
+	}
+
+	static void state_changed(void *context,
+							  const struct sm_state_machine *state_machine,
+							  const struct sm_state *previous_state,
+							  const struct sm_state *current_state) {
+		auto *self = static_cast<sm_awaitable_state_machine *>(context);
+		if (self->chained_ && self->chained_->state_changed) {
+			self->chained_->state_changed(self->chained_->context,
+										  state_machine, previous_state,
+										  current_state);
+		}
+		int event_type = self->event_type_;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+		if (!self->dispatching_) {
+			event_type = state_machine->transit.event.type;
+		}
+#endif
+		self->select(previous_state, event_type,
+					 self->status_of(previous_state, current_state));
+		if (!self->dispatching_) {
+			self->resume();
+		}
+	}
+
+	enum sm_state_machine_handle_event_status
+	status_of(const struct sm_state *previous_state,
+			  const struct sm_state *current_state) {
+		if (current_state == state_machine_.error_state) {
+			return sm_state_machine_error_state_reached;
+		}
+		if (current_state == previous_state) {
+			return sm_state_machine_self_loop;
+		}
+		if (!current_state->completion_transitions &&
+			sm_state_machine_stopped(&state_machine_)) {
+			return sm_state_machine_final_state_reached;
+		}
+		return sm_state_machine_state_changed;
+	}
+#endif
+
+	static bool is_transition(int status) {
+		switch (status) {
+		case sm_state_machine_error_state_reached:
+		case sm_state_machine_state_changed:
+		case sm_state_machine_self_loop:
+		case sm_state_machine_final_state_reached:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	struct sm_state_machine &state_machine_;
+	waiter_list waiting_;
+	waiter_list ready_;
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	struct sm_state_machine_tracer tracer_ = {};
+	struct sm_state_machine_tracer *chained_ = nullptr;
+	/* Nesting of the events being dispatched */
+	unsigned int dispatching_ = 0;
+	int event_type_ = 0;
+#endif
+};
+
+#endif
+
+#endif /* ifndef SM_COROUTINE_HPP_ */
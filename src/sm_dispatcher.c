@@ -0,0 +1,572 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_dispatcher.c
+ *
+ * \brief		core-sharded event dispatcher - implementation
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* pthread_setaffinity_np() */
+#define _GNU_SOURCE
+#endif
+
+#include "sm_dispatcher.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_LINE SM_STATE_MACHINE_CACHE_LINE_SIZE
+
+/**
+ * An event in flight
+ */
+struct sm_dispatcher_slot {
+	uint64_t key;
+	struct sm_event event;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	/* Posted by sm_dispatcher_post_completion() if the state machine is set:
+	 * the event is unused */
+	struct sm_async_completion completion;
+#endif
+};
+
+/**
+ * Single-producer/single-consumer ring from a producer to a shard.
+ *
+ * Each side only writes its own cache line, and keeps a cached copy of the
+ * index of the other side, so that the shared indexes are read only when the
+ * ring looks full (producer) or empty (consumer).
+ */
+struct sm_dispatcher_ring {
+	/* Producer side */
+	_Alignas(CACHE_LINE) SM_ATOMIC(size_t) tail;
+	/* Next slot to write: slots up to here are not published yet */
+	size_t pending_tail;
+	size_t published_tail;
+	size_t cached_head;
+
+	/* Consumer side */
+	_Alignas(CACHE_LINE) SM_ATOMIC(size_t) head;
+	size_t consumed_head;
+	size_t cached_tail;
+
+	/* Read-only */
+	_Alignas(CACHE_LINE) struct sm_dispatcher_slot *slots;
+	size_t mask;
+};
+
+struct sm_dispatcher_shard {
+	_Alignas(CACHE_LINE) struct sm_dispatcher *dispatcher;
+	/* One ring per producer */
+	struct sm_dispatcher_ring *rings;
+	size_t index;
+	pthread_t thread;
+	/* Written only by the thread of the shard */
+	SM_ATOMIC(uint64_t) events_handled;
+	/* NULL if the events are not coalesced */
+	struct sm_inbox *inbox;
+};
+
+struct sm_dispatcher_producer {
+	_Alignas(CACHE_LINE) struct sm_dispatcher *dispatcher;
+	size_t index;
+};
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static bool is_power_of_2(size_t value);
+static void *aligned_calloc(size_t count, size_t size);
+static struct sm_dispatcher_ring *
+producer_ring(const struct sm_dispatcher_producer *producer, size_t shard);
+static struct sm_dispatcher_slot *reserve(struct sm_dispatcher_ring *ring);
+static void commit(const struct sm_dispatcher *dispatcher,
+				   struct sm_dispatcher_ring *ring);
+static void publish(struct sm_dispatcher_ring *ring);
+static size_t consume(struct sm_dispatcher *dispatcher,
+					  struct sm_dispatcher_shard *shard,
+					  struct sm_dispatcher_ring *ring);
+static size_t consume_to_inbox(struct sm_dispatcher_shard *shard,
+							   struct sm_dispatcher_ring *ring);
+static size_t available(struct sm_dispatcher_ring *ring, size_t limit);
+static void release(struct sm_dispatcher_ring *ring, size_t count);
+static void handle(struct sm_dispatcher *dispatcher, size_t shard,
+				   uint64_t key, const struct sm_event *event);
+static void handle_slot(struct sm_dispatcher *dispatcher, size_t shard,
+						const struct sm_dispatcher_slot *slot);
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+static void complete(struct sm_dispatcher *dispatcher, size_t shard,
+					 uint64_t key, struct sm_async_completion completion);
+#endif
+static void *shard_thread(void *arg);
+static void pin_thread(pthread_t thread, size_t index);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_dispatcher_init(struct sm_dispatcher *dispatcher,
+						const struct sm_dispatcher_config *config) {
+	assert(dispatcher != NULL);
+	assert(config != NULL);
+
+	memset(dispatcher, 0, sizeof(*dispatcher));
+	if (!config->num_shards || !config->num_producers ||
+		!is_power_of_2(config->ring_size) || !config->batch_size ||
+		!config->resolve) {
+		return false;
+	}
+	dispatcher->config = *config;
+	atomic_init(&dispatcher->running, false);
+
+	const size_t num_rings = config->num_shards * config->num_producers;
+	dispatcher->shards =
+		aligned_calloc(config->num_shards, sizeof(struct sm_dispatcher_shard));
+	dispatcher->producers = aligned_calloc(
+		config->num_producers, sizeof(struct sm_dispatcher_producer));
+	struct sm_dispatcher_ring *rings =
+		aligned_calloc(num_rings, sizeof(struct sm_dispatcher_ring));
+	struct sm_dispatcher_slot *slots =
+		calloc(num_rings * config->ring_size, sizeof(*slots));
+	struct sm_inbox *inboxes =
+		config->inbox ? calloc(config->num_shards, sizeof(*inboxes)) : NULL;
+	if (!dispatcher->shards || !dispatcher->producers || !rings || !slots ||
+		(config->inbox && !inboxes)) {
+		free(dispatcher->shards);
+		free(dispatcher->producers);
+		free(rings);
+		free(slots);
+		free(inboxes);
+		dispatcher->shards = NULL;
+		dispatcher->producers = NULL;
+		return false;
+	}
+
+	for (size_t i = 0; i < num_rings; ++i) {
+		atomic_init(&rings[i].tail, 0);
+		atomic_init(&rings[i].head, 0);
+		rings[i].slots = slots + i * config->ring_size;
+		rings[i].mask = config->ring_size - 1;
+	}
+	for (size_t i = 0; i < config->num_shards; ++i) {
+		struct sm_dispatcher_shard *shard = &dispatcher->shards[i];
+		shard->dispatcher = dispatcher;
+		shard->rings = rings + i * config->num_producers;
+		shard->index = i;
+		atomic_init(&shard->events_handled, 0);
+		if (inboxes) {
+			shard->inbox = &inboxes[i];
+			sm_inbox_init(shard->inbox, config->inbox);
+		}
+	}
+	for (size_t i = 0; i < config->num_producers; ++i) {
+		dispatcher->producers[i].dispatcher = dispatcher;
+		dispatcher->producers[i].index = i;
+	}
+	return true;
+}
+
+void sm_dispatcher_deinit(struct sm_dispatcher *dispatcher) {
+	assert(dispatcher != NULL);
+	assert(!dispatcher->started);
+
+	if (dispatcher->shards) {
+		/* Rings and slots were allocated as single blocks */
+		free(dispatcher->shards[0].rings[0].slots);
+		free(dispatcher->shards[0].rings);
+		free(dispatcher->shards[0].inbox);
+	}
+	free(dispatcher->shards);
+	free(dispatcher->producers);
+	dispatcher->shards = NULL;
+	dispatcher->producers = NULL;
+}
+
+size_t sm_dispatcher_shard_of(const struct sm_dispatcher *dispatcher,
+							  uint64_t key) {
+	/* Fibonacci hashing, then a multiply-shift range reduction instead of a
+	 * division */
+	uint32_t hash = (uint32_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+	return (size_t)(((uint64_t)hash * dispatcher->config.num_shards) >> 32);
+}
+
+struct sm_dispatcher_producer *
+sm_dispatcher_get_producer(struct sm_dispatcher *dispatcher, size_t index) {
+	assert(dispatcher != NULL);
+	assert(index < dispatcher->config.num_producers);
+	return &dispatcher->producers[index];
+}
+
+bool sm_dispatcher_post(struct sm_dispatcher_producer *producer, uint64_t key,
+						const struct sm_event *event) {
+	assert(producer != NULL);
+	assert(event != NULL);
+
+	const struct sm_dispatcher *dispatcher = producer->dispatcher;
+	struct sm_dispatcher_ring *ring =
+		producer_ring(producer, sm_dispatcher_shard_of(dispatcher, key));
+	struct sm_dispatcher_slot *slot = reserve(ring);
+	if (!slot) {
+		return false;
+	}
+	slot->key = key;
+	slot->event = *event;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	slot->completion.state_machine = NULL;
+#endif
+	commit(dispatcher, ring);
+	return true;
+}
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+bool sm_dispatcher_post_completion(struct sm_dispatcher_producer *producer,
+								   uint64_t key,
+								   struct sm_async_completion completion) {
+	assert(producer != NULL);
+	assert(completion.state_machine != NULL);
+
+	const struct sm_dispatcher *dispatcher = producer->dispatcher;
+	struct sm_dispatcher_ring *ring =
+		producer_ring(producer, sm_dispatcher_shard_of(dispatcher, key));
+	struct sm_dispatcher_slot *slot = reserve(ring);
+	if (!slot) {
+		return false;
+	}
+	slot->key = key;
+	slot->completion = completion;
+	commit(dispatcher, ring);
+	return true;
+}
+#endif
+
+void sm_dispatcher_flush(struct sm_dispatcher_producer *producer) {
+	assert(producer != NULL);
+
+	for (size_t i = 0; i < producer->dispatcher->config.num_shards; ++i) {
+		publish(producer_ring(producer, i));
+	}
+}
+
+size_t sm_dispatcher_poll(struct sm_dispatcher *dispatcher, size_t index) {
+	assert(dispatcher != NULL);
+	assert(index < dispatcher->config.num_shards);
+
+	struct sm_dispatcher_shard *shard = &dispatcher->shards[index];
+	size_t handled = 0;
+
+	for (size_t i = 0; i < dispatcher->config.num_producers; ++i) {
+		struct sm_dispatcher_ring *ring = &shard->rings[i];
+		handled += shard->inbox ? consume_to_inbox(shard, ring)
+								: consume(dispatcher, shard, ring);
+	}
+
+	if (shard->inbox) {
+		/* What has been received from all the producers has been coalesced
+		 * and sorted by priority: count the events that are actually handled,
+		 * still at most one batch per producer */
+		const size_t limit =
+			dispatcher->config.batch_size * dispatcher->config.num_producers;
+		struct sm_inbox_entry entry;
+		handled = 0;
+		while (handled < limit && sm_inbox_pop(shard->inbox, &entry)) {
+			handle(dispatcher, index, entry.key, &entry.event);
+			++handled;
+		}
+	}
+
+	if (handled) {
+		/* Single writer: no read-modify-write needed */
+		atomic_store_explicit(
+			&shard->events_handled,
+			atomic_load_explicit(&shard->events_handled,
+								 memory_order_relaxed) +
+				handled,
+			memory_order_relaxed);
+	}
+	return handled;
+}
+
+size_t sm_dispatcher_cancel(struct sm_dispatcher *dispatcher, size_t shard,
+							uint64_t key) {
+	assert(dispatcher != NULL);
+	assert(shard < dispatcher->config.num_shards);
+
+	struct sm_inbox *inbox = dispatcher->shards[shard].inbox;
+	return inbox ? sm_inbox_cancel(inbox, key) : 0;
+}
+
+bool sm_dispatcher_start(struct sm_dispatcher *dispatcher) {
+	assert(dispatcher != NULL);
+	assert(!dispatcher->started);
+
+	atomic_store_explicit(&dispatcher->running, true, memory_order_release);
+	for (size_t i = 0; i < dispatcher->config.num_shards; ++i) {
+		struct sm_dispatcher_shard *shard = &dispatcher->shards[i];
+		if (pthread_create(&shard->thread, NULL, shard_thread, shard) != 0) {
+			atomic_store_explicit(&dispatcher->running, false,
+								  memory_order_release);
+			for (size_t j = 0; j < i; ++j) {
+				pthread_join(dispatcher->shards[j].thread, NULL);
+			}
+			return false;
+		}
+		if (dispatcher->config.pin_threads) {
+			pin_thread(shard->thread, i);
+		}
+	}
+	dispatcher->started = true;
+	return true;
+}
+
+void sm_dispatcher_stop(struct sm_dispatcher *dispatcher) {
+	assert(dispatcher != NULL);
+
+	if (!dispatcher->started) {
+		return;
+	}
+	atomic_store_explicit(&dispatcher->running, false, memory_order_release);
+	for (size_t i = 0; i < dispatcher->config.num_shards; ++i) {
+		pthread_join(dispatcher->shards[i].thread, NULL);
+	}
+	dispatcher->started = false;
+}
+
+uint64_t sm_dispatcher_events_handled(const struct sm_dispatcher *dispatcher,
+									  size_t shard) {
+	assert(dispatcher != NULL);
+	assert(shard < dispatcher->config.num_shards);
+	return atomic_load_explicit(&dispatcher->shards[shard].events_handled,
+								memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static bool is_power_of_2(size_t value) {
+	return value && !(value & (value - 1));
+}
+
+static void *aligned_calloc(size_t count, size_t size) {
+	/* size is a multiple of the alignment, as the structs are aligned */
+	void *memory = aligned_alloc(CACHE_LINE, count * size);
+	if (memory) {
+		memset(memory, 0, count * size);
+	}
+	return memory;
+}
+
+static struct sm_dispatcher_ring *
+producer_ring(const struct sm_dispatcher_producer *producer, size_t shard) {
+	return &producer->dispatcher->shards[shard].rings[producer->index];
+}
+
+/* Next free slot of \p ring, or NULL if the ring is full */
+static struct sm_dispatcher_slot *reserve(struct sm_dispatcher_ring *ring) {
+	if (ring->pending_tail - ring->cached_head > ring->mask) {
+		ring->cached_head =
+			atomic_load_explicit(&ring->head, memory_order_acquire);
+		if (ring->pending_tail - ring->cached_head > ring->mask) {
+			publish(ring);
+			return NULL;
+		}
+	}
+	return &ring->slots[ring->pending_tail & ring->mask];
+}
+
+/* Append the reserved slot, publishing once a batch is complete */
+static void commit(const struct sm_dispatcher *dispatcher,
+				   struct sm_dispatcher_ring *ring) {
+	++ring->pending_tail;
+	if (ring->pending_tail - ring->published_tail >=
+		dispatcher->config.batch_size) {
+		publish(ring);
+	}
+}
+
+static void publish(struct sm_dispatcher_ring *ring) {
+	if (ring->published_tail != ring->pending_tail) {
+		ring->published_tail = ring->pending_tail;
+		atomic_store_explicit(&ring->tail, ring->pending_tail,
+							  memory_order_release);
+	}
+}
+
+/* Number of events that can be consumed from \p ring, at most \p limit */
+static size_t available(struct sm_dispatcher_ring *ring, size_t limit) {
+	if (ring->consumed_head == ring->cached_tail) {
+		ring->cached_tail =
+			atomic_load_explicit(&ring->tail, memory_order_acquire);
+	}
+	size_t count = ring->cached_tail - ring->consumed_head;
+	return count < limit ? count : limit;
+}
+
+/* Release the consumed slots at once */
+static void release(struct sm_dispatcher_ring *ring, size_t count) {
+	if (count) {
+		ring->consumed_head += count;
+		atomic_store_explicit(&ring->head, ring->consumed_head,
+							  memory_order_release);
+	}
+}
+
+static size_t consume(struct sm_dispatcher *dispatcher,
+					  struct sm_dispatcher_shard *shard,
+					  struct sm_dispatcher_ring *ring) {
+	const size_t count = available(ring, dispatcher->config.batch_size);
+	for (size_t i = 0; i < count; ++i) {
+		const struct sm_dispatcher_slot *slot =
+			&ring->slots[(ring->consumed_head + i) & ring->mask];
+		handle_slot(dispatcher, shard->index, slot);
+	}
+	release(ring, count);
+	return count;
+}
+
+static size_t consume_to_inbox(struct sm_dispatcher_shard *shard,
+							   struct sm_dispatcher_ring *ring) {
+	/* Everything that fits: the inbox works as a reorder buffer, so that
+	 * urgent events overtake the routine ones still in the rings */
+	const size_t count = available(
+		ring, SM_STATE_MACHINE_INBOX_SIZE - sm_inbox_size(shard->inbox));
+	size_t consumed = 0;
+	while (consumed < count) {
+		const struct sm_dispatcher_slot *slot =
+			&ring->slots[(ring->consumed_head + consumed) & ring->mask];
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+		if (slot->completion.state_machine) {
+			/* Not an event: nothing to coalesce */
+			complete(shard->dispatcher, shard->index, slot->key,
+					 slot->completion);
+			++consumed;
+			continue;
+		}
+#endif
+		if (sm_inbox_push(shard->inbox, slot->key, &slot->event) ==
+			sm_inbox_full) {
+			/* Left in the ring until the inbox has been emptied */
+			break;
+		}
+		++consumed;
+	}
+	release(ring, consumed);
+	return consumed;
+}
+
+static void handle(struct sm_dispatcher *dispatcher, size_t shard,
+				   uint64_t key, const struct sm_event *event) {
+	const struct sm_dispatcher_config *config = &dispatcher->config;
+	struct sm_state_machine *state_machine =
+		config->resolve(config->context, shard, key);
+	int status = state_machine
+					 ? sm_state_machine_handle_event(state_machine, event)
+					 : sm_state_machine_error_arg;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	if (status == sm_state_machine_transition_pending ||
+		status == sm_state_machine_event_queued) {
+		/* Still referenced by the state machine: reported by complete() */
+		return;
+	}
+#endif
+	if (config->handled) {
+		config->handled(config->context, shard, key, event, status);
+	}
+}
+
+static void handle_slot(struct sm_dispatcher *dispatcher, size_t shard,
+						const struct sm_dispatcher_slot *slot) {
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	if (slot->completion.state_machine) {
+		complete(dispatcher, shard, slot->key, slot->completion);
+		return;
+	}
+#endif
+	handle(dispatcher, shard, slot->key, &slot->event);
+}
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+static void complete(struct sm_dispatcher *dispatcher, size_t shard,
+					 uint64_t key, struct sm_async_completion completion) {
+	const struct sm_dispatcher_config *config = &dispatcher->config;
+	struct sm_state_machine *state_machine = completion.state_machine;
+	struct sm_state_machine_transit *transit = &state_machine->transit;
+	if (!config->handled) {
+		sm_state_machine_complete_async_action(completion);
+		return;
+	}
+
+	/* The events the state machine releases by completing the transition:
+	 * the one of the transition and the queued ones it handles */
+	const struct sm_event event = transit->event;
+	struct sm_event queued[SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE];
+	const size_t num_queued = transit->queue_count;
+	for (size_t i = 0; i < num_queued; ++i) {
+		queued[i] = transit->queue[(transit->queue_head + i) %
+								   SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE];
+	}
+
+	int status = sm_state_machine_complete_async_action(completion);
+	if (status == sm_state_machine_error_arg) {
+		/* Stale completion: nothing has been released */
+		return;
+	}
+	config->handled(config->context, shard, key, &event, status);
+	size_t num_released = num_queued - transit->queue_count;
+	if (num_released && sm_state_machine_in_transit(state_machine)) {
+		/* The last one started another asynchronous action */
+		--num_released;
+	}
+	for (size_t i = 0; i < num_released; ++i) {
+		config->handled(config->context, shard, key, &queued[i],
+						sm_state_machine_event_queued);
+	}
+}
+#endif
+
+static void *shard_thread(void *arg) {
+	struct sm_dispatcher_shard *shard = arg;
+	struct sm_dispatcher *dispatcher = shard->dispatcher;
+
+	for (;;) {
+		if (sm_dispatcher_poll(dispatcher, shard->index)) {
+			continue;
+		}
+		if (!atomic_load_explicit(&dispatcher->running,
+								  memory_order_acquire)) {
+			/* Whatever was published before the stop request is visible
+			 * now: drain it */
+			while (sm_dispatcher_poll(dispatcher, shard->index)) {
+			}
+			break;
+		}
+		sched_yield();
+	}
+	return NULL;
+}
+
+static void pin_thread(pthread_t thread, size_t index) {
+#if defined(__linux__)
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cores > 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(index % (size_t)num_cores, &cpus);
+		/* Best effort: an unpinned shard still works */
+		(void)pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+	}
+#else
+	(void)thread;
+	(void)index;
+#endif
+}
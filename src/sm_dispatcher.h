@@ -0,0 +1,271 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_dispatcher.h
+ *
+ * \brief		core-sharded event dispatcher - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_dispatcher Sharded dispatcher
+ *
+ * \brief Shared-nothing dispatch of events to many state machines
+ *
+ * The state machine instances are partitioned in shards, and each shard is
+ * owned by a single thread (optionally pinned to a core). An instance is
+ * identified by a 64-bit key: sm_dispatcher_shard_of() tells which shard owns
+ * it, and only the thread of that shard ever touches it.
+ *
+ * Events are posted by a fixed number of producers. Each producer has its own
+ * single-producer/single-consumer ring towards every shard, so posting and
+ * dispatching only need atomic loads and stores: no locks and no atomic
+ * read-modify-write. Both ends work in batches: a producer publishes its
+ * events every sm_dispatcher_config::batch_size events (or on
+ * sm_dispatcher_flush()), and a shard releases the slots it consumed once per
+ * batch.
+ *
+ * Shards can either run on their own threads (sm_dispatcher_start()) or be
+ * polled by the application (sm_dispatcher_poll()).
+ */
+
+/**
+ * \addtogroup sm_dispatcher
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_DISPATCHER_H_
+#define SM_DISPATCHER_H_
+
+#include "sm_atomic.h"
+#include "sm_inbox.h"
+#include "sm_state_machine.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sm_dispatcher_shard;
+struct sm_dispatcher_producer;
+
+/**
+ * \brief Configuration of a dispatcher
+ */
+struct sm_dispatcher_config {
+	/** \brief Number of shards (and of threads, if started) */
+	size_t num_shards;
+	/** \brief Number of producers, see sm_dispatcher_get_producer() */
+	size_t num_producers;
+	/**
+	 * \brief Capacity of each producer to shard ring. Must be a power of 2.
+	 */
+	size_t ring_size;
+	/** \brief Maximum number of events published or consumed at once */
+	size_t batch_size;
+	/**
+	 * \brief Whether to pin the thread of shard i to core i (modulo the
+	 * number of cores). Only supported on Linux.
+	 */
+	bool pin_threads;
+	/**
+	 * \brief Find the state machine identified by \p key
+	 *
+	 * Called by the thread of \p shard. May return NULL if there is no such
+	 * state machine: the event is then discarded.
+	 */
+	struct sm_state_machine *(*resolve)(void *context, size_t shard,
+										uint64_t key);
+	/**
+	 * \brief Called after an event has been handled, e.g. to release its
+	 * payload. May be NULL.
+	 *
+	 * \p status is what sm_state_machine_handle_event() returned, or
+	 * #sm_state_machine_error_arg if resolve() didn't find the state machine.
+	 *
+	 * An event that starts an asynchronous action
+	 * (#sm_state_machine_transition_pending), or that is queued while in
+	 * transit (#sm_state_machine_event_queued), is still referenced by the
+	 * state machine: it is reported only once the transition has been
+	 * completed through sm_dispatcher_post_completion(), with the status
+	 * returned by sm_state_machine_complete_async_action(). The queued events
+	 * handled by that completion are reported then as well, with
+	 * #sm_state_machine_event_queued.
+	 */
+	void (*handled)(void *context, size_t shard, uint64_t key,
+					const struct sm_event *event, int status);
+	/** \brief Passed as is to the callbacks */
+	void *context;
+	/**
+	 * \brief Coalescing of the events, see #sm_inbox. May be NULL.
+	 *
+	 * If not NULL, each shard moves the events it receives to its own
+	 * #sm_inbox, configured with this configuration, before handling them:
+	 * events that arrive faster than they are handled are coalesced there, and
+	 * urgent events overtake the backlog of routine ones through the priority
+	 * lanes.
+	 */
+	const struct sm_inbox_config *inbox;
+};
+
+/**
+ * \brief Sharded dispatcher
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_dispatcher {
+	struct sm_dispatcher_config config;
+	struct sm_dispatcher_shard *shards;
+	struct sm_dispatcher_producer *producers;
+	/** \brief Cleared to ask the shard threads to stop */
+	SM_ATOMIC(bool) running;
+	bool started;
+};
+
+/**
+ * \brief Initialise a dispatcher
+ *
+ * \param [out] dispatcher -
+ * \param [in] config copied into the dispatcher
+ *
+ * \retval true on success
+ * \retval false if \p config is invalid or memory couldn't be allocated
+ */
+bool sm_dispatcher_init(struct sm_dispatcher *dispatcher,
+						const struct sm_dispatcher_config *config);
+
+/**
+ * \brief Release the resources of a dispatcher
+ *
+ * The dispatcher must have been stopped.
+ */
+void sm_dispatcher_deinit(struct sm_dispatcher *dispatcher);
+
+/**
+ * \brief Shard that owns the state machine identified by \p key
+ */
+size_t sm_dispatcher_shard_of(const struct sm_dispatcher *dispatcher,
+							  uint64_t key);
+
+/**
+ * \brief Get a producer
+ *
+ * A producer must be used by one thread at a time.
+ *
+ * \param [in] dispatcher -
+ * \param [in] index less than sm_dispatcher_config::num_producers
+ */
+struct sm_dispatcher_producer *
+sm_dispatcher_get_producer(struct sm_dispatcher *dispatcher, size_t index);
+
+/**
+ * \brief Post an event to the state machine identified by \p key
+ *
+ * The event is copied, its payload is not: it must stay valid until the
+ * event has been handled (see sm_dispatcher_config::handled). The event
+ * becomes visible to the shard once sm_dispatcher_config::batch_size events
+ * have been posted to it by this producer, or on sm_dispatcher_flush().
+ *
+ * \retval true if the event has been posted
+ * \retval false if the ring towards the shard is full. Pending events are
+ * published, so that the shard can make room.
+ */
+bool sm_dispatcher_post(struct sm_dispatcher_producer *producer, uint64_t key,
+						const struct sm_event *event);
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+/**
+ * \brief Post the completion of an asynchronous action
+ *
+ * sm_state_machine_complete_async_action() must be called by the thread that
+ * owns the state machine: an action whose I/O completes on another thread
+ * posts \p completion instead, and the shard that owns \p key completes the
+ * transition. Completions are published like events, but they are not
+ * coalesced (see sm_dispatcher_config::inbox): they are handled as soon as
+ * the shard receives them.
+ *
+ * \param [in] producer -
+ * \param [in] key identifies the state machine of \p completion
+ * \param [in] completion the handle passed to the #sm_async_action_fn
+ *
+ * \retval true if the completion has been posted
+ * \retval false if the ring towards the shard is full
+ */
+bool sm_dispatcher_post_completion(struct sm_dispatcher_producer *producer,
+								   uint64_t key,
+								   struct sm_async_completion completion);
+#endif
+
+/**
+ * \brief Publish the events posted by \p producer that are still pending
+ */
+void sm_dispatcher_flush(struct sm_dispatcher_producer *producer);
+
+/**
+ * \brief Handle the events that have been published to a shard
+ *
+ * Use this function to run a shard on a thread of the application, instead of
+ * calling sm_dispatcher_start(). Only one thread at a time may poll a shard.
+ *
+ * \returns the number of events handled
+ */
+size_t sm_dispatcher_poll(struct sm_dispatcher *dispatcher, size_t shard);
+
+/**
+ * \brief Cancel the events queued for a state machine
+ *
+ * Only the events already moved to the inbox of the shard (see
+ * sm_dispatcher_config::inbox) can be cancelled: e.g. a state machine that
+ * is being destroyed can cancel, from within its actions, the events that
+ * are still queued for it. Must be called by the thread of \p shard.
+ *
+ * \returns the number of cancelled events
+ */
+size_t sm_dispatcher_cancel(struct sm_dispatcher *dispatcher, size_t shard,
+							uint64_t key);
+
+/**
+ * \brief Start a thread for each shard
+ *
+ * \retval true on success
+ * \retval false if the threads couldn't be created
+ */
+bool sm_dispatcher_start(struct sm_dispatcher *dispatcher);
+
+/**
+ * \brief Stop the shard threads
+ *
+ * The shards handle all the events that have been published before
+ * returning. Producers must flush before calling this function.
+ */
+void sm_dispatcher_stop(struct sm_dispatcher *dispatcher);
+
+/**
+ * \brief Number of events handled so far by a shard
+ *
+ * May be called from any thread.
+ */
+uint64_t sm_dispatcher_events_handled(const struct sm_dispatcher *dispatcher,
+									  size_t shard);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_DISPATCHER_H_ */
+
+/**
+ * @}
+ */
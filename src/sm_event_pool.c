@@ -0,0 +1,187 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_event_pool.c
+ *
+ * \brief		event payload pool - implementation
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_event_pool.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Header that precedes the payload of every block
+ */
+struct sm_event_pool_block {
+	/** \brief Pool the block belongs to */
+	struct sm_event_pool *pool;
+	/** \brief Next block in either the local or the remote free list */
+	struct sm_event_pool_block *next;
+	/** \brief Number of references to the payload */
+	atomic_uint refcount;
+};
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static size_t align_up(size_t size, size_t alignment);
+static size_t block_header_size(void);
+static void *block_payload(struct sm_event_pool_block *block);
+static struct sm_event_pool_block *payload_block(void *payload);
+static void release_block(struct sm_event_pool_block *block);
+
+/*******************************************************************************
+ * Private data
+ ******************************************************************************/
+/* Its address identifies the calling thread */
+static _Thread_local char thread_token;
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+void sm_event_pool_init(struct sm_event_pool *pool, void *buffer,
+						size_t buffer_size, size_t payload_size) {
+	assert(pool != NULL);
+	assert(buffer != NULL || buffer_size == 0);
+
+	const size_t alignment = _Alignof(max_align_t);
+	unsigned char *begin =
+		(unsigned char *)align_up((uintptr_t)buffer, alignment);
+	unsigned char *end = (unsigned char *)buffer + buffer_size;
+
+	pool->block_size =
+		block_header_size() + align_up(payload_size, alignment);
+	pool->payload_size = payload_size;
+	pool->owner = &thread_token;
+	pool->free_list = NULL;
+	pool->num_blocks = 0;
+	atomic_init(&pool->remote_free_list, NULL);
+
+	/* Build the free list backwards, so that blocks are handed out in address
+	 * order */
+	size_t available = begin < end ? (size_t)(end - begin) : 0;
+	size_t num_blocks = available / pool->block_size;
+	for (size_t i = num_blocks; i > 0; --i) {
+		struct sm_event_pool_block *block =
+			(struct sm_event_pool_block *)(begin +
+										   (i - 1) * pool->block_size);
+		block->pool = pool;
+		block->next = pool->free_list;
+		atomic_init(&block->refcount, 0);
+		pool->free_list = block;
+	}
+	pool->num_blocks = num_blocks;
+}
+
+void *sm_event_pool_alloc(struct sm_event_pool *pool) {
+	assert(pool != NULL);
+	assert(pool->owner == &thread_token);
+
+	if (!pool->free_list) {
+		/* Reclaim, in one shot, what the other threads have released */
+		pool->free_list = atomic_exchange_explicit(&pool->remote_free_list,
+												   NULL, memory_order_acquire);
+	}
+
+	struct sm_event_pool_block *block = pool->free_list;
+	if (!block) {
+		return NULL;
+	}
+	pool->free_list = block->next;
+	atomic_store_explicit(&block->refcount, 1, memory_order_relaxed);
+	return block_payload(block);
+}
+
+void sm_event_pool_ref(void *payload) {
+	assert(payload != NULL);
+	atomic_fetch_add_explicit(&payload_block(payload)->refcount, 1,
+							  memory_order_relaxed);
+}
+
+void sm_event_pool_unref(void *payload) {
+	if (!payload) {
+		return;
+	}
+	struct sm_event_pool_block *block = payload_block(payload);
+	unsigned int previous = atomic_fetch_sub_explicit(&block->refcount, 1,
+													  memory_order_release);
+	assert(previous > 0);
+	if (previous == 1) {
+		atomic_thread_fence(memory_order_acquire);
+		release_block(block);
+	}
+}
+
+void sm_event_inline_init(struct sm_event_inline *event, int type,
+						  const void *payload, size_t size) {
+	assert(event != NULL);
+	assert(size <= sizeof(event->payload.bytes));
+
+	event->event.type = type;
+	event->event.data = NULL;
+	if (payload) {
+		memcpy(event->payload.bytes, payload, size);
+		event->event.data = event->payload.bytes;
+	}
+}
+
+struct sm_event *sm_event_inline_get(struct sm_event_inline *event) {
+	assert(event != NULL);
+	/* The struct may have been copied since it was initialised */
+	if (event->event.data) {
+		event->event.data = event->payload.bytes;
+	}
+	return &event->event;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static size_t align_up(size_t size, size_t alignment) {
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static size_t block_header_size(void) {
+	/* Keep the payload aligned as if it had been returned by malloc */
+	return align_up(sizeof(struct sm_event_pool_block), _Alignof(max_align_t));
+}
+
+static void *block_payload(struct sm_event_pool_block *block) {
+	return (unsigned char *)block + block_header_size();
+}
+
+static struct sm_event_pool_block *payload_block(void *payload) {
+	return (struct sm_event_pool_block *)((unsigned char *)payload -
+										  block_header_size());
+}
+
+static void release_block(struct sm_event_pool_block *block) {
+	struct sm_event_pool *pool = block->pool;
+
+	if (pool->owner == &thread_token) {
+		block->next = pool->free_list;
+		pool->free_list = block;
+		return;
+	}
+
+	/* Cross-thread release: lock-free push onto the remote free list. Blocks
+	 * are only ever popped all at once by the owner, so there is no ABA. */
+	struct sm_event_pool_block *head = atomic_load_explicit(
+		&pool->remote_free_list, memory_order_relaxed);
+	do {
+		block->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(
+		&pool->remote_free_list, &head, block, memory_order_release,
+		memory_order_relaxed));
+}
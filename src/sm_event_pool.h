@@ -0,0 +1,181 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_event_pool.h
+ *
+ * \brief		event payload pool - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_event_pool Event payload pool
+ *
+ * \brief Allocation of event payloads without malloc
+ *
+ * An event pool is a fixed-size slab allocator that carves payload blocks out
+ * of a buffer provided by the user. Each pool is owned by the thread that
+ * initialised it: allocations and releases performed by that thread only touch
+ * a thread-local free list. Payloads released by other threads are pushed onto
+ * a lock-free list that the owner reclaims when its local free list runs out.
+ *
+ * Payloads are reference counted, so that the same payload can be broadcast
+ * to many state machines without being copied: each receiver calls
+ * sm_event_pool_ref() and releases it with sm_event_pool_unref() once the
+ * event has been handled.
+ *
+ * Payloads that fit in #SM_STATE_MACHINE_EVENT_INLINE_PAYLOAD_SIZE bytes don't
+ * need a pool at all: see #sm_event_inline.
+ */
+
+/**
+ * \addtogroup sm_event_pool
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_EVENT_POOL_H_
+#define SM_EVENT_POOL_H_
+
+#include "sm_atomic.h"
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sm_event_pool_block;
+
+/**
+ * \brief Event payload pool
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_event_pool {
+	/** \brief Blocks that can be allocated by the owner thread */
+	struct sm_event_pool_block *free_list;
+	/** \brief Blocks released by threads other than the owner */
+	SM_ATOMIC(struct sm_event_pool_block *) remote_free_list;
+	/** \brief Identifies the thread that owns the pool */
+	const void *owner;
+	/** \brief Size of a block, header included */
+	size_t block_size;
+	/** \brief Usable size of the payload of each block */
+	size_t payload_size;
+	/** \brief Total number of blocks carved out of the buffer */
+	size_t num_blocks;
+};
+
+/**
+ * \brief Event with an inline payload
+ *
+ * Small payloads can be stored inside the event itself, so that queuing the
+ * event doesn't require any allocation. Use sm_event_inline_init() to fill it
+ * and sm_event_inline_get() to obtain the #sm_event to pass to
+ * sm_state_machine_handle_event().
+ *
+ * The struct can be freely copied (e.g. into a queue):
+ * sm_event_inline_get() re-targets sm_event::data to the copy's own buffer.
+ */
+struct sm_event_inline {
+	/** \brief The event. Its sm_event::data points to #payload */
+	struct sm_event event;
+	/** \brief Inline payload storage */
+	union {
+		unsigned char bytes[SM_STATE_MACHINE_EVENT_INLINE_PAYLOAD_SIZE];
+		/* Force the strictest fundamental alignment */
+		long double align_ld;
+		long long align_ll;
+		void *align_ptr;
+	} payload;
+};
+
+/**
+ * \brief Initialise an event pool
+ *
+ * The calling thread becomes the owner of the pool.
+ *
+ * \param [in] pool the pool to initialise
+ * \param [in] buffer memory from which the blocks are carved. It must outlive
+ * the pool.
+ * \param [in] buffer_size size of \p buffer in bytes
+ * \param [in] payload_size maximum size of the payloads allocated from the
+ * pool
+ */
+void sm_event_pool_init(struct sm_event_pool *pool, void *buffer,
+						size_t buffer_size, size_t payload_size);
+
+/**
+ * \brief Allocate a payload
+ *
+ * Must be called only by the owner thread. The returned payload has a
+ * reference count of 1.
+ *
+ * \param [in] pool -
+ *
+ * \retval a pointer to a payload of sm_event_pool::payload_size bytes
+ * \retval NULL if the pool is exhausted
+ */
+void *sm_event_pool_alloc(struct sm_event_pool *pool);
+
+/**
+ * \brief Acquire an additional reference to a payload
+ *
+ * May be called from any thread.
+ *
+ * \param [in] payload a payload returned by sm_event_pool_alloc()
+ */
+void sm_event_pool_ref(void *payload);
+
+/**
+ * \brief Release a reference to a payload
+ *
+ * When the last reference is released, the payload goes back to its pool.
+ * May be called from any thread.
+ *
+ * \param [in] payload a payload returned by sm_event_pool_alloc(). May be
+ * NULL.
+ */
+void sm_event_pool_unref(void *payload);
+
+/**
+ * \brief Initialise an event with an inline payload
+ *
+ * \param [out] event -
+ * \param [in] type type of the event
+ * \param [in] payload data copied into the event. May be NULL, in which case
+ * sm_event::data will be NULL too.
+ * \param [in] size size of \p payload. It must not exceed
+ * #SM_STATE_MACHINE_EVENT_INLINE_PAYLOAD_SIZE.
+ */
+void sm_event_inline_init(struct sm_event_inline *event, int type,
+						  const void *payload, size_t size);
+
+/**
+ * \brief Get the event to be passed to the state machine
+ *
+ * \param [in] event -
+ *
+ * \returns the embedded event, with sm_event::data pointing to the inline
+ * payload
+ */
+struct sm_event *sm_event_inline_get(struct sm_event_inline *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_EVENT_POOL_H_ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,111 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_fleet.c
+ *
+ * \brief		cache-line-aware allocation of state machines - implementation
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_fleet.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert((SM_STATE_MACHINE_CACHE_LINE_SIZE &
+				(SM_STATE_MACHINE_CACHE_LINE_SIZE - 1u)) == 0,
+			   "SM_STATE_MACHINE_CACHE_LINE_SIZE must be a power of 2");
+_Static_assert((SM_STATE_MACHINE_PAGE_SIZE &
+				(SM_STATE_MACHINE_PAGE_SIZE - 1u)) == 0,
+			   "SM_STATE_MACHINE_PAGE_SIZE must be a power of 2");
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static size_t alignment_of(const struct sm_fleet_config *config);
+static size_t round_up(size_t size, size_t alignment);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_fleet_init(struct sm_fleet *fleet,
+				   const struct sm_fleet_config *config) {
+	assert(fleet != NULL);
+	assert(config != NULL);
+
+	memset(fleet, 0, sizeof(*fleet));
+	if (config->num_partitions == 0 || config->partition_size == 0 ||
+		config->partition_size > SIZE_MAX / sizeof(struct sm_state_machine)) {
+		return false;
+	}
+
+	const size_t alignment = alignment_of(config);
+	const size_t stride = round_up(
+		config->partition_size * sizeof(struct sm_state_machine), alignment);
+	if (stride > SIZE_MAX / config->num_partitions) {
+		return false;
+	}
+	/* The size is a multiple of the alignment, as required by aligned_alloc */
+	fleet->memory = aligned_alloc(alignment, stride * config->num_partitions);
+	if (!fleet->memory) {
+		return false;
+	}
+	fleet->config = *config;
+	fleet->stride = stride;
+
+	if (!config->numa_local) {
+		memset(fleet->memory, 0, stride * config->num_partitions);
+	}
+	return true;
+}
+
+void sm_fleet_deinit(struct sm_fleet *fleet) {
+	assert(fleet != NULL);
+
+	free(fleet->memory);
+	fleet->memory = NULL;
+}
+
+void sm_fleet_touch(struct sm_fleet *fleet, size_t partition) {
+	assert(fleet != NULL);
+	assert(partition < fleet->config.num_partitions);
+
+	memset(fleet->memory + partition * fleet->stride, 0, fleet->stride);
+}
+
+struct sm_state_machine *sm_fleet_partition(const struct sm_fleet *fleet,
+											size_t partition) {
+	assert(fleet != NULL);
+	assert(partition < fleet->config.num_partitions);
+
+	return (struct sm_state_machine *)(fleet->memory +
+									   partition * fleet->stride);
+}
+
+struct sm_state_machine *sm_fleet_get(const struct sm_fleet *fleet,
+									  size_t partition, size_t index) {
+	assert(index < fleet->config.partition_size);
+
+	return &sm_fleet_partition(fleet, partition)[index];
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static size_t alignment_of(const struct sm_fleet_config *config) {
+	return config->numa_local ? SM_STATE_MACHINE_PAGE_SIZE
+							  : SM_STATE_MACHINE_CACHE_LINE_SIZE;
+}
+
+static size_t round_up(size_t size, size_t alignment) {
+	return (size + alignment - 1u) & ~(alignment - 1u);
+}
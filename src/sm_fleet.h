@@ -0,0 +1,132 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_fleet.h
+ *
+ * \brief		cache-line-aware allocation of state machines - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_fleet Fleet
+ *
+ * \brief Allocation of many state machines driven by several threads
+ *
+ * When different threads drive neighbouring state machines of an array, each
+ * transition written by a thread invalidates the cache line that another
+ * thread is using (false sharing). A fleet allocates the state machines in
+ * partitions, one per thread: each partition starts on its own cache line and
+ * is padded to a whole number of cache lines, so that no cache line is written
+ * by two threads.
+ *
+ * On NUMA systems the partitions can also be padded to whole pages, and left
+ * untouched until their owner initialises them with sm_fleet_touch(): the
+ * operating system then places their memory on the node of the owner (first
+ * touch policy).
+ */
+
+/**
+ * \addtogroup sm_fleet
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_FLEET_H_
+#define SM_FLEET_H_
+
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Configuration of a fleet
+ */
+struct sm_fleet_config {
+	/** \brief Number of partitions, typically one per thread */
+	size_t num_partitions;
+	/** \brief Number of state machines of each partition */
+	size_t partition_size;
+	/**
+	 * \brief Pad the partitions to whole pages (#SM_STATE_MACHINE_PAGE_SIZE)
+	 * and don't touch their memory: each partition must be initialised by
+	 * its owner with sm_fleet_touch()
+	 */
+	bool numa_local;
+};
+
+/**
+ * \brief Fleet
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_fleet {
+	struct sm_fleet_config config;
+	unsigned char *memory;
+	/* Distance in bytes between two partitions */
+	size_t stride;
+};
+
+/**
+ * \brief Allocate a fleet
+ *
+ * Unless sm_fleet_config::numa_local is set, the state machines are zeroed:
+ * they still have to be initialised with sm_state_machine_init().
+ *
+ * \param [out] fleet -
+ * \param [in] config copied into the fleet
+ *
+ * \retval true on success
+ * \retval false if the configuration is invalid or the allocation failed
+ */
+bool sm_fleet_init(struct sm_fleet *fleet,
+				   const struct sm_fleet_config *config);
+
+/**
+ * \brief Release the memory of a fleet
+ */
+void sm_fleet_deinit(struct sm_fleet *fleet);
+
+/**
+ * \brief Zero the memory of a partition from the calling thread
+ *
+ * With sm_fleet_config::numa_local, must be called by the owner of the
+ * partition before using it: the memory of the partition is then allocated
+ * on the NUMA node of the owner.
+ */
+void sm_fleet_touch(struct sm_fleet *fleet, size_t partition);
+
+/**
+ * \brief State machines of a partition
+ *
+ * \returns an array of sm_fleet_config::partition_size state machines
+ */
+struct sm_state_machine *sm_fleet_partition(const struct sm_fleet *fleet,
+											size_t partition);
+
+/**
+ * \brief A state machine of a partition
+ */
+struct sm_state_machine *sm_fleet_get(const struct sm_fleet *fleet,
+									  size_t partition, size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_FLEET_H_ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,326 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_generator.cpp
+ *
+ * \brief		synthetic state machine generator - implementation
+ *
+ * The random numbers are drawn from std::mt19937_64 without the standard
+ * distributions, whose algorithms are left to the implementation: the same
+ * seed gives the same state machine with any standard library.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_generator.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+namespace {
+/** Uniform in `[0, n)`. The bias is negligible for the sizes at hand. */
+std::size_t below(std::mt19937_64 &random, std::size_t n) {
+	return static_cast<std::size_t>(random() % n);
+}
+
+/** Uniform in `[0, 1)` */
+double unit(std::mt19937_64 &random) {
+	return static_cast<double>(random() >> 11) / 9007199254740992.0;
+}
+
+/*
+ * sm_state::name, only with logs. Not SM_STATE_MACHINE_STATE_NAME(), which
+ * initializes sm_state::parent_state without logs, before the generated
+ * parent_state.
+ */
+std::string name_field(const std::string &name) {
+	return "#if SM_STATE_MACHINE_ENABLE_LOG\n\t.name = \"" + name +
+		   "\",\n#endif\n";
+}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+bool generated_guard(void *sm_user_data, const struct sm_state *current_state,
+					 void *current_state_data, const struct sm_event *event,
+					 const struct sm_state *next_state, void *next_state_data) {
+	(void)sm_user_data;
+	(void)current_state;
+	(void)current_state_data;
+	(void)next_state;
+	(void)next_state_data;
+	return event->data == nullptr;
+}
+
+const struct sm_guard guard = {
+#if SM_STATE_MACHINE_ENABLE_LOG
+	"generated_guard",
+#endif
+	generated_guard,
+};
+#endif
+} // namespace
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+sm_generated_machine::sm_generated_machine(const sm_generator_options &options)
+	: options_(options) {
+	options_.num_states = std::max<std::size_t>(options_.num_states, 1);
+	options_.depth =
+		std::min(std::max<std::size_t>(options_.depth, 1), options_.num_states);
+	options_.num_event_types = std::max(options_.num_event_types, 1);
+	options_.transitions_per_state = std::min<std::size_t>(
+		std::max<std::size_t>(options_.transitions_per_state, 1),
+		static_cast<std::size_t>(options_.num_event_types));
+	generate();
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	build();
+#endif
+}
+
+const sm_generator_options &sm_generated_machine::options() const {
+	return options_;
+}
+
+const std::vector<sm_generated_state> &sm_generated_machine::model() const {
+	return model_;
+}
+
+std::size_t sm_generated_machine::initial_state_index() const {
+	return initial_state_;
+}
+
+std::vector<int> sm_generated_machine::events(std::size_t count,
+											  std::uint64_t seed) const {
+	std::mt19937_64 random(seed);
+	const std::size_t num_types =
+		static_cast<std::size_t>(options_.num_event_types);
+	std::vector<int> events(count);
+
+	if (options_.distribution == sm_event_distribution::uniform) {
+		for (int &event : events) {
+			event = static_cast<int>(below(random, num_types));
+		}
+		return events;
+	}
+	std::vector<double> cumulative(num_types);
+	double sum = 0;
+	for (std::size_t k = 0; k < num_types; ++k) {
+		sum += 1.0 / std::pow(static_cast<double>(k + 1),
+							  options_.zipf_exponent);
+		cumulative[k] = sum;
+	}
+	for (int &event : events) {
+		const auto it = std::upper_bound(cumulative.begin(), cumulative.end(),
+										 unit(random) * sum);
+		event = static_cast<int>(
+			std::min<std::size_t>(it - cumulative.begin(), num_types - 1));
+	}
+	return events;
+}
+
+std::string sm_generated_machine::c_source(const std::string &prefix,
+										   bool functions) const {
+	const auto state_name = [&prefix](std::size_t index) {
+		return prefix + "_state_" + std::to_string(index);
+	};
+	std::string upper_prefix = prefix;
+	std::transform(upper_prefix.begin(), upper_prefix.end(),
+				   upper_prefix.begin(),
+				   [](unsigned char c) { return std::toupper(c); });
+	const bool guarded = std::any_of(
+		model_.begin(), model_.end(), [](const sm_generated_state &state) {
+			return std::any_of(state.transitions.begin(),
+							   state.transitions.end(),
+							   [](const sm_generated_transition &transition) {
+								   return transition.guarded;
+							   });
+		});
+	const char *def = functions ? "SM_STATE_MACHINE_TRANSITION_FN_DEF"
+								: "SM_STATE_MACHINE_TRANSITION_DEF";
+	const char *add = functions ? "SM_STATE_MACHINE_TRANSITION_FN_ADD"
+								: "SM_STATE_MACHINE_TRANSITION_ADD";
+	std::ostringstream out;
+
+	out << "/* Generated by sm_generated_machine::c_source(): "
+		<< options_.num_states << " states, depth " << options_.depth << ", "
+		<< options_.transitions_per_state << " transitions per state, guard "
+		<< "density " << options_.guard_density << ", seed " << options_.seed
+		<< " */\n"
+		<< "#include \"sm_state_machine.h\"\n\n"
+		<< "#include <stdbool.h>\n"
+		<< "#include <stddef.h>\n\n"
+		<< "#define " << upper_prefix << "_INITIAL_STATE "
+		<< state_name(initial_state_) << "\n\n";
+	if (guarded) {
+		out << "static bool " << prefix << "_guard(void *sm_user_data,\n"
+			<< "\tconst struct sm_state *current_state,\n"
+			<< "\tvoid *current_state_data, const struct sm_event *event,\n"
+			<< "\tconst struct sm_state *next_state, void *next_state_data) "
+			   "{\n"
+			<< "\t(void)sm_user_data;\n"
+			<< "\t(void)current_state;\n"
+			<< "\t(void)current_state_data;\n"
+			<< "\t(void)next_state;\n"
+			<< "\t(void)next_state_data;\n"
+			<< "\treturn event->data == NULL;\n"
+			<< "}\n\n";
+	}
+	for (std::size_t i = 0; i < model_.size(); ++i) {
+		out << "extern const struct sm_state " << state_name(i) << ";\n";
+	}
+	out << "const struct sm_state " << prefix << "_error = {\n"
+		<< name_field(prefix + "_error") << "};\n";
+	for (std::size_t i = 0; i < model_.size(); ++i) {
+		const sm_generated_state &state = model_[i];
+		const std::string name = state_name(i);
+		out << "\n" << def << "_START(" << name << ")\n";
+		for (const sm_generated_transition &transition : state.transitions) {
+			out << add << "(" << transition.event_type << ", "
+				<< (transition.guarded ? prefix + "_guard" : "NULL")
+				<< ", NULL, &" << state_name(transition.next_state) << ")\n";
+		}
+		out << def << "_END(" << name << ")\n"
+			<< "const struct sm_state " << name << " = {\n"
+			<< name_field(name);
+		if (state.parent != none) {
+			out << "\t.parent_state = &" << state_name(state.parent) << ",\n";
+		}
+		if (state.entry != none) {
+			out << "\t.entry_state = &" << state_name(state.entry) << ",\n";
+		}
+		out << "\t.transitions = &SM_STATE_MACHINE_TRANSITION_GET(" << name
+			<< "),\n"
+			<< "};\n";
+	}
+	return out.str();
+}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+const struct sm_state *sm_generated_machine::initial_state() const {
+	return &states_[initial_state_];
+}
+
+const struct sm_state *sm_generated_machine::error_state() const {
+	return &error_;
+}
+
+std::vector<const struct sm_state *> sm_generated_machine::states() const {
+	std::vector<const struct sm_state *> states;
+	states.reserve(states_.size());
+	for (const struct sm_state &state : states_) {
+		states.push_back(&state);
+	}
+	return states;
+}
+#endif
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+void sm_generated_machine::generate() {
+	std::mt19937_64 random(options_.seed);
+	const std::size_t num_states = options_.num_states;
+	std::vector<std::size_t> levels(num_states);
+
+	model_.assign(num_states, sm_generated_state{none, none, {}});
+	for (std::size_t i = 1; i < num_states; ++i) {
+		std::size_t parent = i - 1;
+		if (i >= options_.depth) {
+			/* Drawing i itself makes a root state */
+			parent = below(random, i + 1);
+			parent = parent == i ? none : parent;
+			while (parent != none && levels[parent] + 1 >= options_.depth) {
+				parent = model_[parent].parent;
+			}
+		}
+		model_[i].parent = parent;
+		if (parent != none) {
+			levels[i] = levels[parent] + 1;
+			if (model_[parent].entry == none) {
+				model_[parent].entry = i;
+			}
+		}
+	}
+	initial_state_ = 0;
+	while (model_[initial_state_].entry != none) {
+		initial_state_ = model_[initial_state_].entry;
+	}
+
+	/* A cycle through all the states makes each one reachable */
+	std::vector<std::size_t> cycle(num_states);
+	std::iota(cycle.begin(), cycle.end(), 0);
+	for (std::size_t i = num_states; i > 1; --i) {
+		std::swap(cycle[i - 1], cycle[below(random, i)]);
+	}
+	std::vector<std::size_t> successors(num_states);
+	for (std::size_t i = 0; i < num_states; ++i) {
+		successors[cycle[i]] = cycle[(i + 1) % num_states];
+	}
+
+	std::vector<int> event_types(
+		static_cast<std::size_t>(options_.num_event_types));
+	std::iota(event_types.begin(), event_types.end(), 0);
+	for (std::size_t i = 0; i < num_states; ++i) {
+		std::vector<sm_generated_transition> &transitions =
+			model_[i].transitions;
+		for (std::size_t t = 0; t < options_.transitions_per_state; ++t) {
+			/* Partial Fisher-Yates shuffle: distinct event types */
+			std::swap(event_types[t],
+					  event_types[t + below(random, event_types.size() - t)]);
+			const std::size_t next_state =
+				t == 0 ? successors[i] : below(random, num_states);
+			const bool guarded = unit(random) < options_.guard_density;
+			transitions.push_back({event_types[t], guarded, next_state});
+		}
+	}
+}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+void sm_generated_machine::build() {
+	const std::size_t num_states = model_.size();
+
+	/* Sized once, so that the pointers between them stay valid */
+	names_.resize(num_states + 1);
+	states_.assign(num_states, sm_state{});
+	transitions_.resize(num_states);
+	tables_.assign(num_states, sm_state_transitions{});
+	error_ = sm_state{};
+	for (std::size_t i = 0; i < num_states; ++i) {
+		const sm_generated_state &generated = model_[i];
+		for (const sm_generated_transition &transition :
+			 generated.transitions) {
+			transitions_[i].push_back({transition.event_type,
+									   transition.guarded ? &guard : nullptr,
+									   nullptr,
+									   &states_[transition.next_state]});
+		}
+		tables_[i].transitions = transitions_[i].data();
+		tables_[i].num_transitions = transitions_[i].size();
+
+		struct sm_state &state = states_[i];
+		names_[i] = "state_" + std::to_string(i);
+#if SM_STATE_MACHINE_ENABLE_LOG
+		state.name = names_[i].c_str();
+#endif
+		state.parent_state =
+			generated.parent == none ? nullptr : &states_[generated.parent];
+		state.entry_state =
+			generated.entry == none ? nullptr : &states_[generated.entry];
+		state.transitions = &tables_[i];
+	}
+	names_[num_states] = "state_error";
+#if SM_STATE_MACHINE_ENABLE_LOG
+	error_.name = names_[num_states].c_str();
+#endif
+}
+#endif
@@ -0,0 +1,167 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_generator.hpp
+ *
+ * \brief		synthetic state machine generator - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#ifndef SM_GENERATOR_HPP_
+#define SM_GENERATOR_HPP_
+
+#include "sm_state_machine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * \brief How the event types are drawn by sm_generated_machine::events()
+ */
+enum class sm_event_distribution {
+	/** \brief All the event types are equally likely */
+	uniform,
+	/**
+	 * \brief The k-th event type (from 0) has a probability proportional to
+	 * `1 / (k + 1)^s`, `s` being sm_generator_options::zipf_exponent
+	 */
+	zipf,
+};
+
+/**
+ * \brief Shape of a generated state machine
+ */
+struct sm_generator_options {
+	/** \brief Number of states, the error state excluded. At least 1. */
+	std::size_t num_states = 16;
+	/**
+	 * \brief Number of levels of the state hierarchy: 1 for a flat state
+	 * machine. The first states form a chain of this depth; the others get a
+	 * random parent, or none.
+	 */
+	std::size_t depth = 1;
+	/**
+	 * \brief Transitions of each state, each one for a different event type.
+	 * Clamped to [1, #num_event_types].
+	 */
+	std::size_t transitions_per_state = 4;
+	/** \brief Probability of a transition to have a guard, in [0, 1] */
+	double guard_density = 0.0;
+	/** \brief Event types are `[0, num_event_types)` */
+	int num_event_types = 16;
+	/** \brief Distribution of the events returned by events() */
+	sm_event_distribution distribution = sm_event_distribution::uniform;
+	/** \brief Exponent of sm_event_distribution::zipf */
+	double zipf_exponent = 1.0;
+	/** \brief Same options and seed, same state machine */
+	std::uint64_t seed = 1;
+};
+
+/**
+ * \brief Transition of a generated state
+ */
+struct sm_generated_transition {
+	int event_type;
+	/**
+	 * \brief If true, the transition is guarded by a function that accepts
+	 * the events whose sm_event::data is NULL
+	 */
+	bool guarded;
+	/** \brief Index of the next state */
+	std::size_t next_state;
+};
+
+/**
+ * \brief Generated state
+ */
+struct sm_generated_state {
+	/** \brief Index of the parent state, sm_generated_machine::none if root */
+	std::size_t parent;
+	/** \brief Index of the entry state, sm_generated_machine::none if leaf */
+	std::size_t entry;
+	std::vector<sm_generated_transition> transitions;
+};
+
+/**
+ * \brief Random but valid state machine, to benchmark the engine at scale
+ *
+ * Every state can be reached from the initial state, no transition is shadowed
+ * and the hierarchy has no cycles: sm_verify() reports no issues. The state
+ * machine is available both as a definition in memory, to be dispatched
+ * directly (not with #SM_STATE_MACHINE_OPTIMIZE_RAM, as it is made of tables),
+ * and as C source, for either dispatch mode.
+ */
+class sm_generated_machine {
+  public:
+	/** \brief No parent or entry state */
+	static constexpr std::size_t none = SIZE_MAX;
+
+	explicit sm_generated_machine(const sm_generator_options &options);
+	/* The definition refers to its own members */
+	sm_generated_machine(const sm_generated_machine &) = delete;
+	sm_generated_machine &operator=(const sm_generated_machine &) = delete;
+
+	/** \brief The options, after clamping */
+	const sm_generator_options &options() const;
+	/** \brief The generated states, by index */
+	const std::vector<sm_generated_state> &model() const;
+	/** \brief Index of the initial state, a leaf */
+	std::size_t initial_state_index() const;
+
+	/**
+	 * \brief Draw \p count event types from sm_generator_options::distribution
+	 */
+	std::vector<int> events(std::size_t count, std::uint64_t seed) const;
+
+	/**
+	 * \brief Generate the C source of the state machine
+	 *
+	 * The source includes sm_state_machine.h and defines the states
+	 * `<prefix>_state_<index>` and `<prefix>_error`, the guard
+	 * `<prefix>_guard`, and the macro `<PREFIX>_INITIAL_STATE`.
+	 *
+	 * \param [in] prefix of the generated identifiers
+	 * \param [in] functions if true, the transitions are defined with the \ref
+	 * SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+	 * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*" macros, otherwise with the \ref
+	 * SM_STATE_MACHINE_TRANSITION_DEF_START "SM_STATE_MACHINE_TRANSITION_DEF_*"
+	 * ones (functions as well with #SM_STATE_MACHINE_OPTIMIZE_RAM).
+	 */
+	std::string c_source(const std::string &prefix, bool functions) const;
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	/** \brief Initial state of the definition in memory */
+	const struct sm_state *initial_state() const;
+	/** \brief Error state of the definition in memory. Has no transitions. */
+	const struct sm_state *error_state() const;
+	/** \brief All the states of the definition in memory, by index */
+	std::vector<const struct sm_state *> states() const;
+#endif
+
+  private:
+	void generate();
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	void build();
+#endif
+
+	sm_generator_options options_;
+	std::vector<sm_generated_state> model_;
+	std::size_t initial_state_;
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	std::vector<std::string> names_;
+	std::vector<struct sm_state> states_;
+	struct sm_state error_;
+	std::vector<std::vector<struct sm_transition>> transitions_;
+	std::vector<struct sm_state_transitions> tables_;
+#endif
+};
+
+#endif /* ifndef SM_GENERATOR_HPP_ */
@@ -0,0 +1,214 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_hot_swap.c
+ *
+ * \brief		hot swap of state machine definitions - implementation
+ *
+ * The readers announce the epoch they entered their critical section in, 0
+ * meaning outside of it. Publishing a version and advancing the epoch are
+ * sequentially consistent with the announcements, so that a reader that the
+ * writer sees outside of its critical section will read the new version.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_hot_swap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define CACHE_LINE SM_STATE_MACHINE_CACHE_LINE_SIZE
+
+/* One per cache line, as each one is written by a different thread */
+struct sm_hot_swap_reader {
+	_Alignas(CACHE_LINE) SM_ATOMIC(uint64_t) epoch;
+};
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static bool map_state(const struct sm_definition *to,
+					  const struct sm_definition *from,
+					  const struct sm_state **state);
+static const struct sm_state *lookup(const struct sm_definition *definition,
+									 const struct sm_state *state);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_hot_swap_init(struct sm_hot_swap *hot_swap,
+					  const struct sm_definition *definition,
+					  size_t num_readers) {
+	assert(hot_swap != NULL);
+	assert(definition != NULL);
+
+	const size_t size = num_readers * sizeof(struct sm_hot_swap_reader);
+	hot_swap->readers = num_readers ? aligned_alloc(CACHE_LINE, size) : NULL;
+	if (num_readers && !hot_swap->readers) {
+		return false;
+	}
+	for (size_t i = 0; i < num_readers; ++i) {
+		atomic_init(&hot_swap->readers[i].epoch, 0);
+	}
+	hot_swap->num_readers = num_readers;
+	atomic_init(&hot_swap->current, definition);
+	atomic_init(&hot_swap->epoch, 1);
+	return true;
+}
+
+void sm_hot_swap_deinit(struct sm_hot_swap *hot_swap) {
+	assert(hot_swap != NULL);
+
+	free(hot_swap->readers);
+	hot_swap->readers = NULL;
+	hot_swap->num_readers = 0;
+}
+
+const struct sm_definition *
+sm_hot_swap_current(const struct sm_hot_swap *hot_swap) {
+	assert(hot_swap != NULL);
+	return atomic_load(&hot_swap->current);
+}
+
+const struct sm_definition *
+sm_hot_swap_publish(struct sm_hot_swap *hot_swap,
+					const struct sm_definition *definition) {
+	assert(hot_swap != NULL);
+	assert(definition != NULL);
+	assert(definition->previous == atomic_load(&hot_swap->current));
+
+	return atomic_exchange(&hot_swap->current, definition);
+}
+
+void sm_hot_swap_synchronize(struct sm_hot_swap *hot_swap) {
+	assert(hot_swap != NULL);
+
+	/* The readers that entered before this point may be using any version */
+	const uint64_t epoch = atomic_fetch_add(&hot_swap->epoch, 1);
+	for (size_t i = 0; i < hot_swap->num_readers; ++i) {
+		uint64_t reader_epoch;
+		do {
+			reader_epoch = atomic_load(&hot_swap->readers[i].epoch);
+		} while (reader_epoch != 0 && reader_epoch <= epoch);
+	}
+}
+
+void sm_hot_swap_read_lock(struct sm_hot_swap *hot_swap, size_t reader) {
+	assert(hot_swap != NULL);
+	assert(reader < hot_swap->num_readers);
+	assert(atomic_load_explicit(&hot_swap->readers[reader].epoch,
+								memory_order_relaxed) == 0);
+
+	atomic_store(&hot_swap->readers[reader].epoch,
+				 atomic_load(&hot_swap->epoch));
+}
+
+void sm_hot_swap_read_unlock(struct sm_hot_swap *hot_swap, size_t reader) {
+	assert(hot_swap != NULL);
+	assert(reader < hot_swap->num_readers);
+
+	atomic_store_explicit(&hot_swap->readers[reader].epoch, 0,
+						  memory_order_release);
+}
+
+void sm_hot_swap_instance_init(const struct sm_hot_swap *hot_swap,
+							   struct sm_hot_swap_instance *instance,
+							   const char *name,
+							   struct sm_state_machine_hooks *hooks,
+							   void *user_data, void *state_data) {
+	assert(hot_swap != NULL);
+	assert(instance != NULL);
+
+	const struct sm_definition *definition = sm_hot_swap_current(hot_swap);
+	sm_state_machine_init(&instance->state_machine, name,
+						  definition->initial_state, definition->error_state,
+						  hooks, user_data, state_data);
+	instance->definition = definition;
+}
+
+bool sm_hot_swap_migrate(struct sm_hot_swap_instance *instance,
+						 const struct sm_definition *definition) {
+	assert(instance != NULL);
+	assert(definition != NULL);
+
+	if (instance->definition == definition) {
+		return true;
+	}
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	if (sm_state_machine_in_transit(&instance->state_machine)) {
+		/* The transition ends on the version it started on */
+		return false;
+	}
+#endif
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* The submachine states aren't mapped: the instance stays on its version
+	 * until it leaves them */
+	if (instance->state_machine.submachine_depth) {
+		return false;
+	}
+#endif
+
+	struct sm_state_machine *state_machine = &instance->state_machine;
+	const struct sm_state *current_state = state_machine->current_state;
+	const struct sm_state *previous_state = state_machine->previous_state;
+	if (map_state(definition, instance->definition, &current_state)) {
+		map_state(definition, instance->definition, &previous_state);
+	} else {
+		current_state = definition->initial_state;
+		previous_state = NULL;
+	}
+	sm_state_machine_set_states(state_machine, current_state, previous_state);
+	state_machine->error_state = definition->error_state;
+	instance->definition = definition;
+	return true;
+}
+
+int sm_hot_swap_handle_event(struct sm_hot_swap *hot_swap, size_t reader,
+							 struct sm_hot_swap_instance *instance,
+							 const struct sm_event *event) {
+	assert(hot_swap != NULL);
+	assert(instance != NULL);
+
+	sm_hot_swap_read_lock(hot_swap, reader);
+	sm_hot_swap_migrate(instance, sm_hot_swap_current(hot_swap));
+	int status =
+		sm_state_machine_handle_event(&instance->state_machine, event);
+	sm_hot_swap_read_unlock(hot_swap, reader);
+	return status;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+/* Map \p state, a state of \p from, through all the versions up to \p to.
+ * Returns false if \p from is not a previous version of \p to. */
+static bool map_state(const struct sm_definition *to,
+					  const struct sm_definition *from,
+					  const struct sm_state **state) {
+	if (to == from) {
+		return true;
+	}
+	if (!to->previous || !map_state(to->previous, from, state)) {
+		return false;
+	}
+	*state = lookup(to, *state);
+	return true;
+}
+
+static const struct sm_state *lookup(const struct sm_definition *definition,
+									 const struct sm_state *state) {
+	for (size_t i = 0; i < definition->mapping_size; ++i) {
+		if (definition->mapping[i].from == state) {
+			return definition->mapping[i].to;
+		}
+	}
+	/* Shared by the two versions */
+	return state;
+}
@@ -0,0 +1,239 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_hot_swap.h
+ *
+ * \brief		hot swap of state machine definitions - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_hot_swap Hot swap
+ *
+ * \brief Replace the definition of live state machines without stopping them
+ *
+ * A state machine definition (its states and their transitions) is usually
+ * made of static objects referenced by every instance. To fix it without a
+ * restart, describe each version with a #sm_definition and publish the new one
+ * with sm_hot_swap_publish(), in the style of RCU (read-copy-update):
+ *
+ * - the events dispatched with sm_hot_swap_handle_event() after the
+ *   publication use the new version, while the dispatches already running
+ *   finish on the old one;
+ * - each instance is migrated to the new version right before it handles its
+ *   next event, by mapping its states through sm_definition::mapping;
+ * - reading the current version never takes a lock: each dispatching thread
+ *   (reader) only announces the epoch it is reading in;
+ * - sm_hot_swap_synchronize() waits until no reader can be using the previous
+ *   version anymore.
+ *
+ * States that don't change between two versions can be shared by them, and
+ * don't need to be mapped. A version must be kept alive (e.g. its plugin must
+ * stay loaded) as long as some instance may still be on it: the instances that
+ * don't receive events can be migrated explicitly with sm_hot_swap_migrate().
+ */
+
+/**
+ * \addtogroup sm_hot_swap
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_HOT_SWAP_H_
+#define SM_HOT_SWAP_H_
+
+#include "sm_atomic.h"
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief A state of the previous version and the state replacing it
+ */
+struct sm_state_mapping {
+	/** \brief State of the previous version */
+	const struct sm_state *from;
+	/** \brief Corresponding state of this version */
+	const struct sm_state *to;
+};
+
+/**
+ * \brief A version of a state machine definition
+ */
+struct sm_definition {
+	/** \brief Identifies the version, e.g. for logging */
+	unsigned int version;
+	/** \brief Initial state, also used when an instance can't be mapped */
+	const struct sm_state *initial_state;
+	/** \brief Error state */
+	const struct sm_state *error_state;
+	/** \brief Version this one replaces. NULL for the first one. */
+	const struct sm_definition *previous;
+	/**
+	 * \brief How to migrate the instances from #previous. States that are not
+	 * listed are kept as they are.
+	 */
+	const struct sm_state_mapping *mapping;
+	/** \brief Number of elements of #mapping */
+	size_t mapping_size;
+};
+
+/** \cond */
+struct sm_hot_swap_reader;
+/** \endcond */
+
+/**
+ * \brief Current version of a definition, shared by its instances
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_hot_swap {
+	SM_ATOMIC(const struct sm_definition *) current;
+	SM_ATOMIC(uint64_t) epoch;
+	struct sm_hot_swap_reader *readers;
+	size_t num_readers;
+};
+
+/**
+ * \brief An instance of a hot swappable definition
+ */
+struct sm_hot_swap_instance {
+	/** \brief The state machine */
+	struct sm_state_machine state_machine;
+	/** \brief Version the state machine is on */
+	const struct sm_definition *definition;
+};
+
+/**
+ * \brief Initialise a hot swappable definition
+ *
+ * \param [out] hot_swap -
+ * \param [in] definition first version
+ * \param [in] num_readers number of threads that dispatch events to the
+ * instances, each one identified by an index in `[0, num_readers)`
+ *
+ * \retval true on success
+ * \retval false if the allocation failed
+ */
+bool sm_hot_swap_init(struct sm_hot_swap *hot_swap,
+					  const struct sm_definition *definition,
+					  size_t num_readers);
+
+/**
+ * \brief Release the memory of a hot swappable definition
+ */
+void sm_hot_swap_deinit(struct sm_hot_swap *hot_swap);
+
+/**
+ * \brief Current version
+ */
+const struct sm_definition *
+sm_hot_swap_current(const struct sm_hot_swap *hot_swap);
+
+/**
+ * \brief Publish a new version
+ *
+ * Lock-free with respect to the readers. There must be a single writer at a
+ * time.
+ *
+ * \param [in] hot_swap -
+ * \param [in] definition new version. Its sm_definition::previous must be the
+ * current version.
+ *
+ * \returns the replaced version
+ */
+const struct sm_definition *
+sm_hot_swap_publish(struct sm_hot_swap *hot_swap,
+					const struct sm_definition *definition);
+
+/**
+ * \brief Wait until all the dispatches that started before this call have
+ * ended
+ *
+ * Must not be called by a reader within sm_hot_swap_read_lock() and
+ * sm_hot_swap_read_unlock().
+ */
+void sm_hot_swap_synchronize(struct sm_hot_swap *hot_swap);
+
+/**
+ * \brief Enter a read-side critical section
+ *
+ * Within the critical section, the version returned by sm_hot_swap_current()
+ * stays alive. Critical sections can't be nested.
+ *
+ * \param [in] hot_swap -
+ * \param [in] reader index of the calling thread
+ */
+void sm_hot_swap_read_lock(struct sm_hot_swap *hot_swap, size_t reader);
+
+/**
+ * \brief Leave a read-side critical section
+ */
+void sm_hot_swap_read_unlock(struct sm_hot_swap *hot_swap, size_t reader);
+
+/**
+ * \brief Initialise an instance on the current version
+ *
+ * See sm_state_machine_init() for the parameters.
+ */
+void sm_hot_swap_instance_init(const struct sm_hot_swap *hot_swap,
+							   struct sm_hot_swap_instance *instance,
+							   const char *name,
+							   struct sm_state_machine_hooks *hooks,
+							   void *user_data, void *state_data);
+
+/**
+ * \brief Migrate an instance to a version
+ *
+ * An instance whose version isn't a previous version of \p definition is
+ * restarted from sm_definition::initial_state. No action is called.
+ *
+ * \retval true if the instance is on \p definition
+ * \retval false if the instance is in transit (see
+ * sm_state_machine_in_transit()): it will be migrated when the transition
+ * completes. Likewise, if the instance is inside a submachine (see
+ * sm_state_machine_submachine_states()): it will be migrated once it has left
+ * it.
+ */
+bool sm_hot_swap_migrate(struct sm_hot_swap_instance *instance,
+						 const struct sm_definition *definition);
+
+/**
+ * \brief Pass an event to an instance, on the current version
+ *
+ * Wraps sm_state_machine_handle_event() in a read-side critical section,
+ * migrating the instance first if a new version has been published.
+ *
+ * \param [in] hot_swap -
+ * \param [in] reader index of the calling thread
+ * \param [in] instance -
+ * \param [in] event -
+ *
+ * \return #stateM_handleEventRetVals
+ */
+int sm_hot_swap_handle_event(struct sm_hot_swap *hot_swap, size_t reader,
+							 struct sm_hot_swap_instance *instance,
+							 const struct sm_event *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_HOT_SWAP_H_ */
+
+/**
+ * @}
+ */
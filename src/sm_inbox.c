@@ -0,0 +1,305 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_inbox.c
+ *
+ * \brief		coalescing event queue - implementation
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_inbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define NIL UINT32_MAX
+#define MASK (SM_STATE_MACHINE_INBOX_SIZE - 1u)
+
+_Static_assert((SM_STATE_MACHINE_INBOX_SIZE & MASK) == 0,
+			   "SM_STATE_MACHINE_INBOX_SIZE must be a power of 2");
+_Static_assert(SM_STATE_MACHINE_INBOX_SIZE < NIL,
+			   "SM_STATE_MACHINE_INBOX_SIZE is too large");
+_Static_assert(SM_STATE_MACHINE_INBOX_LANES >= 1 &&
+				   SM_STATE_MACHINE_INBOX_LANES <= UINT8_MAX + 1u,
+			   "SM_STATE_MACHINE_INBOX_LANES must be in [1, 256]");
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static enum sm_inbox_policy policy_of(const struct sm_inbox *inbox, int type);
+static uint8_t lane_of(const struct sm_inbox *inbox, int type);
+static uint32_t next_to_drain(struct sm_inbox *inbox);
+static uint32_t key_hash(uint64_t key);
+static uint32_t coalesce_hash(uint64_t key, int type);
+static uint32_t find_coalescable(const struct sm_inbox *inbox, uint64_t key,
+								 int type);
+static void discard(const struct sm_inbox *inbox,
+					const struct sm_inbox_entry *entry);
+static void unlink_coalesce_chain(struct sm_inbox *inbox, uint32_t index);
+static void remove_node(struct sm_inbox *inbox, uint32_t index);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+void sm_inbox_init(struct sm_inbox *inbox,
+				   const struct sm_inbox_config *config) {
+	assert(inbox != NULL);
+
+	memset(&inbox->config, 0, sizeof(inbox->config));
+	if (config) {
+		inbox->config = *config;
+	}
+	for (uint32_t i = 0; i < SM_STATE_MACHINE_INBOX_SIZE; ++i) {
+		inbox->nodes[i].next =
+			i + 1 < SM_STATE_MACHINE_INBOX_SIZE ? i + 1 : NIL;
+		inbox->coalesce_buckets[i] = NIL;
+		inbox->key_buckets[i] = NIL;
+	}
+	for (size_t i = 0; i < SM_STATE_MACHINE_INBOX_LANES; ++i) {
+		inbox->head[i] = NIL;
+		inbox->tail[i] = NIL;
+	}
+	inbox->free_list = 0;
+	inbox->size = 0;
+	inbox->credit = 0;
+	inbox->lane = 0;
+}
+
+enum sm_inbox_push_status sm_inbox_push(struct sm_inbox *inbox, uint64_t key,
+										const struct sm_event *event) {
+	assert(inbox != NULL);
+	assert(event != NULL);
+
+	const enum sm_inbox_policy policy = policy_of(inbox, event->type);
+	const struct sm_inbox_entry incoming = {key, *event, 1};
+
+	if (policy != sm_inbox_policy_queue) {
+		uint32_t index = find_coalescable(inbox, key, event->type);
+		if (index != NIL) {
+			struct sm_inbox_entry *queued = &inbox->nodes[index].entry;
+			++queued->count;
+			switch (policy) {
+			case sm_inbox_policy_keep_latest:
+				discard(inbox, queued);
+				queued->event.data = event->data;
+				break;
+			case sm_inbox_policy_count:
+				discard(inbox, &incoming);
+				queued->event.data = (void *)(uintptr_t)queued->count;
+				break;
+			case sm_inbox_policy_keep_first:
+			default:
+				discard(inbox, &incoming);
+				break;
+			}
+			return sm_inbox_coalesced;
+		}
+	}
+
+	const uint32_t index = inbox->free_list;
+	if (index == NIL) {
+		return sm_inbox_full;
+	}
+	struct sm_inbox_node *node = &inbox->nodes[index];
+	inbox->free_list = node->next;
+
+	node->entry = incoming;
+	if (policy == sm_inbox_policy_count) {
+		discard(inbox, &incoming);
+		node->entry.event.data = (void *)(uintptr_t)1;
+	}
+
+	const uint8_t lane = lane_of(inbox, event->type);
+	node->lane = lane;
+	node->previous = inbox->tail[lane];
+	node->next = NIL;
+	if (inbox->tail[lane] != NIL) {
+		inbox->nodes[inbox->tail[lane]].next = index;
+	} else {
+		inbox->head[lane] = index;
+	}
+	inbox->tail[lane] = index;
+
+	node->coalescable = policy != sm_inbox_policy_queue;
+	if (node->coalescable) {
+		uint32_t *bucket =
+			&inbox->coalesce_buckets[coalesce_hash(key, event->type)];
+		node->coalesce_next = *bucket;
+		*bucket = index;
+	}
+	uint32_t *bucket = &inbox->key_buckets[key_hash(key)];
+	node->key_previous = NIL;
+	node->key_next = *bucket;
+	if (*bucket != NIL) {
+		inbox->nodes[*bucket].key_previous = index;
+	}
+	*bucket = index;
+
+	++inbox->size;
+	return sm_inbox_queued;
+}
+
+bool sm_inbox_pop(struct sm_inbox *inbox, struct sm_inbox_entry *entry) {
+	assert(inbox != NULL);
+	assert(entry != NULL);
+
+	const uint32_t index = next_to_drain(inbox);
+	if (index == NIL) {
+		return false;
+	}
+	*entry = inbox->nodes[index].entry;
+	remove_node(inbox, index);
+	return true;
+}
+
+size_t sm_inbox_cancel(struct sm_inbox *inbox, uint64_t key) {
+	assert(inbox != NULL);
+
+	size_t cancelled = 0;
+	uint32_t index = inbox->key_buckets[key_hash(key)];
+	while (index != NIL) {
+		const uint32_t next = inbox->nodes[index].key_next;
+		if (inbox->nodes[index].entry.key == key) {
+			discard(inbox, &inbox->nodes[index].entry);
+			remove_node(inbox, index);
+			++cancelled;
+		}
+		index = next;
+	}
+	return cancelled;
+}
+
+size_t sm_inbox_size(const struct sm_inbox *inbox) {
+	assert(inbox != NULL);
+	return inbox->size;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static enum sm_inbox_policy policy_of(const struct sm_inbox *inbox, int type) {
+	if (!inbox->config.policies || type < 0 ||
+		(size_t)type >= inbox->config.num_types) {
+		return sm_inbox_policy_queue;
+	}
+	return inbox->config.policies[type];
+}
+
+static uint8_t lane_of(const struct sm_inbox *inbox, int type) {
+	if (SM_STATE_MACHINE_INBOX_LANES == 1 || !inbox->config.lanes || type < 0 ||
+		(size_t)type >= inbox->config.num_types) {
+		return 0;
+	}
+	assert(inbox->config.lanes[type] < SM_STATE_MACHINE_INBOX_LANES);
+	return inbox->config.lanes[type];
+}
+
+static uint32_t next_to_drain(struct sm_inbox *inbox) {
+	if (SM_STATE_MACHINE_INBOX_LANES == 1) {
+		return inbox->head[0];
+	}
+	if (!inbox->config.weights) {
+		/* Strict priority */
+		for (size_t lane = SM_STATE_MACHINE_INBOX_LANES; lane-- > 0;) {
+			if (inbox->head[lane] != NIL) {
+				return inbox->head[lane];
+			}
+		}
+		return NIL;
+	}
+	if (inbox->size == 0) {
+		return NIL;
+	}
+	/* Weighted round robin, from the most urgent lane down. Terminates as
+	 * there is at least one event and no weight is zero. */
+	while (inbox->credit == 0 || inbox->head[inbox->lane] == NIL) {
+		inbox->lane = inbox->lane == 0 ? SM_STATE_MACHINE_INBOX_LANES - 1u
+									   : inbox->lane - 1u;
+		inbox->credit = inbox->config.weights[inbox->lane];
+		assert(inbox->credit != 0);
+	}
+	--inbox->credit;
+	return inbox->head[inbox->lane];
+}
+
+static uint32_t key_hash(uint64_t key) {
+	return (uint32_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & MASK;
+}
+
+static uint32_t coalesce_hash(uint64_t key, int type) {
+	return key_hash(key ^ ((uint64_t)(uint32_t)type << 32 | (uint32_t)type));
+}
+
+static uint32_t find_coalescable(const struct sm_inbox *inbox, uint64_t key,
+								 int type) {
+	uint32_t index = inbox->coalesce_buckets[coalesce_hash(key, type)];
+	while (index != NIL) {
+		const struct sm_inbox_node *node = &inbox->nodes[index];
+		if (node->entry.key == key && node->entry.event.type == type) {
+			return index;
+		}
+		index = node->coalesce_next;
+	}
+	return NIL;
+}
+
+static void discard(const struct sm_inbox *inbox,
+					const struct sm_inbox_entry *entry) {
+	if (inbox->config.discard) {
+		inbox->config.discard(inbox->config.context, entry);
+	}
+}
+
+/* Remove \p index from its coalescing chain. The chain is singly linked: it
+ * holds at most one node per (key, type) and the table has as many buckets as
+ * nodes, so it is expected to be short. */
+static void unlink_coalesce_chain(struct sm_inbox *inbox, uint32_t index) {
+	const struct sm_inbox_node *node = &inbox->nodes[index];
+	uint32_t *link = &inbox->coalesce_buckets[coalesce_hash(
+		node->entry.key, node->entry.event.type)];
+	while (*link != index) {
+		assert(*link != NIL);
+		link = &inbox->nodes[*link].coalesce_next;
+	}
+	*link = node->coalesce_next;
+}
+
+static void remove_node(struct sm_inbox *inbox, uint32_t index) {
+	struct sm_inbox_node *node = &inbox->nodes[index];
+
+	if (node->previous != NIL) {
+		inbox->nodes[node->previous].next = node->next;
+	} else {
+		inbox->head[node->lane] = node->next;
+	}
+	if (node->next != NIL) {
+		inbox->nodes[node->next].previous = node->previous;
+	} else {
+		inbox->tail[node->lane] = node->previous;
+	}
+
+	if (node->coalescable) {
+		unlink_coalesce_chain(inbox, index);
+	}
+	/* The oldest event of a key is at the end of its chain: unlinked in
+	 * constant time, so that draining a backlog stays linear */
+	if (node->key_previous != NIL) {
+		inbox->nodes[node->key_previous].key_next = node->key_next;
+	} else {
+		inbox->key_buckets[key_hash(node->entry.key)] = node->key_next;
+	}
+	if (node->key_next != NIL) {
+		inbox->nodes[node->key_next].key_previous = node->key_previous;
+	}
+
+	node->next = inbox->free_list;
+	inbox->free_list = index;
+	--inbox->size;
+}
@@ -0,0 +1,235 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_inbox.h
+ *
+ * \brief		coalescing event queue - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_inbox Inbox
+ *
+ * \brief Queued delivery of events, with coalescing
+ *
+ * An inbox is a bounded FIFO of events waiting to be handled by a set of state
+ * machines, each one identified by a 64-bit key. When the events of a type
+ * arrive faster than they can be handled, and only some of them matter, the
+ * type can be given a coalescing policy (#sm_inbox_policy): an event that
+ * finds an event of the same type for the same key already queued is merged
+ * into it instead of being queued, so the state machine handles it once.
+ *
+ * The queued event that a new one may be merged into is found through a hash
+ * table, so that coalescing is O(1) at enqueue time.
+ *
+ * Urgent events, such as faults or shutdown requests, shouldn't wait behind a
+ * backlog of routine ones: each event type can be assigned to one of
+ * #SM_STATE_MACHINE_INBOX_LANES priority lanes: lane 0 is the default one and
+ * the higher the lane, the more urgent its events.
+ * The lanes are drained either in strict priority order or, to avoid starving
+ * the less urgent lanes, by weighted round robin. With a single lane (the
+ * default) the inbox is a plain FIFO.
+ *
+ * An inbox doesn't allocate memory (its capacity is
+ * #SM_STATE_MACHINE_INBOX_SIZE) and it is not thread-safe.
+ */
+
+/**
+ * \addtogroup sm_inbox
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_INBOX_H_
+#define SM_INBOX_H_
+
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief What to do with an event that finds an event of the same type for
+ * the same key already queued
+ */
+enum sm_inbox_policy {
+	/** \brief Queue it: no coalescing */
+	sm_inbox_policy_queue,
+	/**
+	 * \brief Keep the latest: the payload of the queued event is superseded
+	 * by the new one. The event keeps its position in the queue.
+	 */
+	sm_inbox_policy_keep_latest,
+	/** \brief Keep the first: the new event is dropped */
+	sm_inbox_policy_keep_first,
+	/**
+	 * \brief Count: the events are merged into one, whose \ref sm_event::data
+	 * "payload" is the number of merged events, cast to `uintptr_t`. Meant for
+	 * events without payload, such as ticks or heartbeats.
+	 */
+	sm_inbox_policy_count,
+};
+
+/**
+ * \brief A queued event
+ */
+struct sm_inbox_entry {
+	/** \brief Identifies the state machine the event is for */
+	uint64_t key;
+	/** \brief The event */
+	struct sm_event event;
+	/** \brief Number of events that have been merged into this one */
+	unsigned int count;
+};
+
+/**
+ * \brief Configuration of an inbox
+ */
+struct sm_inbox_config {
+	/**
+	 * \brief Policy of each event type, indexed by event type. Types that
+	 * are negative or not less than #num_types are always queued. May be
+	 * NULL: no coalescing.
+	 */
+	const enum sm_inbox_policy *policies;
+	/**
+	 * \brief Priority lane of each event type, indexed by event type. Must be
+	 * less than #SM_STATE_MACHINE_INBOX_LANES. Types that are negative or not
+	 * less than #num_types go to lane 0. May be NULL: all the types go to
+	 * lane 0.
+	 */
+	const uint8_t *lanes;
+	/** \brief Number of elements of #policies and #lanes */
+	size_t num_types;
+	/**
+	 * \brief Number of events drained from each lane in turn, indexed by lane.
+	 * Must not be zero. May be NULL: strict priority, i.e. an event is drained
+	 * only when all the more urgent (higher) lanes are empty.
+	 */
+	const unsigned int *weights;
+	/**
+	 * \brief Called for every event that is dropped, superseded or cancelled,
+	 * e.g. to release its payload. May be NULL.
+	 */
+	void (*discard)(void *context, const struct sm_inbox_entry *entry);
+	/** \brief Passed as is to #discard */
+	void *context;
+};
+
+/**
+ * \brief Outcome of sm_inbox_push()
+ */
+enum sm_inbox_push_status {
+	/** \brief The event has been queued */
+	sm_inbox_queued,
+	/** \brief The event has been merged into a queued one */
+	sm_inbox_coalesced,
+	/** \brief The inbox is full: the event has not been queued */
+	sm_inbox_full,
+};
+
+/** \cond */
+struct sm_inbox_node {
+	struct sm_inbox_entry entry;
+	/* FIFO */
+	uint32_t previous;
+	uint32_t next;
+	/* Hash chains: by (key, type) for coalescing, and by key. The key chain
+	 * is doubly linked, as it holds every event queued for a key. */
+	uint32_t coalesce_next;
+	uint32_t key_previous;
+	uint32_t key_next;
+	bool coalescable;
+	uint8_t lane;
+};
+/** \endcond */
+
+/**
+ * \brief Inbox
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_inbox {
+	struct sm_inbox_config config;
+	struct sm_inbox_node nodes[SM_STATE_MACHINE_INBOX_SIZE];
+	uint32_t coalesce_buckets[SM_STATE_MACHINE_INBOX_SIZE];
+	uint32_t key_buckets[SM_STATE_MACHINE_INBOX_SIZE];
+	/* One FIFO per lane */
+	uint32_t head[SM_STATE_MACHINE_INBOX_LANES];
+	uint32_t tail[SM_STATE_MACHINE_INBOX_LANES];
+	uint32_t free_list;
+	uint32_t size;
+	/* Weighted round robin: lane being drained and events left in its turn */
+	uint32_t credit;
+	uint8_t lane;
+};
+
+/**
+ * \brief Initialise an inbox
+ *
+ * \param [out] inbox -
+ * \param [in] config copied into the inbox. May be NULL: no coalescing.
+ */
+void sm_inbox_init(struct sm_inbox *inbox,
+				   const struct sm_inbox_config *config);
+
+/**
+ * \brief Queue an event, or merge it into a queued one
+ *
+ * \param [in] inbox -
+ * \param [in] key identifies the state machine the event is for
+ * \param [in] event copied into the inbox
+ *
+ * \returns #sm_inbox_push_status
+ */
+enum sm_inbox_push_status sm_inbox_push(struct sm_inbox *inbox, uint64_t key,
+										const struct sm_event *event);
+
+/**
+ * \brief Remove the next event to be handled: the oldest one of the lane
+ * being drained
+ *
+ * \param [in] inbox -
+ * \param [out] entry the removed event
+ *
+ * \retval true if an event has been removed
+ * \retval false if the inbox is empty
+ */
+bool sm_inbox_pop(struct sm_inbox *inbox, struct sm_inbox_entry *entry);
+
+/**
+ * \brief Cancel all the events queued for a state machine
+ *
+ * \param [in] inbox -
+ * \param [in] key identifies the state machine
+ *
+ * \returns the number of cancelled events
+ */
+size_t sm_inbox_cancel(struct sm_inbox *inbox, uint64_t key);
+
+/**
+ * \brief Number of queued events
+ */
+size_t sm_inbox_size(const struct sm_inbox *inbox);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_INBOX_H_ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,592 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_metrics.c
+ *
+ * \brief		aggregated metrics of many state machines - implementation
+ *
+ * Each shard has a single writer, so the counters are updated with relaxed
+ * loads and stores instead of read-modify-write operations; the readers may
+ * see a transition counted in one shard and not yet in another, as with any
+ * scrape. The edges are counted in an open addressing table keyed by
+ * `from * num_states + to + 1`, 0 marking a free slot. The dwell times are
+ * counted when a state is left, from the timestamps of the state machine.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_metrics.h"
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+
+#include "sm_atomic.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CACHE_LINE SM_STATE_MACHINE_CACHE_LINE_SIZE
+#define NO_STATE SIZE_MAX
+
+struct sm_metrics_state_id {
+	const struct sm_state *state;
+	size_t id;
+};
+
+struct sm_metrics_edge {
+	SM_ATOMIC(uint64_t) key;
+	SM_ATOMIC(uint64_t) count;
+};
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+struct sm_metrics_dwell {
+	SM_ATOMIC(uint64_t) buckets[SM_METRICS_DWELL_BUCKETS];
+	SM_ATOMIC(uint64_t) sum;
+};
+#endif
+
+/*
+ * Followed by the occupancy, the dwell times and the edges, in the same
+ * allocation
+ */
+struct sm_metrics_shard {
+	_Alignas(CACHE_LINE) SM_ATOMIC(uint64_t) error_entries;
+	SM_ATOMIC(uint64_t) dropped_edges;
+	SM_ATOMIC(int64_t) * occupancy;
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	struct sm_metrics_dwell *dwell;
+#endif
+	struct sm_metrics_edge *edges;
+	/* Only accessed by the writer */
+	size_t num_edges;
+};
+
+/* Counted edge, when merging the shards */
+struct merged_edge {
+	uint64_t key;
+	uint64_t count;
+};
+
+struct writer {
+	char *buffer;
+	size_t size;
+	size_t length;
+};
+
+static _Thread_local size_t thread_index;
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static int compare_ids(const void *a, const void *b);
+static int compare_edges(const void *a, const void *b);
+static size_t state_id(const struct sm_metrics *metrics,
+					   const struct sm_state *state);
+static struct sm_metrics_shard *current_shard(struct sm_metrics *metrics);
+static void add(SM_ATOMIC(uint64_t) * counter, uint64_t value);
+static void add_occupancy(struct sm_metrics_shard *shard, size_t state,
+						  int64_t value);
+static void count_edge(const struct sm_metrics *metrics,
+					   struct sm_metrics_shard *shard, uint64_t key);
+static void on_state_changed(void *context,
+							 const struct sm_state_machine *state_machine,
+							 const struct sm_state *previous_state,
+							 const struct sm_state *current_state);
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+static size_t dwell_bucket(uint64_t time);
+static void count_dwell(struct sm_metrics_shard *shard, size_t state,
+						uint64_t time);
+static void append_dwell(struct writer *writer,
+						 const struct sm_metrics *metrics, const char *prefix,
+						 const struct sm_metrics_histogram *histograms);
+#endif
+static void append(struct writer *writer, const char *format, ...);
+static void append_state(struct writer *writer,
+						 const struct sm_metrics *metrics, size_t state);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_metrics_init(struct sm_metrics *metrics,
+					 const struct sm_state *const *states, size_t num_states,
+					 size_t num_threads, size_t max_edges) {
+	assert(metrics != NULL);
+	assert(states != NULL || num_states == 0);
+	assert(num_threads > 0);
+
+	/* At most half full, so that the probes stay short */
+	size_t capacity = 2;
+	while (capacity < 2 * max_edges) {
+		capacity *= 2;
+	}
+	const size_t occupancy_size =
+		(num_states * sizeof(SM_ATOMIC(int64_t)) + CACHE_LINE - 1) /
+		CACHE_LINE * CACHE_LINE;
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	const size_t dwell_size =
+		(num_states * sizeof(struct sm_metrics_dwell) + CACHE_LINE - 1) /
+		CACHE_LINE * CACHE_LINE;
+#else
+	const size_t dwell_size = 0;
+#endif
+	/* The size is a multiple of the alignment, as required by aligned_alloc */
+	const size_t shard_size =
+		(sizeof(struct sm_metrics_shard) + occupancy_size + dwell_size +
+		 capacity * sizeof(struct sm_metrics_edge) + CACHE_LINE - 1) /
+		CACHE_LINE * CACHE_LINE;
+
+	metrics->ids = malloc(num_states * sizeof(*metrics->ids) + 1);
+	metrics->shards = calloc(num_threads, sizeof(*metrics->shards));
+	metrics->num_threads = num_threads;
+	if (!metrics->ids || !metrics->shards) {
+		sm_metrics_deinit(metrics);
+		return false;
+	}
+	for (size_t i = 0; i < num_states; ++i) {
+		metrics->ids[i].state = states[i];
+		metrics->ids[i].id = i;
+	}
+	qsort(metrics->ids, num_states, sizeof(*metrics->ids), compare_ids);
+
+	for (size_t i = 0; i < num_threads; ++i) {
+		struct sm_metrics_shard *shard = aligned_alloc(CACHE_LINE, shard_size);
+		if (!shard) {
+			sm_metrics_deinit(metrics);
+			return false;
+		}
+		metrics->shards[i] = shard;
+		atomic_init(&shard->error_entries, 0);
+		atomic_init(&shard->dropped_edges, 0);
+		shard->occupancy = (void *)(shard + 1);
+		shard->edges =
+			(void *)((char *)(shard + 1) + occupancy_size + dwell_size);
+		shard->num_edges = 0;
+		for (size_t j = 0; j < num_states; ++j) {
+			atomic_init(&shard->occupancy[j], 0);
+		}
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+		shard->dwell = (void *)((char *)(shard + 1) + occupancy_size);
+		for (size_t j = 0; j < num_states; ++j) {
+			for (size_t k = 0; k < SM_METRICS_DWELL_BUCKETS; ++k) {
+				atomic_init(&shard->dwell[j].buckets[k], 0);
+			}
+			atomic_init(&shard->dwell[j].sum, 0);
+		}
+#endif
+		for (size_t j = 0; j < capacity; ++j) {
+			atomic_init(&shard->edges[j].key, 0);
+			atomic_init(&shard->edges[j].count, 0);
+		}
+	}
+	metrics->states = states;
+	metrics->num_states = num_states;
+	metrics->edge_capacity = capacity;
+	metrics->max_edges = max_edges;
+	metrics->tracer = (struct sm_state_machine_tracer){
+		.context = metrics,
+		.state_changed = on_state_changed,
+	};
+	return true;
+}
+
+void sm_metrics_deinit(struct sm_metrics *metrics) {
+	assert(metrics != NULL);
+
+	for (size_t i = 0; metrics->shards && i < metrics->num_threads; ++i) {
+		free(metrics->shards[i]);
+	}
+	free(metrics->shards);
+	free(metrics->ids);
+	metrics->shards = NULL;
+	metrics->ids = NULL;
+	metrics->num_threads = 0;
+	metrics->num_states = 0;
+}
+
+struct sm_state_machine_tracer *sm_metrics_tracer(struct sm_metrics *metrics) {
+	assert(metrics != NULL);
+	return &metrics->tracer;
+}
+
+void sm_metrics_set_thread(size_t thread) { thread_index = thread; }
+
+void sm_metrics_instance_added(struct sm_metrics *metrics,
+							   const struct sm_state *state) {
+	assert(metrics != NULL);
+	add_occupancy(current_shard(metrics), state_id(metrics, state), 1);
+}
+
+void sm_metrics_instance_removed(struct sm_metrics *metrics,
+								 const struct sm_state *state) {
+	assert(metrics != NULL);
+	add_occupancy(current_shard(metrics), state_id(metrics, state), -1);
+}
+
+int64_t sm_metrics_occupancy(const struct sm_metrics *metrics,
+							 const struct sm_state *state) {
+	assert(metrics != NULL);
+
+	const size_t id = state_id(metrics, state);
+	int64_t occupancy = 0;
+	for (size_t i = 0; id != NO_STATE && i < metrics->num_threads; ++i) {
+		occupancy += atomic_load_explicit(&metrics->shards[i]->occupancy[id],
+										  memory_order_relaxed);
+	}
+	return occupancy;
+}
+
+uint64_t sm_metrics_transitions(const struct sm_metrics *metrics,
+								const struct sm_state *from,
+								const struct sm_state *to) {
+	assert(metrics != NULL);
+
+	const size_t from_id = state_id(metrics, from);
+	const size_t to_id = state_id(metrics, to);
+	if (from_id == NO_STATE || to_id == NO_STATE) {
+		return 0;
+	}
+	const uint64_t key = (uint64_t)from_id * metrics->num_states + to_id + 1;
+	uint64_t transitions = 0;
+	for (size_t i = 0; i < metrics->num_threads; ++i) {
+		const struct sm_metrics_edge *edges = metrics->shards[i]->edges;
+		for (size_t j = 0; j < metrics->edge_capacity; ++j) {
+			if (atomic_load_explicit(&edges[j].key, memory_order_relaxed) ==
+				key) {
+				transitions += atomic_load_explicit(&edges[j].count,
+													memory_order_relaxed);
+				break;
+			}
+		}
+	}
+	return transitions;
+}
+
+uint64_t sm_metrics_error_entries(const struct sm_metrics *metrics) {
+	assert(metrics != NULL);
+
+	uint64_t entries = 0;
+	for (size_t i = 0; i < metrics->num_threads; ++i) {
+		entries += atomic_load_explicit(&metrics->shards[i]->error_entries,
+										memory_order_relaxed);
+	}
+	return entries;
+}
+
+uint64_t sm_metrics_dropped_edges(const struct sm_metrics *metrics) {
+	assert(metrics != NULL);
+
+	uint64_t dropped = 0;
+	for (size_t i = 0; i < metrics->num_threads; ++i) {
+		dropped += atomic_load_explicit(&metrics->shards[i]->dropped_edges,
+										memory_order_relaxed);
+	}
+	return dropped;
+}
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+void sm_metrics_dwell(const struct sm_metrics *metrics,
+					  const struct sm_state *state,
+					  struct sm_metrics_histogram *histogram) {
+	assert(metrics != NULL);
+	assert(histogram != NULL);
+
+	*histogram = (struct sm_metrics_histogram){0};
+	const size_t id = state_id(metrics, state);
+	for (size_t i = 0; id != NO_STATE && i < metrics->num_threads; ++i) {
+		const struct sm_metrics_dwell *dwell = &metrics->shards[i]->dwell[id];
+		for (size_t j = 0; j < SM_METRICS_DWELL_BUCKETS; ++j) {
+			const uint64_t count = atomic_load_explicit(&dwell->buckets[j],
+														memory_order_relaxed);
+			histogram->buckets[j] += count;
+			histogram->count += count;
+		}
+		histogram->sum +=
+			atomic_load_explicit(&dwell->sum, memory_order_relaxed);
+	}
+}
+#endif
+
+int sm_metrics_write(const struct sm_metrics *metrics, const char *prefix,
+					 char *buffer, size_t size) {
+	assert(metrics != NULL);
+	assert(prefix != NULL);
+	assert(buffer != NULL || size == 0);
+
+	/* The edges of all the shards, sorted to merge the duplicates */
+	struct merged_edge *edges =
+		malloc(metrics->num_threads * metrics->edge_capacity * sizeof(*edges));
+	if (!edges) {
+		return -1;
+	}
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	struct sm_metrics_histogram *histograms =
+		malloc(metrics->num_states * sizeof(*histograms) + 1);
+	if (!histograms) {
+		free(edges);
+		return -1;
+	}
+	for (size_t i = 0; i < metrics->num_states; ++i) {
+		sm_metrics_dwell(metrics, metrics->states[i], &histograms[i]);
+	}
+#endif
+	size_t num_edges = 0;
+	for (size_t i = 0; i < metrics->num_threads; ++i) {
+		const struct sm_metrics_edge *shard_edges = metrics->shards[i]->edges;
+		for (size_t j = 0; j < metrics->edge_capacity; ++j) {
+			const uint64_t key = atomic_load_explicit(&shard_edges[j].key,
+													  memory_order_relaxed);
+			if (key) {
+				edges[num_edges].key = key;
+				edges[num_edges].count = atomic_load_explicit(
+					&shard_edges[j].count, memory_order_relaxed);
+				++num_edges;
+			}
+		}
+	}
+	qsort(edges, num_edges, sizeof(*edges), compare_edges);
+
+	struct writer writer = {buffer, size, 0};
+	if (size) {
+		buffer[0] = '\0';
+	}
+	append(&writer, "# TYPE %s_state_instances gauge\n", prefix);
+	for (size_t i = 0; i < metrics->num_states; ++i) {
+		append(&writer, "%s_state_instances{state=\"", prefix);
+		append_state(&writer, metrics, i);
+		append(&writer, "\"} %lld\n",
+			   (long long)sm_metrics_occupancy(metrics, metrics->states[i]));
+	}
+	append(&writer, "# TYPE %s_transitions_total counter\n", prefix);
+	for (size_t i = 0; i < num_edges;) {
+		uint64_t count = 0;
+		size_t j = i;
+		for (; j < num_edges && edges[j].key == edges[i].key; ++j) {
+			count += edges[j].count;
+		}
+		const uint64_t edge = edges[i].key - 1;
+		append(&writer, "%s_transitions_total{from=\"", prefix);
+		append_state(&writer, metrics, (size_t)(edge / metrics->num_states));
+		append(&writer, "\",to=\"");
+		append_state(&writer, metrics, (size_t)(edge % metrics->num_states));
+		append(&writer, "\"} %llu\n", (unsigned long long)count);
+		i = j;
+	}
+	append(&writer, "# TYPE %s_error_entries_total counter\n", prefix);
+	append(&writer, "%s_error_entries_total %llu\n", prefix,
+		   (unsigned long long)sm_metrics_error_entries(metrics));
+	append(&writer, "# TYPE %s_dropped_edges_total counter\n", prefix);
+	append(&writer, "%s_dropped_edges_total %llu\n", prefix,
+		   (unsigned long long)sm_metrics_dropped_edges(metrics));
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	append_dwell(&writer, metrics, prefix, histograms);
+	free(histograms);
+#endif
+
+	free(edges);
+	return (int)writer.length;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static int compare_ids(const void *a, const void *b) {
+	const struct sm_state *lhs = ((const struct sm_metrics_state_id *)a)->state;
+	const struct sm_state *rhs = ((const struct sm_metrics_state_id *)b)->state;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static int compare_edges(const void *a, const void *b) {
+	const uint64_t lhs = ((const struct merged_edge *)a)->key;
+	const uint64_t rhs = ((const struct merged_edge *)b)->key;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static size_t state_id(const struct sm_metrics *metrics,
+					   const struct sm_state *state) {
+	const struct sm_metrics_state_id key = {state, 0};
+	const struct sm_metrics_state_id *found =
+		state ? bsearch(&key, metrics->ids, metrics->num_states,
+						sizeof(*metrics->ids), compare_ids)
+			  : NULL;
+	return found ? found->id : NO_STATE;
+}
+
+static struct sm_metrics_shard *current_shard(struct sm_metrics *metrics) {
+	assert(thread_index < metrics->num_threads);
+	return metrics->shards[thread_index];
+}
+
+static void add(SM_ATOMIC(uint64_t) * counter, uint64_t value) {
+	atomic_store_explicit(
+		counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+		memory_order_relaxed);
+}
+
+static void add_occupancy(struct sm_metrics_shard *shard, size_t state,
+						  int64_t value) {
+	if (state == NO_STATE) {
+		return;
+	}
+	SM_ATOMIC(int64_t) *occupancy = &shard->occupancy[state];
+	atomic_store_explicit(
+		occupancy,
+		atomic_load_explicit(occupancy, memory_order_relaxed) + value,
+		memory_order_relaxed);
+}
+
+static void count_edge(const struct sm_metrics *metrics,
+					   struct sm_metrics_shard *shard, uint64_t key) {
+	const size_t mask = metrics->edge_capacity - 1;
+	/* Fibonacci hashing */
+	size_t slot = (size_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask;
+	for (;;) {
+		struct sm_metrics_edge *edge = &shard->edges[slot];
+		const uint64_t found =
+			atomic_load_explicit(&edge->key, memory_order_relaxed);
+		if (found == key) {
+			add(&edge->count, 1);
+			return;
+		}
+		if (!found) {
+			if (shard->num_edges == metrics->max_edges) {
+				add(&shard->dropped_edges, 1);
+				return;
+			}
+			++shard->num_edges;
+			atomic_store_explicit(&edge->count, 1, memory_order_relaxed);
+			atomic_store_explicit(&edge->key, key, memory_order_release);
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void on_state_changed(void *context,
+							 const struct sm_state_machine *state_machine,
+							 const struct sm_state *previous_state,
+							 const struct sm_state *current_state) {
+	struct sm_metrics *metrics = context;
+	struct sm_metrics_shard *shard = current_shard(metrics);
+
+	if (current_state == state_machine->error_state) {
+		add(&shard->error_entries, 1);
+	}
+	const size_t from = state_id(metrics, previous_state);
+	const size_t to = state_id(metrics, current_state);
+	if (from != to) {
+		add_occupancy(shard, from, -1);
+		add_occupancy(shard, to, 1);
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+		count_dwell(shard, from,
+					sm_state_machine_time_in_previous_state(state_machine));
+#endif
+	}
+	if (from != NO_STATE && to != NO_STATE) {
+		count_edge(metrics, shard,
+				   (uint64_t)from * metrics->num_states + to + 1);
+	}
+}
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+static size_t dwell_bucket(uint64_t time) {
+#if defined(__GNUC__)
+	return time ? 64u - (size_t)__builtin_clzll(time) : 0;
+#else
+	size_t bucket = 0;
+	for (; time; time >>= 1) {
+		++bucket;
+	}
+	return bucket;
+#endif
+}
+
+static void count_dwell(struct sm_metrics_shard *shard, size_t state,
+						uint64_t time) {
+	if (state == NO_STATE) {
+		return;
+	}
+	struct sm_metrics_dwell *dwell = &shard->dwell[state];
+	add(&dwell->buckets[dwell_bucket(time)], 1);
+	add(&dwell->sum, time);
+}
+
+static void append_dwell(struct writer *writer,
+						 const struct sm_metrics *metrics, const char *prefix,
+						 const struct sm_metrics_histogram *histograms) {
+	/* The same buckets for all the states, up to the largest one used */
+	size_t num_buckets = 1;
+	for (size_t i = 0; i < metrics->num_states; ++i) {
+		for (size_t j = num_buckets; j < SM_METRICS_DWELL_BUCKETS; ++j) {
+			if (histograms[i].buckets[j]) {
+				num_buckets = j + 1;
+			}
+		}
+	}
+	append(writer, "# TYPE %s_state_dwell histogram\n", prefix);
+	for (size_t i = 0; i < metrics->num_states; ++i) {
+		uint64_t cumulative = 0;
+		for (size_t j = 0; j < num_buckets; ++j) {
+			/* Bucket j holds the times up to 2^j - 1 */
+			const uint64_t le = j ? UINT64_MAX >> (64u - j) : 0;
+			cumulative += histograms[i].buckets[j];
+			append(writer, "%s_state_dwell_bucket{state=\"", prefix);
+			append_state(writer, metrics, i);
+			append(writer, "\",le=\"%llu\"} %llu\n", (unsigned long long)le,
+				   (unsigned long long)cumulative);
+		}
+		append(writer, "%s_state_dwell_bucket{state=\"", prefix);
+		append_state(writer, metrics, i);
+		append(writer, "\",le=\"+Inf\"} %llu\n",
+			   (unsigned long long)histograms[i].count);
+		append(writer, "%s_state_dwell_sum{state=\"", prefix);
+		append_state(writer, metrics, i);
+		append(writer, "\"} %llu\n", (unsigned long long)histograms[i].sum);
+		append(writer, "%s_state_dwell_count{state=\"", prefix);
+		append_state(writer, metrics, i);
+		append(writer, "\"} %llu\n", (unsigned long long)histograms[i].count);
+	}
+}
+#endif
+
+static void append(struct writer *writer, const char *format, ...) {
+	const size_t offset =
+		writer->length < writer->size ? writer->length : writer->size;
+	va_list args;
+	va_start(args, format);
+	char *buffer = writer->buffer ? writer->buffer + offset : NULL;
+	const int length = vsnprintf(buffer, writer->size - offset, format, args);
+	va_end(args);
+	writer->length += length > 0 ? (size_t)length : 0;
+}
+
+static void append_state(struct writer *writer,
+						 const struct sm_metrics *metrics, size_t state) {
+#if SM_STATE_MACHINE_ENABLE_LOG
+	const char *name = metrics->states[state]->name;
+	if (name) {
+		/* Escaped as a label value */
+		for (const char *c = name; *c; ++c) {
+			if (*c == '\\' || *c == '"') {
+				append(writer, "\\%c", *c);
+			} else if (*c == '\n') {
+				append(writer, "\\n");
+			} else {
+				append(writer, "%c", *c);
+			}
+		}
+		return;
+	}
+#else
+	(void)metrics;
+#endif
+	append(writer, "state_%zu", state);
+}
+
+#endif
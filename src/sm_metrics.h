@@ -0,0 +1,227 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_metrics.h
+ *
+ * \brief		aggregated metrics of many state machines - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_metrics Metrics
+ *
+ * \brief Occupancy, transitions and errors of a fleet of state machines
+ *
+ * An #sm_metrics counts, for all the instances of a definition:
+ *
+ * - how many instances are in each state (occupancy);
+ * - how many times each edge (state left, state entered) has been followed;
+ * - how many times the error state has been entered;
+ * - with #SM_STATE_MACHINE_ENABLE_TIMESTAMPS, how long the instances stayed in
+ *   each state (dwell time), as a histogram with power of 2 buckets.
+ *
+ * It is fed by the #sm_state_machine_tracer returned by sm_metrics_tracer(),
+ * and requires #SM_STATE_MACHINE_ENABLE_TRACE. Each dispatching thread writes
+ * its own counters (a shard), selected with sm_metrics_set_thread(), so the
+ * dispatch never contends with the other threads nor with the readers. The
+ * shards are merged only when read, e.g. by sm_metrics_write() for a scraper:
+ * rates are computed by the reader from two readings of the counters.
+ */
+
+/**
+ * \addtogroup sm_metrics
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_METRICS_H_
+#define SM_METRICS_H_
+
+#include "sm_state_machine.h"
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+/**
+ * \brief Number of buckets of a dwell time histogram: bucket 0 counts the
+ * times equal to 0, bucket `i > 0` the times in `[2^(i-1), 2^i)`
+ */
+#define SM_METRICS_DWELL_BUCKETS 65u
+
+/**
+ * \brief Dwell times in a state, in units of
+ * #SM_STATE_MACHINE_TIMESTAMP_CLOCK
+ */
+struct sm_metrics_histogram {
+	/** \brief Number of times in each bucket */
+	uint64_t buckets[SM_METRICS_DWELL_BUCKETS];
+	/** \brief Number of times */
+	uint64_t count;
+	/** \brief Sum of the times. Wraps around. */
+	uint64_t sum;
+};
+#endif
+
+/** \cond */
+struct sm_metrics_shard;
+struct sm_metrics_state_id;
+/** \endcond */
+
+/**
+ * \brief Metrics of the instances of a definition
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_metrics {
+	const struct sm_state *const *states;
+	size_t num_states;
+	/* Sorted by address, to map the states to their index */
+	struct sm_metrics_state_id *ids;
+	struct sm_metrics_shard **shards;
+	size_t num_threads;
+	size_t edge_capacity;
+	size_t max_edges;
+	struct sm_state_machine_tracer tracer;
+};
+
+/**
+ * \brief Initialise the metrics of a definition
+ *
+ * \param [out] metrics -
+ * \param [in] states the states to be counted. Transitions from or to other
+ * states are ignored. The array must outlive \p metrics.
+ * \param [in] num_states number of elements of \p states
+ * \param [in] num_threads number of threads that dispatch events to the
+ * instances, each one identified by an index in `[0, num_threads)`
+ * \param [in] max_edges number of distinct edges each thread can count. The
+ * edges followed once a thread's table is full are only counted by
+ * sm_metrics_dropped_edges().
+ *
+ * \retval true on success
+ * \retval false if the allocation failed
+ */
+bool sm_metrics_init(struct sm_metrics *metrics,
+					 const struct sm_state *const *states, size_t num_states,
+					 size_t num_threads, size_t max_edges);
+
+/**
+ * \brief Release the memory of the metrics
+ */
+void sm_metrics_deinit(struct sm_metrics *metrics);
+
+/**
+ * \brief Tracer to be assigned to sm_state_machine_hooks::tracer of the
+ * instances
+ */
+struct sm_state_machine_tracer *sm_metrics_tracer(struct sm_metrics *metrics);
+
+/**
+ * \brief Select the counters the calling thread writes
+ *
+ * Applies to all the #sm_metrics. Threads that don't call it use index 0.
+ *
+ * \param [in] thread index of the calling thread, in `[0, num_threads)`
+ */
+void sm_metrics_set_thread(size_t thread);
+
+/**
+ * \brief Count an instance initialised in \p state
+ *
+ * Instances are not counted by sm_state_machine_init(): call this function
+ * when an instance is created, from a dispatching thread.
+ */
+void sm_metrics_instance_added(struct sm_metrics *metrics,
+							   const struct sm_state *state);
+
+/**
+ * \brief Stop counting an instance, currently in \p state
+ */
+void sm_metrics_instance_removed(struct sm_metrics *metrics,
+								 const struct sm_state *state);
+
+/**
+ * \brief Number of instances in a state
+ */
+int64_t sm_metrics_occupancy(const struct sm_metrics *metrics,
+							 const struct sm_state *state);
+
+/**
+ * \brief Number of times the instances went from \p from to \p to
+ */
+uint64_t sm_metrics_transitions(const struct sm_metrics *metrics,
+								const struct sm_state *from,
+								const struct sm_state *to);
+
+/**
+ * \brief Number of times the instances entered their error state
+ */
+uint64_t sm_metrics_error_entries(const struct sm_metrics *metrics);
+
+/**
+ * \brief Number of transitions not counted by sm_metrics_transitions()
+ * because an edge table was full
+ */
+uint64_t sm_metrics_dropped_edges(const struct sm_metrics *metrics);
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+/**
+ * \brief Times the instances stayed in a state before leaving it
+ *
+ * \param [in] metrics -
+ * \param [in] state -
+ * \param [out] histogram -
+ */
+void sm_metrics_dwell(const struct sm_metrics *metrics,
+					  const struct sm_state *state,
+					  struct sm_metrics_histogram *histogram);
+#endif
+
+/**
+ * \brief Write the metrics in the Prometheus text exposition format
+ *
+ * The metrics are `<prefix>_state_instances{state="..."}` (gauge),
+ * `<prefix>_transitions_total{from="...",to="..."}`,
+ * `<prefix>_error_entries_total` and `<prefix>_dropped_edges_total`
+ * (counters) and, with #SM_STATE_MACHINE_ENABLE_TIMESTAMPS,
+ * `<prefix>_state_dwell{state="..."}` (histogram, with the buckets up to the
+ * largest time counted in any state). States are named after sm_state::name
+ * (#SM_STATE_MACHINE_ENABLE_LOG), `state_<index>` otherwise.
+ *
+ * \param [in] metrics -
+ * \param [in] prefix prefix of the metric names
+ * \param [out] buffer -
+ * \param [in] size size of \p buffer. The output is truncated, and always
+ * NUL-terminated, if it doesn't fit.
+ *
+ * \returns the length of the complete output, as snprintf(), or a negative
+ * value if the allocation of the merged counters failed
+ */
+int sm_metrics_write(const struct sm_metrics *metrics, const char *prefix,
+					 char *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#endif /* ifndef SM_METRICS_H_ */
+
+/**
+ * @}
+ */
@@ -0,0 +1,204 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_pool.c
+ *
+ * \brief		pool of recycled state machines - implementation
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_pool.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE SM_STATE_MACHINE_CACHE_LINE_SIZE
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static struct sm_state_machine *pop(struct sm_pool *pool);
+static void copy_prototype(const struct sm_pool *pool,
+						   struct sm_state_machine *instance,
+						   uint64_t timestamp);
+static uint64_t now(void);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_pool_init(struct sm_pool *pool,
+				  const struct sm_state_machine *prototype, size_t capacity) {
+	assert(pool != NULL);
+	assert(prototype != NULL);
+
+	pool->instances = NULL;
+	pool->free = NULL;
+	pool->capacity = 0;
+	pool->num_free = 0;
+	if (capacity == 0 ||
+		capacity > (SIZE_MAX - CACHE_LINE) / sizeof(struct sm_state_machine)) {
+		return false;
+	}
+	/* The size is a multiple of the alignment, as required by aligned_alloc */
+	const size_t size =
+		(capacity * sizeof(struct sm_state_machine) + CACHE_LINE - 1u) &
+		~(size_t)(CACHE_LINE - 1u);
+	pool->instances = aligned_alloc(CACHE_LINE, size);
+	pool->free = malloc(capacity * sizeof(size_t));
+	if (!pool->instances || !pool->free) {
+		sm_pool_deinit(pool);
+		return false;
+	}
+	pool->prototype = *prototype;
+	pool->capacity = capacity;
+	/* Acquired in order of address */
+	for (size_t i = 0; i < capacity; ++i) {
+		pool->free[i] = capacity - 1u - i;
+	}
+	pool->num_free = capacity;
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	/* The sequence lock of an instance starts even, as after
+	 * sm_state_machine_init() */
+	for (size_t i = 0; i < capacity; ++i) {
+		atomic_init(&pool->instances[i].published.sequence, 0);
+	}
+#endif
+	return true;
+}
+
+void sm_pool_deinit(struct sm_pool *pool) {
+	assert(pool != NULL);
+
+	free(pool->instances);
+	free(pool->free);
+	pool->instances = NULL;
+	pool->free = NULL;
+	pool->capacity = 0;
+	pool->num_free = 0;
+}
+
+struct sm_state_machine *sm_pool_acquire(struct sm_pool *pool, void *user_data,
+										 void *state_data) {
+	assert(pool != NULL);
+
+	struct sm_state_machine *instance = pop(pool);
+	if (instance) {
+		copy_prototype(pool, instance, now());
+		instance->user_data = user_data;
+		instance->state_data = state_data;
+	}
+	return instance;
+}
+
+size_t sm_pool_acquire_bulk(struct sm_pool *pool,
+							struct sm_state_machine **instances, size_t count) {
+	assert(pool != NULL);
+	assert(instances != NULL || count == 0);
+
+	if (count > pool->num_free) {
+		count = pool->num_free;
+	}
+	/* The same entry time for all */
+	const uint64_t timestamp = count ? now() : 0;
+	for (size_t i = 0; i < count; ++i) {
+		instances[i] = pop(pool);
+		copy_prototype(pool, instances[i], timestamp);
+	}
+	return count;
+}
+
+void sm_pool_reset(struct sm_pool *pool, struct sm_state_machine *instance) {
+	assert(pool != NULL);
+	assert(sm_pool_index(pool, instance) < pool->capacity);
+
+	void *user_data = instance->user_data;
+	void *state_data = instance->state_data;
+	copy_prototype(pool, instance, now());
+	instance->user_data = user_data;
+	instance->state_data = state_data;
+}
+
+void sm_pool_release(struct sm_pool *pool, struct sm_state_machine *instance) {
+	assert(pool != NULL);
+	assert(pool->num_free < pool->capacity);
+
+	pool->free[pool->num_free++] = sm_pool_index(pool, instance);
+}
+
+int sm_pool_handle_event(struct sm_pool *pool,
+						 struct sm_state_machine *instance,
+						 const struct sm_event *event) {
+	assert(pool != NULL);
+
+	const int ret = sm_state_machine_handle_event(instance, event);
+	if (ret == sm_state_machine_final_state_reached) {
+		sm_pool_release(pool, instance);
+	}
+	return ret;
+}
+
+size_t sm_pool_in_use(const struct sm_pool *pool) {
+	assert(pool != NULL);
+	return pool->capacity - pool->num_free;
+}
+
+size_t sm_pool_index(const struct sm_pool *pool,
+					 const struct sm_state_machine *instance) {
+	assert(pool != NULL);
+	assert(instance >= pool->instances &&
+		   instance < pool->instances + pool->capacity);
+
+	return (size_t)(instance - pool->instances);
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static struct sm_state_machine *pop(struct sm_pool *pool) {
+	if (pool->num_free == 0) {
+		return NULL;
+	}
+	return &pool->instances[pool->free[--pool->num_free]];
+}
+
+static void copy_prototype(const struct sm_pool *pool,
+						   struct sm_state_machine *instance,
+						   uint64_t timestamp) {
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	/* The published states may be read concurrently: not copied, but
+	 * published again through the sequence lock of the instance */
+	_Static_assert(offsetof(struct sm_state_machine, published) +
+						   sizeof(instance->published) ==
+					   sizeof(struct sm_state_machine),
+				   "published must be the last member of sm_state_machine");
+	memcpy(instance, &pool->prototype,
+		   offsetof(struct sm_state_machine, published));
+	sm_state_machine_set_states(instance, pool->prototype.current_state,
+								pool->prototype.previous_state);
+#else
+	*instance = pool->prototype;
+#endif
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	instance->entered_at = timestamp;
+#else
+	(void)timestamp;
+#endif
+}
+
+static uint64_t now(void) {
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	return sm_state_machine_timestamp();
+#else
+	return 0;
+#endif
+}
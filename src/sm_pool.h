@@ -0,0 +1,164 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_pool.h
+ *
+ * \brief		pool of recycled state machines - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_pool Pool
+ *
+ * \brief Instances created and destroyed at a high rate
+ *
+ * A pool lays out a fixed number of instances of the same definition in a
+ * contiguous, cache line aligned array, allocated once. The instances are
+ * initialised by copying a prototype, initialised once with
+ * sm_state_machine_init(): hooks, name, initial and error state are not
+ * passed again for each instance, and resetting an instance to its initial
+ * state is a single copy.
+ *
+ * The free instances are kept in a stack, so that acquiring and releasing an
+ * instance take constant time and the instance acquired is the one released
+ * last, likely still in the cache. sm_pool_handle_event() releases the
+ * instances that reach a final state.
+ *
+ * A pool isn't thread safe: give each thread its own.
+ */
+
+/**
+ * \addtogroup sm_pool
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_POOL_H_
+#define SM_POOL_H_
+
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Pool
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_pool {
+	struct sm_state_machine prototype;
+	struct sm_state_machine *instances;
+	size_t capacity;
+	/* Indexes of the free instances, the next to be acquired last */
+	size_t *free;
+	size_t num_free;
+};
+
+/**
+ * \brief Allocate a pool
+ *
+ * \param [out] pool -
+ * \param [in] prototype initialised with sm_state_machine_init() and not used
+ * since. Copied into the pool.
+ * \param [in] capacity number of instances
+ *
+ * \retval true on success
+ * \retval false if \p capacity is 0 or the allocation failed
+ */
+bool sm_pool_init(struct sm_pool *pool,
+				  const struct sm_state_machine *prototype, size_t capacity);
+
+/**
+ * \brief Release the memory of a pool, and all its instances
+ */
+void sm_pool_deinit(struct sm_pool *pool);
+
+/**
+ * \brief Acquire a free instance, in the initial state
+ *
+ * \param [in] pool -
+ * \param [in] user_data user data of the instance, see
+ * sm_state_machine_init()
+ * \param [in] state_data state data of the instance, see
+ * sm_state_machine_init()
+ *
+ * \returns the instance, NULL if all the instances are in use
+ */
+struct sm_state_machine *sm_pool_acquire(struct sm_pool *pool, void *user_data,
+										 void *state_data);
+
+/**
+ * \brief Acquire several free instances, in the initial state
+ *
+ * The instances get the user data and state data of the prototype. Acquired
+ * from a new pool, they are contiguous.
+ *
+ * \param [in] pool -
+ * \param [out] instances the instances acquired
+ * \param [in] count number of instances to acquire
+ *
+ * \returns the number of instances acquired: less than \p count if not enough
+ * instances are free
+ */
+size_t sm_pool_acquire_bulk(struct sm_pool *pool,
+							struct sm_state_machine **instances, size_t count);
+
+/**
+ * \brief Return an instance to its initial state
+ *
+ * Its user data and state data are kept. Any transition in progress is
+ * abandoned, without calling the actions.
+ */
+void sm_pool_reset(struct sm_pool *pool, struct sm_state_machine *instance);
+
+/**
+ * \brief Return an instance to the pool
+ *
+ * The instance must not be used any more.
+ */
+void sm_pool_release(struct sm_pool *pool, struct sm_state_machine *instance);
+
+/**
+ * \brief Dispatch an event to an instance, and release it if it reaches a
+ * final state
+ *
+ * \return #stateM_handleEventRetVals. After
+ * #sm_state_machine_final_state_reached the instance is free and must not be
+ * used any more.
+ */
+int sm_pool_handle_event(struct sm_pool *pool,
+						 struct sm_state_machine *instance,
+						 const struct sm_event *event);
+
+/**
+ * \brief Number of instances in use
+ */
+size_t sm_pool_in_use(const struct sm_pool *pool);
+
+/**
+ * \brief Index of an instance in the pool, between 0 and the capacity
+ */
+size_t sm_pool_index(const struct sm_pool *pool,
+					 const struct sm_state_machine *instance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_POOL_H_ */
+
+/**
+ * @}
+ */
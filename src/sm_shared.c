@@ -0,0 +1,380 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_shared.c
+ *
+ * \brief		state machine instances in shared memory - implementation
+ *
+ * The creator initialises the segment and publishes it by storing the magic
+ * number last, so that a process opening it concurrently either sees it
+ * complete or refuses it.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* shm_open(), ftruncate(), kill() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_shared.h"
+
+#include "sm_atomic.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* "sm_share" */
+#define MAGIC UINT64_C(0x736d5f7368617265)
+#define FNV_OFFSET_BASIS UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME UINT64_C(0x100000001b3)
+
+struct sm_shared_state_id {
+	const struct sm_state *state;
+	uint32_t id;
+};
+
+struct sm_shared_instance {
+	/* pid of the owner, 0 if not owned */
+	SM_ATOMIC(int32_t) owner;
+	uint32_t current_state;
+	uint32_t previous_state;
+};
+
+struct sm_shared_segment {
+	SM_ATOMIC(uint64_t) magic;
+	uint64_t definition_hash;
+	uint64_t num_instances;
+	struct sm_shared_instance instances[];
+};
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static int compare_ids(const void *a, const void *b);
+static uint64_t hash_value(uint64_t hash, uint64_t value);
+static uint64_t
+hash_transitions(const struct sm_shared_definition *definition, uint64_t hash,
+				 const struct sm_state_transitions *transitions);
+static bool owner_is_dead(int32_t owner);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_shared_definition_init(struct sm_shared_definition *definition,
+							   const struct sm_state *const *states,
+							   size_t num_states) {
+	assert(definition != NULL);
+	assert(states != NULL || num_states == 0);
+
+	if (num_states >= SM_SHARED_NO_STATE) {
+		return false;
+	}
+	/* Never 0 bytes, so that NULL always means failure */
+	definition->ids = malloc(num_states * sizeof(*definition->ids) + 1);
+	if (!definition->ids) {
+		return false;
+	}
+	for (size_t i = 0; i < num_states; ++i) {
+		definition->ids[i].state = states[i];
+		definition->ids[i].id = (uint32_t)i;
+	}
+	qsort(definition->ids, num_states, sizeof(*definition->ids), compare_ids);
+	definition->states = states;
+	definition->num_states = num_states;
+	/* Needs the identifiers of the states it refers to */
+	definition->hash = sm_shared_definition_hash(definition);
+	return true;
+}
+
+void sm_shared_definition_deinit(struct sm_shared_definition *definition) {
+	assert(definition != NULL);
+
+	free(definition->ids);
+	definition->ids = NULL;
+	definition->num_states = 0;
+}
+
+uint64_t
+sm_shared_definition_hash(const struct sm_shared_definition *definition) {
+	assert(definition != NULL);
+
+	uint64_t hash = hash_value(FNV_OFFSET_BASIS, definition->num_states);
+	for (size_t i = 0; i < definition->num_states; ++i) {
+		const struct sm_state *state = definition->states[i];
+#if SM_STATE_MACHINE_ENABLE_LOG
+		for (const char *c = state->name; c && *c; ++c) {
+			hash = hash_value(hash, (unsigned char)*c);
+		}
+#endif
+		hash = hash_value(hash,
+						  sm_shared_state_id(definition, state->parent_state));
+		hash = hash_value(hash,
+						  sm_shared_state_id(definition, state->entry_state));
+		hash = hash_value(hash, (uint64_t)(state->entry_action != NULL) |
+									(uint64_t)(state->exit_action != NULL)
+										<< 1);
+		hash = hash_transitions(definition, hash, state->transitions);
+		hash = hash_transitions(definition, hash,
+								state->completion_transitions);
+	}
+	return hash;
+}
+
+uint32_t sm_shared_state_id(const struct sm_shared_definition *definition,
+							const struct sm_state *state) {
+	assert(definition != NULL);
+
+	const struct sm_shared_state_id key = {state, 0};
+	const struct sm_shared_state_id *found =
+		state ? bsearch(&key, definition->ids, definition->num_states,
+						sizeof(key), compare_ids)
+			  : NULL;
+	return found ? found->id : SM_SHARED_NO_STATE;
+}
+
+const struct sm_state *
+sm_shared_state(const struct sm_shared_definition *definition, uint32_t id) {
+	assert(definition != NULL);
+	return id < definition->num_states ? definition->states[id] : NULL;
+}
+
+bool sm_shared_create(struct sm_shared *shared, const char *name,
+					  const struct sm_shared_definition *definition,
+					  size_t num_instances,
+					  const struct sm_state *initial_state) {
+	assert(shared != NULL);
+	assert(name != NULL);
+	assert(definition != NULL);
+
+	const uint32_t initial_id = sm_shared_state_id(definition, initial_state);
+	if (initial_id == SM_SHARED_NO_STATE) {
+		errno = EINVAL;
+		return false;
+	}
+	const size_t size = sizeof(struct sm_shared_segment) +
+						num_instances * sizeof(struct sm_shared_instance);
+	const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	void *memory = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0) {
+		memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	const int error = errno;
+	close(fd);
+	if (memory == MAP_FAILED) {
+		shm_unlink(name);
+		errno = error;
+		return false;
+	}
+
+	struct sm_shared_segment *segment = memory;
+	segment->definition_hash = definition->hash;
+	segment->num_instances = num_instances;
+	for (size_t i = 0; i < num_instances; ++i) {
+		atomic_init(&segment->instances[i].owner, 0);
+		segment->instances[i].current_state = initial_id;
+		segment->instances[i].previous_state = SM_SHARED_NO_STATE;
+	}
+	atomic_store_explicit(&segment->magic, MAGIC, memory_order_release);
+
+	shared->segment = segment;
+	shared->size = size;
+	shared->definition = definition;
+	return true;
+}
+
+bool sm_shared_open(struct sm_shared *shared, const char *name,
+					const struct sm_shared_definition *definition) {
+	assert(shared != NULL);
+	assert(name != NULL);
+	assert(definition != NULL);
+
+	const int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat status;
+	void *memory = MAP_FAILED;
+	if (fstat(fd, &status) == 0 &&
+		(size_t)status.st_size >= sizeof(struct sm_shared_segment)) {
+		memory = mmap(NULL, (size_t)status.st_size, PROT_READ | PROT_WRITE,
+					  MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (memory == MAP_FAILED) {
+		return false;
+	}
+
+	struct sm_shared_segment *segment = memory;
+	const size_t size = (size_t)status.st_size;
+	if (atomic_load_explicit(&segment->magic, memory_order_acquire) != MAGIC ||
+		segment->definition_hash != definition->hash ||
+		segment->num_instances >
+			(size - sizeof(*segment)) / sizeof(struct sm_shared_instance)) {
+		munmap(memory, size);
+		return false;
+	}
+	shared->segment = segment;
+	shared->size = size;
+	shared->definition = definition;
+	return true;
+}
+
+void sm_shared_close(struct sm_shared *shared) {
+	assert(shared != NULL);
+
+	if (shared->segment) {
+		munmap(shared->segment, shared->size);
+	}
+	shared->segment = NULL;
+	shared->size = 0;
+}
+
+bool sm_shared_unlink(const char *name) {
+	assert(name != NULL);
+	return shm_unlink(name) == 0;
+}
+
+size_t sm_shared_num_instances(const struct sm_shared *shared) {
+	assert(shared != NULL);
+	return (size_t)shared->segment->num_instances;
+}
+
+void sm_shared_lock(struct sm_shared *shared, size_t instance) {
+	assert(shared != NULL);
+	assert(instance < shared->segment->num_instances);
+
+	SM_ATOMIC(int32_t) *owner = &shared->segment->instances[instance].owner;
+	const int32_t self = (int32_t)getpid();
+	int32_t expected = 0;
+	while (!atomic_compare_exchange_weak_explicit(owner, &expected, self,
+												  memory_order_acquire,
+												  memory_order_relaxed)) {
+		assert(expected != self);
+		if (expected != 0 && !owner_is_dead(expected)) {
+			sched_yield();
+			expected = 0;
+		}
+		/* Otherwise retry, taking over from the dead owner */
+	}
+}
+
+void sm_shared_unlock(struct sm_shared *shared, size_t instance) {
+	assert(shared != NULL);
+	assert(instance < shared->segment->num_instances);
+
+	atomic_store_explicit(&shared->segment->instances[instance].owner, 0,
+						  memory_order_release);
+}
+
+void sm_shared_load(const struct sm_shared *shared, size_t instance,
+					struct sm_state_machine *state_machine) {
+	assert(shared != NULL);
+	assert(instance < shared->segment->num_instances);
+	assert(state_machine != NULL);
+
+	const struct sm_shared_instance *stored =
+		&shared->segment->instances[instance];
+	sm_state_machine_set_states(
+		state_machine,
+		sm_shared_state(shared->definition, stored->current_state),
+		sm_shared_state(shared->definition, stored->previous_state));
+}
+
+void sm_shared_store(struct sm_shared *shared, size_t instance,
+					 const struct sm_state_machine *state_machine) {
+	assert(shared != NULL);
+	assert(instance < shared->segment->num_instances);
+	assert(state_machine != NULL);
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	assert(!sm_state_machine_in_transit(state_machine));
+#endif
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* The submachine states aren't stored */
+	assert(state_machine->submachine_depth == 0);
+#endif
+
+	struct sm_shared_instance *stored = &shared->segment->instances[instance];
+	stored->current_state =
+		sm_shared_state_id(shared->definition, state_machine->current_state);
+	stored->previous_state =
+		sm_shared_state_id(shared->definition, state_machine->previous_state);
+}
+
+int sm_shared_handle_event(struct sm_shared *shared, size_t instance,
+						   struct sm_state_machine *state_machine,
+						   const struct sm_event *event) {
+	assert(shared != NULL);
+	assert(state_machine != NULL);
+
+	sm_shared_lock(shared, instance);
+	sm_shared_load(shared, instance, state_machine);
+	int status = sm_state_machine_handle_event(state_machine, event);
+	sm_shared_store(shared, instance, state_machine);
+	sm_shared_unlock(shared, instance);
+	return status;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static int compare_ids(const void *a, const void *b) {
+	const struct sm_shared_state_id *id_a = a;
+	const struct sm_shared_state_id *id_b = b;
+	return (id_a->state > id_b->state) - (id_a->state < id_b->state);
+}
+
+/* FNV-1a, one byte at a time, so that it doesn't depend on endianness */
+static uint64_t hash_value(uint64_t hash, uint64_t value) {
+	for (int i = 0; i < 8; ++i) {
+		hash = (hash ^ ((value >> (i * 8)) & 0xffu)) * FNV_PRIME;
+	}
+	return hash;
+}
+
+/* The functions are left out, as their addresses differ between processes */
+static uint64_t
+hash_transitions(const struct sm_shared_definition *definition, uint64_t hash,
+				 const struct sm_state_transitions *transitions) {
+	if (!transitions) {
+		return hash_value(hash, 0);
+	}
+	if (transitions->handle_event) {
+		/* Transitions defined as a function can't be inspected */
+		return hash_value(hash, UINT64_MAX);
+	}
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	hash = hash_value(hash, transitions->num_transitions + 1);
+	for (size_t i = 0; i < transitions->num_transitions; ++i) {
+		const struct sm_transition *transition = &transitions->transitions[i];
+		hash = hash_value(hash, (uint64_t)(int64_t)transition->event_type);
+		hash = hash_value(hash, (uint64_t)(transition->guard != NULL) |
+									(uint64_t)(transition->action != NULL)
+										<< 1);
+		hash = hash_value(
+			hash, sm_shared_state_id(definition, transition->next_state));
+	}
+#else
+	(void)definition;
+#endif
+	return hash;
+}
+
+static bool owner_is_dead(int32_t owner) {
+	return kill((pid_t)owner, 0) != 0 && errno == ESRCH;
+}
@@ -0,0 +1,247 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_shared.h
+ *
+ * \brief		state machine instances in shared memory - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_shared Shared memory
+ *
+ * \brief State machine instances driven by several processes
+ *
+ * The state of the instances (current and previous state) lives in a POSIX
+ * shared memory segment, so that any process that maps it can dispatch events
+ * to any instance, e.g. the workers of a pre-fork server.
+ *
+ * The states are stored as identifiers, not as pointers, since the definition
+ * may be at a different address in each process: each process describes its
+ * own copy of the definition with a #sm_shared_definition, listing the states
+ * in the same order. A hash of the definition (hierarchy, transitions and, if
+ * #SM_STATE_MACHINE_ENABLE_LOG is enabled, names) is stored in the segment, and
+ * sm_shared_open() refuses a definition that doesn't match.
+ *
+ * An instance is owned by one process at a time through a lock word holding
+ * the owner's pid: sm_shared_handle_event() takes it, loads the state into a
+ * local #sm_state_machine, dispatches the event and stores the state back. The
+ * lock of a process that died while holding it is taken over, with the state
+ * of its last completed dispatch. The hooks, the user data and the state data
+ * are those of the local state machine, i.e. they are per process.
+ *
+ * Asynchronous actions (#SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS) are not
+ * supported: a transition can't be left in transit in the segment.
+ */
+
+/**
+ * \addtogroup sm_shared
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_SHARED_H_
+#define SM_SHARED_H_
+
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Identifier of no state, e.g. the previous state of a new instance
+ */
+#define SM_SHARED_NO_STATE UINT32_MAX
+
+/** \cond */
+struct sm_shared_state_id;
+struct sm_shared_segment;
+/** \endcond */
+
+/**
+ * \brief A process' copy of a state machine definition
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_shared_definition {
+	const struct sm_state *const *states;
+	size_t num_states;
+	/* Sorted by address, to map the states to their identifier */
+	struct sm_shared_state_id *ids;
+	uint64_t hash;
+};
+
+/**
+ * \brief A mapping of a shared memory segment of instances
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_shared {
+	struct sm_shared_segment *segment;
+	size_t size;
+	const struct sm_shared_definition *definition;
+};
+
+/**
+ * \brief Describe the local copy of a definition
+ *
+ * \param [out] definition -
+ * \param [in] states all the states of the definition, error state included.
+ * The identifier of a state is its index: all the processes must list them in
+ * the same order. The array must outlive \p definition.
+ * \param [in] num_states number of elements of \p states
+ *
+ * \retval true on success
+ * \retval false if the allocation failed, or there are too many states
+ */
+bool sm_shared_definition_init(struct sm_shared_definition *definition,
+							   const struct sm_state *const *states,
+							   size_t num_states);
+
+/**
+ * \brief Release the memory of a definition
+ */
+void sm_shared_definition_deinit(struct sm_shared_definition *definition);
+
+/**
+ * \brief Hash of a definition, as stored in the segments
+ */
+uint64_t
+sm_shared_definition_hash(const struct sm_shared_definition *definition);
+
+/**
+ * \brief Identifier of a state
+ *
+ * \returns the identifier, or #SM_SHARED_NO_STATE if \p state is NULL or not
+ * part of the definition
+ */
+uint32_t sm_shared_state_id(const struct sm_shared_definition *definition,
+							const struct sm_state *state);
+
+/**
+ * \brief State of an identifier
+ *
+ * \returns the state, or NULL if there is no state with identifier \p id
+ */
+const struct sm_state *
+sm_shared_state(const struct sm_shared_definition *definition, uint32_t id);
+
+/**
+ * \brief Create a segment of instances and map it
+ *
+ * All the instances start in \p initial_state. Fails if a segment with the
+ * same name already exists.
+ *
+ * \param [out] shared -
+ * \param [in] name name of the segment, as for shm_open(): e.g. "/my_machines"
+ * \param [in] definition local copy of the definition. Must outlive \p shared.
+ * \param [in] num_instances -
+ * \param [in] initial_state initial state of the instances
+ *
+ * \retval true on success
+ * \retval false on failure (errno is set)
+ */
+bool sm_shared_create(struct sm_shared *shared, const char *name,
+					  const struct sm_shared_definition *definition,
+					  size_t num_instances,
+					  const struct sm_state *initial_state);
+
+/**
+ * \brief Map an existing segment of instances
+ *
+ * \param [out] shared -
+ * \param [in] name name of the segment
+ * \param [in] definition local copy of the definition. Must outlive \p shared.
+ *
+ * \retval true on success
+ * \retval false if the segment doesn't exist, is not completely initialised
+ * yet, or was created for a different definition
+ */
+bool sm_shared_open(struct sm_shared *shared, const char *name,
+					const struct sm_shared_definition *definition);
+
+/**
+ * \brief Unmap a segment. The segment and its instances are kept.
+ */
+void sm_shared_close(struct sm_shared *shared);
+
+/**
+ * \brief Remove a segment
+ *
+ * The processes that mapped it keep using it until they close it.
+ */
+bool sm_shared_unlink(const char *name);
+
+/**
+ * \brief Number of instances of a segment
+ */
+size_t sm_shared_num_instances(const struct sm_shared *shared);
+
+/**
+ * \brief Take the ownership of an instance, waiting for its current owner
+ *
+ * Not reentrant: a process must not lock an instance it already owns.
+ */
+void sm_shared_lock(struct sm_shared *shared, size_t instance);
+
+/**
+ * \brief Release the ownership of an instance
+ */
+void sm_shared_unlock(struct sm_shared *shared, size_t instance);
+
+/**
+ * \brief Copy the state of an owned instance into a local state machine
+ *
+ * \param [in] shared -
+ * \param [in] instance -
+ * \param [out] state_machine initialised with sm_state_machine_init(): its
+ * current and previous states are replaced
+ */
+void sm_shared_load(const struct sm_shared *shared, size_t instance,
+					struct sm_state_machine *state_machine);
+
+/**
+ * \brief Copy the state of a local state machine into an owned instance
+ */
+void sm_shared_store(struct sm_shared *shared, size_t instance,
+					 const struct sm_state_machine *state_machine);
+
+/**
+ * \brief Pass an event to an instance
+ *
+ * Locks the instance, loads it into \p state_machine, dispatches \p event with
+ * sm_state_machine_handle_event(), stores it back and unlocks it.
+ *
+ * \param [in] shared -
+ * \param [in] instance -
+ * \param [in] state_machine local state machine, see sm_shared_load()
+ * \param [in] event -
+ *
+ * \return #stateM_handleEventRetVals
+ */
+int sm_shared_handle_event(struct sm_shared *shared, size_t instance,
+						   struct sm_state_machine *state_machine,
+						   const struct sm_event *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_SHARED_H_ */
+
+/**
+ * @}
+ */
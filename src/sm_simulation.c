@@ -0,0 +1,350 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_simulation.c
+ *
+ * \brief		discrete-event simulation of state machines - implementation
+ *
+ * Calendar queue (R. Brown, 1988). The event at time t is in bucket
+ * `(t / width) % num_buckets`; each bucket is a list sorted by time, the
+ * events of the same time in scheduling order. The next event is searched
+ * from the current bucket on, a day at a time: it is the head of the first
+ * bucket whose head falls in the day being scanned. If a whole year is
+ * scanned without finding it, the heads of all the buckets are compared.
+ *
+ * The number of buckets is doubled when there are more than 2 events per
+ * bucket and halved when there are less than 1 every 2, and the width is set
+ * to 3 times the average spacing of the next events, as sampled at that time.
+ * The common case of events scheduled in time order (e.g. all at the same
+ * time) is appended to the tail of its bucket in constant time.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+#include "sm_simulation.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define MIN_BUCKETS 16u
+#define CHUNK_SIZE 1024u
+/* Number of events sampled to compute the width of the buckets */
+#define SAMPLE_SIZE 32u
+
+struct sm_simulation_entry {
+	struct sm_simulation_entry *next;
+	uint64_t time;
+	size_t instance;
+	struct sm_event event;
+};
+
+struct sm_simulation_bucket {
+	struct sm_simulation_entry *head;
+	struct sm_simulation_entry *tail;
+};
+
+struct sm_simulation_chunk {
+	struct sm_simulation_chunk *next;
+	struct sm_simulation_entry entries[CHUNK_SIZE];
+};
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static struct sm_simulation_entry *
+allocate_entry(struct sm_simulation *simulation);
+static void insert(struct sm_simulation *simulation,
+				   struct sm_simulation_entry *entry);
+static void reposition(struct sm_simulation *simulation, uint64_t time);
+static struct sm_simulation_bucket *
+find_next(struct sm_simulation *simulation);
+static void dispatch(struct sm_simulation *simulation,
+					 struct sm_simulation_bucket *bucket);
+static uint64_t estimate_width(const struct sm_simulation *simulation);
+static void resize(struct sm_simulation *simulation, size_t num_buckets);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_simulation_init(struct sm_simulation *simulation,
+						struct sm_state_machine *instances,
+						size_t num_instances) {
+	assert(simulation != NULL);
+	assert(instances != NULL || num_instances == 0);
+
+	*simulation = (struct sm_simulation){
+		.instances = instances,
+		.num_instances = num_instances,
+		.buckets = calloc(MIN_BUCKETS, sizeof(struct sm_simulation_bucket)),
+		.num_buckets = MIN_BUCKETS,
+		.width = 1,
+		.bucket_top = 1,
+	};
+	return simulation->buckets != NULL;
+}
+
+void sm_simulation_deinit(struct sm_simulation *simulation) {
+	assert(simulation != NULL);
+
+	while (simulation->chunks) {
+		struct sm_simulation_chunk *next = simulation->chunks->next;
+		free(simulation->chunks);
+		simulation->chunks = next;
+	}
+	free(simulation->buckets);
+	simulation->buckets = NULL;
+	simulation->free_entries = NULL;
+	simulation->size = 0;
+}
+
+bool sm_simulation_schedule(struct sm_simulation *simulation, uint64_t time,
+							size_t instance, const struct sm_event *event) {
+	assert(simulation != NULL);
+	assert(time >= simulation->now);
+	assert(instance < simulation->num_instances);
+	assert(event != NULL);
+
+	struct sm_simulation_entry *entry = allocate_entry(simulation);
+	if (!entry) {
+		return false;
+	}
+	entry->next = NULL;
+	entry->time = time;
+	entry->instance = instance;
+	entry->event = *event;
+	/* Before the day being scanned, e.g. after sm_simulation_run() */
+	if (time < simulation->bucket_top - simulation->width) {
+		reposition(simulation, time);
+	}
+	insert(simulation, entry);
+	if (++simulation->size > 2 * simulation->num_buckets) {
+		resize(simulation, 2 * simulation->num_buckets);
+	}
+	return true;
+}
+
+uint64_t sm_simulation_now(const struct sm_simulation *simulation) {
+	assert(simulation != NULL);
+	return simulation->now;
+}
+
+size_t sm_simulation_current_instance(const struct sm_simulation *simulation) {
+	assert(simulation != NULL);
+	return simulation->current_instance;
+}
+
+size_t sm_simulation_pending(const struct sm_simulation *simulation) {
+	assert(simulation != NULL);
+	return simulation->size;
+}
+
+uint64_t sm_simulation_dispatched(const struct sm_simulation *simulation) {
+	assert(simulation != NULL);
+	return simulation->dispatched;
+}
+
+bool sm_simulation_step(struct sm_simulation *simulation) {
+	assert(simulation != NULL);
+
+	struct sm_simulation_bucket *bucket = find_next(simulation);
+	if (!bucket) {
+		return false;
+	}
+	dispatch(simulation, bucket);
+	return true;
+}
+
+uint64_t sm_simulation_run(struct sm_simulation *simulation, uint64_t until) {
+	assert(simulation != NULL);
+	assert(until >= simulation->now);
+
+	const uint64_t dispatched = simulation->dispatched;
+	for (struct sm_simulation_bucket *bucket;
+		 (bucket = find_next(simulation)) && bucket->head->time <= until;) {
+		dispatch(simulation, bucket);
+	}
+	simulation->now = until;
+	return simulation->dispatched - dispatched;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+static struct sm_simulation_entry *
+allocate_entry(struct sm_simulation *simulation) {
+	if (!simulation->free_entries) {
+		struct sm_simulation_chunk *chunk = malloc(sizeof(*chunk));
+		if (!chunk) {
+			return NULL;
+		}
+		chunk->next = simulation->chunks;
+		simulation->chunks = chunk;
+		for (size_t i = 0; i < CHUNK_SIZE; ++i) {
+			chunk->entries[i].next =
+				i + 1 < CHUNK_SIZE ? &chunk->entries[i + 1] : NULL;
+		}
+		simulation->free_entries = chunk->entries;
+	}
+	struct sm_simulation_entry *entry = simulation->free_entries;
+	simulation->free_entries = entry->next;
+	return entry;
+}
+
+static void insert(struct sm_simulation *simulation,
+				   struct sm_simulation_entry *entry) {
+	struct sm_simulation_bucket *bucket =
+		&simulation->buckets[(entry->time / simulation->width) &
+							 (simulation->num_buckets - 1)];
+	if (!bucket->head) {
+		bucket->head = entry;
+		bucket->tail = entry;
+	} else if (entry->time >= bucket->tail->time) {
+		bucket->tail->next = entry;
+		bucket->tail = entry;
+	} else if (entry->time < bucket->head->time) {
+		entry->next = bucket->head;
+		bucket->head = entry;
+	} else {
+		/* After the events of the same time, and before the tail */
+		struct sm_simulation_entry *previous = bucket->head;
+		while (previous->next->time <= entry->time) {
+			previous = previous->next;
+		}
+		entry->next = previous->next;
+		previous->next = entry;
+	}
+}
+
+/* Scan from the day of \p time, that no event precedes */
+static void reposition(struct sm_simulation *simulation, uint64_t time) {
+	const uint64_t day = time / simulation->width;
+	simulation->bucket = (size_t)day & (simulation->num_buckets - 1);
+	simulation->bucket_top = (day + 1) * simulation->width;
+}
+
+static struct sm_simulation_bucket *
+find_next(struct sm_simulation *simulation) {
+	if (!simulation->size) {
+		return NULL;
+	}
+	const size_t mask = simulation->num_buckets - 1;
+	for (size_t i = 0; i < simulation->num_buckets; ++i) {
+		struct sm_simulation_bucket *bucket =
+			&simulation->buckets[simulation->bucket];
+		if (bucket->head && bucket->head->time < simulation->bucket_top) {
+			return bucket;
+		}
+		simulation->bucket = (simulation->bucket + 1) & mask;
+		simulation->bucket_top += simulation->width;
+	}
+
+	/* Nothing within a year: the earliest head is the next event */
+	struct sm_simulation_bucket *next = NULL;
+	for (size_t i = 0; i < simulation->num_buckets; ++i) {
+		struct sm_simulation_bucket *bucket = &simulation->buckets[i];
+		if (bucket->head &&
+			(!next || bucket->head->time < next->head->time)) {
+			next = bucket;
+		}
+	}
+	reposition(simulation, next->head->time);
+	return next;
+}
+
+static void dispatch(struct sm_simulation *simulation,
+					 struct sm_simulation_bucket *bucket) {
+	struct sm_simulation_entry *entry = bucket->head;
+	bucket->head = entry->next;
+	if (!bucket->head) {
+		bucket->tail = NULL;
+	}
+	--simulation->size;
+	simulation->now = entry->time;
+	simulation->current_instance = entry->instance;
+	const struct sm_event event = entry->event;
+	entry->next = simulation->free_entries;
+	simulation->free_entries = entry;
+	if (simulation->num_buckets > MIN_BUCKETS &&
+		simulation->size < simulation->num_buckets / 2) {
+		resize(simulation, simulation->num_buckets / 2);
+	}
+
+	++simulation->dispatched;
+	sm_state_machine_handle_event(
+		&simulation->instances[simulation->current_instance], &event);
+}
+
+/*
+ * 3 times the average spacing of the next events, ignoring the spacings
+ * larger than twice the average as Brown suggests
+ */
+static uint64_t estimate_width(const struct sm_simulation *simulation) {
+	/* The earliest times, sorted */
+	uint64_t sample[SAMPLE_SIZE];
+	size_t num_samples = 0;
+	for (size_t i = 0; i < simulation->num_buckets; ++i) {
+		for (const struct sm_simulation_entry *entry =
+				 simulation->buckets[i].head;
+			 entry; entry = entry->next) {
+			if (num_samples == SAMPLE_SIZE &&
+				entry->time >= sample[SAMPLE_SIZE - 1]) {
+				/* The list is sorted: the next ones are later */
+				break;
+			}
+			size_t j = num_samples < SAMPLE_SIZE ? num_samples++
+												 : SAMPLE_SIZE - 1;
+			for (; j > 0 && sample[j - 1] > entry->time; --j) {
+				sample[j] = sample[j - 1];
+			}
+			sample[j] = entry->time;
+		}
+	}
+	if (num_samples < 2) {
+		return simulation->width;
+	}
+
+	const uint64_t average =
+		(sample[num_samples - 1] - sample[0]) / (num_samples - 1);
+	uint64_t total = 0;
+	uint64_t count = 0;
+	for (size_t i = 1; i < num_samples; ++i) {
+		const uint64_t spacing = sample[i] - sample[i - 1];
+		if (spacing <= 2 * average) {
+			total += spacing;
+			++count;
+		}
+	}
+	const uint64_t width = count ? 3 * total / count : 3 * average;
+	return width ? width : 1;
+}
+
+static void resize(struct sm_simulation *simulation, size_t num_buckets) {
+	struct sm_simulation_bucket *buckets =
+		calloc(num_buckets, sizeof(*buckets));
+	if (!buckets) {
+		/* Slower, but still correct */
+		return;
+	}
+	struct sm_simulation_bucket *previous = simulation->buckets;
+	const size_t previous_num_buckets = simulation->num_buckets;
+	simulation->width = estimate_width(simulation);
+	simulation->buckets = buckets;
+	simulation->num_buckets = num_buckets;
+	/* The events of the same time are in the same bucket, in order */
+	for (size_t i = 0; i < previous_num_buckets; ++i) {
+		for (struct sm_simulation_entry *entry = previous[i].head; entry;) {
+			struct sm_simulation_entry *next = entry->next;
+			entry->next = NULL;
+			insert(simulation, entry);
+			entry = next;
+		}
+	}
+	free(previous);
+	reposition(simulation, simulation->now);
+}
@@ -0,0 +1,170 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_simulation.h
+ *
+ * \brief		discrete-event simulation of state machines - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_simulation Simulation
+ *
+ * \brief Discrete-event simulation of many state machines
+ *
+ * A simulation dispatches timestamped events to a set of instances in time
+ * order, on a virtual clock: the clock jumps to the time of each event as it
+ * is dispatched. The actions of the instances schedule the future events, of
+ * their own instance (see sm_simulation_current_instance()) or of any other.
+ * Events scheduled for the same time are dispatched in the order they were
+ * scheduled.
+ *
+ * The pending events are kept in a calendar queue: an array of buckets
+ * ("days") covering a "year" of virtual time, each holding the events of its
+ * days in time order. Scheduling and dispatching an event take constant time
+ * on average, the bucket width being adapted to the spacing of the events as
+ * the queue grows and shrinks.
+ */
+
+/**
+ * \addtogroup sm_simulation
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_SIMULATION_H_
+#define SM_SIMULATION_H_
+
+#include "sm_state_machine.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \cond */
+struct sm_simulation_entry;
+struct sm_simulation_bucket;
+struct sm_simulation_chunk;
+/** \endcond */
+
+/**
+ * \brief Simulation
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_simulation {
+	struct sm_state_machine *instances;
+	size_t num_instances;
+	/* Virtual time of the last event dispatched */
+	uint64_t now;
+	size_t current_instance;
+	uint64_t dispatched;
+	/* Calendar: the number of buckets is a power of 2 */
+	struct sm_simulation_bucket *buckets;
+	size_t num_buckets;
+	uint64_t width;
+	size_t size;
+	/* Bucket being scanned, and end of its current day */
+	size_t bucket;
+	uint64_t bucket_top;
+	/* The entries are allocated in chunks and recycled */
+	struct sm_simulation_entry *free_entries;
+	struct sm_simulation_chunk *chunks;
+};
+
+/**
+ * \brief Initialise a simulation at time 0
+ *
+ * \param [out] simulation -
+ * \param [in] instances the instances, initialised with
+ * sm_state_machine_init(). Must outlive \p simulation.
+ * \param [in] num_instances -
+ *
+ * \retval true on success
+ * \retval false if the allocation failed
+ */
+bool sm_simulation_init(struct sm_simulation *simulation,
+						struct sm_state_machine *instances,
+						size_t num_instances);
+
+/**
+ * \brief Release the memory of a simulation, discarding the pending events
+ */
+void sm_simulation_deinit(struct sm_simulation *simulation);
+
+/**
+ * \brief Schedule an event
+ *
+ * May be called by the actions of the instances.
+ *
+ * \param [in] simulation -
+ * \param [in] time virtual time of the event, not before sm_simulation_now()
+ * \param [in] instance index of the instance the event is dispatched to
+ * \param [in] event copied. The data it points to must be valid until it is
+ * dispatched.
+ *
+ * \retval true on success
+ * \retval false if the allocation failed
+ */
+bool sm_simulation_schedule(struct sm_simulation *simulation, uint64_t time,
+							size_t instance, const struct sm_event *event);
+
+/**
+ * \brief Virtual time: the time of the event being (or last) dispatched
+ */
+uint64_t sm_simulation_now(const struct sm_simulation *simulation);
+
+/**
+ * \brief Index of the instance the event being (or last) dispatched was
+ * dispatched to
+ */
+size_t sm_simulation_current_instance(const struct sm_simulation *simulation);
+
+/**
+ * \brief Number of events scheduled and not dispatched yet
+ */
+size_t sm_simulation_pending(const struct sm_simulation *simulation);
+
+/**
+ * \brief Number of events dispatched so far
+ */
+uint64_t sm_simulation_dispatched(const struct sm_simulation *simulation);
+
+/**
+ * \brief Dispatch the next event
+ *
+ * \retval true if an event was dispatched
+ * \retval false if there are no pending events
+ */
+bool sm_simulation_step(struct sm_simulation *simulation);
+
+/**
+ * \brief Dispatch the events up to a time, included
+ *
+ * The events scheduled meanwhile by the actions are dispatched as well, if
+ * not later than \p until. The clock is then advanced to \p until.
+ *
+ * \returns the number of events dispatched
+ */
+uint64_t sm_simulation_run(struct sm_simulation *simulation, uint64_t until);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_SIMULATION_H_ */
+
+/**
+ * @}
+ */
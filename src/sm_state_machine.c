@@ -39,27 +39,118 @@
 
 #include <assert.h>
 
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+#if SM_STATE_MACHINE_TIMESTAMP_CLOCK == SM_STATE_MACHINE_CLOCK_MONOTONIC
+#include <time.h>
+#elif SM_STATE_MACHINE_TIMESTAMP_CLOCK == SM_STATE_MACHINE_CLOCK_TSC
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif !defined(__aarch64__)
+#error "SM_STATE_MACHINE_CLOCK_TSC is not supported on this target"
+#endif
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define SM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define SM_ALWAYS_INLINE inline
+#endif
+
+/*
+ * Functions between sm_state_machine_handle_event() and the guards and actions
+ * of a transition. Only the single header build, whose functions are static,
+ * defines it as SM_ALWAYS_INLINE: the whole dispatch of an event is then
+ * inlined in its caller.
+ */
+#ifndef SM_DISPATCH_INLINE
+#define SM_DISPATCH_INLINE
+#endif
+
 /*******************************************************************************
  * Private function declarations
  ******************************************************************************/
 static void go_to_error_state(struct sm_state_machine *sm_handle,
 							  const struct sm_event *const event);
-static struct sm_transition *
-get_transition(const struct sm_state_machine *sm_handle,
-			   const struct sm_state *state,
-			   const struct sm_event *const event);
 static void *get_state_data(const struct sm_state_machine *sm_handle,
 							const struct sm_state *state);
-static enum sm_state_machine_handle_event_status
+static SM_DISPATCH_INLINE enum sm_state_machine_handle_event_status
 handle_event(struct sm_state_machine *state_machine,
 			 const struct sm_event *event, sm_guard_fn guard,
 			 sm_action_fn transition_action, const struct sm_state *next_state);
+static SM_DISPATCH_INLINE bool
+leave_state(struct sm_state_machine *sm_handle, const struct sm_event *event,
+			sm_guard_fn guard, const struct sm_state *next_state);
+static SM_DISPATCH_INLINE enum sm_state_machine_handle_event_status
+enter_state(struct sm_state_machine *sm_handle, const struct sm_event *event,
+			const struct sm_state *next_state);
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+static enum sm_state_machine_handle_event_status
+handle_async_event(struct sm_state_machine *sm_handle,
+				   const struct sm_event *event, sm_guard_fn guard,
+				   sm_async_action_fn transition_action,
+				   const struct sm_state *next_state);
+static enum sm_state_machine_handle_event_status
+handle_event_in_transit(struct sm_state_machine *sm_handle,
+						const struct sm_event *event);
+static enum sm_state_machine_handle_event_status
+dispatch_queued_events(struct sm_state_machine *sm_handle,
+					   enum sm_state_machine_handle_event_status status);
+static bool is_surfaced(enum sm_state_machine_handle_event_status status);
+#endif
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+dispatch_event(struct sm_state_machine *sm_handle,
+			   const struct sm_event *event, bool trusted);
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+dispatch_one(struct sm_state_machine *sm_handle, const struct sm_event *event,
+			 bool trusted);
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+dispatch_to_states(struct sm_state_machine *sm_handle,
+				   const struct sm_event *event, bool trusted);
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+handle_state_transitions(struct sm_state_machine *sm_handle,
+						 const struct sm_state *state,
+						 const struct sm_state_transitions *transitions,
+						 const struct sm_event *event, bool trusted);
+static SM_ALWAYS_INLINE bool
+has_transitions(const struct sm_state_transitions *transitions);
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+take_transition(struct sm_state_machine *sm_handle,
+				const struct sm_state *state,
+				const struct sm_transition *transition,
+				const struct sm_event *event);
+static enum sm_state_machine_handle_event_status
+handle_completion_transitions(struct sm_state_machine *sm_handle,
+							  const struct sm_event *event, bool trusted);
+static bool completion_taken(struct sm_state_machine *sm_handle,
+							 const struct sm_event *completion_event,
+							 bool trusted);
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+static SM_ALWAYS_INLINE const struct sm_state *
+parent_of(struct sm_state_machine *sm_handle, const struct sm_state *state);
+#endif
+#if SM_STATE_MACHINE_ENABLE_TRACE
+static void trace_transition_taken(const struct sm_state_machine *sm_handle,
+								   const struct sm_event *event,
+								   const struct sm_state *state,
+								   const struct sm_transition *transition);
+static void trace_state_changed(const struct sm_state_machine *sm_handle);
+#endif
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+static void stamp(struct sm_state_machine *sm_handle);
+#endif
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+static void publish(struct sm_state_machine *sm_handle);
+#endif
 
-void sm_state_machine_init(struct sm_state_machine *sm_handle, const char *name,
-						   const struct sm_state *initial_state,
-						   const struct sm_state *error_state,
-						   struct sm_state_machine_hooks *hooks,
-						   void *user_data, void *state_data) {
+SM_STATE_MACHINE_API void
+sm_state_machine_init(struct sm_state_machine *sm_handle, const char *name,
+					  const struct sm_state *initial_state,
+					  const struct sm_state *error_state,
+					  struct sm_state_machine_hooks *hooks,
+					  void *user_data, void *state_data) {
 	assert(initial_state != NULL);
 	assert(error_state != NULL);
 	assert(sm_handle != NULL);
@@ -75,90 +166,45 @@ void sm_state_machine_init(struct sm_state_machine *sm_handle, const char *name,
 	sm_handle->hooks = *hooks;
 	sm_handle->user_data = user_data;
 	sm_handle->state_data = state_data;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	sm_handle->transit.next_state = NULL;
+	sm_handle->transit.id = 0;
+	sm_handle->transit.starting = false;
+	sm_handle->transit.completed = false;
+	sm_handle->transit.policy = sm_state_machine_transit_reject;
+	sm_handle->transit.queue_head = 0;
+	sm_handle->transit.queue_count = 0;
+#endif
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	sm_handle->submachine_depth = 0;
+#endif
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	sm_handle->entered_at = sm_state_machine_timestamp();
+	sm_handle->previous_state_time = 0;
+#endif
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	atomic_init(&sm_handle->published.sequence, 0);
+	atomic_init(&sm_handle->published.current_state, initial_state);
+	atomic_init(&sm_handle->published.previous_state, NULL);
+#endif
 }
 
 /*******************************************************************************
  * Public function definitions
  ******************************************************************************/
-int sm_state_machine_handle_event(struct sm_state_machine *sm_handle,
-								  const struct sm_event *event) {
-#if SM_STATE_MACHINE_OPTIMIZE_RAM
-	if (sm_handle->current_state && sm_handle->current_state->transitions) {
-		assert(sm_handle->current_state->transitions->handle_event != NULL);
-		return sm_handle->current_state->transitions->handle_event(sm_handle,
-																   event);
-	}
-	return sm_state_machine_no_state_change;
-#else
-
-	if (!sm_handle || !event) {
-		return sm_state_machine_error_arg;
-	}
-
-	if (!sm_handle->current_state) {
-		go_to_error_state(sm_handle, event);
-		return sm_state_machine_error_state_reached;
-	}
-
-	if (!sm_handle->current_state->transitions ||
-		!sm_handle->current_state->transitions->num_transitions)
-		return sm_state_machine_no_state_change;
-
-	enum sm_state_machine_handle_event_status status =
-		sm_state_machine_no_state_change;
-	const struct sm_state *next_state = sm_handle->current_state;
-	do {
-		struct sm_transition *transition;
-		for (size_t i = 0; i < next_state->transitions->num_transitions; ++i) {
-			transition = &next_state->transitions->transitions[i];
-
-			// A transition for the given event has been found:
-			if (transition->event_type == event->type) {
-				/*
-				 * A transition must have a next state defined. If the user has
-				 * not defined the next state, go to error state:
-				 */
-				assert(transition->next_state);
-				if (!transition->next_state) {
-					go_to_error_state(sm_handle, event);
-					return sm_state_machine_error_state_reached;
-				}
-
-#if SM_STATE_MACHINE_ENABLE_LOG
-				if (sm_handle->hooks.logger &&
-					sm_handle->hooks.logger->log_attempt_transition) {
-					sm_handle->hooks.logger->log_attempt_transition(
-						sm_handle, sm_state_machine_get_name(sm_handle), event,
-						sm_handle->hooks.stringify_event
-							? sm_handle->hooks.stringify_event(event)
-							: NULL,
-						transition->guard, sm_handle->current_state,
-						transition->action, transition->next_state);
-				}
-#endif
-				status = handle_event(
-					sm_handle, event,
-					transition->guard != NULL ? transition->guard->fn : NULL,
-					transition->action != NULL ? transition->action->fn : NULL,
-					transition->next_state);
-				if (status != sm_state_machine_rejected_by_guard) {
-					break;
-				}
-			}
-		}
-
-		if (status == sm_state_machine_no_state_change) {
-			next_state = next_state->parent_state;
-		} else {
-			break;
-		}
-	} while (next_state);
+SM_STATE_MACHINE_API SM_DISPATCH_INLINE int
+sm_state_machine_handle_event(struct sm_state_machine *sm_handle,
+							  const struct sm_event *event) {
+	return dispatch_event(sm_handle, event, false);
+}
 
-	return sm_state_machine_no_state_change;
-#endif
+SM_STATE_MACHINE_API SM_DISPATCH_INLINE int
+sm_state_machine_handle_event_trusted(struct sm_state_machine *sm_handle,
+									  const struct sm_event *event) {
+	return dispatch_event(sm_handle, event, true);
 }
 
-const struct sm_state *
+SM_STATE_MACHINE_API const struct sm_state *
 sm_state_machine_current_state(const struct sm_state_machine *sm_handle) {
 	if (!sm_handle)
 		return NULL;
@@ -166,7 +212,7 @@ sm_state_machine_current_state(const struct sm_state_machine *sm_handle) {
 	return sm_handle->current_state;
 }
 
-const struct sm_state *
+SM_STATE_MACHINE_API const struct sm_state *
 sm_state_machine_previous_state(const struct sm_state_machine *sm_handle) {
 	if (!sm_handle)
 		return NULL;
@@ -174,15 +220,156 @@ sm_state_machine_previous_state(const struct sm_state_machine *sm_handle) {
 	return sm_handle->previous_state;
 }
 
-bool sm_state_machine_stopped(struct sm_state_machine *sm_handle) {
-#if SM_STATE_MACHINE_OPTIMIZE_RAM
-	return !sm_handle->current_state->transitions;
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+SM_STATE_MACHINE_API void
+sm_state_machine_get_snapshot(const struct sm_state_machine *sm_handle,
+							  struct sm_state_machine_snapshot *snapshot) {
+	assert(sm_handle != NULL);
+	assert(snapshot != NULL);
+
+	const struct sm_state_machine_published *published = &sm_handle->published;
+	unsigned long begin;
+	unsigned long end;
+	do {
+		begin =
+			atomic_load_explicit(&published->sequence, memory_order_acquire);
+		snapshot->current_state = atomic_load_explicit(
+			&published->current_state, memory_order_relaxed);
+		snapshot->previous_state = atomic_load_explicit(
+			&published->previous_state, memory_order_relaxed);
+		/* The loads above can't be reordered after the one below */
+		atomic_thread_fence(memory_order_acquire);
+		end = atomic_load_explicit(&published->sequence, memory_order_relaxed);
+	} while ((begin & 1u) || begin != end);
+	snapshot->transitions = begin / 2;
+}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+SM_STATE_MACHINE_API uint64_t sm_state_machine_timestamp(void) {
+#if SM_STATE_MACHINE_TIMESTAMP_CLOCK == SM_STATE_MACHINE_CLOCK_MONOTONIC
+	struct timespec now;
+#ifdef CLOCK_MONOTONIC_COARSE
+	/* Read from the vDSO without a system call, at the tick resolution */
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#elif SM_STATE_MACHINE_TIMESTAMP_CLOCK == SM_STATE_MACHINE_CLOCK_TSC
+#if defined(__aarch64__) && !defined(_MSC_VER)
+	uint64_t ticks;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	return __rdtsc();
+#endif
 #else
-	return !sm_handle->current_state->transitions ||
-		   !sm_handle->current_state->transitions->num_transitions;
+	return sm_state_machine_user_clock();
 #endif
 }
 
+SM_STATE_MACHINE_API uint64_t
+sm_state_machine_entered_at(const struct sm_state_machine *sm_handle) {
+	assert(sm_handle != NULL);
+	return sm_handle->entered_at;
+}
+
+SM_STATE_MACHINE_API uint64_t
+sm_state_machine_time_in_state(const struct sm_state_machine *sm_handle) {
+	assert(sm_handle != NULL);
+	return sm_state_machine_timestamp() - sm_handle->entered_at;
+}
+
+SM_STATE_MACHINE_API uint64_t sm_state_machine_time_in_previous_state(
+	const struct sm_state_machine *sm_handle) {
+	assert(sm_handle != NULL);
+	return sm_handle->previous_state_time;
+}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+SM_STATE_MACHINE_API const struct sm_state *const *
+sm_state_machine_submachine_states(const struct sm_state_machine *sm_handle,
+								   size_t *depth) {
+	assert(sm_handle != NULL);
+	assert(depth != NULL);
+	*depth = sm_handle->submachine_depth;
+	return sm_handle->submachine_states;
+}
+#endif
+
+SM_STATE_MACHINE_API bool
+sm_state_machine_stopped(struct sm_state_machine *sm_handle) {
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* The events are still passed to the submachine states */
+	if (sm_handle->submachine_depth) {
+		return false;
+	}
+#endif
+	/* The completion transitions are only evaluated when the state is
+	 * entered: once none was taken, they can't leave the state any more */
+	return !has_transitions(sm_handle->current_state->transitions);
+}
+
+SM_STATE_MACHINE_API void
+sm_state_machine_set_states(struct sm_state_machine *sm_handle,
+							const struct sm_state *current_state,
+							const struct sm_state *previous_state) {
+	assert(sm_handle != NULL);
+	assert(current_state != NULL);
+	sm_handle->current_state = current_state;
+	sm_handle->previous_state = previous_state;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* The stack of a local state machine may be left by another instance */
+	sm_handle->submachine_depth = 0;
+#endif
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	publish(sm_handle);
+#endif
+}
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+SM_STATE_MACHINE_API int sm_state_machine_complete_async_action(
+	struct sm_async_completion completion) {
+	struct sm_state_machine *sm_handle = completion.state_machine;
+	if (!sm_handle || !sm_handle->transit.next_state ||
+		completion.id != sm_handle->transit.id) {
+		return sm_state_machine_error_arg;
+	}
+
+	if (sm_handle->transit.starting) {
+		/* Completed from within the action: handle_async_event() enters the
+		 * next state as soon as the action returns */
+		sm_handle->transit.completed = true;
+		return sm_state_machine_transition_pending;
+	}
+
+	const struct sm_state *next_state = sm_handle->transit.next_state;
+	sm_handle->transit.next_state = NULL;
+	enum sm_state_machine_handle_event_status status =
+		enter_state(sm_handle, &sm_handle->transit.event, next_state);
+	if (status == sm_state_machine_state_changed &&
+		sm_handle->current_state->completion_transitions) {
+		status = handle_completion_transitions(
+			sm_handle, &sm_handle->transit.event, false);
+	}
+	return dispatch_queued_events(sm_handle, status);
+}
+
+SM_STATE_MACHINE_API bool
+sm_state_machine_in_transit(const struct sm_state_machine *sm_handle) {
+	return sm_handle && sm_handle->transit.next_state;
+}
+
+SM_STATE_MACHINE_API void sm_state_machine_set_transit_policy(
+	struct sm_state_machine *sm_handle,
+	enum sm_state_machine_transit_policy policy) {
+	assert(sm_handle != NULL);
+	sm_handle->transit.policy = policy;
+}
+#endif
+
 /*******************************************************************************
  * Private function definitions
  ******************************************************************************/
@@ -190,6 +377,18 @@ static void go_to_error_state(struct sm_state_machine *sm_handle,
 							  const struct sm_event *const event) {
 	sm_handle->previous_state = sm_handle->current_state;
 	sm_handle->current_state = sm_handle->error_state;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	sm_handle->submachine_depth = 0;
+#endif
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	stamp(sm_handle);
+#endif
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	publish(sm_handle);
+#endif
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	trace_state_changed(sm_handle);
+#endif
 
 	if (sm_handle->current_state && sm_handle->current_state->entry_action) {
 		sm_handle->current_state->entry_action->fn(
@@ -200,28 +399,362 @@ static void go_to_error_state(struct sm_state_machine *sm_handle,
 	}
 }
 
-#if !SM_STATE_MACHINE_OPTIMIZE_RAM
-static struct sm_transition *
-get_transition(const struct sm_state_machine *sm_handle,
-			   const struct sm_state *state,
-			   const struct sm_event *const event) {
-	if (state->transitions == NULL) {
-		return NULL;
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+/* A self loop doesn't enter the state again: the clock isn't even read */
+static void stamp(struct sm_state_machine *sm_handle) {
+	if (sm_handle->current_state != sm_handle->previous_state) {
+		const uint64_t now = sm_state_machine_timestamp();
+		sm_handle->previous_state_time = now - sm_handle->entered_at;
+		sm_handle->entered_at = now;
+	}
+}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+/* Only the dispatching thread writes, so plain increments are enough */
+static void publish(struct sm_state_machine *sm_handle) {
+	struct sm_state_machine_published *published = &sm_handle->published;
+	const unsigned long sequence =
+		atomic_load_explicit(&published->sequence, memory_order_relaxed);
+
+	atomic_store_explicit(&published->sequence, sequence + 1,
+						  memory_order_relaxed);
+	/* The stores below can't be reordered before the one above */
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&published->current_state, sm_handle->current_state,
+						  memory_order_relaxed);
+	atomic_store_explicit(&published->previous_state,
+						  sm_handle->previous_state, memory_order_relaxed);
+	atomic_store_explicit(&published->sequence, sequence + 2,
+						  memory_order_release);
+}
+#endif
+
+/*
+ * \p trusted is always a constant: once this function is inlined in the public
+ * entry points, the validation of the arguments and of the transition tables
+ * is compiled out of sm_state_machine_handle_event_trusted().
+ */
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+dispatch_event(struct sm_state_machine *sm_handle,
+			   const struct sm_event *event, bool trusted) {
+	if (!trusted && (!sm_handle || !event)) {
+		return sm_state_machine_error_arg;
+	}
+
+	enum sm_state_machine_handle_event_status status =
+		dispatch_one(sm_handle, event, trusted);
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	/* Events may have been queued by an action that completed synchronously */
+	if (sm_handle->transit.queue_count && !sm_handle->transit.next_state) {
+		status = dispatch_queued_events(sm_handle, status);
+	}
+#endif
+	return status;
+}
+
+/* One event, between the event_begin and event_end tracer callbacks */
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+dispatch_one(struct sm_state_machine *sm_handle, const struct sm_event *event,
+			 bool trusted) {
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	const struct sm_state_machine_tracer *tracer = sm_handle->hooks.tracer;
+	if (tracer && tracer->event_begin) {
+		tracer->event_begin(tracer->context, sm_handle, event);
+	}
+#endif
+	enum sm_state_machine_handle_event_status status =
+		dispatch_to_states(sm_handle, event, trusted);
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	if (tracer && tracer->event_end) {
+		tracer->event_end(tracer->context, sm_handle, event, status);
+	}
+#endif
+	return status;
+}
+
+static SM_ALWAYS_INLINE enum sm_state_machine_handle_event_status
+dispatch_to_states(struct sm_state_machine *sm_handle,
+				   const struct sm_event *event, bool trusted) {
+	enum sm_state_machine_handle_event_status status =
+		sm_state_machine_no_state_change;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	if (sm_handle->transit.next_state) {
+		return handle_event_in_transit(sm_handle, event);
+	}
+#endif
+#if SM_STATE_MACHINE_OPTIMIZE_RAM
+	if (!sm_handle->current_state) {
+		return sm_state_machine_no_state_change;
+	}
+#else
+	if (!trusted && !sm_handle->current_state) {
+		go_to_error_state(sm_handle, event);
+		return sm_state_machine_error_state_reached;
+	}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* Walking up leaves the submachines: restored if no transition is taken */
+	const size_t depth = sm_handle->submachine_depth;
+	if (!depth && !has_transitions(sm_handle->current_state->transitions))
+#else
+	if (!has_transitions(sm_handle->current_state->transitions))
+#endif
+		return sm_state_machine_no_state_change;
+
+	const struct sm_state *state = sm_handle->current_state;
+	do {
+		if (state->transitions) {
+			status = handle_state_transitions(sm_handle, state,
+											  state->transitions, event,
+											  trusted);
+		}
+
+		if (status == sm_state_machine_no_state_change) {
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+			state = parent_of(sm_handle, state);
+#else
+			state = state->parent_state;
+#endif
+		} else {
+			break;
+		}
+	} while (state);
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	if (status == sm_state_machine_no_state_change ||
+		status == sm_state_machine_rejected_by_guard) {
+		sm_handle->submachine_depth = depth;
 	}
-	for (size_t i = 0; i < state->transitions->num_transitions; ++i) {
-		struct sm_transition *t = &state->transitions->transitions[i];
+#endif
 
-		/* A transition for the given event has been found: */
-		if (t->event_type == event->type) {
-			return t;
+	if (status == sm_state_machine_state_changed &&
+		sm_handle->current_state->completion_transitions) {
+		status = handle_completion_transitions(sm_handle, event, trusted);
+	}
+	return status;
+}
+
+#if SM_STATE_MACHINE_OPTIMIZE_RAM
+static enum sm_state_machine_handle_event_status
+handle_state_transitions(struct sm_state_machine *sm_handle,
+						 const struct sm_state *state,
+						 const struct sm_state_transitions *transitions,
+						 const struct sm_event *event, bool trusted) {
+	(void)trusted;
+	assert(transitions->handle_event != NULL);
+	return transitions->handle_event(sm_handle, state, event);
+}
+#else
+static enum sm_state_machine_handle_event_status
+handle_state_transitions(struct sm_state_machine *sm_handle,
+						 const struct sm_state *state,
+						 const struct sm_state_transitions *transitions,
+						 const struct sm_event *event, bool trusted) {
+	if (transitions->handle_event) {
+		return transitions->handle_event(sm_handle, state, event);
+	}
+
+	enum sm_state_machine_handle_event_status status =
+		sm_state_machine_no_state_change;
+	for (size_t i = 0; i < transitions->num_transitions; ++i) {
+		const struct sm_transition *transition = &transitions->transitions[i];
+
+		// A transition for the given event has been found:
+		if (transition->event_type == event->type) {
+			/*
+			 * A transition must have a next state defined. If the user has
+			 * not defined the next state, go to error state:
+			 */
+			assert(transition->next_state);
+			if (!trusted && !transition->next_state) {
+				go_to_error_state(sm_handle, event);
+				return sm_state_machine_error_state_reached;
+			}
+
+			status = take_transition(sm_handle, state, transition, event);
+			if (status != sm_state_machine_rejected_by_guard) {
+				break;
+			}
 		}
 	}
+	return status;
+}
+#endif
 
-	/* No transitions found for given event for given state: */
-	return NULL;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+/*
+ * The top level states of a submachine have no parent: the parent is the
+ * innermost submachine state, whose transitions, and the states they lead to,
+ * are outside of the submachine
+ */
+static const struct sm_state *parent_of(struct sm_state_machine *sm_handle,
+										const struct sm_state *state) {
+	if (state->parent_state || !sm_handle->submachine_depth) {
+		return state->parent_state;
+	}
+	return sm_handle->submachine_states[--sm_handle->submachine_depth];
 }
 #endif
 
+/* False for the final states */
+static bool has_transitions(const struct sm_state_transitions *transitions) {
+#if SM_STATE_MACHINE_OPTIMIZE_RAM
+	return transitions != NULL;
+#else
+	return transitions &&
+		   (transitions->num_transitions || transitions->handle_event);
+#endif
+}
+
+/* Attempt \p transition, defined in \p state, whose event matches */
+static enum sm_state_machine_handle_event_status
+take_transition(struct sm_state_machine *sm_handle,
+				const struct sm_state *state,
+				const struct sm_transition *transition,
+				const struct sm_event *event) {
+	enum sm_state_machine_handle_event_status status;
+#if SM_STATE_MACHINE_ENABLE_LOG
+	if (sm_handle->hooks.logger &&
+		sm_handle->hooks.logger->log_attempt_transition) {
+		sm_handle->hooks.logger->log_attempt_transition(
+			sm_handle, sm_state_machine_get_name(sm_handle), event,
+			sm_handle->hooks.stringify_event
+				? sm_handle->hooks.stringify_event(event)
+				: NULL,
+			transition->guard, sm_handle->current_state, transition->action,
+			transition->next_state);
+	}
+#endif
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	if (transition->action && transition->action->async_fn) {
+		status = handle_async_event(
+			sm_handle, event,
+			transition->guard != NULL ? transition->guard->fn : NULL,
+			transition->action->async_fn, transition->next_state);
+	} else
+#endif
+		status = handle_event(
+			sm_handle, event,
+			transition->guard != NULL ? transition->guard->fn : NULL,
+			transition->action != NULL ? transition->action->fn : NULL,
+			transition->next_state);
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	if (status != sm_state_machine_rejected_by_guard) {
+		trace_transition_taken(sm_handle, event, state, transition);
+	}
+#else
+	(void)state;
+#endif
+	return status;
+}
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+static void trace_transition_taken(const struct sm_state_machine *sm_handle,
+								   const struct sm_event *event,
+								   const struct sm_state *state,
+								   const struct sm_transition *transition) {
+	const struct sm_state_machine_tracer *tracer = sm_handle->hooks.tracer;
+	if (tracer && tracer->transition_taken) {
+		tracer->transition_taken(tracer->context, sm_handle, event, state,
+								 transition);
+	}
+}
+
+static void trace_state_changed(const struct sm_state_machine *sm_handle) {
+	const struct sm_state_machine_tracer *tracer = sm_handle->hooks.tracer;
+	if (tracer && tracer->state_changed) {
+		tracer->state_changed(tracer->context, sm_handle,
+							  sm_handle->previous_state,
+							  sm_handle->current_state);
+	}
+}
+#endif
+
+static enum sm_state_machine_handle_event_status
+handle_completion_transitions(struct sm_state_machine *sm_handle,
+							  const struct sm_event *event, bool trusted) {
+	/* The payload of the triggering event is carried along the chain */
+	const struct sm_event completion_event = {
+		.type = SM_STATE_MACHINE_EVENT_COMPLETION,
+		.data = event->data,
+	};
+	enum sm_state_machine_handle_event_status status =
+		sm_state_machine_state_changed;
+
+	for (unsigned int i = 0; i < SM_STATE_MACHINE_MAX_COMPLETION_CHAIN; ++i) {
+		const struct sm_state_transitions *completion_transitions =
+			sm_handle->current_state->completion_transitions;
+		if (status != sm_state_machine_state_changed ||
+			!completion_transitions) {
+			return status;
+		}
+		enum sm_state_machine_handle_event_status completion_status =
+			handle_state_transitions(sm_handle, sm_handle->current_state,
+									 completion_transitions, &completion_event,
+									 trusted);
+		/* No completion transition has been taken: the state is stable */
+		if (completion_status == sm_state_machine_no_state_change ||
+			completion_status == sm_state_machine_rejected_by_guard) {
+			return sm_state_machine_stopped(sm_handle)
+					   ? sm_state_machine_final_state_reached
+					   : status;
+		}
+		status = completion_status;
+	}
+
+	if (status == sm_state_machine_state_changed &&
+		sm_handle->current_state->completion_transitions) {
+		if (completion_taken(sm_handle, &completion_event, trusted)) {
+			/* Livelock: the chain of completion transitions didn't settle */
+			go_to_error_state(sm_handle, &completion_event);
+			return sm_state_machine_error_state_reached;
+		}
+		if (sm_state_machine_stopped(sm_handle)) {
+			return sm_state_machine_final_state_reached;
+		}
+	}
+	return status;
+}
+
+/*
+ * Whether one more completion transition would be taken at the end of the
+ * longest chain. The guards of a table are evaluated without taking the
+ * transition; a function can only be run, taking the transition if any.
+ */
+static bool completion_taken(struct sm_state_machine *sm_handle,
+							 const struct sm_event *completion_event,
+							 bool trusted) {
+	const struct sm_state *state = sm_handle->current_state;
+	const struct sm_state_transitions *transitions =
+		state->completion_transitions;
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	if (!transitions->handle_event) {
+		for (size_t i = 0; i < transitions->num_transitions; ++i) {
+			const struct sm_transition *transition =
+				&transitions->transitions[i];
+			if (transition->event_type != completion_event->type) {
+				continue;
+			}
+			if (!transition->guard || !transition->guard->fn ||
+				transition->guard->fn(
+					sm_handle->user_data, state,
+					get_state_data(sm_handle, state), completion_event,
+					transition->next_state,
+					get_state_data(sm_handle, transition->next_state))) {
+				return true;
+			}
+		}
+		return false;
+	}
+#endif
+	const enum sm_state_machine_handle_event_status status =
+		handle_state_transitions(sm_handle, state, transitions,
+								 completion_event, trusted);
+	return status != sm_state_machine_no_state_change &&
+		   status != sm_state_machine_rejected_by_guard;
+}
+
 static void *get_state_data(const struct sm_state_machine *sm_handle,
 							const struct sm_state *state) {
 	if (sm_handle->hooks.state_data_mapper) {
@@ -234,15 +767,33 @@ static enum sm_state_machine_handle_event_status
 handle_event(struct sm_state_machine *sm_handle, const struct sm_event *event,
 			 sm_guard_fn guard, sm_action_fn transition_action,
 			 const struct sm_state *next_state) {
-	bool guard_rejected = false;
+	if (!leave_state(sm_handle, event, guard, next_state)) {
+		return sm_state_machine_rejected_by_guard;
+	}
+
+	/* Run transition action (if any): */
+	if (transition_action) {
+		transition_action(sm_handle->user_data, sm_handle->current_state,
+						  get_state_data(sm_handle, sm_handle->current_state),
+						  event, next_state,
+						  get_state_data(sm_handle, next_state));
+	}
+
+	return enter_state(sm_handle, event, next_state);
+}
+
+/*
+ * Check the guard and, if it accepts the transition, run the exit action.
+ * Returns false if the guard rejected the transition.
+ */
+static bool leave_state(struct sm_state_machine *sm_handle,
+						const struct sm_event *event, sm_guard_fn guard,
+						const struct sm_state *next_state) {
 	if (guard &&
 		!guard(sm_handle->user_data, sm_handle->current_state,
 			   get_state_data(sm_handle, sm_handle->current_state), event,
 			   next_state, get_state_data(sm_handle, next_state))) {
-		guard_rejected = true;
-	}
-	if (guard_rejected) {
-		return sm_state_machine_rejected_by_guard;
+		return false;
 	}
 
 	/* Run exit action only if the current state is left (only if it does
@@ -254,19 +805,33 @@ handle_event(struct sm_state_machine *sm_handle, const struct sm_event *event,
 			get_state_data(sm_handle, sm_handle->current_state), event,
 			next_state, get_state_data(sm_handle, next_state));
 	}
+	return true;
+}
 
-	/* Run transition action (if any): */
-	if (transition_action) {
-		transition_action(sm_handle->user_data, sm_handle->current_state,
-						  get_state_data(sm_handle, sm_handle->current_state),
-						  event, next_state,
-						  get_state_data(sm_handle, next_state));
-	}
-
+static enum sm_state_machine_handle_event_status
+enter_state(struct sm_state_machine *sm_handle, const struct sm_event *event,
+			const struct sm_state *next_state) {
 	/* If the new state is a parent state, enter its entry state (if it has
 	 * one). Step down through the whole family tree until a state without
 	 * an entry state is found: */
-	while (next_state->entry_state) {
+	for (const struct sm_state *child = next_state->entry_state;;
+		 child = next_state->entry_state) {
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+		/* A submachine state descends into the submachine instead */
+		if (next_state->submachine) {
+			if (sm_handle->submachine_depth ==
+				SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH) {
+				go_to_error_state(sm_handle, event);
+				return sm_state_machine_error_state_reached;
+			}
+			sm_handle->submachine_states[sm_handle->submachine_depth++] =
+				next_state;
+			child = next_state->submachine->initial_state;
+		}
+#endif
+		if (!child) {
+			break;
+		}
 		if (next_state->entry_action) {
 			assert(next_state->entry_action->fn);
 			next_state->entry_action->fn(
@@ -274,7 +839,7 @@ handle_event(struct sm_state_machine *sm_handle, const struct sm_event *event,
 				get_state_data(sm_handle, sm_handle->current_state), event,
 				next_state, get_state_data(sm_handle, next_state));
 		}
-		next_state = next_state->entry_state;
+		next_state = child;
 	}
 	/* Call the new state's entry action if it has any (only if state does
 	 * not return to itself): */
@@ -288,6 +853,15 @@ handle_event(struct sm_state_machine *sm_handle, const struct sm_event *event,
 
 	sm_handle->previous_state = sm_handle->current_state;
 	sm_handle->current_state = next_state;
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	stamp(sm_handle);
+#endif
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	publish(sm_handle);
+#endif
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	trace_state_changed(sm_handle);
+#endif
 
 	/* If the state returned to itself: */
 	if (sm_handle->current_state == sm_handle->previous_state) {
@@ -299,54 +873,143 @@ handle_event(struct sm_state_machine *sm_handle, const struct sm_event *event,
 	}
 
 	/* If the new state is a final state, notify user that the state
-	 * machine has stopped: */
-	if (sm_state_machine_stopped(sm_handle)) {
+	 * machine has stopped (after its completion transitions, if any): */
+	if (!sm_handle->current_state->completion_transitions &&
+		sm_state_machine_stopped(sm_handle)) {
 		return sm_state_machine_final_state_reached;
 	}
 
 	return sm_state_machine_state_changed;
 }
 
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+static enum sm_state_machine_handle_event_status
+handle_async_event(struct sm_state_machine *sm_handle,
+				   const struct sm_event *event, sm_guard_fn guard,
+				   sm_async_action_fn transition_action,
+				   const struct sm_state *next_state) {
+	if (!leave_state(sm_handle, event, guard, next_state)) {
+		return sm_state_machine_rejected_by_guard;
+	}
+
+	/* The event may not outlive this call: keep a copy for the entry
+	 * actions */
+	sm_handle->transit.next_state = next_state;
+	sm_handle->transit.event = *event;
+	sm_handle->transit.starting = true;
+	sm_handle->transit.completed = false;
+	const struct sm_async_completion completion = {
+		.state_machine = sm_handle,
+		.id = ++sm_handle->transit.id,
+	};
+	transition_action(sm_handle->user_data, sm_handle->current_state,
+					  get_state_data(sm_handle, sm_handle->current_state),
+					  event, next_state, get_state_data(sm_handle, next_state),
+					  completion);
+	sm_handle->transit.starting = false;
+
+	if (!sm_handle->transit.completed) {
+		return sm_state_machine_transition_pending;
+	}
+	sm_handle->transit.next_state = NULL;
+	return enter_state(sm_handle, event, next_state);
+}
+
+static enum sm_state_machine_handle_event_status
+handle_event_in_transit(struct sm_state_machine *sm_handle,
+						const struct sm_event *event) {
+	switch (sm_handle->transit.policy) {
+	case sm_state_machine_transit_defer:
+		return sm_state_machine_event_deferred;
+	case sm_state_machine_transit_queue:
+		if (sm_handle->transit.queue_count <
+			SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE) {
+			size_t tail = (sm_handle->transit.queue_head +
+						   sm_handle->transit.queue_count) %
+						  SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE;
+			sm_handle->transit.queue[tail] = *event;
+			++sm_handle->transit.queue_count;
+			return sm_state_machine_event_queued;
+		}
+		return sm_state_machine_event_rejected;
+	case sm_state_machine_transit_reject:
+	default:
+		return sm_state_machine_event_rejected;
+	}
+}
+
+/*
+ * A flat loop rather than a recursion through sm_state_machine_handle_event():
+ * the events queued while handling a queued event are handled by the same
+ * loop. Returns \p status, unless one of the events stopped the state machine
+ * or started another asynchronous action: then the first of them.
+ */
+static enum sm_state_machine_handle_event_status
+dispatch_queued_events(struct sm_state_machine *sm_handle,
+					   enum sm_state_machine_handle_event_status status) {
+	/* Stop as soon as one of the events starts another asynchronous action:
+	 * the remaining ones stay queued */
+	while (sm_handle->transit.queue_count && !sm_handle->transit.next_state) {
+		struct sm_event event =
+			sm_handle->transit.queue[sm_handle->transit.queue_head];
+		sm_handle->transit.queue_head = (sm_handle->transit.queue_head + 1) %
+										SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE;
+		--sm_handle->transit.queue_count;
+		enum sm_state_machine_handle_event_status queued_status =
+			dispatch_one(sm_handle, &event, false);
+		if (is_surfaced(queued_status) && !is_surfaced(status)) {
+			status = queued_status;
+		}
+	}
+	return status;
+}
+
+static bool is_surfaced(enum sm_state_machine_handle_event_status status) {
+	return status == sm_state_machine_error_state_reached ||
+		   status == sm_state_machine_final_state_reached ||
+		   status == sm_state_machine_transition_pending;
+}
+#endif
+
 #if SM_STATE_MACHINE_ENABLE_LOG
-const char *
+SM_STATE_MACHINE_API const char *
 sm_state_machine_get_name(const struct sm_state_machine *sm_handle) {
 	assert(sm_handle != NULL);
 	return sm_handle->name;
 }
 #endif
 
-#if SM_STATE_MACHINE_OPTIMIZE_RAM
-enum sm_state_machine_handle_event_status
+#if SM_STATE_MACHINE_ENABLE_LOG || SM_STATE_MACHINE_ENABLE_TRACE
+SM_STATE_MACHINE_API enum sm_state_machine_handle_event_status
+sm_state_machine_transition_def_helper_take_transition(
+	struct sm_state_machine *sm_handle, const struct sm_state *state,
+	const struct sm_event *event, const struct sm_transition *transition) {
+	return take_transition(sm_handle, state, transition, event);
+}
+#else
+SM_STATE_MACHINE_API enum sm_state_machine_handle_event_status
 sm_state_machine_transition_def_helper_handle_event(
 	struct sm_state_machine *sm_handle, const struct sm_event *event,
 	sm_guard_fn guard, sm_action_fn transition_action,
 	const struct sm_state *next_state) {
-	return handle_event(sm_handle, event, guard, transition_action, next_state);
+	return handle_event(sm_handle, event, guard, transition_action,
+						next_state);
 }
 
-enum sm_state_machine_handle_event_status
+SM_STATE_MACHINE_API enum sm_state_machine_handle_event_status
 sm_state_machine_transition_def_helper_handle_event_ex(
 	struct sm_state_machine *sm_handle, const struct sm_event *event,
-	struct sm_guard *guard, struct sm_action *transition_action,
+	const struct sm_guard *guard, const struct sm_action *transition_action,
 	const struct sm_state *next_state) {
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	if (transition_action && transition_action->async_fn) {
+		return handle_async_event(sm_handle, event,
+								  guard == NULL ? NULL : guard->fn,
+								  transition_action->async_fn, next_state);
+	}
+#endif
 	return handle_event(
 		sm_handle, event, guard == NULL ? NULL : guard->fn,
 		transition_action == NULL ? NULL : transition_action->fn, next_state);
 }
-
-enum sm_state_machine_handle_event_status
-sm_state_machine_transition_def_helper_parent_handle_event(
-	struct sm_state_machine *sm_handle, const struct sm_event *event) {
-	assert(sm_handle->current_state != NULL);
-	if (sm_handle->current_state->parent_state &&
-		sm_handle->current_state->parent_state->transitions) {
-		assert(
-			sm_handle->current_state->parent_state->transitions->handle_event !=
-			NULL);
-		return sm_handle->current_state->parent_state->transitions
-			->handle_event(sm_handle, event);
-	}
-	return sm_state_machine_no_state_change;
-}
-
 #endif
@@ -87,13 +87,39 @@
 
 #include "sm_state_machine_config.h"
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+#include <stdint.h>
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+#include "sm_atomic.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * \brief Qualifier of the objects defined by the definition macros, see
+ * #SM_STATE_MACHINE_CONST_TABLES
+ */
+#if SM_STATE_MACHINE_CONST_TABLES
+#define SM_STATE_MACHINE_TABLE_CONST const
+#else
+#define SM_STATE_MACHINE_TABLE_CONST
+#endif
+
+#ifndef SM_STATE_MACHINE_API
+/**
+ * \brief Linkage of the functions of the library. The single header build
+ * (sm_state_machine_single.h) defines it as `static inline`.
+ */
+#define SM_STATE_MACHINE_API
+#endif
+
 struct sm_state;
 struct sm_state_machine;
 
@@ -114,6 +140,8 @@ enum sm_state_machine_handle_event_status {
 	 * happens:
 	 * - The current state is NULL
 	 * - A transition for the current event did not define the next state
+	 * - More than #SM_STATE_MACHINE_MAX_COMPLETION_CHAIN completion
+	 *   transitions would be chained by a single event
 	 */
 	sm_state_machine_error_state_reached,
 	/** \brief The current state changed into a non-final state */
@@ -136,6 +164,27 @@ enum sm_state_machine_handle_event_status {
 	sm_state_machine_rejected_by_guard,
 	/** \brief A final state (any but the error state) was reached */
 	sm_state_machine_final_state_reached,
+	/**
+	 * \brief The transition action is asynchronous and hasn't completed yet
+	 *
+	 * The state machine is in transit: the transition is completed by
+	 * sm_state_machine_complete_async_action(). See #sm_async_action_fn.
+	 */
+	sm_state_machine_transition_pending,
+	/**
+	 * \brief The event arrived while in transit and has been queued. It will
+	 * be handled once the transition completes.
+	 */
+	sm_state_machine_event_queued,
+	/**
+	 * \brief The event arrived while in transit and hasn't been handled. The
+	 * caller must dispatch it again once the transition completes.
+	 */
+	sm_state_machine_event_deferred,
+	/**
+	 * \brief The event arrived while in transit and has been discarded
+	 */
+	sm_state_machine_event_rejected,
 };
 
 /**
@@ -163,6 +212,19 @@ struct sm_event {
 	void *data;
 };
 
+/**
+ * \brief Event type reserved for completion transitions
+ *
+ * Transitions with this event type are not triggered by user events: they are
+ * evaluated by sm_state_machine_handle_event() right after their state has
+ * been entered. See sm_state::completion_transitions.
+ *
+ * The event passed to the guards and actions of a completion transition has
+ * this type and carries the \ref sm_event::data "payload" of the event that
+ * caused the state to be entered.
+ */
+#define SM_STATE_MACHINE_EVENT_COMPLETION INT_MIN
+
 /**
  * \brief Check if data passed with event fulfils a condition
  *
@@ -211,16 +273,40 @@ struct sm_guard {
  */
 #if SM_STATE_MACHINE_ENABLE_LOG
 #define SM_STATE_MACHINE_GUARD(_fn_)                                           \
-	(struct sm_guard) {                                                        \
+	(SM_STATE_MACHINE_TABLE_CONST struct sm_guard) {                           \
 		.name = #_fn_, .fn = _fn_                                              \
 	}
 #else
 #define SM_STATE_MACHINE_GUARD(_fn_)                                           \
-	(struct sm_guard) {                                                        \
+	(SM_STATE_MACHINE_TABLE_CONST struct sm_guard) {                           \
 		.fn = _fn_                                                             \
 	}
 #endif
 
+/**
+ * \brief Define a guard object once, to be shared by several transitions
+ *
+ * #SM_STATE_MACHINE_GUARD and #SM_STATE_MACHINE_TRANSITION_ADD create a new
+ * object each time they are used. Define the objects of the guards used by
+ * more than one transition with this macro instead, and reference them with
+ * #SM_STATE_MACHINE_GUARD_REF in #SM_STATE_MACHINE_TRANSITION_ADD_EX.
+ *
+ * \param [in] _fn_ The function to be executed as guard
+ */
+#if SM_STATE_MACHINE_ENABLE_LOG
+#define SM_STATE_MACHINE_GUARD_DEF(_fn_)                                       \
+	static SM_STATE_MACHINE_TABLE_CONST struct sm_guard _fn_##_guard = {       \
+		.name = #_fn_, .fn = _fn_}
+#else
+#define SM_STATE_MACHINE_GUARD_DEF(_fn_)                                       \
+	static SM_STATE_MACHINE_TABLE_CONST struct sm_guard _fn_##_guard = {       \
+		.fn = _fn_}
+#endif
+/**
+ * \brief Reference a guard object defined with #SM_STATE_MACHINE_GUARD_DEF
+ */
+#define SM_STATE_MACHINE_GUARD_REF(_fn_) (&_fn_##_guard)
+
 /**
  * \brief Function containing tasks to be performed during the
  * transition.
@@ -263,6 +349,73 @@ typedef void (*sm_action_fn)(void *sm_user_data,
 							 const struct sm_event *event,
 							 const struct sm_state *new_state,
 							 void *new_state_data);
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+/**
+ * \brief Handle that completes an asynchronous transition action
+ *
+ * It can be copied freely: only the first completion of a given transition is
+ * accepted.
+ *
+ * \sa sm_state_machine_complete_async_action()
+ */
+struct sm_async_completion {
+	/** \brief The state machine that is in transit */
+	struct sm_state_machine *state_machine;
+	/** \brief Identifies the transition */
+	unsigned int id;
+};
+
+/**
+ * \brief Asynchronous transition action
+ *
+ * Same as #sm_action_fn, but the action doesn't have to be over when the
+ * function returns: it typically starts some slow I/O and returns right away.
+ * Meanwhile the state machine is in transit: the exit actions have been
+ * executed and the current state is still the state being left. When the
+ * action is over, \p completion must be passed to
+ * sm_state_machine_complete_async_action(), which executes the entry actions
+ * and enters the next state.
+ *
+ * The action may also complete before returning.
+ *
+ * The state machine keeps a copy of \p event, but not of its payload:
+ * sm_event::data must stay valid until the transition completes, since it is
+ * passed to the entry actions and to the completion transitions.
+ *
+ * How the events that arrive while in transit are handled is chosen with
+ * sm_state_machine_set_transit_policy().
+ */
+typedef void (*sm_async_action_fn)(void *sm_user_data,
+								   const struct sm_state *current_state,
+								   void *current_state_data,
+								   const struct sm_event *event,
+								   const struct sm_state *new_state,
+								   void *new_state_data,
+								   struct sm_async_completion completion);
+
+/**
+ * \brief What to do with the events that arrive while in transit
+ */
+enum sm_state_machine_transit_policy {
+	/** \brief Discard them (#sm_state_machine_event_rejected) */
+	sm_state_machine_transit_reject,
+	/**
+	 * \brief Hand them back to the caller (#sm_state_machine_event_deferred),
+	 * who will dispatch them again once the transition completes
+	 */
+	sm_state_machine_transit_defer,
+	/**
+	 * \brief Queue up to #SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE of them
+	 * (#sm_state_machine_event_queued), and handle them in order once the
+	 * transition completes. Events that don't fit are discarded.
+	 *
+	 * As for the event of the transition, the payload of a queued event
+	 * must stay valid until it has been handled.
+	 */
+	sm_state_machine_transit_queue,
+};
+#endif
+
 /**
  * \brief Action
  *
@@ -279,6 +432,15 @@ struct sm_action {
 	 * \brief Function to be executed
 	 */
 	sm_action_fn fn;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	/**
+	 * \brief Asynchronous function to be executed instead of #fn. Only
+	 * transition actions can be asynchronous.
+	 *
+	 * See #SM_STATE_MACHINE_ASYNC_ACTION.
+	 */
+	sm_async_action_fn async_fn;
+#endif
 };
 
 /**
@@ -292,16 +454,73 @@ struct sm_action {
  */
 #if SM_STATE_MACHINE_ENABLE_LOG
 #define SM_STATE_MACHINE_ACTION(_fn_)                                          \
-	(struct sm_action) {                                                       \
+	(SM_STATE_MACHINE_TABLE_CONST struct sm_action) {                          \
 		.name = #_fn_, .fn = _fn_                                              \
 	}
 #else
 #define SM_STATE_MACHINE_ACTION(_fn_)                                          \
-	(struct sm_action) {                                                       \
+	(SM_STATE_MACHINE_TABLE_CONST struct sm_action) {                          \
 		.fn = _fn_                                                             \
 	}
 #endif
 
+/**
+ * \brief Define an action object once, to be shared by several transitions
+ * or states
+ *
+ * See #SM_STATE_MACHINE_GUARD_DEF.
+ *
+ * \param [in] _fn_ The function to be executed as action
+ */
+#if SM_STATE_MACHINE_ENABLE_LOG
+#define SM_STATE_MACHINE_ACTION_DEF(_fn_)                                      \
+	static SM_STATE_MACHINE_TABLE_CONST struct sm_action _fn_##_action = {     \
+		.name = #_fn_, .fn = _fn_}
+#else
+#define SM_STATE_MACHINE_ACTION_DEF(_fn_)                                      \
+	static SM_STATE_MACHINE_TABLE_CONST struct sm_action _fn_##_action = {     \
+		.fn = _fn_}
+#endif
+/**
+ * \brief Reference an action object defined with #SM_STATE_MACHINE_ACTION_DEF
+ */
+#define SM_STATE_MACHINE_ACTION_REF(_fn_) (&_fn_##_action)
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+/**
+ * \brief Utility macro that you can use to define an asynchronous transition
+ * action object
+ *
+ * \param [in] _fn_ The function to be executed as action (type
+ * #sm_async_action_fn)
+ */
+#if SM_STATE_MACHINE_ENABLE_LOG
+#define SM_STATE_MACHINE_ASYNC_ACTION(_fn_)                                    \
+	(SM_STATE_MACHINE_TABLE_CONST struct sm_action) {                          \
+		.name = #_fn_, .async_fn = _fn_                                        \
+	}
+#else
+#define SM_STATE_MACHINE_ASYNC_ACTION(_fn_)                                    \
+	(SM_STATE_MACHINE_TABLE_CONST struct sm_action) {                          \
+		.async_fn = _fn_                                                       \
+	}
+#endif
+
+/**
+ * \brief Define an asynchronous transition action object once, see
+ * #SM_STATE_MACHINE_ACTION_DEF. Reference it with #SM_STATE_MACHINE_ACTION_REF.
+ */
+#if SM_STATE_MACHINE_ENABLE_LOG
+#define SM_STATE_MACHINE_ASYNC_ACTION_DEF(_fn_)                                \
+	static SM_STATE_MACHINE_TABLE_CONST struct sm_action _fn_##_action = {     \
+		.name = #_fn_, .async_fn = _fn_}
+#else
+#define SM_STATE_MACHINE_ASYNC_ACTION_DEF(_fn_)                                \
+	static SM_STATE_MACHINE_TABLE_CONST struct sm_action _fn_##_action = {     \
+		.async_fn = _fn_}
+#endif
+#endif
+
 /**
  * \brief Transition between a state and another state
  *
@@ -336,72 +555,175 @@ struct sm_transition {
 	 *
 	 * May be NULL.
 	 */
-	struct sm_guard *guard;
+	const struct sm_guard *guard;
 	/**
 	 * \brief The action to be executed as a side effect of the transition.
 	 * This is called only if #guard returns true.
 	 *
 	 * May be NULL.
 	 */
-	struct sm_action *action;
+	const struct sm_action *action;
 	/**
 	 * \brief The next state
 	 *
 	 * This must point to the next state that will be entered. It cannot be
 	 * NULL.
 	 */
-	struct sm_state *next_state;
+	const struct sm_state *next_state;
 };
 
 /**
  * This struct represents the transitions that are defined for a single state.
  */
 struct sm_state_transitions {
-#if SM_STATE_MACHINE_OPTIMIZE_RAM
-	/**
-	 * If #SM_STATE_MACHINE_OPTIMIZE_RAM is enabled, the transitions defined
-	 * with the \ref SM_STATE_MACHINE_TRANSITION_DEF_START
-	 * "SM_STATE_MACHINE_TRANSITION_DEF_*" macros will be glued into single
-	 * function.
-	 *
-	 * This is the pointer to that function.
-	 */
-	int (*handle_event)(struct sm_state_machine *state_machine,
-						const struct sm_event *event);
-#else
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
 	/**
 	 * \brief An array of transitions for the state.
 	 */
-	struct sm_transition *transitions;
+	const struct sm_transition *transitions;
 	/**
 	 * \brief Number of transitions in the #transitions array.
 	 */
 	size_t num_transitions;
 #endif
+	/**
+	 * The transitions defined with the \ref
+	 * SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+	 * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*" macros (and, if
+	 * #SM_STATE_MACHINE_OPTIMIZE_RAM is enabled, with the \ref
+	 * SM_STATE_MACHINE_TRANSITION_DEF_START "SM_STATE_MACHINE_TRANSITION_DEF_*"
+	 * macros) are glued into a single function.
+	 *
+	 * This is the pointer to that function. \p state is the state the
+	 * transitions are defined in: the current state or one of its parents.
+	 *
+	 * If not NULL, #transitions is not used. This way a state machine can mix
+	 * both: e.g. a function for the hot states with many transitions, and a
+	 * compact table for the others.
+	 */
+	int (*handle_event)(struct sm_state_machine *state_machine,
+						const struct sm_state *state,
+						const struct sm_event *event);
 };
 
-#if SM_STATE_MACHINE_OPTIMIZE_RAM
-enum sm_state_machine_handle_event_status
+/*
+ * The macros adding a transition take a function name or NULL as guard and
+ * action, and don't create any sm_guard or sm_action object for NULL:
+ * SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(
+ * SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_fn_) is 1 if _fn_ is the
+ * NULL token, 0 otherwise. It must be pasted by the macro given _fn_, before
+ * NULL is expanded.
+ */
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_NULL ~, 1
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_SECOND(_a_, _b_, ...) _b_
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(...)                    \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_SECOND(__VA_ARGS__, 0, ~)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(_a_, _b_)                   \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT_(_a_, _b_)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT_(_a_, _b_) _a_##_b_
+
+/**
+ * \brief Start the definition of transitions for a state, as a function
+ *
+ * The transitions are compiled into code: the events are compared with
+ * constants, and the guards and actions are called directly. Within the
+ * block, add them with #SM_STATE_MACHINE_TRANSITION_FN_ADD and
+ * #SM_STATE_MACHINE_TRANSITION_FN_ADD_EX. If #SM_STATE_MACHINE_OPTIMIZE_RAM is
+ * enabled, all the transitions are defined this way.
+ */
+#define SM_STATE_MACHINE_TRANSITION_FN_DEF_START(_state_name_)                 \
+	enum sm_state_machine_handle_event_status _state_name_##_transition_fn(    \
+		struct sm_state_machine *sm_handle, const struct sm_state *state,      \
+		const struct sm_event *event) {                                        \
+		enum sm_state_machine_handle_event_status status =                     \
+			sm_state_machine_no_state_change;                                  \
+		(void)state;                                                           \
+		do {
+#if SM_STATE_MACHINE_ENABLE_LOG || SM_STATE_MACHINE_ENABLE_TRACE
+/*
+ * The logger and the tracer are handed the same sm_transition, sm_guard and
+ * sm_action objects as in table mode. They are defined as static const
+ * objects local to each transition, so that they end up in read-only memory,
+ * and only if the logs or the traces are enabled.
+ */
+SM_STATE_MACHINE_API enum sm_state_machine_handle_event_status
+sm_state_machine_transition_def_helper_take_transition(
+	struct sm_state_machine *sm_handle, const struct sm_state *state,
+	const struct sm_event *event, const struct sm_transition *transition);
+#if SM_STATE_MACHINE_ENABLE_LOG
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_INIT(_fn_)                      \
+	{.name = #_fn_, .fn = _fn_}
+#else
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_INIT(_fn_)                      \
+	{.fn = _fn_}
+#endif
+/* No descriptor for NULL */
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_0(_fn_)                   \
+	static const struct sm_guard sm_guard_descriptor =                         \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_INIT(_fn_);
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_1(_fn_)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_REF_0(_fn_)               \
+	(_fn_ == NULL ? NULL : &sm_guard_descriptor)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_REF_1(_fn_) NULL
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_0(_fn_)                  \
+	static const struct sm_action sm_action_descriptor =                       \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_INIT(_fn_);
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_1(_fn_)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_REF_0(_fn_)              \
+	(_fn_ == NULL ? NULL : &sm_action_descriptor)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_REF_1(_fn_) NULL
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_TAKE(_event_, _guard_,          \
+													_action_, _next_state_)    \
+	if (event->type == _event_) {                                              \
+		static const struct sm_transition sm_transition_descriptor = {         \
+			_event_, _guard_, _action_, _next_state_};                         \
+		status = sm_state_machine_transition_def_helper_take_transition(       \
+			sm_handle, state, event, &sm_transition_descriptor);               \
+		if (status != sm_state_machine_rejected_by_guard) {                    \
+			break;                                                             \
+		}                                                                      \
+	}
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_FN_ADD(                         \
+	_event_, _guard_, _action_, _next_state_, _no_guard_, _no_action_)         \
+	{                                                                          \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(                            \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_, _no_guard_)         \
+		(_guard_)                                                              \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(                            \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_, _no_action_)       \
+		(_action_)                                                             \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_TAKE(                           \
+			_event_,                                                           \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(                        \
+				SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_REF_,             \
+				_no_guard_)(_guard_),                                          \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(                        \
+				SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_REF_,            \
+				_no_action_)(_action_),                                        \
+			_next_state_)                                                      \
+	}
+/*
+ * The guard and the action must be address constants: e.g. objects defined
+ * with #SM_STATE_MACHINE_GUARD_DEF and #SM_STATE_MACHINE_ACTION_DEF, not
+ * compound literals.
+ */
+#define SM_STATE_MACHINE_TRANSITION_FN_ADD_EX(_event_, _guard_, _action_,      \
+											  _next_state_)                    \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_TAKE(_event_, (_guard_),            \
+												(_action_), _next_state_)
+#else
+SM_STATE_MACHINE_API enum sm_state_machine_handle_event_status
 sm_state_machine_transition_def_helper_handle_event(
 	struct sm_state_machine *sm_handle, const struct sm_event *event,
 	sm_guard_fn guard, sm_action_fn transition_action,
 	const struct sm_state *next_state);
-enum sm_state_machine_handle_event_status
+SM_STATE_MACHINE_API enum sm_state_machine_handle_event_status
 sm_state_machine_transition_def_helper_handle_event_ex(
 	struct sm_state_machine *sm_handle, const struct sm_event *event,
-	struct sm_guard *guard, struct sm_action *transition_action,
+	const struct sm_guard *guard, const struct sm_action *transition_action,
 	const struct sm_state *next_state);
-enum sm_state_machine_handle_event_status
-sm_state_machine_transition_def_helper_parent_handle_event(
-	struct sm_state_machine *sm_handle, const struct sm_event *event);
-#define SM_STATE_MACHINE_TRANSITION_DEF_START(_state_name_)                    \
-	enum sm_state_machine_handle_event_status _state_name_##_transition_fn(    \
-		struct sm_state_machine *sm_handle, const struct sm_event *event) {    \
-		enum sm_state_machine_handle_event_status status =                     \
-			sm_state_machine_no_state_change;                                  \
-		do {
-#define SM_STATE_MACHINE_TRANSITION_ADD(_event_, _guard_, _action_,            \
-										_next_state_)                          \
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_FN_ADD(                         \
+	_event_, _guard_, _action_, _next_state_, _no_guard_, _no_action_)         \
 	if (event->type == _event_) {                                              \
 		status = sm_state_machine_transition_def_helper_handle_event(          \
 			sm_handle, event, _guard_, _action_, _next_state_);                \
@@ -410,8 +732,8 @@ sm_state_machine_transition_def_helper_parent_handle_event(
 		}                                                                      \
 	}
 
-#define SM_STATE_MACHINE_TRANSITION_ADD_EX(_event_, _guard_, _action_,         \
-										   _next_state_)                       \
+#define SM_STATE_MACHINE_TRANSITION_FN_ADD_EX(_event_, _guard_, _action_,      \
+											  _next_state_)                    \
 	if (event->type == _event_) {                                              \
 		status = sm_state_machine_transition_def_helper_handle_event_ex(       \
 			sm_handle, event, (_guard_), (_action_), _next_state_);            \
@@ -419,46 +741,78 @@ sm_state_machine_transition_def_helper_parent_handle_event(
 			break;                                                             \
 		}                                                                      \
 	}
+#endif
+/**
+ * \brief Add a transition to a state, in a \ref
+ * SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+ * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*" block
+ *
+ * See #SM_STATE_MACHINE_TRANSITION_ADD.
+ */
+#define SM_STATE_MACHINE_TRANSITION_FN_ADD(_event_, _guard_, _action_,         \
+										   _next_state_)                       \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_FN_ADD(                             \
+		_event_, _guard_, _action_, _next_state_,                              \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_guard_),            \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_action_))
 
-#define SM_STATE_MACHINE_TRANSITION_DEF_END(_state_name_)                      \
+/* The parent states are handed the event by the state machine */
+#define SM_STATE_MACHINE_TRANSITION_FN_DEF_END(_state_name_)                   \
 	}                                                                          \
 	while (0)                                                                  \
 		;                                                                      \
-	if (status != sm_state_machine_no_state_change) {                          \
-		return status;                                                         \
-	}                                                                          \
-	return sm_state_machine_transition_def_helper_parent_handle_event(         \
-		sm_handle, event);                                                     \
+	return status;                                                             \
 	}                                                                          \
-	struct sm_state_transitions _state_name_##_transition = {                  \
-		.handle_event = _state_name_##_transition_fn,                          \
+	SM_STATE_MACHINE_TABLE_CONST struct sm_state_transitions                   \
+		_state_name_##_transition = {                                          \
+			.handle_event = _state_name_##_transition_fn,                      \
 	};
-#define SM_STATE_MACHINE_TRANSITION_GET(_state_name_) _state_name_##_transition
+
+#if SM_STATE_MACHINE_OPTIMIZE_RAM
+#define SM_STATE_MACHINE_TRANSITION_DEF_START(_state_name_)                    \
+	SM_STATE_MACHINE_TRANSITION_FN_DEF_START(_state_name_)
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ADD                             \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_FN_ADD
+#define SM_STATE_MACHINE_TRANSITION_ADD_EX(_event_, _guard_, _action_,         \
+										   _next_state_)                       \
+	SM_STATE_MACHINE_TRANSITION_FN_ADD_EX(_event_, _guard_, _action_,          \
+										  _next_state_)
+#define SM_STATE_MACHINE_TRANSITION_DEF_END(_state_name_)                      \
+	SM_STATE_MACHINE_TRANSITION_FN_DEF_END(_state_name_)
 #else
 /**
  * \brief Start the definition of transitions for a state
  */
 #define SM_STATE_MACHINE_TRANSITION_DEF_START(_state_name_)                    \
-	struct sm_transition _state_name_##_transition_array[] = {
-/**                                                                            \
- * \brief Add a transition to a state using shorthand notation: i.e. you just
- * have to pass the functions as guard and action, instead of using
- * #SM_STATE_MACHINE_GUARD and #SM_STATE_MACHINE_ACTION
- *
- * \param [in] event event
- * \param [in] guard guard function (type #sm_action_fn)
- * \param [in] action action function (type #sm_action_fn)
- * \param [in] next_state next state (type #sm_state *)
- */
-#define SM_STATE_MACHINE_TRANSITION_ADD(_event_, _guard_, _action_,            \
-										_next_state_)                          \
-	{_event_, _guard_ == NULL ? NULL : &SM_STATE_MACHINE_GUARD(_guard_),       \
-	 _action_ == NULL ? NULL : &SM_STATE_MACHINE_ACTION(_action_),             \
+	SM_STATE_MACHINE_TABLE_CONST struct sm_transition                          \
+		_state_name_##_transition_array[] = {
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ADD(                            \
+	_event_, _guard_, _action_, _next_state_, _no_guard_, _no_action_)         \
+	{_event_,                                                                  \
+	 SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(                               \
+		 SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_LITERAL_,                \
+		 _no_guard_)(_guard_),                                                 \
+	 SM_STATE_MACHINE_TRANSITION_DEF_HELPER_CAT(                               \
+		 SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_LITERAL_,               \
+		 _no_action_)(_action_),                                               \
 	 _next_state_},
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_LITERAL_0(_fn_)           \
+	(_fn_ == NULL ? NULL : &SM_STATE_MACHINE_GUARD(_fn_))
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_GUARD_LITERAL_1(_fn_) NULL
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_LITERAL_0(_fn_)          \
+	(_fn_ == NULL ? NULL : &SM_STATE_MACHINE_ACTION(_fn_))
+#define SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ACTION_LITERAL_1(_fn_) NULL
 
 /**                                                                            \
  * \brief Add a transition to a state.
  *
+ * In a function (#SM_STATE_MACHINE_TRANSITION_FN_ADD_EX, or with
+ * #SM_STATE_MACHINE_OPTIMIZE_RAM) and with either the logs or the traces
+ * enabled, \p guard and \p action must be address constants, e.g. objects
+ * defined with #SM_STATE_MACHINE_GUARD_DEF and #SM_STATE_MACHINE_ACTION_DEF.
+ *
  * \param [in] event event
  * \param [in] guard guard function (type #sm_action *)
  * \param [in] action action function (type #sm_action *)
@@ -473,18 +827,71 @@ sm_state_machine_transition_def_helper_parent_handle_event(
 #define SM_STATE_MACHINE_TRANSITION_DEF_END(_state_name_)                      \
 	}                                                                          \
 	;                                                                          \
-	struct sm_state_transitions _state_name_##_transition = {                  \
-		.transitions = _state_name_##_transition_array,                        \
-		.num_transitions = sizeof(_state_name_##_transition_array) /           \
-						   sizeof(struct sm_transition),                       \
+	SM_STATE_MACHINE_TABLE_CONST struct sm_state_transitions                   \
+		_state_name_##_transition = {                                          \
+			.transitions = _state_name_##_transition_array,                    \
+			.num_transitions = sizeof(_state_name_##_transition_array) /       \
+							   sizeof(struct sm_transition),                   \
 	};
+#endif
+/**
+ * \brief Add a transition to a state using shorthand notation: i.e. you just
+ * have to pass the functions as guard and action, instead of using
+ * #SM_STATE_MACHINE_GUARD and #SM_STATE_MACHINE_ACTION
+ *
+ * \param [in] event event
+ * \param [in] guard guard function (type #sm_action_fn), or NULL
+ * \param [in] action action function (type #sm_action_fn), or NULL
+ * \param [in] next_state next state (type #sm_state *)
+ */
+#define SM_STATE_MACHINE_TRANSITION_ADD(_event_, _guard_, _action_,            \
+										_next_state_)                          \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ADD(                                \
+		_event_, _guard_, _action_, _next_state_,                              \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_guard_),            \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_action_))
 /**
  * \brief Get the state transition defined with \ref
  * SM_STATE_MACHINE_TRANSITION_DEF_START "SM_STATE_MACHINE_TRANSITION_DEF_*"
- * macros
+ * or \ref SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+ * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*" macros
  */
 #define SM_STATE_MACHINE_TRANSITION_GET(_state_name_) _state_name_##_transition
-#endif
+
+/**
+ * \brief Add a completion transition to a state
+ *
+ * Completion transitions must be defined in their own \ref
+ * SM_STATE_MACHINE_TRANSITION_DEF_START "SM_STATE_MACHINE_TRANSITION_DEF_*"
+ * block, which is then referenced by sm_state::completion_transitions.
+ *
+ * \param [in] guard guard function (type #sm_guard_fn). May be NULL.
+ * \param [in] action action function (type #sm_action_fn). May be NULL.
+ * \param [in] next_state next state (type #sm_state *)
+ */
+#define SM_STATE_MACHINE_COMPLETION_TRANSITION_ADD(_guard_, _action_,          \
+												   _next_state_)               \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_ADD(                                \
+		SM_STATE_MACHINE_EVENT_COMPLETION, _guard_, _action_, _next_state_,    \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_guard_),            \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_action_))
+/**
+ * \brief Add a completion transition to a state, in a \ref
+ * SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+ * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*" block
+ */
+#define SM_STATE_MACHINE_COMPLETION_TRANSITION_FN_ADD(_guard_, _action_,       \
+													  _next_state_)            \
+	SM_STATE_MACHINE_TRANSITION_DEF_HELPER_FN_ADD(                             \
+		SM_STATE_MACHINE_EVENT_COMPLETION, _guard_, _action_, _next_state_,    \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_guard_),            \
+		SM_STATE_MACHINE_TRANSITION_DEF_HELPER_IS_NULL(                        \
+			SM_STATE_MACHINE_TRANSITION_DEF_HELPER_NULL_##_action_))
 
 /**
  * \brief State
@@ -522,9 +929,28 @@ sm_state_machine_transition_def_helper_parent_handle_event(
  * children chains. If such cycles are present, stateM_handleEvent() will
  * never finish due to never-ending loops.
  *
+ * ### Submachines ###
+ *
+ * With #SM_STATE_MACHINE_ENABLE_SUBMACHINES, a group of states can be defined
+ * once, as a #sm_submachine, and used by several states: its top level states
+ * have no parent state, and each state using it (a submachine state, see
+ * #submachine) acts as their parent. Entering a submachine state enters the
+ * \ref sm_submachine::initial_state "initial state" of the submachine; the
+ * events not handled within the submachine are passed to the submachine
+ * state and its parents. Each state machine remembers the submachine states
+ * it is nested in (see sm_state_machine_submachine_states()), so the states
+ * and the transition tables of the submachine are shared by all its uses.
+ *
+ * A state of a submachine without transitions doesn't terminate the state
+ * machine: the events are still passed to the submachine state.
+ * The submachine states aren't saved with the current state by sm_shared,
+ * sm_wal and sm_hot_swap: there, an instance must not be inside a submachine
+ * when it is stored, snapshotted or migrated.
+ *
  * ### Final state ###
  * A final state is a state that terminates the state machine. A state is
- * considered as a final state if its #numTransitions is 0:
+ * considered as a final state if its #numTransitions is 0 and none of its
+ * #completion_transitions, if any, was taken when it was entered:
  * ~~~{.c}
  * struct state finalState = {
  *    .transitions = NULL,
@@ -548,16 +974,36 @@ struct sm_state {
 	/**
 	 * \brief If the state has a parent state, this pointer must be non-NULL.
 	 */
-	struct sm_state *parent_state;
+	const struct sm_state *parent_state;
 	/**
 	 * \brief If this state is a parent state, this pointer may point to a
 	 * child state that serves as an entry point.
 	 */
-	struct sm_state *entry_state;
+	const struct sm_state *entry_state;
 	/**
 	 * \brief Transitions defined for the current state
 	 */
-	struct sm_state_transitions *transitions;
+	const struct sm_state_transitions *transitions;
+	/**
+	 * \brief Completion transitions of the state. May be NULL.
+	 *
+	 * Completion transitions have no triggering event: they are evaluated, in
+	 * order, as soon as the state has been entered by
+	 * sm_state_machine_handle_event(), and the first one whose guard accepts
+	 * is taken. Completion transitions can be chained up to
+	 * #SM_STATE_MACHINE_MAX_COMPLETION_CHAIN times within a single event: if
+	 * the state reached then would still take one, the error state is entered
+	 * instead (the guards of a table are evaluated, the transition isn't
+	 * taken).
+	 *
+	 * Unlike regular #transitions, completion transitions are not inherited
+	 * from the parent states, and they are not evaluated when the state
+	 * returns to itself.
+	 *
+	 * Use #SM_STATE_MACHINE_COMPLETION_TRANSITION_ADD to define them. States
+	 * that leave this NULL don't pay any cost for the feature.
+	 */
+	const struct sm_state_transitions *completion_transitions;
 	/**
 	 * \brief This action is executed whenever the state is being entered. May
 	 * be NULL.
@@ -568,7 +1014,7 @@ struct sm_state {
 	 * \note A group/parent state with its #entry_state defined will not have
 	 * its #entry_action called.
 	 */
-	struct sm_action *entry_action;
+	const struct sm_action *entry_action;
 	/**
 	 * \brief This action is called whenever the state is being left. May be
 	 * NULL.
@@ -576,8 +1022,30 @@ struct sm_state {
 	 * \note If a state returns to itself through a transition (either directly
 	 * or through a parent/group sate), its #exit_action will not be called.
 	 */
-	struct sm_action *exit_action;
+	const struct sm_action *exit_action;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/**
+	 * \brief Submachine nested in this state, entered in place of
+	 * #entry_state. May be NULL.
+	 */
+	const struct sm_submachine *submachine;
+#endif
+};
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+/**
+ * \brief Group of states shared by several parent states
+ *
+ * See \ref sm_state "Submachines".
+ */
+struct sm_submachine {
+	/**
+	 * \brief State entered when a state using the submachine is entered.
+	 * The top level states of the submachine have no parent state.
+	 */
+	const struct sm_state *initial_state;
 };
+#endif
 
 /**
  * \brief Utility macro that you can use to conditionally add the name field in
@@ -592,6 +1060,53 @@ struct sm_state {
 #define SM_STATE_MACHINE_STATE_NAME(_state_name_) .parent_state = NULL
 #endif
 
+#if SM_STATE_MACHINE_ENABLE_TRACE
+/**
+ * \brief Tracing hooks
+ *
+ * Every callback is optional and receives the #context.
+ *
+ * \sa sm_state_machine_hooks::tracer
+ */
+struct sm_state_machine_tracer {
+	/** \brief Passed as is to every callback */
+	void *context;
+	/** \brief Called before an event is dispatched */
+	void (*event_begin)(void *context,
+						const struct sm_state_machine *state_machine,
+						const struct sm_event *event);
+	/**
+	 * \brief Called after a transition has been taken
+	 *
+	 * \p state is the state the transition is defined in: either the
+	 * previous state or one of its parents. If the transitions are defined as
+	 * functions (#SM_STATE_MACHINE_OPTIMIZE_RAM), \p transition is a read-only
+	 * copy of the transition, with the same address at every call.
+	 */
+	void (*transition_taken)(void *context,
+							 const struct sm_state_machine *state_machine,
+							 const struct sm_event *event,
+							 const struct sm_state *state,
+							 const struct sm_transition *transition);
+	/** \brief Called after an event has been dispatched */
+	void (*event_end)(void *context,
+					  const struct sm_state_machine *state_machine,
+					  const struct sm_event *event, int status);
+	/**
+	 * \brief Called after the current state has been replaced, also by
+	 * itself
+	 *
+	 * Unlike #transition_taken, \p current_state is the leaf state actually
+	 * entered. Called as well for each completion transition, for the entries
+	 * in the error state and when an asynchronous action completes.
+	 */
+	void (*state_changed)(void *context,
+						  const struct sm_state_machine *state_machine,
+						  const struct sm_state *previous_state,
+						  const struct sm_state *current_state);
+};
+#endif
+
 /**
  * \brief State machine hooks
  *
@@ -615,6 +1130,12 @@ struct sm_state_machine_hooks {
 	 */
 	void *(*state_data_mapper)(const struct sm_state *state,
 							   void *state_user_data);
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	/**
+	 * \brief Tracing hooks. May be NULL.
+	 */
+	struct sm_state_machine_tracer *tracer;
+#endif
 };
 
 /**
@@ -624,12 +1145,8 @@ struct sm_state_machine_hooks {
  * members directly.
  */
 struct sm_state_machine {
-#if SM_STATE_MACHINE_ENABLE_LOG
-	/**
-	 * \brief Name that can be used for logging and debugging
-	 */
-	const char *name;
-#endif
+	/* The members written by every transition come first, so that they share
+	 * a cache line; the read-mostly ones follow */
 	/** \brief Pointer to the current state */
 	const struct sm_state *current_state;
 	/**
@@ -661,6 +1178,69 @@ struct sm_state_machine {
 	 * \brief See
 	 */
 	void *state_data;
+#if SM_STATE_MACHINE_ENABLE_LOG
+	/**
+	 * \brief Name that can be used for logging and debugging
+	 */
+	const char *name;
+#endif
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	/**
+	 * \brief Transition whose asynchronous action hasn't completed yet
+	 */
+	struct sm_state_machine_transit {
+		/** \brief Next state of the transition. NULL if not in transit. */
+		const struct sm_state *next_state;
+		/** \brief Copy of the event that triggered the transition */
+		struct sm_event event;
+		/** \brief Identifies the transition, see sm_async_completion::id */
+		unsigned int id;
+		/** \brief The asynchronous action is being started */
+		bool starting;
+		/** \brief The action completed before returning */
+		bool completed;
+		/** \brief See sm_state_machine_set_transit_policy() */
+		enum sm_state_machine_transit_policy policy;
+		/** \brief Events queued while in transit (circular buffer) */
+		struct sm_event queue[SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE];
+		/** \brief Index of the oldest queued event */
+		size_t queue_head;
+		/** \brief Number of queued events */
+		size_t queue_count;
+	} transit;
+#endif
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/**
+	 * \brief Submachine states the current state is nested in, the
+	 * outermost first
+	 */
+	const struct sm_state
+		*submachine_states[SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH];
+	/** \brief Number of valid #submachine_states */
+	size_t submachine_depth;
+#endif
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+	/** \brief Timestamp of the entry in the current state */
+	uint64_t entered_at;
+	/**
+	 * \brief Time spent in the state left by the last change of state, see
+	 * sm_state_machine_time_in_previous_state()
+	 */
+	uint64_t previous_state_time;
+#endif
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	/**
+	 * \brief States published for sm_state_machine_get_snapshot(),
+	 * protected by a sequence lock: #sequence is odd while they are being
+	 * written, and twice the number of transitions otherwise. Being
+	 * atomic, they make #sm_state_machine not copyable in C++.
+	 */
+	struct sm_state_machine_published {
+		SM_ATOMIC(unsigned long) sequence;
+		SM_ATOMIC(const struct sm_state *) current_state;
+		SM_ATOMIC(const struct sm_state *) previous_state;
+	} published;
+#endif
 };
 
 /**
@@ -690,12 +1270,13 @@ struct sm_state_machine {
  * \param [in] state_data pointer to user defined state data. Portion of the
  * data will be passed to every action and guard.
  */
-void sm_state_machine_init(struct sm_state_machine *state_machine,
-						   const char *state_machine_name,
-						   const struct sm_state *initial_state,
-						   const struct sm_state *error_state,
-						   struct sm_state_machine_hooks *hooks,
-						   void *user_data, void *state_data);
+SM_STATE_MACHINE_API void
+sm_state_machine_init(struct sm_state_machine *state_machine,
+					  const char *state_machine_name,
+					  const struct sm_state *initial_state,
+					  const struct sm_state *error_state,
+					  struct sm_state_machine_hooks *hooks,
+					  void *user_data, void *state_data);
 
 /**
  * \brief Utility macro that reduces the boilerplate code required for ref
@@ -736,13 +1317,38 @@ void sm_state_machine_init(struct sm_state_machine *state_machine,
  *
  * The returned value is negative if an error occurs.
  *
+ * If the transition completes events queued while in transit (see
+ * #sm_state_machine_transit_queue), they are handled before returning; the
+ * first of them that reaches the error state, a final state or starts another
+ * asynchronous action overrides the returned value, as for
+ * sm_state_machine_complete_async_action().
+ *
+ * \param state_machine the state machine to pass an event to.
+ * \param event the event to be handled.
+ *
+ * \return #stateM_handleEventRetVals
+ */
+SM_STATE_MACHINE_API int
+sm_state_machine_handle_event(struct sm_state_machine *state_machine,
+							  const struct sm_event *event);
+
+/**
+ * \brief Pass an event to a state machine whose definition has been verified
+ *
+ * Same as sm_state_machine_handle_event(), but the arguments and the
+ * transition tables are not validated: \p state_machine and \p event must not
+ * be NULL, the state machine must have a current state and every transition
+ * must define its next state. Use this function only for definitions that
+ * passed the verification of sm_verify() (see sm_utils.hpp), e.g. through the
+ * `sm_state_machine_add_verification()` CMake function.
+ *
  * \param state_machine the state machine to pass an event to.
  * \param event the event to be handled.
  *
  * \return #stateM_handleEventRetVals
  */
-int sm_state_machine_handle_event(struct sm_state_machine *state_machine,
-								  const struct sm_event *event);
+SM_STATE_MACHINE_API int sm_state_machine_handle_event_trusted(
+	struct sm_state_machine *state_machine, const struct sm_event *event);
 
 /**
  * \brief Get the current state
@@ -752,7 +1358,7 @@ int sm_state_machine_handle_event(struct sm_state_machine *state_machine,
  * \retval a pointer to the current state.
  * \retval NULL if \pn{state_machine} is NULL.
  */
-const struct sm_state *
+SM_STATE_MACHINE_API const struct sm_state *
 sm_state_machine_current_state(const struct sm_state_machine *state_machine);
 
 /**
@@ -764,9 +1370,106 @@ sm_state_machine_current_state(const struct sm_state_machine *state_machine);
  * \retval NULL if \pn{state_machine} is NULL.
  * \retval NULL if there has not yet been any transitions.
  */
-const struct sm_state *
+SM_STATE_MACHINE_API const struct sm_state *
 sm_state_machine_previous_state(const struct sm_state_machine *state_machine);
 
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+/**
+ * \brief Consistent view of a state machine, see
+ * sm_state_machine_get_snapshot()
+ */
+struct sm_state_machine_snapshot {
+	/** \brief Current state */
+	const struct sm_state *current_state;
+	/** \brief Previous state, NULL before the first transition */
+	const struct sm_state *previous_state;
+	/**
+	 * \brief Number of transitions since sm_state_machine_init(), the
+	 * entries in the error state and the calls to
+	 * sm_state_machine_set_states() included. Wraps around.
+	 */
+	unsigned long transitions;
+};
+
+/**
+ * \brief Read the current and previous state from any thread
+ *
+ * Unlike sm_state_machine_current_state() and
+ * sm_state_machine_previous_state(), this function may be called while
+ * another thread dispatches events: the two states are always those of the
+ * same transition. The dispatching thread is never blocked; the reader retries
+ * only if it overlaps with the few stores that publish a transition.
+ *
+ * States assigned outside of a dispatch (e.g. by sm_hot_swap_migrate() or
+ * sm_shared_load()) are published by sm_state_machine_set_states().
+ *
+ * \param [in] state_machine -
+ * \param [out] snapshot -
+ */
+SM_STATE_MACHINE_API void
+sm_state_machine_get_snapshot(const struct sm_state_machine *state_machine,
+							  struct sm_state_machine_snapshot *snapshot);
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+#if SM_STATE_MACHINE_TIMESTAMP_CLOCK == SM_STATE_MACHINE_CLOCK_USER
+/**
+ * \brief Clock of the timestamps, defined by the application
+ *
+ * Must be monotonic, and cheap: it is read at every change of state.
+ */
+uint64_t sm_state_machine_user_clock(void);
+#endif
+
+/**
+ * \brief Read the clock of the timestamps, see
+ * #SM_STATE_MACHINE_TIMESTAMP_CLOCK
+ */
+SM_STATE_MACHINE_API uint64_t sm_state_machine_timestamp(void);
+
+/**
+ * \brief Timestamp of the entry in the current state
+ *
+ * Taken after the entry actions, when the current state is replaced. A self
+ * loop doesn't enter the state again, and states assigned outside of a
+ * dispatch (e.g. by sm_hot_swap_migrate() or sm_shared_load()) keep the
+ * timestamp of the previous one.
+ */
+SM_STATE_MACHINE_API uint64_t
+sm_state_machine_entered_at(const struct sm_state_machine *state_machine);
+
+/**
+ * \brief Time spent in the current state so far, in units of
+ * #SM_STATE_MACHINE_TIMESTAMP_CLOCK
+ */
+SM_STATE_MACHINE_API uint64_t
+sm_state_machine_time_in_state(const struct sm_state_machine *state_machine);
+
+/**
+ * \brief Time spent in the state left by the last change of state, e.g. in a
+ * tracer's sm_state_machine_tracer::state_changed. 0 before the first one.
+ */
+SM_STATE_MACHINE_API uint64_t sm_state_machine_time_in_previous_state(
+	const struct sm_state_machine *state_machine);
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+/**
+ * \brief Submachine states the current state is nested in
+ *
+ * Tell apart the uses of a submachine, whose states are shared.
+ *
+ * \param [in] state_machine -
+ * \param [out] depth number of submachine states, 0 if the current state isn't
+ * in a submachine
+ *
+ * \returns the submachine states, the outermost first
+ */
+SM_STATE_MACHINE_API const struct sm_state *const *
+sm_state_machine_submachine_states(const struct sm_state_machine *state_machine,
+								   size_t *depth);
+#endif
+
 /**
  * \brief Check if the state machine has stopped
  *
@@ -776,7 +1479,78 @@ sm_state_machine_previous_state(const struct sm_state_machine *state_machine);
  * \retval false if \pn{state_machine} is NULL or if the current state is not a
  * final state.
  */
-bool sm_state_machine_stopped(struct sm_state_machine *state_machine);
+SM_STATE_MACHINE_API bool
+sm_state_machine_stopped(struct sm_state_machine *state_machine);
+
+/**
+ * \brief Assign the current and previous states outside of a dispatch
+ *
+ * For the modules that migrate, load or restore instances (sm_hot_swap.h,
+ * sm_pool.h, sm_shared.h, sm_wal.h), not for the applications: the states
+ * are published to sm_state_machine_get_snapshot() like those of a
+ * transition, and no action is run. The timestamps are left as they are.
+ * The states are top level ones: the state machine is no longer inside a
+ * submachine (#SM_STATE_MACHINE_ENABLE_SUBMACHINES).
+ *
+ * \param state_machine -
+ * \param current_state -
+ * \param previous_state may be NULL
+ */
+SM_STATE_MACHINE_API void
+sm_state_machine_set_states(struct sm_state_machine *state_machine,
+							const struct sm_state *current_state,
+							const struct sm_state *previous_state);
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+/**
+ * \brief Complete the asynchronous action of a transition
+ *
+ * Executes the entry actions and enters the next state of the transition
+ * (followed by its completion transitions, if any), then handles the events
+ * queued while in transit. May be called from within the action itself.
+ *
+ * Not thread-safe: it dispatches events like sm_state_machine_handle_event(),
+ * so it must be called by the thread that handles the events of the state
+ * machine, never concurrently with it. An action whose I/O completes on
+ * another thread must hand \p completion over to that thread, e.g. through
+ * the event queue the thread reads from (see sm_dispatcher_post_completion()).
+ *
+ * \param completion the handle passed to the #sm_async_action_fn
+ *
+ * \retval #sm_state_machine_error_arg if \p completion doesn't refer to the
+ * pending transition, e.g. because it has already been completed
+ * \retval the first of #sm_state_machine_error_state_reached,
+ * #sm_state_machine_final_state_reached and
+ * #sm_state_machine_transition_pending returned by a queued event, if any
+ * \retval the outcome of the transition otherwise, as returned by
+ * sm_state_machine_handle_event() for synchronous actions
+ */
+SM_STATE_MACHINE_API int sm_state_machine_complete_async_action(
+	struct sm_async_completion completion);
+
+/**
+ * \brief Check if the state machine is waiting for an asynchronous action
+ *
+ * \param state_machine -
+ *
+ * \retval true if a transition is pending
+ * \retval false otherwise, or if \pn{state_machine} is NULL
+ */
+SM_STATE_MACHINE_API bool
+sm_state_machine_in_transit(const struct sm_state_machine *state_machine);
+
+/**
+ * \brief Choose how to handle the events that arrive while in transit
+ *
+ * The default policy is #sm_state_machine_transit_reject.
+ *
+ * \param state_machine -
+ * \param policy -
+ */
+SM_STATE_MACHINE_API void sm_state_machine_set_transit_policy(
+	struct sm_state_machine *state_machine,
+	enum sm_state_machine_transit_policy policy);
+#endif
 
 #if SM_STATE_MACHINE_ENABLE_LOG
 /**
@@ -786,7 +1560,7 @@ bool sm_state_machine_stopped(struct sm_state_machine *state_machine);
  *
  * \returns the name passed during initialization. May be NULL.
  */
-const char *
+SM_STATE_MACHINE_API const char *
 sm_state_machine_get_name(const struct sm_state_machine *state_machine);
 #endif
 
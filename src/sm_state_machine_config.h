@@ -23,6 +23,14 @@
 #define SM_STATE_MACHINE_ENABLE_LOG 1u
 #endif
 
+#ifndef SM_STATE_MACHINE_ENABLE_TRACE
+/**
+ * Whether to enable the tracing hooks (see sm_state_machine_hooks::tracer),
+ * used e.g. to profile the state machine at run time
+ */
+#define SM_STATE_MACHINE_ENABLE_TRACE 0u
+#endif
+
 #ifndef SM_STATE_MACHINE_OPTIMIZE_RAM
 /**
  * Whether to enable RAM optimization by constructing transition functions
@@ -34,4 +42,143 @@
 #define SM_STATE_MACHINE_OPTIMIZE_RAM 0u
 #endif
 
+#ifndef SM_STATE_MACHINE_CONST_TABLES
+/**
+ * Whether the objects defined by the \ref SM_STATE_MACHINE_TRANSITION_DEF_START
+ * "SM_STATE_MACHINE_TRANSITION_DEF_*", #SM_STATE_MACHINE_GUARD and
+ * #SM_STATE_MACHINE_ACTION macros are const, so that they can be placed in
+ * read-only memory (flash) instead of being copied to RAM.
+ *
+ * The tables are never modified at run time: to reorder them, see
+ * sm_get_transition_tables_source() (sm_utils.hpp).
+ */
+#define SM_STATE_MACHINE_CONST_TABLES 1u
+#endif
+
+#ifndef SM_STATE_MACHINE_MAX_COMPLETION_CHAIN
+/**
+ * Maximum number of completion transitions that a single call to
+ * sm_state_machine_handle_event() may chain.
+ *
+ * If the state reached after this many completion transitions still has
+ * completion transitions, the state machine is considered to be in a livelock
+ * and enters the error state.
+ */
+#define SM_STATE_MACHINE_MAX_COMPLETION_CHAIN 8u
+#endif
+
+#ifndef SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+/**
+ * Whether transition actions may be asynchronous (see sm_async_action_fn)
+ */
+#define SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS 0u
+#endif
+
+#ifndef SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE
+/**
+ * Number of events that a state machine can queue while waiting for an
+ * asynchronous action (see sm_state_machine_transit_queue)
+ */
+#define SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE 4u
+#endif
+
+#ifndef SM_STATE_MACHINE_ENABLE_SNAPSHOT
+/**
+ * Whether each transition publishes the current and previous state for
+ * sm_state_machine_get_snapshot(), so that other threads can read them
+ */
+#define SM_STATE_MACHINE_ENABLE_SNAPSHOT 0u
+#endif
+
+#ifndef SM_STATE_MACHINE_ENABLE_TIMESTAMPS
+/**
+ * Whether each state machine records when it entered its current state, see
+ * sm_state_machine_time_in_state()
+ */
+#define SM_STATE_MACHINE_ENABLE_TIMESTAMPS 0u
+#endif
+
+/**
+ * \brief Monotonic clock, coarse where available (CLOCK_MONOTONIC_COARSE on
+ * Linux), in nanoseconds. POSIX only: the single header build must be included
+ * with POSIX enabled, e.g. `_POSIX_C_SOURCE`.
+ */
+#define SM_STATE_MACHINE_CLOCK_MONOTONIC 1u
+/**
+ * \brief Time stamp counter of the CPU (x86 TSC, AArch64 virtual counter), in
+ * ticks. Must be invariant, and synchronised among the cores if the state
+ * machines migrate between threads.
+ */
+#define SM_STATE_MACHINE_CLOCK_TSC 2u
+/**
+ * \brief sm_state_machine_user_clock(), defined by the application, e.g. a
+ * hardware timer
+ */
+#define SM_STATE_MACHINE_CLOCK_USER 3u
+
+#ifndef SM_STATE_MACHINE_TIMESTAMP_CLOCK
+/**
+ * Clock of the timestamps (#SM_STATE_MACHINE_ENABLE_TIMESTAMPS): one of
+ * #SM_STATE_MACHINE_CLOCK_MONOTONIC, #SM_STATE_MACHINE_CLOCK_TSC and
+ * #SM_STATE_MACHINE_CLOCK_USER
+ */
+#define SM_STATE_MACHINE_TIMESTAMP_CLOCK SM_STATE_MACHINE_CLOCK_MONOTONIC
+#endif
+
+#ifndef SM_STATE_MACHINE_ENABLE_SUBMACHINES
+/**
+ * Whether states may use a submachine (see sm_state::submachine): a group of
+ * states defined once and nested in several parent states
+ */
+#define SM_STATE_MACHINE_ENABLE_SUBMACHINES 0u
+#endif
+
+#ifndef SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH
+/**
+ * Maximum number of submachines nested in one another
+ * (#SM_STATE_MACHINE_ENABLE_SUBMACHINES). Each state machine keeps this many
+ * pointers. Entering one more submachine enters the error state.
+ */
+#define SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH 4u
+#endif
+
+#ifndef SM_STATE_MACHINE_CACHE_LINE_SIZE
+/**
+ * Size of a cache line of the target, used to keep data written by different
+ * threads on different cache lines
+ */
+#define SM_STATE_MACHINE_CACHE_LINE_SIZE 64u
+#endif
+
+#ifndef SM_STATE_MACHINE_PAGE_SIZE
+/**
+ * Size of a memory page, in bytes. Used to place the partitions of a fleet
+ * (see sm_fleet) on the NUMA node of their owner.
+ */
+#define SM_STATE_MACHINE_PAGE_SIZE 4096u
+#endif
+
+#ifndef SM_STATE_MACHINE_INBOX_SIZE
+/**
+ * Number of events that an inbox (see sm_inbox) can hold. Must be a power of
+ * 2.
+ */
+#define SM_STATE_MACHINE_INBOX_SIZE 256u
+#endif
+
+#ifndef SM_STATE_MACHINE_INBOX_LANES
+/**
+ * Number of priority lanes of an inbox (see sm_inbox). With a single lane, the
+ * inbox is a plain FIFO.
+ */
+#define SM_STATE_MACHINE_INBOX_LANES 1u
+#endif
+
+#ifndef SM_STATE_MACHINE_EVENT_INLINE_PAYLOAD_SIZE
+/**
+ * Size of the payload buffer embedded in #sm_event_inline
+ */
+#define SM_STATE_MACHINE_EVENT_INLINE_PAYLOAD_SIZE 48u
+#endif
+
 #endif /* ifndef SM_STATE_MACHINE_CONFIG_H_ */
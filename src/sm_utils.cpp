@@ -16,5 +16,831 @@
 
 #include "sm_utils.hpp"
 
-std::string sm_get_plantuml_representation(struct sm_state *initial_state) {
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+/**
+ * States of a definition, in the order they are discovered by a traversal
+ * from the initial state
+ */
+struct state_graph {
+	std::vector<const struct sm_state *> states;
+	std::unordered_map<const struct sm_state *, size_t> ids;
+	/* The submachine each state belongs to, nullptr for the top level */
+	std::unordered_map<const struct sm_state *, const struct sm_submachine *>
+		owners;
+};
+
+/**
+ * Transition together with the state it is defined in
+ */
+struct graph_transition {
+	const struct sm_state *state;
+	const struct sm_transition *transition;
+	bool completion;
+};
+
+state_graph collect_states(const struct sm_state *initial_state,
+						   const struct sm_state *error_state) {
+	using owned_state =
+		std::pair<const struct sm_state *, const struct sm_submachine *>;
+	state_graph graph;
+	std::vector<owned_state> to_visit{{initial_state, nullptr},
+									  {error_state, nullptr}};
+	/* Depth first, but visiting the states in the order they are referenced */
+	std::reverse(to_visit.begin(), to_visit.end());
+
+	while (!to_visit.empty()) {
+		const struct sm_state *state = to_visit.back().first;
+		const struct sm_submachine *owner = to_visit.back().second;
+		to_visit.pop_back();
+		if (!state || graph.ids.count(state)) {
+			continue;
+		}
+		graph.ids.emplace(state, graph.states.size());
+		graph.states.push_back(state);
+		graph.owners.emplace(state, owner);
+
+		/* Entering a state activates its entry states, and being in a state
+		 * means being in all its parents */
+		std::vector<owned_state> next{{state->entry_state, owner},
+									  {state->parent_state, owner}};
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+		/* The states of a submachine are only reached through it */
+		if (state->submachine) {
+			next.push_back(
+				{state->submachine->initial_state, state->submachine});
+		}
+#endif
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+		for (const struct sm_state_transitions *transitions :
+			 {state->transitions, state->completion_transitions}) {
+			for (size_t i = 0; transitions && i < transitions->num_transitions;
+				 ++i) {
+				next.push_back({transitions->transitions[i].next_state, owner});
+			}
+		}
+#endif
+		to_visit.insert(to_visit.end(), next.rbegin(), next.rend());
+	}
+	return graph;
+}
+
+std::vector<graph_transition> collect_transitions(const state_graph &graph) {
+	std::vector<graph_transition> result;
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	for (const struct sm_state *state : graph.states) {
+		for (const struct sm_state_transitions *transitions :
+			 {state->transitions, state->completion_transitions}) {
+			for (size_t i = 0; transitions && i < transitions->num_transitions;
+				 ++i) {
+				result.push_back({state, &transitions->transitions[i],
+								  transitions ==
+									  state->completion_transitions});
+			}
+		}
+	}
+#else
+	(void)graph;
+#endif
+	return result;
+}
+
+std::string state_name(const struct sm_state *state) {
+	if (!state) {
+		return "(null)";
+	}
+#if SM_STATE_MACHINE_ENABLE_LOG
+	if (state->name) {
+		return state->name;
+	}
+#endif
+	std::ostringstream stream;
+	stream << static_cast<const void *>(state);
+	return stream.str();
+}
+
+std::string guard_name(const struct sm_guard *guard) {
+#if SM_STATE_MACHINE_ENABLE_LOG
+	if (guard->name) {
+		return guard->name;
+	}
+#else
+	(void)guard;
+#endif
+	return "guard";
+}
+
+std::string action_name(const struct sm_action *action) {
+#if SM_STATE_MACHINE_ENABLE_LOG
+	if (action->name) {
+		return action->name;
+	}
+#else
+	(void)action;
+#endif
+	return "action";
+}
+
+std::string transition_label(const graph_transition &transition,
+							 const sm_diagram_options &options) {
+	std::ostringstream stream;
+	const struct sm_transition *t = transition.transition;
+	if (!transition.completion) {
+		struct sm_event event = {t->event_type, nullptr};
+		const char *event_name =
+			options.stringify_event ? options.stringify_event(&event) : nullptr;
+		if (event_name) {
+			stream << event_name;
+		} else {
+			stream << t->event_type;
+		}
+	}
+	if (t->guard && t->guard->fn) {
+		stream << (transition.completion ? "[" : " [") << guard_name(t->guard)
+			   << "]";
+	}
+	if (t->action && t->action->fn) {
+		stream << " / " << action_name(t->action);
+	}
+	return stream.str();
+}
+
+/**
+ * Heat annotations of a diagram: hits, average latency and color
+ */
+class heat_painter {
+  public:
+	explicit heat_painter(const sm_heatmap *heatmap) : heatmap_(heatmap) {
+		if (!heatmap_) {
+			return;
+		}
+		for (const auto &heat : heatmap_->states) {
+			max_state_hits_ = std::max(max_state_hits_, heat.second.hits);
+		}
+		for (const auto &heat : heatmap_->transitions) {
+			max_transition_hits_ =
+				std::max(max_transition_hits_, heat.second.hits);
+		}
+	}
+
+	bool enabled() const {
+		return heatmap_ != nullptr;
+	}
+
+	const sm_heat *heat(const struct sm_state *state) const {
+		return find(heatmap_->states, state);
+	}
+
+	const sm_heat *heat(const struct sm_transition *transition) const {
+		return find(heatmap_->transitions, transition);
+	}
+
+	/* White when cold, red when as hot as the hottest state/transition */
+	std::string state_color(const sm_heat *heat) const {
+		return color(heat, max_state_hits_);
+	}
+
+	std::string transition_color(const sm_heat *heat) const {
+		return color(heat, max_transition_hits_);
+	}
+
+	static std::string annotation(const sm_heat *heat) {
+		std::ostringstream stream;
+		std::uint64_t hits = heat ? heat->hits : 0;
+		stream << hits << " hits";
+		if (hits) {
+			char latency[32];
+			std::snprintf(latency, sizeof(latency), ", %.1f us avg",
+						  std::chrono::duration<double, std::micro>(
+							  heat->latency)
+								  .count() /
+							  static_cast<double>(hits));
+			stream << latency;
+		}
+		return stream.str();
+	}
+
+  private:
+	template <typename Key>
+	static const sm_heat *
+	find(const std::unordered_map<const Key *, sm_heat> &map, const Key *key) {
+		auto it = map.find(key);
+		return it == map.end() ? nullptr : &it->second;
+	}
+
+	static std::string color(const sm_heat *heat, std::uint64_t max_hits) {
+		double ratio = heat && max_hits ? static_cast<double>(heat->hits) /
+											  static_cast<double>(max_hits)
+										: 0.0;
+		unsigned int cold = static_cast<unsigned int>(255.0 * (1.0 - ratio));
+		char color[8];
+		std::snprintf(color, sizeof(color), "#FF%02X%02X", cold, cold);
+		return color;
+	}
+
+	const sm_heatmap *heatmap_;
+	std::uint64_t max_state_hits_ = 0;
+	std::uint64_t max_transition_hits_ = 0;
+};
+
+std::string escape(const std::string &text) {
+	std::string result;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			result += '\\';
+		}
+		result += c;
+	}
+	return result;
+}
+
+/* The top level states of \p owner, if \p parent is nullptr */
+std::vector<const struct sm_state *>
+children_of(const state_graph &graph, const struct sm_state *parent,
+			const struct sm_submachine *owner = nullptr) {
+	std::vector<const struct sm_state *> children;
+	for (const struct sm_state *state : graph.states) {
+		if (state->parent_state == parent &&
+			(parent || graph.owners.at(state) == owner)) {
+			children.push_back(state);
+		}
+	}
+	return children;
+}
+
+/*
+ * The states drawn inside a state: its children, then the top level states
+ * of its submachine
+ */
+std::vector<const struct sm_state *>
+inner_states(const state_graph &graph, const struct sm_state *state) {
+	std::vector<const struct sm_state *> states = children_of(graph, state);
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	if (state->submachine) {
+		for (const struct sm_state *top :
+			 children_of(graph, nullptr, state->submachine)) {
+			states.push_back(top);
+		}
+	}
+#endif
+	return states;
+}
+
+/*
+ * A submachine is drawn inside each of its submachine states: the ids of its
+ * states are prefixed by the ids of the submachine states they are drawn in.
+ * Returns the prefixes of the states of \p owner.
+ */
+std::vector<std::string> instances_of(const state_graph &graph,
+									  const struct sm_submachine *owner,
+									  size_t depth = 0) {
+	if (!owner) {
+		return {""};
+	}
+	std::vector<std::string> prefixes;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* A submachine that contains itself is drawn down to the maximum depth */
+	if (depth == SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH) {
+		return prefixes;
+	}
+	for (const struct sm_state *state : graph.states) {
+		if (state->submachine != owner) {
+			continue;
+		}
+		for (const std::string &prefix :
+			 instances_of(graph, graph.owners.at(state), depth + 1)) {
+			prefixes.push_back(prefix + "S" +
+							   std::to_string(graph.ids.at(state)) + "_");
+		}
+	}
+#else
+	(void)graph;
+	(void)depth;
+#endif
+	return prefixes;
+}
+
+void verify_hierarchy(const struct sm_state *state,
+					  std::vector<sm_verify_issue> &issues) {
+	std::set<const struct sm_state *> visited;
+	for (const struct sm_state *parent = state; parent;
+		 parent = parent->parent_state) {
+		if (!visited.insert(parent).second) {
+			issues.push_back({sm_verify_parent_cycle, state, nullptr});
+			break;
+		}
+	}
+
+	if (state->entry_state && state->entry_state->parent_state != state) {
+		issues.push_back({sm_verify_entry_state_not_child, state, nullptr});
+	}
+	visited.clear();
+	for (const struct sm_state *entry = state; entry;
+		 entry = entry->entry_state) {
+		if (!visited.insert(entry).second) {
+			issues.push_back({sm_verify_entry_state_cycle, state, nullptr});
+			break;
+		}
+	}
+}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+void verify_transitions(const struct sm_state *state,
+						const struct sm_state_transitions *transitions,
+						std::vector<sm_verify_issue> &issues) {
+	if (!transitions) {
+		return;
+	}
+	for (size_t i = 0; i < transitions->num_transitions; ++i) {
+		const struct sm_transition *transition = &transitions->transitions[i];
+		if (!transition->next_state) {
+			issues.push_back({sm_verify_missing_next_state, state, transition});
+		}
+		for (size_t j = 0; j < i; ++j) {
+			const struct sm_transition *previous =
+				&transitions->transitions[j];
+			if (previous->event_type == transition->event_type &&
+				(!previous->guard || !previous->guard->fn)) {
+				issues.push_back(
+					{sm_verify_shadowed_transition, state, transition});
+				break;
+			}
+		}
+	}
+}
+#endif
+} // namespace
+
+std::string
+sm_get_plantuml_representation(const struct sm_state *initial_state,
+							   const sm_diagram_options &options) {
+	const state_graph graph = collect_states(initial_state, nullptr);
+	const heat_painter painter(options.heatmap);
+	std::ostringstream out;
+
+	auto id = [&graph](const struct sm_state *state) {
+		return "S" + std::to_string(graph.ids.at(state));
+	};
+
+	std::function<void(const struct sm_state *, const std::string &,
+					   const std::string &, size_t)>
+		emit_state = [&](const struct sm_state *state,
+						 const std::string &indent, const std::string &prefix,
+						 size_t depth) {
+			const std::string state_id = prefix + id(state);
+			out << indent << "state \"" << escape(state_name(state))
+				<< "\" as " << state_id;
+			if (painter.enabled()) {
+				out << " " << painter.state_color(painter.heat(state));
+			}
+			std::vector<const struct sm_state *> children =
+				children_of(graph, state);
+			const struct sm_state *entry_state =
+				graph.ids.count(state->entry_state) ? state->entry_state
+													: nullptr;
+			bool submachine = false;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+			/* The submachine is entered instead of the entry state */
+			if (state->submachine &&
+				depth < SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH) {
+				submachine = true;
+				entry_state = state->submachine->initial_state;
+			}
+#endif
+			if (!children.empty() || submachine) {
+				out << " {\n";
+				for (const struct sm_state *child : children) {
+					emit_state(child, indent + "\t", prefix, depth);
+				}
+				std::string entry_prefix = prefix;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+				if (submachine) {
+					entry_prefix = state_id + "_";
+					for (const struct sm_state *top :
+						 children_of(graph, nullptr, state->submachine)) {
+						emit_state(top, indent + "\t", entry_prefix,
+								   depth + 1);
+					}
+				}
+#endif
+				if (entry_state) {
+					out << indent << "\t[*] --> " << entry_prefix
+						<< id(entry_state) << "\n";
+				}
+				out << indent << "}";
+			}
+			out << "\n";
+			if (state->entry_action && state->entry_action->fn) {
+				out << indent << state_id << " : entry / "
+					<< action_name(state->entry_action) << "\n";
+			}
+			if (state->exit_action && state->exit_action->fn) {
+				out << indent << state_id << " : exit / "
+					<< action_name(state->exit_action) << "\n";
+			}
+			if (painter.enabled()) {
+				out << indent << state_id << " : "
+					<< heat_painter::annotation(painter.heat(state)) << "\n";
+			}
+		};
+
+	out << "@startuml\n";
+	for (const struct sm_state *state : children_of(graph, nullptr)) {
+		emit_state(state, "", "", 0);
+	}
+	out << "[*] --> " << id(initial_state) << "\n";
+	for (const graph_transition &transition : collect_transitions(graph)) {
+		const struct sm_state *next_state = transition.transition->next_state;
+		if (!next_state) {
+			continue;
+		}
+		std::string label = transition_label(transition, options);
+		std::string color;
+		if (painter.enabled()) {
+			const sm_heat *heat = painter.heat(transition.transition);
+			color = "[" + painter.transition_color(heat) +
+					(heat && heat->hits ? ",bold" : "") + "]";
+			label += (label.empty() ? "" : "\\n") +
+					 heat_painter::annotation(heat);
+		}
+		/* Once in each submachine state of its submachine */
+		for (const std::string &prefix :
+			 instances_of(graph, graph.owners.at(transition.state))) {
+			out << prefix << id(transition.state) << " -" << color << "-> "
+				<< prefix << id(next_state);
+			if (!label.empty()) {
+				out << " : " << label;
+			}
+			out << "\n";
+		}
+	}
+	out << "@enduml\n";
+	return out.str();
+}
+
+std::string
+sm_get_graphviz_representation(const struct sm_state *initial_state,
+							   const sm_diagram_options &options) {
+	const state_graph graph = collect_states(initial_state, nullptr);
+	const heat_painter painter(options.heatmap);
+	std::ostringstream out;
+
+	auto id = [&graph](const struct sm_state *state) {
+		return "S" + std::to_string(graph.ids.at(state));
+	};
+	auto is_parent = [&graph](const struct sm_state *state) {
+		return !inner_states(graph, state).empty();
+	};
+	auto label = [&](const struct sm_state *state) {
+		std::string text = escape(state_name(state));
+		if (state->entry_action && state->entry_action->fn) {
+			text += "\\nentry / " + escape(action_name(state->entry_action));
+		}
+		if (state->exit_action && state->exit_action->fn) {
+			text += "\\nexit / " + escape(action_name(state->exit_action));
+		}
+		if (painter.enabled()) {
+			text += "\\n" + heat_painter::annotation(painter.heat(state));
+		}
+		return text;
+	};
+
+	std::function<void(const struct sm_state *, const std::string &,
+					   const std::string &, size_t)>
+		emit_state = [&](const struct sm_state *state,
+						 const std::string &indent, const std::string &prefix,
+						 size_t depth) {
+			const std::string state_id = prefix + id(state);
+			std::string color =
+				painter.enabled() ? painter.state_color(painter.heat(state))
+								  : std::string("white");
+			if (!is_parent(state)) {
+				out << indent << state_id << " [label=\"" << label(state)
+					<< "\", fillcolor=\"" << color << "\"];\n";
+				return;
+			}
+			/* A parent state is a cluster, and its point node is the anchor
+			 * of the transitions entering or leaving the parent state */
+			out << indent << "subgraph cluster_" << state_id << " {\n";
+			out << indent << "\tlabel=\"" << label(state) << "\";\n";
+			out << indent << "\tstyle=\"rounded,filled\";\n";
+			out << indent << "\tfillcolor=\"" << color << "\";\n";
+			out << indent << "\t" << state_id << " [shape=point];\n";
+			for (const struct sm_state *child : children_of(graph, state)) {
+				emit_state(child, indent + "\t", prefix, depth);
+			}
+			const struct sm_state *entry_state =
+				graph.ids.count(state->entry_state) ? state->entry_state
+													: nullptr;
+			std::string entry_prefix = prefix;
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+			/* The submachine is entered instead of the entry state */
+			if (state->submachine &&
+				depth < SM_STATE_MACHINE_MAX_SUBMACHINE_DEPTH) {
+				entry_state = state->submachine->initial_state;
+				entry_prefix = state_id + "_";
+				for (const struct sm_state *top :
+					 children_of(graph, nullptr, state->submachine)) {
+					emit_state(top, indent + "\t", entry_prefix, depth + 1);
+				}
+			}
+#endif
+			if (entry_state) {
+				out << indent << "\t" << state_id << " -> " << entry_prefix
+					<< id(entry_state) << ";\n";
+			}
+			out << indent << "}\n";
+		};
+
+	out << "digraph state_machine {\n";
+	out << "\tcompound=true;\n";
+	out << "\tnode [shape=box, style=\"rounded,filled\"];\n";
+	out << "\t__initial [shape=point];\n";
+	for (const struct sm_state *state : children_of(graph, nullptr)) {
+		emit_state(state, "\t", "", 0);
+	}
+	out << "\t__initial -> " << id(initial_state) << ";\n";
+	for (const graph_transition &transition : collect_transitions(graph)) {
+		const struct sm_state *next_state = transition.transition->next_state;
+		if (!next_state) {
+			continue;
+		}
+		std::string text = escape(transition_label(transition, options));
+		std::string style;
+		if (painter.enabled()) {
+			const sm_heat *heat = painter.heat(transition.transition);
+			text += (text.empty() ? "" : "\\n") +
+					heat_painter::annotation(heat);
+			style = "color=\"" + painter.transition_color(heat) +
+					"\", penwidth=" + (heat && heat->hits ? "2" : "1") + ", ";
+		}
+		/* Once in each submachine state of its submachine */
+		for (const std::string &prefix :
+			 instances_of(graph, graph.owners.at(transition.state))) {
+			out << "\t" << prefix << id(transition.state) << " -> " << prefix
+				<< id(next_state) << " [";
+			if (is_parent(transition.state)) {
+				out << "ltail=cluster_" << prefix << id(transition.state)
+					<< ", ";
+			}
+			if (is_parent(next_state) && next_state != transition.state) {
+				out << "lhead=cluster_" << prefix << id(next_state) << ", ";
+			}
+			out << style << "label=\"" << text << "\"];\n";
+		}
+	}
+	out << "}\n";
+	return out.str();
+}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+std::vector<int>
+sm_get_hot_event_order(const struct sm_state_transitions *transitions,
+					   const sm_heatmap &heatmap) {
+	std::vector<std::pair<int, std::uint64_t>> groups;
+	for (size_t i = 0; transitions && i < transitions->num_transitions; ++i) {
+		const struct sm_transition *transition = &transitions->transitions[i];
+		auto group = std::find_if(groups.begin(), groups.end(),
+								  [transition](const auto &g) {
+									  return g.first == transition->event_type;
+								  });
+		if (group == groups.end()) {
+			group = groups.insert(groups.end(), {transition->event_type, 0});
+		}
+		auto heat = heatmap.transitions.find(transition);
+		if (heat != heatmap.transitions.end()) {
+			group->second += heat->second.hits;
+		}
+	}
+	std::stable_sort(
+		groups.begin(), groups.end(),
+		[](const auto &a, const auto &b) { return a.second > b.second; });
+
+	std::vector<int> order;
+	for (const auto &group : groups) {
+		if (group.second) {
+			order.push_back(group.first);
+		}
+	}
+	return order;
+}
+
+#if SM_STATE_MACHINE_ENABLE_LOG
+std::string
+sm_get_transition_tables_source(const struct sm_state *initial_state,
+								const sm_heatmap &heatmap,
+								const sm_diagram_options &options) {
+	const state_graph graph = collect_states(initial_state, nullptr);
+	/* A missing name doesn't compile, rather than silently dropping the
+	 * guard or the action */
+	auto name_of = [](const char *name) {
+		return name ? name : "/* unnamed */";
+	};
+	std::ostringstream out;
+
+	out << "/* Generated by sm_get_transition_tables_source(): hottest events "
+		   "first */\n";
+	for (const struct sm_state *state : graph.states) {
+		const struct sm_state_transitions *transitions = state->transitions;
+		if (!transitions || !transitions->transitions) {
+			continue;
+		}
+		/* The events never hit follow, in the order of the table */
+		std::vector<int> order = sm_get_hot_event_order(transitions, heatmap);
+		for (size_t i = 0; i < transitions->num_transitions; ++i) {
+			const int type = transitions->transitions[i].event_type;
+			if (std::find(order.begin(), order.end(), type) == order.end()) {
+				order.push_back(type);
+			}
+		}
+
+		const std::string name = state_name(state);
+		out << "\nSM_STATE_MACHINE_TRANSITION_DEF_START(" << name << ")\n";
+		for (int type : order) {
+			struct sm_event event = {type, nullptr};
+			const char *event_name = options.stringify_event
+										 ? options.stringify_event(&event)
+										 : nullptr;
+			for (size_t i = 0; i < transitions->num_transitions; ++i) {
+				const struct sm_transition *transition =
+					&transitions->transitions[i];
+				if (transition->event_type != type) {
+					continue;
+				}
+				out << "SM_STATE_MACHINE_TRANSITION_ADD_EX(";
+				if (event_name) {
+					out << event_name;
+				} else {
+					out << type;
+				}
+				out << ", ";
+				if (transition->guard) {
+					out << "&SM_STATE_MACHINE_GUARD("
+						<< name_of(transition->guard->name) << ")";
+				} else {
+					out << "NULL";
+				}
+				out << ", ";
+				if (!transition->action) {
+					out << "NULL";
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+				} else if (transition->action->async_fn) {
+					out << "&SM_STATE_MACHINE_ASYNC_ACTION("
+						<< name_of(transition->action->name) << ")";
+#endif
+				} else {
+					out << "&SM_STATE_MACHINE_ACTION("
+						<< name_of(transition->action->name) << ")";
+				}
+				out << ", ";
+				if (transition->next_state) {
+					out << "&" << state_name(transition->next_state);
+				} else {
+					out << "NULL";
+				}
+				out << ")\n";
+			}
+		}
+		out << "SM_STATE_MACHINE_TRANSITION_DEF_END(" << name << ")\n";
+	}
+	return out.str();
+}
+#endif
+#endif
+
+std::vector<sm_verify_issue>
+sm_verify(const struct sm_state *initial_state,
+		  const struct sm_state *error_state,
+		  const std::vector<const struct sm_state *> &states) {
+	std::vector<sm_verify_issue> issues;
+	const state_graph graph = collect_states(initial_state, error_state);
+
+	for (const struct sm_state *state : graph.states) {
+		verify_hierarchy(state, issues);
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+		verify_transitions(state, state->transitions, issues);
+		verify_transitions(state, state->completion_transitions, issues);
+#endif
+	}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	/* The states reached through a function are unknown */
+	const bool opaque = std::any_of(
+		graph.states.begin(), graph.states.end(),
+		[](const struct sm_state *state) {
+			return (state->transitions && state->transitions->handle_event) ||
+				   (state->completion_transitions &&
+					state->completion_transitions->handle_event);
+		});
+#endif
+	for (const struct sm_state *state : states) {
+		if (graph.ids.count(state)) {
+			continue;
+		}
+		verify_hierarchy(state, issues);
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+		if (!opaque) {
+			issues.push_back({sm_verify_unreachable_state, state, nullptr});
+		}
+#endif
+	}
+	return issues;
+}
+
+std::string sm_verify_issue_to_string(const sm_verify_issue &issue) {
+	std::ostringstream stream;
+	stream << "state " << state_name(issue.state) << ": ";
+	switch (issue.type) {
+	case sm_verify_missing_next_state:
+		stream << "transition for event " << issue.transition->event_type
+			   << " has no next state";
+		break;
+	case sm_verify_shadowed_transition:
+		stream << "transition for event " << issue.transition->event_type
+			   << " to " << state_name(issue.transition->next_state)
+			   << " is shadowed by a previous unguarded transition";
+		break;
+	case sm_verify_entry_state_not_child:
+		stream << "entry state " << state_name(issue.state->entry_state)
+			   << " is not a child state";
+		break;
+	case sm_verify_entry_state_cycle:
+		stream << "entry state chain contains a cycle";
+		break;
+	case sm_verify_parent_cycle:
+		stream << "parent state chain contains a cycle";
+		break;
+	case sm_verify_unreachable_state:
+		stream << "unreachable from the initial state";
+		break;
+	}
+	return stream.str();
+}
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+sm_profiler::sm_profiler()
+	: tracer_{this, &sm_profiler::event_begin, &sm_profiler::transition_taken,
+			  &sm_profiler::event_end, nullptr} {
+}
+
+struct sm_state_machine_tracer *sm_profiler::tracer() {
+	return &tracer_;
+}
+
+const sm_heatmap &sm_profiler::heatmap() const {
+	return heatmap_;
+}
+
+void sm_profiler::reset() {
+	heatmap_ = sm_heatmap();
+}
+
+void sm_profiler::event_begin(void *context,
+							  const struct sm_state_machine *state_machine,
+							  const struct sm_event *) {
+	sm_profiler *self = static_cast<sm_profiler *>(context);
+	self->dispatches_.push_back({state_machine->current_state,
+								 std::chrono::steady_clock::now(),
+								 {}});
+}
+
+void sm_profiler::transition_taken(void *context,
+								   const struct sm_state_machine *,
+								   const struct sm_event *,
+								   const struct sm_state *,
+								   const struct sm_transition *transition) {
+	sm_profiler *self = static_cast<sm_profiler *>(context);
+	if (transition && !self->dispatches_.empty()) {
+		self->dispatches_.back().transitions.push_back(transition);
+	}
+}
+
+void sm_profiler::event_end(void *context, const struct sm_state_machine *,
+							const struct sm_event *, int) {
+	sm_profiler *self = static_cast<sm_profiler *>(context);
+	if (self->dispatches_.empty()) {
+		return;
+	}
+	const dispatch &current = self->dispatches_.back();
+	const std::chrono::nanoseconds latency =
+		std::chrono::steady_clock::now() - current.begin;
+
+	if (current.state) {
+		sm_heat &heat = self->heatmap_.states[current.state];
+		heat.hits++;
+		heat.latency += latency;
+	}
+	for (const struct sm_transition *transition : current.transitions) {
+		sm_heat &heat = self->heatmap_.transitions[transition];
+		heat.hits++;
+		heat.latency += latency;
+	}
+	self->dispatches_.pop_back();
 }
+#endif
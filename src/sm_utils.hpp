@@ -13,9 +13,226 @@
  *
  * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
  */
+#ifndef SM_UTILS_HPP_
+#define SM_UTILS_HPP_
 
 #include "sm_state_machine.h"
 
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
-std::string sm_get_plantuml_representation(struct sm_state *initial_state);
+/**
+ * \brief Run-time cost of a state or a transition
+ */
+struct sm_heat {
+	/**
+	 * \brief Number of events dispatched while in the state, or number of
+	 * times the transition has been taken
+	 */
+	std::uint64_t hits = 0;
+	/** \brief Total time spent dispatching those events */
+	std::chrono::nanoseconds latency{0};
+};
+
+/**
+ * \brief Run-time profile of a state machine definition
+ *
+ * Usually collected with #sm_profiler.
+ */
+struct sm_heatmap {
+	std::unordered_map<const struct sm_state *, sm_heat> states;
+	std::unordered_map<const struct sm_transition *, sm_heat> transitions;
+};
+
+/**
+ * \brief Options of the diagram representations of a state machine
+ */
+struct sm_diagram_options {
+	/**
+	 * \brief Used to name the events of the transitions. If NULL, the event
+	 * types are printed as numbers.
+	 */
+	const char *(*stringify_event)(const struct sm_event *event) = nullptr;
+	/**
+	 * \brief If not NULL, states and transitions are colored by their
+	 * number of hits, and annotated with their hits and average latency.
+	 */
+	const sm_heatmap *heatmap = nullptr;
+};
+
+/**
+ * \brief Get the PlantUML state diagram of a state machine definition
+ *
+ * All the states that can be reached from \p initial_state are drawn, with
+ * their hierarchy, entry states, entry/exit actions and transitions (with
+ * their guards and actions). A submachine is drawn inside each of its
+ * submachine states (#SM_STATE_MACHINE_ENABLE_SUBMACHINES).
+ *
+ * \note Transitions defined as functions (#SM_STATE_MACHINE_OPTIMIZE_RAM, or
+ * \ref SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+ * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*") can't be inspected: they are not
+ * drawn, nor are the states only reachable through them.
+ */
+std::string
+sm_get_plantuml_representation(const struct sm_state *initial_state,
+							   const sm_diagram_options &options = {});
+
+/**
+ * \brief Get the Graphviz (dot) representation of a state machine definition
+ *
+ * Same content as sm_get_plantuml_representation(). Parent states are drawn
+ * as clusters.
+ */
+std::string
+sm_get_graphviz_representation(const struct sm_state *initial_state,
+							   const sm_diagram_options &options = {});
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+/**
+ * \brief Event types of a transition table, hottest first
+ *
+ * The hits of an event type are the hits of all its transitions. Event types
+ * without hits are left out; ties keep the order of the table.
+ */
+std::vector<int>
+sm_get_hot_event_order(const struct sm_state_transitions *transitions,
+					   const sm_heatmap &heatmap);
+
+#if SM_STATE_MACHINE_ENABLE_LOG
+/**
+ * \brief Generate the transition tables of a state machine definition, hottest
+ * events first
+ *
+ * For each state that can be reached from \p initial_state and that is
+ * defined with a transition table, the source contains a \ref
+ * SM_STATE_MACHINE_TRANSITION_DEF_START "SM_STATE_MACHINE_TRANSITION_DEF_*"
+ * block, to be compiled instead of the original one: the tables stay const
+ * (#SM_STATE_MACHINE_CONST_TABLES). Only the order of the groups of
+ * transitions for the same event changes, see sm_get_hot_event_order(): the
+ * transitions of an event keep their relative order (i.e. their guard
+ * priority), and the events never hit keep their order after the others.
+ *
+ * States, guards and actions are named after their sm_state::name,
+ * sm_guard::name and sm_action::name, event types after
+ * sm_diagram_options::stringify_event, if given.
+ */
+std::string
+sm_get_transition_tables_source(const struct sm_state *initial_state,
+								const sm_heatmap &heatmap,
+								const sm_diagram_options &options = {});
+#endif
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+/**
+ * \brief Collects a #sm_heatmap while state machines dispatch events
+ *
+ * Assign tracer() to sm_state_machine_hooks::tracer of the state machines to
+ * be profiled. The profiler is not thread safe: use one for each thread.
+ */
+class sm_profiler {
+  public:
+	sm_profiler();
+	sm_profiler(const sm_profiler &) = delete;
+	sm_profiler &operator=(const sm_profiler &) = delete;
+
+	/** \brief Tracer to be assigned to sm_state_machine_hooks::tracer */
+	struct sm_state_machine_tracer *tracer();
+	/** \brief The profile collected so far */
+	const sm_heatmap &heatmap() const;
+	/** \brief Discard the profile collected so far */
+	void reset();
+
+  private:
+	struct dispatch {
+		const struct sm_state *state;
+		std::chrono::steady_clock::time_point begin;
+		std::vector<const struct sm_transition *> transitions;
+	};
+
+	static void event_begin(void *context,
+							const struct sm_state_machine *state_machine,
+							const struct sm_event *event);
+	static void transition_taken(void *context,
+								 const struct sm_state_machine *state_machine,
+								 const struct sm_event *event,
+								 const struct sm_state *state,
+								 const struct sm_transition *transition);
+	static void event_end(void *context,
+						  const struct sm_state_machine *state_machine,
+						  const struct sm_event *event, int status);
+
+	struct sm_state_machine_tracer tracer_;
+	sm_heatmap heatmap_;
+	/* Events can be dispatched from within actions */
+	std::vector<dispatch> dispatches_;
+};
+#endif
+
+/**
+ * \brief Kind of problem found by sm_verify()
+ */
+enum sm_verify_issue_type {
+	/** \brief A transition doesn't define its next state */
+	sm_verify_missing_next_state,
+	/**
+	 * \brief A transition can never be taken, because a previous transition
+	 * of the same state, for the same event, has no guard
+	 */
+	sm_verify_shadowed_transition,
+	/** \brief The sm_state::entry_state of a state is not one of its children */
+	sm_verify_entry_state_not_child,
+	/** \brief Following sm_state::entry_state never reaches a leaf state */
+	sm_verify_entry_state_cycle,
+	/** \brief Following sm_state::parent_state never reaches a root state */
+	sm_verify_parent_cycle,
+	/** \brief The state can't be reached from the initial state */
+	sm_verify_unreachable_state,
+};
+
+/**
+ * \brief Problem found by sm_verify()
+ */
+struct sm_verify_issue {
+	enum sm_verify_issue_type type;
+	/** \brief The state the problem has been found in */
+	const struct sm_state *state;
+	/** \brief The offending transition, if the problem concerns one */
+	const struct sm_transition *transition;
+};
+
+/**
+ * \brief Verify a state machine definition
+ *
+ * Walks the definition once, starting from \p initial_state and \p
+ * error_state, following transitions, completion transitions, entry states and
+ * parent states. A definition without issues can be dispatched with
+ * sm_state_machine_handle_event_trusted().
+ *
+ * \note Transitions defined as functions (#SM_STATE_MACHINE_OPTIMIZE_RAM, or
+ * \ref SM_STATE_MACHINE_TRANSITION_FN_DEF_START
+ * "SM_STATE_MACHINE_TRANSITION_FN_DEF_*") can't be inspected: only the state
+ * hierarchy of the states only reachable through them is verified, and if
+ * there are any, reachability isn't checked.
+ *
+ * \param [in] initial_state the initial state of the state machine
+ * \param [in] error_state the error state of the state machine. May be NULL.
+ * \param [in] states all the states of the definition. Any of them that can't
+ * be reached is reported. May be empty.
+ *
+ * \returns the problems found. Empty if the definition is valid.
+ */
+std::vector<sm_verify_issue>
+sm_verify(const struct sm_state *initial_state,
+		  const struct sm_state *error_state,
+		  const std::vector<const struct sm_state *> &states = {});
+
+/**
+ * \brief Describe a problem found by sm_verify() in a human readable way
+ */
+std::string sm_verify_issue_to_string(const sm_verify_issue &issue);
+
+#endif /* ifndef SM_UTILS_HPP_ */
@@ -0,0 +1,891 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_wal.c
+ *
+ * \brief		write-ahead event log of state machine instances -
+ * implementation
+ *
+ * The directory holds at most one snapshot, `snapshot-<first event>`, and the
+ * log of the events from that one on, `log-<first event>` (hexadecimal
+ * indexes). A snapshot is written to a temporary file and renamed, then the
+ * new log is created: after a crash, the newest valid snapshot is restored and
+ * the logs that continue it are replayed.
+ *
+ * Each commit appends a frame: the size of the events (varint), their CRC-32
+ * (4 bytes, little endian) and the events. An event is its instance, its type
+ * (zigzag encoded), the size of its payload (varints) and the payload. The
+ * frame header is encoded in the space reserved at the beginning of the
+ * buffer, so that a commit is a single write().
+ *
+ * A snapshot is the magic number, the hash of the definition, the index of
+ * the first event after it and the number of instances (8 bytes each, little
+ * endian), the current and previous state of each instance (varints, 0 for no
+ * state and the state identifier + 1 otherwise) and the CRC-32 of all of it.
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#if !defined(_POSIX_C_SOURCE)
+/* fdatasync(), strdup() */
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "sm_wal.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* "sm_snap1" */
+#define SNAPSHOT_MAGIC UINT64_C(0x736d5f736e617031)
+#define SNAPSHOT_HEADER_SIZE 32u
+#define CRC_SIZE 4u
+/* The longest varint, and the CRC */
+#define VARINT_MAX_SIZE 10u
+#define FRAME_HEADER_SIZE (VARINT_MAX_SIZE + CRC_SIZE)
+/* Instance, type and size of the payload */
+#define EVENT_HEADER_MAX_SIZE (3u * VARINT_MAX_SIZE)
+
+#define LOG_PREFIX "log-"
+#define SNAPSHOT_PREFIX "snapshot-"
+#define SNAPSHOT_TEMPORARY "snapshot.tmp"
+
+/* The files in the directory */
+struct listing {
+	uint64_t *logs;
+	size_t num_logs;
+	uint64_t *snapshots;
+	size_t num_snapshots;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+/*******************************************************************************
+ * Private function declarations
+ ******************************************************************************/
+static void init_crc_table(void);
+static uint32_t crc32(const unsigned char *data, size_t size);
+static size_t put_varint(unsigned char *out, uint64_t value);
+static bool get_varint(const unsigned char **in, const unsigned char *end,
+					   uint64_t *value);
+static void put_u64(unsigned char *out, uint64_t value);
+static uint64_t get_u64(const unsigned char *in);
+static uint64_t zigzag(int value);
+static int unzigzag(uint64_t value);
+static char *file_path(const struct sm_wal *wal, const char *prefix,
+					   uint64_t first_event);
+static bool list_directory(const char *directory, struct listing *listing);
+static bool parse_index(const char *name, const char *prefix, uint64_t *index);
+static int compare_indexes(const void *a, const void *b);
+static bool read_file(const char *path, unsigned char **data, size_t *size);
+static bool write_all(int fd, const unsigned char *data, size_t size);
+static int sync_data(int fd);
+static bool sync_directory(const char *directory);
+static int restore_snapshot(struct sm_wal *wal, uint64_t first_event,
+							struct sm_state_machine *instances);
+static bool replay_log(struct sm_wal *wal, uint64_t first_event,
+					   struct sm_state_machine *instances);
+static bool parse_frame(struct sm_wal *wal, const unsigned char *body,
+						const unsigned char *end,
+						struct sm_state_machine *instances, void **payload,
+						size_t *payload_capacity);
+static bool open_log(struct sm_wal *wal, uint64_t first_event, int flags);
+static void remove_older(const struct sm_wal *wal, uint64_t first_event);
+static bool reserve(struct sm_wal *wal, size_t size);
+static void commit(struct sm_wal *wal);
+
+/*******************************************************************************
+ * Public function definitions
+ ******************************************************************************/
+bool sm_wal_open(struct sm_wal *wal, const char *directory,
+				 const struct sm_shared_definition *definition,
+				 struct sm_state_machine *instances, size_t num_instances,
+				 size_t buffer_size) {
+	assert(wal != NULL);
+	assert(directory != NULL);
+	assert(definition != NULL);
+	assert(instances != NULL || num_instances == 0);
+
+	pthread_once(&crc_table_once, init_crc_table);
+
+	const size_t capacity = FRAME_HEADER_SIZE + buffer_size;
+	*wal = (struct sm_wal){
+		.directory = strdup(directory),
+		.definition = definition,
+		.num_instances = num_instances,
+		.fd = -1,
+		.buffer = malloc(capacity),
+		.used = FRAME_HEADER_SIZE,
+		.capacity = capacity,
+		.spare = malloc(capacity),
+		.spare_capacity = capacity,
+	};
+	struct listing listing = {0};
+	if (!wal->directory || !wal->buffer || !wal->spare) {
+		errno = ENOMEM;
+		goto failure;
+	}
+	if (!list_directory(directory, &listing)) {
+		goto failure;
+	}
+
+	/* The newest valid snapshot, or none */
+	uint64_t first_event = 0;
+	for (size_t i = listing.num_snapshots; i-- > 0;) {
+		const int restored =
+			restore_snapshot(wal, listing.snapshots[i], instances);
+		if (restored < 0) {
+			goto failure;
+		}
+		if (restored > 0) {
+			first_event = listing.snapshots[i];
+			break;
+		}
+	}
+
+	/* The logs that continue it, each starting where the previous one ended */
+	wal->first_event = first_event;
+	wal->next_event = first_event;
+	wal->replaying = true;
+	for (size_t i = 0; i < listing.num_logs; ++i) {
+		if (listing.logs[i] != wal->next_event) {
+			continue;
+		}
+		wal->first_event = listing.logs[i];
+		if (!replay_log(wal, listing.logs[i], instances)) {
+			wal->replaying = false;
+			goto failure;
+		}
+	}
+	wal->replaying = false;
+	wal->durable_events = wal->next_event;
+
+	if (!open_log(wal, wal->first_event, O_CREAT) ||
+		!sync_directory(directory)) {
+		goto failure;
+	}
+	remove_older(wal, first_event);
+	free(listing.logs);
+	free(listing.snapshots);
+
+	pthread_mutex_init(&wal->mutex, NULL);
+	pthread_cond_init(&wal->committed, NULL);
+	return true;
+
+failure: {
+	const int error = errno;
+	if (wal->fd >= 0) {
+		close(wal->fd);
+	}
+	free(listing.logs);
+	free(listing.snapshots);
+	free(wal->directory);
+	free(wal->buffer);
+	free(wal->spare);
+	errno = error;
+	return false;
+}
+}
+
+bool sm_wal_close(struct sm_wal *wal) {
+	assert(wal != NULL);
+
+	bool durable = sm_wal_sync(wal, wal->next_event);
+	int error = errno;
+	if (close(wal->fd) != 0 && durable) {
+		durable = false;
+		error = errno;
+	}
+	pthread_mutex_destroy(&wal->mutex);
+	pthread_cond_destroy(&wal->committed);
+	free(wal->directory);
+	free(wal->buffer);
+	free(wal->spare);
+	wal->directory = NULL;
+	wal->buffer = NULL;
+	wal->spare = NULL;
+	wal->fd = -1;
+	errno = error;
+	return durable;
+}
+
+uint64_t sm_wal_append(struct sm_wal *wal, size_t instance,
+					   const struct sm_event *event, const void *payload,
+					   size_t size) {
+	assert(wal != NULL);
+	assert(instance < wal->num_instances);
+	assert(event != NULL);
+	assert(payload != NULL || size == 0);
+
+	unsigned char header[EVENT_HEADER_MAX_SIZE];
+	size_t header_size = put_varint(header, instance);
+	header_size += put_varint(header + header_size, zigzag(event->type));
+	header_size += put_varint(header + header_size, size);
+
+	pthread_mutex_lock(&wal->mutex);
+	if (reserve(wal, header_size + size)) {
+		memcpy(wal->buffer + wal->used, header, header_size);
+		if (size) {
+			memcpy(wal->buffer + wal->used + header_size, payload, size);
+		}
+		wal->used += header_size + size;
+	} else if (!wal->error) {
+		/* Reported by sm_wal_sync() */
+		wal->error = ENOMEM;
+	}
+	const uint64_t sequence = ++wal->next_event;
+	pthread_mutex_unlock(&wal->mutex);
+	return sequence;
+}
+
+int sm_wal_handle_event(struct sm_wal *wal, size_t instance,
+						struct sm_state_machine *state_machine,
+						const struct sm_event *event, const void *payload,
+						size_t size, uint64_t *sequence) {
+	assert(wal != NULL);
+
+	const int status = sm_state_machine_handle_event(state_machine, event);
+	uint64_t appended = 0;
+	switch (status) {
+	case sm_state_machine_error_state_reached:
+	case sm_state_machine_state_changed:
+	case sm_state_machine_self_loop:
+	case sm_state_machine_final_state_reached:
+		appended = sm_wal_append(wal, instance, event, payload, size);
+		break;
+	default:
+		break;
+	}
+	if (sequence) {
+		*sequence = appended;
+	}
+	return status;
+}
+
+bool sm_wal_sync(struct sm_wal *wal, uint64_t sequence) {
+	assert(wal != NULL);
+
+	pthread_mutex_lock(&wal->mutex);
+	assert(sequence <= wal->next_event);
+	while (!wal->error && wal->durable_events < sequence) {
+		if (wal->committing) {
+			/* Its commit may not include this event: check again after it */
+			pthread_cond_wait(&wal->committed, &wal->mutex);
+		} else {
+			commit(wal);
+		}
+	}
+	const int error = wal->error;
+	pthread_mutex_unlock(&wal->mutex);
+	if (error) {
+		errno = error;
+		return false;
+	}
+	return true;
+}
+
+bool sm_wal_snapshot(struct sm_wal *wal,
+					 const struct sm_state_machine *instances) {
+	assert(wal != NULL);
+	assert(instances != NULL || wal->num_instances == 0);
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	/* The submachine states aren't part of the snapshot */
+	for (size_t i = 0; i < wal->num_instances; ++i) {
+		assert(instances[i].submachine_depth == 0);
+	}
+#endif
+
+	if (!sm_wal_sync(wal, wal->next_event)) {
+		return false;
+	}
+	const uint64_t first_event = wal->next_event;
+	const size_t size = SNAPSHOT_HEADER_SIZE +
+						wal->num_instances * 2 * VARINT_MAX_SIZE + CRC_SIZE;
+	unsigned char *data = malloc(size);
+	char *temporary = file_path(wal, SNAPSHOT_TEMPORARY, 0);
+	char *path = file_path(wal, SNAPSHOT_PREFIX, first_event);
+	bool success = false;
+	int fd = -1;
+	if (!data || !temporary || !path) {
+		errno = ENOMEM;
+		goto done;
+	}
+
+	put_u64(data, SNAPSHOT_MAGIC);
+	put_u64(data + 8, wal->definition->hash);
+	put_u64(data + 16, first_event);
+	put_u64(data + 24, wal->num_instances);
+	size_t used = SNAPSHOT_HEADER_SIZE;
+	for (size_t i = 0; i < wal->num_instances; ++i) {
+		const uint32_t current =
+			sm_shared_state_id(wal->definition, instances[i].current_state);
+		const uint32_t previous =
+			sm_shared_state_id(wal->definition, instances[i].previous_state);
+		used += put_varint(data + used,
+						   current == SM_SHARED_NO_STATE ? 0 : current + 1u);
+		used += put_varint(data + used,
+						   previous == SM_SHARED_NO_STATE ? 0 : previous + 1u);
+	}
+	const uint32_t crc = crc32(data, used);
+	for (size_t i = 0; i < CRC_SIZE; ++i) {
+		data[used++] = (unsigned char)(crc >> (8 * i));
+	}
+
+	fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || !write_all(fd, data, used) || sync_data(fd) != 0 ||
+		close(fd) != 0) {
+		goto done;
+	}
+	fd = -1;
+	if (rename(temporary, path) != 0 || !sync_directory(wal->directory)) {
+		goto done;
+	}
+
+	/*
+	 * The events from now on go to a new log. Without it, they would be
+	 * appended to the previous log, that the snapshot makes obsolete.
+	 */
+	const int previous_fd = wal->fd;
+	if (!open_log(wal, first_event, O_CREAT | O_TRUNC) ||
+		!sync_directory(wal->directory)) {
+		const int error = errno;
+		unlink(path);
+		errno = error;
+		goto done;
+	}
+	close(previous_fd);
+	wal->first_event = first_event;
+	remove_older(wal, first_event);
+	success = true;
+
+done: {
+	const int error = errno;
+	if (fd >= 0) {
+		close(fd);
+	}
+	free(data);
+	free(temporary);
+	free(path);
+	errno = error;
+	return success;
+}
+}
+
+bool sm_wal_replaying(const struct sm_wal *wal) {
+	assert(wal != NULL);
+	return wal->replaying;
+}
+
+uint64_t sm_wal_num_commits(const struct sm_wal *wal) {
+	assert(wal != NULL);
+	return wal->commits;
+}
+
+/*******************************************************************************
+ * Private function definitions
+ ******************************************************************************/
+/* CRC-32 (IEEE 802.3), reflected */
+static void init_crc_table(void) {
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (UINT32_C(0xedb88320) & (0u - (crc & 1u)));
+		}
+		crc_table[i] = crc;
+	}
+}
+
+static uint32_t crc32(const unsigned char *data, size_t size) {
+	uint32_t crc = UINT32_MAX;
+	for (size_t i = 0; i < size; ++i) {
+		crc = crc_table[(crc ^ data[i]) & 0xffu] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value) {
+	size_t size = 0;
+	while (value >= 0x80u) {
+		out[size++] = (unsigned char)(value | 0x80u);
+		value >>= 7;
+	}
+	out[size++] = (unsigned char)value;
+	return size;
+}
+
+static bool get_varint(const unsigned char **in, const unsigned char *end,
+					   uint64_t *value) {
+	*value = 0;
+	for (unsigned shift = 0; shift < 64 && *in < end; shift += 7) {
+		const unsigned char byte = *(*in)++;
+		*value |= (uint64_t)(byte & 0x7fu) << shift;
+		if (!(byte & 0x80u)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+	for (size_t i = 0; i < 8; ++i) {
+		out[i] = (unsigned char)(value >> (8 * i));
+	}
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+	uint64_t value = 0;
+	for (size_t i = 0; i < 8; ++i) {
+		value |= (uint64_t)in[i] << (8 * i);
+	}
+	return value;
+}
+
+/* Small negative types take a single byte as well */
+static uint64_t zigzag(int value) {
+	return ((uint64_t)(int64_t)value << 1) ^ (value < 0 ? UINT64_MAX : 0);
+}
+
+static int unzigzag(uint64_t value) {
+	return (int)((int64_t)(value >> 1) ^ -(int64_t)(value & 1u));
+}
+
+static char *file_path(const struct sm_wal *wal, const char *prefix,
+					   uint64_t first_event) {
+	const size_t size = strlen(wal->directory) + strlen(prefix) + 18;
+	char *path = malloc(size);
+	if (path) {
+		if (strcmp(prefix, SNAPSHOT_TEMPORARY) == 0) {
+			snprintf(path, size, "%s/%s", wal->directory, prefix);
+		} else {
+			snprintf(path, size, "%s/%s%016" PRIx64, wal->directory, prefix,
+					 first_event);
+		}
+	}
+	return path;
+}
+
+static bool list_directory(const char *directory, struct listing *listing) {
+	DIR *dir = opendir(directory);
+	if (!dir) {
+		return false;
+	}
+	size_t capacity = 0;
+	bool success = true;
+	for (struct dirent *entry; success && (entry = readdir(dir));) {
+		uint64_t index;
+		uint64_t **indexes;
+		size_t *count;
+		if (parse_index(entry->d_name, LOG_PREFIX, &index)) {
+			indexes = &listing->logs;
+			count = &listing->num_logs;
+		} else if (parse_index(entry->d_name, SNAPSHOT_PREFIX, &index)) {
+			indexes = &listing->snapshots;
+			count = &listing->num_snapshots;
+		} else {
+			continue;
+		}
+		/* Both arrays have the same capacity, at least the files seen */
+		if (listing->num_logs + listing->num_snapshots == capacity) {
+			capacity = capacity ? 2 * capacity : 8;
+			uint64_t *logs =
+				realloc(listing->logs, capacity * sizeof(*listing->logs));
+			if (logs) {
+				listing->logs = logs;
+			}
+			uint64_t *snapshots = realloc(listing->snapshots,
+										  capacity * sizeof(*listing->logs));
+			if (snapshots) {
+				listing->snapshots = snapshots;
+			}
+			if (!logs || !snapshots) {
+				errno = ENOMEM;
+				success = false;
+				break;
+			}
+		}
+		(*indexes)[(*count)++] = index;
+	}
+	closedir(dir);
+	qsort(listing->logs, listing->num_logs, sizeof(*listing->logs),
+		  compare_indexes);
+	qsort(listing->snapshots, listing->num_snapshots,
+		  sizeof(*listing->snapshots), compare_indexes);
+	return success;
+}
+
+static bool parse_index(const char *name, const char *prefix,
+						uint64_t *index) {
+	const size_t length = strlen(prefix);
+	if (strncmp(name, prefix, length) != 0 || strlen(name) != length + 16) {
+		return false;
+	}
+	char *end;
+	*index = strtoull(name + length, &end, 16);
+	return *end == '\0';
+}
+
+static int compare_indexes(const void *a, const void *b) {
+	const uint64_t lhs = *(const uint64_t *)a;
+	const uint64_t rhs = *(const uint64_t *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static bool read_file(const char *path, unsigned char **data, size_t *size) {
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat status;
+	*data = NULL;
+	*size = 0;
+	if (fstat(fd, &status) != 0) {
+		close(fd);
+		return false;
+	}
+	/* Never 0 bytes, so that NULL always means failure */
+	*data = malloc((size_t)status.st_size + 1);
+	while (*data && *size < (size_t)status.st_size) {
+		const ssize_t result =
+			read(fd, *data + *size, (size_t)status.st_size - *size);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			break;
+		}
+		*size += (size_t)result;
+	}
+	const bool success = *data && *size == (size_t)status.st_size;
+	const int error = *data ? errno : ENOMEM;
+	close(fd);
+	if (!success) {
+		free(*data);
+		*data = NULL;
+		errno = error;
+	}
+	return success;
+}
+
+static bool write_all(int fd, const unsigned char *data, size_t size) {
+	while (size) {
+		const ssize_t result = write(fd, data, size);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			return false;
+		}
+		data += result;
+		size -= (size_t)result;
+	}
+	return true;
+}
+
+static int sync_data(int fd) {
+#if defined(__APPLE__)
+	return fsync(fd);
+#else
+	return fdatasync(fd);
+#endif
+}
+
+/* Makes the creation, the renaming and the removal of files durable */
+static bool sync_directory(const char *directory) {
+	const int fd = open(directory, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	const bool success = fsync(fd) == 0;
+	close(fd);
+	return success;
+}
+
+/* 1 if restored, 0 if not valid, -1 if of another definition or on failure */
+static int restore_snapshot(struct sm_wal *wal, uint64_t first_event,
+							struct sm_state_machine *instances) {
+	char *path = file_path(wal, SNAPSHOT_PREFIX, first_event);
+	unsigned char *data = NULL;
+	size_t size = 0;
+	if (!path) {
+		errno = ENOMEM;
+		return -1;
+	}
+	const bool found = read_file(path, &data, &size);
+	free(path);
+	if (!found) {
+		return errno == ENOMEM ? -1 : 0;
+	}
+
+	int restored = 0;
+	if (size < SNAPSHOT_HEADER_SIZE + CRC_SIZE ||
+		get_u64(data) != SNAPSHOT_MAGIC ||
+		get_u64(data + 16) != first_event) {
+		goto done;
+	}
+	const unsigned char *end = data + size - CRC_SIZE;
+	uint32_t crc = 0;
+	for (size_t i = 0; i < CRC_SIZE; ++i) {
+		crc |= (uint32_t)end[i] << (8 * i);
+	}
+	if (crc != crc32(data, size - CRC_SIZE)) {
+		goto done;
+	}
+	if (get_u64(data + 8) != wal->definition->hash ||
+		get_u64(data + 24) != wal->num_instances) {
+		errno = EINVAL;
+		restored = -1;
+		goto done;
+	}
+
+	/* Decoded before being applied, so that a bad snapshot changes nothing */
+	const unsigned char *in = data + SNAPSHOT_HEADER_SIZE;
+	for (size_t pass = 0; pass < 2; ++pass) {
+		in = data + SNAPSHOT_HEADER_SIZE;
+		for (size_t i = 0; i < wal->num_instances; ++i) {
+			uint64_t current;
+			uint64_t previous;
+			if (!get_varint(&in, end, &current) ||
+				!get_varint(&in, end, &previous) || current == 0 ||
+				current > wal->definition->num_states ||
+				previous > wal->definition->num_states) {
+				goto done;
+			}
+			if (pass == 1) {
+				sm_state_machine_set_states(
+					&instances[i],
+					sm_shared_state(wal->definition, (uint32_t)(current - 1)),
+					previous ? sm_shared_state(wal->definition,
+											   (uint32_t)(previous - 1))
+							 : NULL);
+			}
+		}
+	}
+	restored = 1;
+
+done:
+	free(data);
+	return restored;
+}
+
+static bool replay_log(struct sm_wal *wal, uint64_t first_event,
+					   struct sm_state_machine *instances) {
+	char *path = file_path(wal, LOG_PREFIX, first_event);
+	unsigned char *data = NULL;
+	size_t size = 0;
+	if (!path || !read_file(path, &data, &size)) {
+		free(path);
+		if (path) {
+			/* Removed since listed: nothing to replay */
+			return errno == ENOENT;
+		}
+		errno = ENOMEM;
+		return false;
+	}
+
+	/* A copy of the payload, aligned for any type */
+	void *payload = NULL;
+	size_t payload_capacity = 0;
+	const unsigned char *in = data;
+	const unsigned char *end = data + size;
+	bool success = true;
+	while (in < end) {
+		const unsigned char *frame = in;
+		uint64_t body_size;
+		if (!get_varint(&in, end, &body_size) ||
+			(size_t)(end - in) < CRC_SIZE ||
+			(size_t)(end - in) - CRC_SIZE < body_size) {
+			in = frame;
+			break;
+		}
+		uint32_t crc = 0;
+		for (size_t i = 0; i < CRC_SIZE; ++i) {
+			crc |= (uint32_t)*in++ << (8 * i);
+		}
+		const unsigned char *body = in;
+		in += body_size;
+		if (crc != crc32(body, (size_t)body_size) ||
+			!parse_frame(wal, body, in, NULL, NULL, NULL)) {
+			in = frame;
+			break;
+		}
+		if (!parse_frame(wal, body, in, instances, &payload,
+						 &payload_capacity)) {
+			errno = ENOMEM;
+			success = false;
+			break;
+		}
+	}
+
+	/* Discard the partially written commit, if any */
+	if (success && in < end) {
+		const int fd = open(path, O_WRONLY);
+		success = fd >= 0 && ftruncate(fd, (off_t)(in - data)) == 0 &&
+				  sync_data(fd) == 0;
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+	free(payload);
+	free(data);
+	free(path);
+	return success;
+}
+
+/*
+ * Checks the events of a frame if \p instances is NULL, dispatches them
+ * otherwise
+ */
+static bool parse_frame(struct sm_wal *wal, const unsigned char *body,
+						const unsigned char *end,
+						struct sm_state_machine *instances, void **payload,
+						size_t *payload_capacity) {
+	while (body < end) {
+		uint64_t instance;
+		uint64_t type;
+		uint64_t size;
+		if (!get_varint(&body, end, &instance) ||
+			!get_varint(&body, end, &type) || !get_varint(&body, end, &size) ||
+			instance >= wal->num_instances || (uint64_t)(end - body) < size) {
+			return false;
+		}
+		if (instances) {
+			if (size > *payload_capacity) {
+				free(*payload);
+				*payload = malloc((size_t)size);
+				*payload_capacity = *payload ? (size_t)size : 0;
+				if (!*payload) {
+					return false;
+				}
+			}
+			if (size) {
+				memcpy(*payload, body, (size_t)size);
+			}
+			const struct sm_event event = {unzigzag(type),
+										   size ? *payload : NULL};
+			sm_state_machine_handle_event(&instances[instance], &event);
+			++wal->next_event;
+		}
+		body += size;
+	}
+	return true;
+}
+
+static bool open_log(struct sm_wal *wal, uint64_t first_event, int flags) {
+	char *path = file_path(wal, LOG_PREFIX, first_event);
+	if (!path) {
+		errno = ENOMEM;
+		return false;
+	}
+	const int fd = open(path, O_WRONLY | O_APPEND | flags, 0644);
+	free(path);
+	if (fd < 0) {
+		return false;
+	}
+	wal->fd = fd;
+	return true;
+}
+
+/* Errors are ignored: the files left are ignored as well at the next open */
+static void remove_older(const struct sm_wal *wal, uint64_t first_event) {
+	struct listing listing = {0};
+	list_directory(wal->directory, &listing);
+	for (size_t i = 0; i < listing.num_logs; ++i) {
+		char *path = listing.logs[i] < first_event
+						 ? file_path(wal, LOG_PREFIX, listing.logs[i])
+						 : NULL;
+		if (path) {
+			unlink(path);
+			free(path);
+		}
+	}
+	for (size_t i = 0; i < listing.num_snapshots; ++i) {
+		char *path = listing.snapshots[i] != first_event
+						 ? file_path(wal, SNAPSHOT_PREFIX, listing.snapshots[i])
+						 : NULL;
+		if (path) {
+			unlink(path);
+			free(path);
+		}
+	}
+	char *path = file_path(wal, SNAPSHOT_TEMPORARY, 0);
+	if (path) {
+		unlink(path);
+		free(path);
+	}
+	free(listing.logs);
+	free(listing.snapshots);
+}
+
+/* Called with the mutex locked */
+static bool reserve(struct sm_wal *wal, size_t size) {
+	if (wal->capacity - wal->used >= size) {
+		return true;
+	}
+	size_t capacity = 2 * wal->capacity;
+	if (capacity - wal->used < size) {
+		capacity = wal->used + size;
+	}
+	unsigned char *buffer = realloc(wal->buffer, capacity);
+	if (!buffer) {
+		return false;
+	}
+	wal->buffer = buffer;
+	wal->capacity = capacity;
+	return true;
+}
+
+/*
+ * Called with the mutex locked, by a single thread at a time. The events
+ * appended during the I/O go to the other buffer, and to the next commit.
+ */
+static void commit(struct sm_wal *wal) {
+	unsigned char *data = wal->buffer;
+	const size_t used = wal->used;
+	const size_t capacity = wal->capacity;
+	const uint64_t events = wal->next_event;
+	wal->committing = true;
+	wal->buffer = wal->spare;
+	wal->capacity = wal->spare_capacity;
+	wal->used = FRAME_HEADER_SIZE;
+	pthread_mutex_unlock(&wal->mutex);
+
+	/* The frame header just before the events */
+	const size_t body_size = used - FRAME_HEADER_SIZE;
+	unsigned char header[FRAME_HEADER_SIZE];
+	size_t header_size = put_varint(header, body_size);
+	const uint32_t crc = crc32(data + FRAME_HEADER_SIZE, body_size);
+	for (size_t i = 0; i < CRC_SIZE; ++i) {
+		header[header_size++] = (unsigned char)(crc >> (8 * i));
+	}
+	unsigned char *frame = data + FRAME_HEADER_SIZE - header_size;
+	memcpy(frame, header, header_size);
+	const bool success = write_all(wal->fd, frame, header_size + body_size) &&
+						 sync_data(wal->fd) == 0;
+	const int error = errno;
+
+	pthread_mutex_lock(&wal->mutex);
+	wal->spare = data;
+	wal->spare_capacity = capacity;
+	wal->committing = false;
+	if (success) {
+		wal->durable_events = events;
+		++wal->commits;
+	} else if (!wal->error) {
+		wal->error = error ? error : EIO;
+	}
+	pthread_cond_broadcast(&wal->committed);
+}
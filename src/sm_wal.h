@@ -0,0 +1,222 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		sm_wal.h
+ *
+ * \brief		write-ahead event log of state machine instances - interface
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+
+/**
+ * \defgroup sm_wal Write-ahead log
+ *
+ * \brief Durable state machine instances, rebuilt from their events
+ *
+ * A #sm_wal logs the events that changed the state of a set of instances, so
+ * that they can be rebuilt after a restart by dispatching the same events
+ * again (event sourcing). The log and the snapshots are files in a directory
+ * of the local file system.
+ *
+ * - Appending an event only copies it into a memory buffer, compactly encoded
+ *   (varints). sm_wal_sync() makes the events durable: the first thread that
+ *   calls it writes and flushes the events of all the threads in a single
+ *   write() and fdatasync() (group commit), the others wait for it. Effects
+ *   of an event visible outside of the process (e.g. replies) must wait for
+ *   its sm_wal_sync().
+ * - sm_wal_snapshot() writes the state of all the instances and starts a new
+ *   log: the older log and snapshot are removed.
+ * - sm_wal_open() restores the last snapshot and replays the events logged
+ *   after it. The actions of the instances run again: they can check
+ *   sm_wal_replaying() to skip their external effects.
+ *
+ * The events are logged with a copy of their data (the payload), handed to
+ * the actions through sm_event::data when replayed. The states are stored by
+ * index in a #sm_shared_definition, whose hash is checked when a snapshot is
+ * restored.
+ *
+ * Asynchronous actions (#SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS) are not
+ * supported, and the events must be dispatched deterministically: the guards
+ * and the actions may depend only on the state, the event and its payload.
+ */
+
+/**
+ * \addtogroup sm_wal
+ * @{
+ *
+ * \file
+ */
+#ifndef SM_WAL_H_
+#define SM_WAL_H_
+
+#include "sm_shared.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief Write-ahead log of a set of instances
+ *
+ * Treat this struct as an opaque type. Don't manipulate the
+ * members directly.
+ */
+struct sm_wal {
+	char *directory;
+	const struct sm_shared_definition *definition;
+	size_t num_instances;
+	/* Log file the events are appended to */
+	int fd;
+	/* Index of the first event of the log file */
+	uint64_t first_event;
+	pthread_mutex_t mutex;
+	pthread_cond_t committed;
+	/* Events appended and not being committed yet */
+	unsigned char *buffer;
+	size_t used;
+	size_t capacity;
+	/* Buffer being committed, swapped with #buffer by each commit */
+	unsigned char *spare;
+	size_t spare_capacity;
+	/* Index of the next event to be appended */
+	uint64_t next_event;
+	/* The events before this one are durable */
+	uint64_t durable_events;
+	uint64_t commits;
+	bool committing;
+	/* errno of the first failed commit */
+	int error;
+	bool replaying;
+};
+
+/**
+ * \brief Open the log in \p directory, restoring the instances
+ *
+ * The instances, initialised with sm_state_machine_init(), get the state of
+ * the last snapshot, if any, and the events logged after it are dispatched to
+ * them. A partially written commit at the end of the log (e.g. after a power
+ * loss) is discarded.
+ *
+ * \param [out] wal -
+ * \param [in] directory existing directory of the log and the snapshots
+ * \param [in] definition the states of the instances. Must outlive \p wal.
+ * \param [in,out] instances -
+ * \param [in] num_instances -
+ * \param [in] buffer_size initial capacity of the buffer of the events not yet
+ * committed, in bytes. The buffer grows if needed.
+ *
+ * \retval true on success
+ * \retval false on failure (errno is set), e.g. if the snapshot was taken for
+ * a different definition or number of instances
+ */
+bool sm_wal_open(struct sm_wal *wal, const char *directory,
+				 const struct sm_shared_definition *definition,
+				 struct sm_state_machine *instances, size_t num_instances,
+				 size_t buffer_size);
+
+/**
+ * \brief Commit the events appended so far and close the log
+ *
+ * \retval true if all the events are durable
+ * \retval false otherwise (errno is set)
+ */
+bool sm_wal_close(struct sm_wal *wal);
+
+/**
+ * \brief Log an event dispatched to an instance
+ *
+ * Thread safe. The events of an instance must be appended in the order they
+ * are dispatched.
+ *
+ * \param [in] wal -
+ * \param [in] instance index of the instance
+ * \param [in] event -
+ * \param [in] payload data of the event to be logged, handed to the actions
+ * when the event is replayed. May be NULL if \p size is 0.
+ * \param [in] size size of \p payload, in bytes
+ *
+ * \returns the sequence number of the event, to be passed to sm_wal_sync()
+ */
+uint64_t sm_wal_append(struct sm_wal *wal, size_t instance,
+					   const struct sm_event *event, const void *payload,
+					   size_t size);
+
+/**
+ * \brief Dispatch an event to an instance and log it
+ *
+ * The event is dispatched with sm_state_machine_handle_event(), and logged
+ * with sm_wal_append() only if the state machine changed state or ran a
+ * transition (self loops included): ignored and rejected events aren't.
+ *
+ * \param [in] wal -
+ * \param [in] instance index of the instance
+ * \param [in] state_machine the instance
+ * \param [in] event -
+ * \param [in] payload see sm_wal_append()
+ * \param [in] size see sm_wal_append()
+ * \param [out] sequence sequence number of the event, or 0 if not logged.
+ * May be NULL.
+ *
+ * \return #stateM_handleEventRetVals
+ */
+int sm_wal_handle_event(struct sm_wal *wal, size_t instance,
+						struct sm_state_machine *state_machine,
+						const struct sm_event *event, const void *payload,
+						size_t size, uint64_t *sequence);
+
+/**
+ * \brief Wait until an event and the ones appended before it are durable
+ *
+ * \param [in] wal -
+ * \param [in] sequence sequence number returned by sm_wal_append(). 0 waits
+ * for nothing.
+ *
+ * \retval true if the event is durable
+ * \retval false if a commit failed (errno is set). The log is unusable.
+ */
+bool sm_wal_sync(struct sm_wal *wal, uint64_t sequence);
+
+/**
+ * \brief Write a snapshot of the instances and truncate the log
+ *
+ * Must not be called while events are being dispatched or appended.
+ *
+ * \param [in] wal -
+ * \param [in] instances the instances passed to sm_wal_open()
+ *
+ * \retval true on success
+ * \retval false on failure (errno is set). The previous snapshot and log are
+ * kept.
+ */
+bool sm_wal_snapshot(struct sm_wal *wal,
+					 const struct sm_state_machine *instances);
+
+/**
+ * \brief Whether the events are being replayed by sm_wal_open()
+ */
+bool sm_wal_replaying(const struct sm_wal *wal);
+
+/**
+ * \brief Number of commits (write() and fdatasync()) done so far
+ */
+uint64_t sm_wal_num_commits(const struct sm_wal *wal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef SM_WAL_H_ */
+
+/**
+ * @}
+ */
@@ -23,6 +23,8 @@
 #include "test_sm_mocks.hpp"
 
 #include <array>
+#include <string>
+#include <vector>
 
 using trompeloeil::_;
 using trompeloeil::eq;
@@ -360,3 +362,342 @@ TEST_CASE("State machine") {
 		sm_state_machine_handle_event(&sm, &event);
 	}
 }
+
+TEST_CASE("Completion transitions") {
+	SETUP_LOOSE_MOCK_DEFAULT();
+
+	sm_state_machine sm;
+	sm_state_machine_hooks hooks = {};
+	sm_state_machine_init(&sm, nullptr, &s1, &s_error, &hooks, nullptr,
+						  nullptr);
+
+	struct sm_event event;
+	event.data = nullptr;
+
+	SECTION("completion transitions are chained within the same event") {
+		event.type = event_s1_to_s7;
+		sequence seq;
+		REQUIRE_CALL(mocks, guard4(nullptr, &s7, nullptr, _, &s8, nullptr))
+			.IN_SEQUENCE(seq)
+			.RETURN(true);
+		REQUIRE_CALL(mocks,
+					 trans_action3(nullptr, &s7, nullptr, _, &s8, nullptr))
+			.IN_SEQUENCE(seq);
+		REQUIRE_CALL(mocks,
+					 s3_entry_action(nullptr, &s8, nullptr, _, &s3, nullptr))
+			.IN_SEQUENCE(seq);
+		REQUIRE(sm_state_machine_handle_event(&sm, &event) ==
+				sm_state_machine_state_changed);
+		REQUIRE(sm_state_machine_current_state(&sm) == &s3);
+		REQUIRE(sm_state_machine_previous_state(&sm) == &s8);
+	}
+
+	SECTION("a rejected completion transition keeps the entered state") {
+		event.type = event_s1_to_s7;
+		REQUIRE_CALL(mocks, guard4(nullptr, &s7, nullptr, _, &s8, nullptr))
+			.RETURN(false);
+		FORBID_CALL(mocks, trans_action3(_, _, _, _, _, _));
+		/* s7 has no other transitions: it can't be left any more */
+		REQUIRE(sm_state_machine_handle_event(&sm, &event) ==
+				sm_state_machine_final_state_reached);
+		REQUIRE(sm_state_machine_current_state(&sm) == &s7);
+		REQUIRE(sm_state_machine_stopped(&sm));
+	}
+
+	SECTION("a livelock of completion transitions leads to the error state") {
+		event.type = event_s1_to_s9;
+		REQUIRE_CALL(mocks, s_error_entry_action(nullptr, _, nullptr, _,
+												 &s_error, nullptr));
+		REQUIRE(sm_state_machine_handle_event(&sm, &event) ==
+				sm_state_machine_error_state_reached);
+		REQUIRE(sm_state_machine_current_state(&sm) == &s_error);
+	}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	SECTION("the longest chain ends in a state whose guards decide") {
+		/* chain[0] -> ... -> chain[n], then chain[n] -> chain[0] if accepted */
+		constexpr size_t n = SM_STATE_MACHINE_MAX_COMPLETION_CHAIN;
+		static bool accept;
+		sm_guard guard = {};
+		guard.fn = [](void *, const sm_state *, void *, const sm_event *,
+					  const sm_state *, void *) { return accept; };
+		std::array<sm_state, n + 1> chain = {};
+		std::array<sm_transition, n + 1> hops;
+		std::array<sm_state_transitions, n + 1> tables;
+		for (size_t i = 0; i <= n; ++i) {
+			hops[i] = {SM_STATE_MACHINE_EVENT_COMPLETION,
+					   i == n ? &guard : nullptr, nullptr,
+					   &chain[(i + 1) % (n + 1)]};
+			tables[i] = {&hops[i], 1};
+			chain[i].completion_transitions = &tables[i];
+		}
+		sm_transition leave = {event_s1_to_s2, nullptr, nullptr, &s1};
+		sm_state_transitions leave_table = {&leave, 1};
+		chain[n].transitions = &leave_table;
+		sm_state start = {};
+		sm_transition enter = {event_s1_to_s2, nullptr, nullptr, &chain[0]};
+		sm_state_transitions start_table = {&enter, 1};
+		start.transitions = &start_table;
+		sm_state_machine_init(&sm, nullptr, &start, &s_error, &hooks, nullptr,
+							  nullptr);
+		event.type = event_s1_to_s2;
+
+		SECTION("rejected: the chain settles") {
+			accept = false;
+			REQUIRE(sm_state_machine_handle_event(&sm, &event) ==
+					sm_state_machine_state_changed);
+			REQUIRE(sm_state_machine_current_state(&sm) == &chain[n]);
+		}
+		SECTION("accepted: livelock") {
+			accept = true;
+			REQUIRE_CALL(mocks, s_error_entry_action(nullptr, &chain[n],
+													 nullptr, _, &s_error,
+													 nullptr));
+			REQUIRE(sm_state_machine_handle_event(&sm, &event) ==
+					sm_state_machine_error_state_reached);
+		}
+	}
+#endif
+}
+
+TEST_CASE("Trusted dispatch") {
+	SETUP_LOOSE_MOCK_DEFAULT();
+
+	sm_state_machine sm;
+	sm_state_machine_hooks hooks = {};
+	sm_state_machine_init(&sm, nullptr, &s1, &s_error, &hooks, nullptr,
+						  nullptr);
+
+	struct sm_event event;
+	event.data = nullptr;
+	event.type = event_s1_to_s2;
+	sequence seq;
+	REQUIRE_CALL(mocks, guard1(nullptr, &s1, nullptr, &event, &s2, nullptr))
+		.IN_SEQUENCE(seq)
+		.RETURN(true);
+	REQUIRE_CALL(mocks,
+				 s1_exit_action(nullptr, &s1, nullptr, &event, &s2, nullptr))
+		.IN_SEQUENCE(seq);
+	REQUIRE_CALL(mocks,
+				 trans_action1(nullptr, &s1, nullptr, &event, &s2, nullptr))
+		.IN_SEQUENCE(seq);
+	REQUIRE_CALL(mocks,
+				 s2_entry_action(nullptr, &s1, nullptr, &event, &s2, nullptr))
+		.IN_SEQUENCE(seq);
+	REQUIRE(sm_state_machine_handle_event_trusted(&sm, &event) ==
+			sm_state_machine_state_changed);
+	REQUIRE(sm_state_machine_current_state(&sm) == &s2);
+}
+
+namespace {
+struct instrumentation {
+	const sm_state *state = nullptr;
+	const sm_transition *transition = nullptr;
+	const char *guard_name = nullptr;
+	const char *action_name = nullptr;
+};
+instrumentation recorded;
+} // namespace
+
+TEST_CASE("Inherited transitions") {
+	SETUP_LOOSE_MOCK_DEFAULT();
+
+	sm_state_machine sm;
+	sm_state_machine_hooks hooks = {};
+	recorded = {};
+#if SM_STATE_MACHINE_ENABLE_LOG
+	sm_state_machine_hooks::sm_state_machine_logger logger = {
+		[](const sm_state_machine *, const char *, const sm_event *,
+		   const char *, const sm_guard *guard, const sm_state *,
+		   const sm_action *action, const sm_state *) {
+			recorded.guard_name = guard->name;
+			recorded.action_name = action->name;
+		}};
+	hooks.logger = &logger;
+#endif
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	sm_state_machine_tracer tracer = {
+		nullptr, nullptr,
+		[](void *, const sm_state_machine *, const sm_event *,
+		   const sm_state *state, const sm_transition *transition) {
+			recorded.state = state;
+			recorded.transition = transition;
+		},
+		nullptr};
+	hooks.tracer = &tracer;
+#endif
+	sm_state_machine_init(&sm, nullptr, &s11, &s_error, &hooks, nullptr,
+						  nullptr);
+	REQUIRE_FALSE(sm_state_machine_stopped(&sm));
+	sm_state_machine_init(&sm, nullptr, &s11_child_child, &s_error, &hooks,
+						  nullptr, nullptr);
+
+	struct sm_event event;
+	event.data = nullptr;
+	event.type = event_s11_to_s1;
+	REQUIRE_CALL(mocks, guard2(nullptr, &s11_child_child, nullptr, &event, &s1,
+							   nullptr))
+		.RETURN(true);
+	REQUIRE_CALL(mocks, trans_action2(nullptr, &s11_child_child, nullptr,
+									  &event, &s1, nullptr));
+	REQUIRE(sm_state_machine_handle_event(&sm, &event) ==
+			sm_state_machine_state_changed);
+	REQUIRE(sm_state_machine_current_state(&sm) == &s1);
+
+#if SM_STATE_MACHINE_ENABLE_LOG
+	REQUIRE(std::string(recorded.guard_name) == "guard2");
+	REQUIRE(std::string(recorded.action_name) == "trans_action2");
+#endif
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	/* The same transition, in both table and function mode */
+	REQUIRE(recorded.state == &s11);
+	REQUIRE(recorded.transition != nullptr);
+	REQUIRE(recorded.transition->event_type == event_s11_to_s1);
+	REQUIRE(recorded.transition->next_state == &s1);
+	REQUIRE(recorded.transition->guard->fn == &guard2);
+	const sm_transition *transition = recorded.transition;
+
+	sm_state_machine_init(&sm, nullptr, &s11_child_child, &s_error, &hooks,
+						  nullptr, nullptr);
+	ALLOW_CALL(mocks, guard2(_, _, _, _, _, _)).RETURN(true);
+	ALLOW_CALL(mocks, trans_action2(_, _, _, _, _, _));
+	sm_state_machine_handle_event(&sm, &event);
+	REQUIRE(recorded.transition == transition);
+#endif
+}
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS && !SM_STATE_MACHINE_OPTIMIZE_RAM
+namespace {
+struct async_context {
+	std::vector<sm_async_completion> pending;
+	bool complete_immediately = false;
+	int entries = 0;
+	int exits = 0;
+};
+
+void async_io(void *sm_user_data, const sm_state *, void *, const sm_event *,
+			  const sm_state *, void *, sm_async_completion completion) {
+	auto *context = static_cast<async_context *>(sm_user_data);
+	if (context->complete_immediately) {
+		sm_state_machine_complete_async_action(completion);
+	} else {
+		context->pending.push_back(completion);
+	}
+}
+
+void count_entry(void *sm_user_data, const sm_state *, void *,
+				 const sm_event *, const sm_state *, void *) {
+	++static_cast<async_context *>(sm_user_data)->entries;
+}
+
+void count_exit(void *sm_user_data, const sm_state *, void *,
+				const sm_event *, const sm_state *, void *) {
+	++static_cast<async_context *>(sm_user_data)->exits;
+}
+} // namespace
+
+TEST_CASE("Asynchronous actions") {
+	enum { event_start = 1, event_stop };
+	sm_action io = {};
+	io.async_fn = async_io;
+	sm_action entry = {};
+	entry.fn = count_entry;
+	sm_action exit = {};
+	exit.fn = count_exit;
+
+	sm_state idle = {};
+	sm_state busy = {};
+	sm_state error = {};
+	sm_transition idle_transitions[] = {{event_start, nullptr, &io, &busy}};
+	sm_transition busy_transitions[] = {{event_stop, nullptr, nullptr, &idle}};
+	sm_state_transitions idle_table = {idle_transitions, 1};
+	sm_state_transitions busy_table = {busy_transitions, 1};
+	idle.transitions = &idle_table;
+	idle.exit_action = &exit;
+	busy.transitions = &busy_table;
+	busy.entry_action = &entry;
+
+	async_context context;
+	sm_state_machine sm;
+	sm_state_machine_hooks hooks = {};
+	sm_state_machine_init(&sm, nullptr, &idle, &error, &hooks, &context,
+						  nullptr);
+	sm_event start = {event_start, nullptr};
+	sm_event stop = {event_stop, nullptr};
+
+	SECTION("the next state is entered when the action completes") {
+		REQUIRE(sm_state_machine_handle_event(&sm, &start) ==
+				sm_state_machine_transition_pending);
+		REQUIRE(sm_state_machine_in_transit(&sm));
+		REQUIRE(sm_state_machine_current_state(&sm) == &idle);
+		REQUIRE(context.exits == 1);
+		REQUIRE(context.entries == 0);
+
+		REQUIRE(sm_state_machine_complete_async_action(context.pending[0]) ==
+				sm_state_machine_state_changed);
+		REQUIRE(!sm_state_machine_in_transit(&sm));
+		REQUIRE(sm_state_machine_current_state(&sm) == &busy);
+		REQUIRE(context.entries == 1);
+
+		/* A completion handle can be used only once */
+		REQUIRE(sm_state_machine_complete_async_action(context.pending[0]) ==
+				sm_state_machine_error_arg);
+	}
+
+	SECTION("the action may complete before returning") {
+		context.complete_immediately = true;
+		REQUIRE(sm_state_machine_handle_event(&sm, &start) ==
+				sm_state_machine_state_changed);
+		REQUIRE(sm_state_machine_current_state(&sm) == &busy);
+		REQUIRE(context.entries == 1);
+	}
+
+	SECTION("events in transit are rejected by default") {
+		sm_state_machine_handle_event(&sm, &start);
+		REQUIRE(sm_state_machine_handle_event(&sm, &stop) ==
+				sm_state_machine_event_rejected);
+		sm_state_machine_complete_async_action(context.pending[0]);
+		REQUIRE(sm_state_machine_current_state(&sm) == &busy);
+	}
+
+	SECTION("events in transit can be deferred to the caller") {
+		sm_state_machine_set_transit_policy(&sm,
+											sm_state_machine_transit_defer);
+		sm_state_machine_handle_event(&sm, &start);
+		REQUIRE(sm_state_machine_handle_event(&sm, &stop) ==
+				sm_state_machine_event_deferred);
+		sm_state_machine_complete_async_action(context.pending[0]);
+		REQUIRE(sm_state_machine_current_state(&sm) == &busy);
+	}
+
+	SECTION("events in transit can be queued") {
+		sm_state_machine_set_transit_policy(&sm,
+											sm_state_machine_transit_queue);
+		sm_state_machine_handle_event(&sm, &start);
+		REQUIRE(sm_state_machine_handle_event(&sm, &stop) ==
+				sm_state_machine_event_queued);
+		REQUIRE(sm_state_machine_handle_event(&sm, &start) ==
+				sm_state_machine_event_queued);
+		for (unsigned int i = 2; i < SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE; ++i) {
+			sm_state_machine_handle_event(&sm, &stop);
+		}
+		REQUIRE(sm_state_machine_handle_event(&sm, &stop) ==
+				sm_state_machine_event_rejected);
+
+		/* busy -> idle -> (in transit again): the rest stays queued, and
+		 * the new transition is reported */
+		REQUIRE(sm_state_machine_complete_async_action(context.pending[0]) ==
+				sm_state_machine_transition_pending);
+		REQUIRE(sm_state_machine_in_transit(&sm));
+		REQUIRE(context.pending.size() == 2);
+		REQUIRE(sm.transit.queue_count ==
+				SM_STATE_MACHINE_TRANSIT_QUEUE_SIZE - 2);
+
+		REQUIRE(sm_state_machine_complete_async_action(context.pending[1]) ==
+				sm_state_machine_state_changed);
+		REQUIRE(!sm_state_machine_in_transit(&sm));
+		REQUIRE(sm_state_machine_current_state(&sm) == &idle);
+		REQUIRE(sm.transit.queue_count == 0);
+	}
+}
+#endif
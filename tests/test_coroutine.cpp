@@ -0,0 +1,259 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_coroutine.cpp
+ *
+ * \brief		C++20 coroutine support unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_coroutine.hpp"
+
+#if defined(__cpp_impl_coroutine) && !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <exception>
+#include <vector>
+
+namespace {
+/* Minimal eagerly started coroutine, owned by the caller */
+struct task {
+	struct promise_type {
+		task get_return_object() {
+			return task{
+				std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	explicit task(std::coroutine_handle<promise_type> handle)
+		: handle(handle) {}
+	task(task &&other) noexcept : handle(other.handle) {
+		other.handle = nullptr;
+	}
+	~task() {
+		if (handle) {
+			handle.destroy();
+		}
+	}
+	bool done() const { return handle.done(); }
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+enum { event_start = 1, event_stop, event_pause, event_load, event_link };
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+void load(void *sm_user_data, const sm_state *, void *, const sm_event *,
+		  const sm_state *, void *, sm_async_completion completion) {
+	static_cast<std::vector<sm_async_completion> *>(sm_user_data)
+		->push_back(completion);
+}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+void count_state_changed(void *context, const sm_state_machine *,
+						 const sm_state *, const sm_state *) {
+	++*static_cast<int *>(context);
+}
+#endif
+
+/*
+ * idle -start-> running (entered through running_fast) -stop-> idle; idle
+ * -load-> running with an asynchronous action; idle -link-> link, whose
+ * submachine starts with handshake
+ */
+struct fixture {
+	/* Before the wrapper, which installs its tracer */
+	sm_state_machine &init() {
+		idle.transitions = &idle_table;
+		running.entry_state = &running_fast;
+		running_fast.parent_state = &running;
+		running_fast.transitions = &running_table;
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+		load_action.async_fn = load;
+		idle_transitions[2].action = &load_action;
+#endif
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+		handshake_submachine.initial_state = &handshake;
+		link.submachine = &handshake_submachine;
+		link.transitions = &link_table;
+#endif
+#if SM_STATE_MACHINE_ENABLE_TRACE
+		tracer.context = &state_changes;
+		tracer.state_changed = count_state_changed;
+		hooks.tracer = &tracer;
+#endif
+		sm_state_machine_init(&sm, nullptr, &idle, &error, &hooks,
+							  &completions, nullptr);
+		return sm;
+	}
+
+	void dispatch(int type) {
+		sm_event event = {type, nullptr};
+		machine.handle_event(&event);
+	}
+
+	sm_state idle = {};
+	sm_state running = {};
+	sm_state running_fast = {};
+	sm_state link = {};
+	sm_state handshake = {};
+	sm_state error = {};
+	sm_action load_action = {};
+	sm_transition idle_transitions[3] = {
+		{event_start, nullptr, nullptr, &running},
+		{event_link, nullptr, nullptr, &link},
+		{event_load, nullptr, nullptr, &running}};
+	sm_transition running_transitions[2] = {
+		{event_stop, nullptr, nullptr, &idle},
+		{event_pause, nullptr, nullptr, &running_fast}};
+	sm_transition link_transitions[1] = {{event_stop, nullptr, nullptr, &idle}};
+	sm_state_transitions idle_table = {idle_transitions, 3};
+	sm_state_transitions running_table = {running_transitions, 2};
+	sm_state_transitions link_table = {link_transitions, 1};
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	sm_submachine handshake_submachine = {};
+#endif
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	std::vector<sm_async_completion> completions;
+#else
+	int completions = 0;
+#endif
+	int state_changes = 0;
+	sm_state_machine_hooks hooks = {};
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	sm_state_machine_tracer tracer = {};
+#endif
+	sm_state_machine sm;
+	sm_awaitable_state_machine machine{init()};
+};
+
+task wait_for(sm_awaitable_state_machine &machine, const sm_state *state,
+			  int &resumed) {
+	co_await machine.until(state);
+	++resumed;
+}
+
+task record_transitions(sm_awaitable_state_machine &machine,
+						std::vector<sm_transition_info> &transitions,
+						size_t count) {
+	while (transitions.size() < count) {
+		transitions.push_back(co_await machine.next_transition());
+	}
+}
+} // namespace
+
+TEST_CASE("Coroutines") {
+	fixture f;
+
+	SECTION("until() doesn't suspend if the state is already current") {
+		int resumed = 0;
+		task t = wait_for(f.machine, &f.idle, resumed);
+		REQUIRE(t.done());
+		REQUIRE(resumed == 1);
+	}
+
+	SECTION("until() resumes when the state, or a child, is entered") {
+		int resumed_running = 0;
+		int resumed_idle = 0;
+		task running = wait_for(f.machine, &f.running, resumed_running);
+		task idle = wait_for(f.machine, &f.idle, resumed_idle);
+		REQUIRE(resumed_running == 0);
+
+		f.dispatch(event_stop);
+		REQUIRE(resumed_running == 0);
+		f.dispatch(event_start);
+		REQUIRE(running.done());
+		REQUIRE(resumed_running == 1);
+		REQUIRE(resumed_idle == 1);
+	}
+
+	SECTION("next_transition() skips events that don't change state") {
+		std::vector<sm_transition_info> transitions;
+		task t = record_transitions(f.machine, transitions, 3);
+
+		f.dispatch(event_stop);
+		f.dispatch(event_start);
+		f.dispatch(event_start);
+		f.dispatch(event_pause);
+		REQUIRE(!t.done());
+		f.dispatch(event_stop);
+		REQUIRE(t.done());
+
+		REQUIRE(transitions.size() == 3);
+		REQUIRE(transitions[0].previous_state == &f.idle);
+		REQUIRE(transitions[0].current_state == &f.running_fast);
+		REQUIRE(transitions[0].event_type == event_start);
+		REQUIRE(transitions[1].previous_state == &f.running_fast);
+		REQUIRE(transitions[1].current_state == &f.running_fast);
+		REQUIRE(transitions[1].event_type == event_pause);
+		REQUIRE(transitions[2].current_state == &f.idle);
+		REQUIRE(transitions[2].status == sm_state_machine_state_changed);
+	}
+
+	SECTION("destroying a suspended coroutine cancels its wait") {
+		int resumed = 0;
+		{
+			task t = wait_for(f.machine, &f.running, resumed);
+			REQUIRE(!t.done());
+		}
+		f.dispatch(event_start);
+		REQUIRE(resumed == 0);
+	}
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	SECTION("events dispatched without the wrapper resume the coroutines") {
+		int resumed = 0;
+		task t = wait_for(f.machine, &f.running, resumed);
+		sm_event start = {event_start, nullptr};
+		sm_state_machine_handle_event(&f.sm, &start);
+		REQUIRE(t.done());
+		REQUIRE(resumed == 1);
+		/* The tracer of the state machine is still called */
+		REQUIRE(f.state_changes == 1);
+	}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_TRACE && SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS
+	SECTION("completing an asynchronous action resumes the coroutines") {
+		std::vector<sm_transition_info> transitions;
+		task t = record_transitions(f.machine, transitions, 1);
+		f.dispatch(event_load);
+		REQUIRE(!t.done());
+		REQUIRE(f.completions.size() == 1);
+
+		sm_state_machine_complete_async_action(f.completions[0]);
+		REQUIRE(t.done());
+		REQUIRE(transitions[0].previous_state == &f.idle);
+		REQUIRE(transitions[0].current_state == &f.running_fast);
+		REQUIRE(transitions[0].event_type == event_load);
+		REQUIRE(transitions[0].status == sm_state_machine_state_changed);
+	}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	SECTION("until() sees the submachine states") {
+		int resumed = 0;
+		task t = wait_for(f.machine, &f.link, resumed);
+		f.dispatch(event_link);
+		REQUIRE(f.sm.current_state == &f.handshake);
+		REQUIRE(t.done());
+
+		task again = wait_for(f.machine, &f.link, resumed);
+		REQUIRE(again.done());
+		REQUIRE(resumed == 2);
+	}
+#endif
+}
+#endif
@@ -0,0 +1,265 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_dispatcher.cpp
+ *
+ * \brief		Sharded dispatcher unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_dispatcher.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+struct handled_event {
+	size_t shard;
+	uint64_t key;
+	int type;
+	int status;
+};
+
+struct recorder {
+	std::vector<handled_event> events;
+	/* Not copyable: the published states are atomic */
+	std::unique_ptr<sm_state_machine[]> machines;
+	size_t num_machines = 0;
+
+	void resize(size_t size) {
+		machines.reset(new sm_state_machine[size]);
+		num_machines = size;
+	}
+};
+
+sm_state_machine *resolve(void *context, size_t, uint64_t key) {
+	auto *r = static_cast<recorder *>(context);
+	return key < r->num_machines ? &r->machines[key] : nullptr;
+}
+
+void record(void *context, size_t shard, uint64_t key, const sm_event *event,
+			int status) {
+	static_cast<recorder *>(context)->events.push_back(
+		{shard, key, event->type, status});
+}
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS && !SM_STATE_MACHINE_OPTIMIZE_RAM
+void start_io(void *sm_user_data, const sm_state *, void *, const sm_event *,
+			  const sm_state *, void *, sm_async_completion completion) {
+	static_cast<std::vector<sm_async_completion> *>(sm_user_data)
+		->push_back(completion);
+}
+#endif
+
+sm_dispatcher_config make_config(recorder &r, size_t num_shards,
+								 size_t num_producers, size_t ring_size,
+								 size_t batch_size) {
+	sm_dispatcher_config config = {};
+	config.num_shards = num_shards;
+	config.num_producers = num_producers;
+	config.ring_size = ring_size;
+	config.batch_size = batch_size;
+	config.resolve = resolve;
+	config.handled = record;
+	config.context = &r;
+	return config;
+}
+} // namespace
+
+TEST_CASE("Dispatcher") {
+	recorder r;
+	sm_dispatcher dispatcher;
+
+	SECTION("invalid configurations are refused") {
+		sm_dispatcher_config config = make_config(r, 2, 1, 6, 1);
+		REQUIRE(!sm_dispatcher_init(&dispatcher, &config));
+		config = make_config(r, 0, 1, 8, 1);
+		REQUIRE(!sm_dispatcher_init(&dispatcher, &config));
+	}
+
+	SECTION("events reach the owning shard, in order") {
+		sm_dispatcher_config config = make_config(r, 4, 2, 64, 1);
+		REQUIRE(sm_dispatcher_init(&dispatcher, &config));
+
+		for (int i = 0; i < 32; ++i) {
+			sm_event event = {i, nullptr};
+			REQUIRE(sm_dispatcher_post(sm_dispatcher_get_producer(&dispatcher,
+															  i % 2),
+									   i % 8, &event));
+		}
+		size_t handled = 0;
+		for (size_t shard = 0; shard < 4; ++shard) {
+			/* At most one batch per producer is handled at a time */
+			while (size_t count = sm_dispatcher_poll(&dispatcher, shard)) {
+				REQUIRE(count <= 2);
+				handled += count;
+			}
+			REQUIRE(sm_dispatcher_events_handled(&dispatcher, shard) ==
+					(uint64_t)std::count_if(
+						r.events.begin(), r.events.end(),
+						[shard](const handled_event &e) {
+							return e.shard == shard;
+						}));
+		}
+		REQUIRE(handled == 32);
+
+		std::map<uint64_t, int> last_type;
+		for (const handled_event &e : r.events) {
+			REQUIRE(e.shard == sm_dispatcher_shard_of(&dispatcher, e.key));
+			REQUIRE(e.type % 8 == static_cast<int>(e.key));
+			if (last_type.count(e.key)) {
+				REQUIRE(e.type > last_type[e.key]);
+			}
+			last_type[e.key] = e.type;
+		}
+		sm_dispatcher_deinit(&dispatcher);
+	}
+
+	SECTION("producers publish in batches") {
+		sm_dispatcher_config config = make_config(r, 1, 1, 16, 4);
+		REQUIRE(sm_dispatcher_init(&dispatcher, &config));
+		sm_dispatcher_producer *producer =
+			sm_dispatcher_get_producer(&dispatcher, 0);
+		sm_event event = {0, nullptr};
+
+		for (int i = 0; i < 3; ++i) {
+			sm_dispatcher_post(producer, 1, &event);
+		}
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 0);
+		sm_dispatcher_post(producer, 1, &event);
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 4);
+
+		sm_dispatcher_post(producer, 1, &event);
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 0);
+		sm_dispatcher_flush(producer);
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 1);
+		sm_dispatcher_deinit(&dispatcher);
+	}
+
+	SECTION("a full ring refuses events until the shard catches up") {
+		sm_dispatcher_config config = make_config(r, 1, 1, 4, 8);
+		REQUIRE(sm_dispatcher_init(&dispatcher, &config));
+		sm_dispatcher_producer *producer =
+			sm_dispatcher_get_producer(&dispatcher, 0);
+		sm_event event = {0, nullptr};
+
+		for (int i = 0; i < 4; ++i) {
+			REQUIRE(sm_dispatcher_post(producer, 1, &event));
+		}
+		REQUIRE(!sm_dispatcher_post(producer, 1, &event));
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 4);
+		REQUIRE(sm_dispatcher_post(producer, 1, &event));
+		sm_dispatcher_deinit(&dispatcher);
+	}
+
+	SECTION("shard threads handle everything published before stopping") {
+		const size_t num_events = 10000;
+		sm_dispatcher_config config = make_config(r, 3, 2, 256, 16);
+		config.handled = nullptr;
+		config.pin_threads = true;
+		sm_state idle = {};
+		sm_state error = {};
+		sm_state_machine_hooks hooks = {};
+		r.resize(num_events);
+		for (size_t i = 0; i < num_events; ++i) {
+			sm_state_machine_init(&r.machines[i], nullptr, &idle, &error,
+								  &hooks, nullptr, nullptr);
+		}
+		REQUIRE(sm_dispatcher_init(&dispatcher, &config));
+		REQUIRE(sm_dispatcher_start(&dispatcher));
+
+		std::vector<std::thread> producers;
+		for (size_t p = 0; p < 2; ++p) {
+			producers.emplace_back([&dispatcher, p] {
+				sm_dispatcher_producer *producer =
+					sm_dispatcher_get_producer(&dispatcher, p);
+				sm_event event = {0, nullptr};
+				for (size_t i = 0; i < num_events; ++i) {
+					while (!sm_dispatcher_post(producer, i, &event)) {
+						std::this_thread::yield();
+					}
+				}
+				sm_dispatcher_flush(producer);
+			});
+		}
+		for (std::thread &producer : producers) {
+			producer.join();
+		}
+		sm_dispatcher_stop(&dispatcher);
+
+		uint64_t handled = 0;
+		for (size_t shard = 0; shard < 3; ++shard) {
+			handled += sm_dispatcher_events_handled(&dispatcher, shard);
+		}
+		REQUIRE(handled == 2 * num_events);
+		sm_dispatcher_deinit(&dispatcher);
+	}
+
+#if SM_STATE_MACHINE_ENABLE_ASYNC_ACTIONS && !SM_STATE_MACHINE_OPTIMIZE_RAM
+	SECTION("events held in transit are reported once the action completes") {
+		enum { event_start = 1, event_stop };
+		sm_action io = {};
+		io.async_fn = start_io;
+		sm_state idle = {};
+		sm_state busy = {};
+		sm_state error = {};
+		sm_transition idle_transitions[] = {{event_start, nullptr, &io, &busy}};
+		sm_transition busy_transitions[] = {
+			{event_stop, nullptr, nullptr, &idle}};
+		sm_state_transitions idle_table = {idle_transitions, 1};
+		sm_state_transitions busy_table = {busy_transitions, 1};
+		idle.transitions = &idle_table;
+		busy.transitions = &busy_table;
+		std::vector<sm_async_completion> completions;
+		sm_state_machine_hooks hooks = {};
+		r.resize(1);
+		sm_state_machine_init(&r.machines[0], nullptr, &idle, &error, &hooks,
+							  &completions, nullptr);
+		sm_state_machine_set_transit_policy(&r.machines[0],
+											sm_state_machine_transit_queue);
+
+		sm_dispatcher_config config = make_config(r, 1, 2, 8, 2);
+		REQUIRE(sm_dispatcher_init(&dispatcher, &config));
+		sm_dispatcher_producer *producer =
+			sm_dispatcher_get_producer(&dispatcher, 0);
+		sm_dispatcher_producer *io_producer =
+			sm_dispatcher_get_producer(&dispatcher, 1);
+		sm_event start = {event_start, nullptr};
+		sm_event stop = {event_stop, nullptr};
+		REQUIRE(sm_dispatcher_post(producer, 0, &start));
+		REQUIRE(sm_dispatcher_post(producer, 0, &stop));
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 2);
+		REQUIRE(r.events.empty());
+		REQUIRE(completions.size() == 1);
+
+		/* Completed from another producer, e.g. an I/O thread */
+		REQUIRE(sm_dispatcher_post_completion(io_producer, 0, completions[0]));
+		sm_dispatcher_flush(io_producer);
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 1);
+		REQUIRE(r.events.size() == 2);
+		REQUIRE(r.events[0].type == event_start);
+		REQUIRE(r.events[0].status == sm_state_machine_state_changed);
+		REQUIRE(r.events[1].type == event_stop);
+		REQUIRE(r.events[1].status == sm_state_machine_event_queued);
+		REQUIRE(sm_state_machine_current_state(&r.machines[0]) == &idle);
+
+		/* A stale completion is ignored */
+		REQUIRE(sm_dispatcher_post_completion(io_producer, 0, completions[0]));
+		sm_dispatcher_flush(io_producer);
+		REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 1);
+		REQUIRE(r.events.size() == 2);
+		sm_dispatcher_deinit(&dispatcher);
+	}
+#endif
+}
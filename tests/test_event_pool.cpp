@@ -0,0 +1,95 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_event_pool.cpp
+ *
+ * \brief		Event payload pool unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_event_pool.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Event pool") {
+	alignas(max_align_t) unsigned char buffer[1024];
+	sm_event_pool pool;
+	sm_event_pool_init(&pool, buffer, sizeof(buffer), 40);
+	REQUIRE(pool.num_blocks > 0);
+
+	SECTION("the pool can be exhausted and refilled") {
+		std::vector<void *> payloads;
+		while (void *payload = sm_event_pool_alloc(&pool)) {
+			payloads.push_back(payload);
+		}
+		REQUIRE(payloads.size() == pool.num_blocks);
+
+		sm_event_pool_unref(payloads.back());
+		REQUIRE(sm_event_pool_alloc(&pool) == payloads.back());
+	}
+
+	SECTION("a payload is released only with its last reference") {
+		void *payload = sm_event_pool_alloc(&pool);
+		for (size_t i = 1; i < pool.num_blocks; ++i) {
+			REQUIRE(sm_event_pool_alloc(&pool) != nullptr);
+		}
+		sm_event_pool_ref(payload);
+		sm_event_pool_ref(payload);
+		sm_event_pool_unref(payload);
+		sm_event_pool_unref(payload);
+		REQUIRE(sm_event_pool_alloc(&pool) == nullptr);
+		sm_event_pool_unref(payload);
+		REQUIRE(sm_event_pool_alloc(&pool) == payload);
+	}
+
+	SECTION("payloads released by another thread are reclaimed") {
+		std::vector<void *> payloads;
+		while (void *payload = sm_event_pool_alloc(&pool)) {
+			payloads.push_back(payload);
+		}
+		std::thread([&payloads] {
+			for (void *payload : payloads) {
+				sm_event_pool_unref(payload);
+			}
+		}).join();
+		for (size_t i = 0; i < payloads.size(); ++i) {
+			REQUIRE(sm_event_pool_alloc(&pool) != nullptr);
+		}
+		REQUIRE(sm_event_pool_alloc(&pool) == nullptr);
+	}
+}
+
+TEST_CASE("Inline event") {
+	const char payload[] = "inline payload";
+	sm_event_inline event;
+	sm_event_inline_init(&event, 3, payload, sizeof(payload));
+
+	SECTION("the payload is stored in the event") {
+		sm_event *e = sm_event_inline_get(&event);
+		REQUIRE(e->type == 3);
+		REQUIRE(std::strcmp(static_cast<const char *>(e->data), payload) == 0);
+	}
+
+	SECTION("a copy of the event refers to its own payload") {
+		sm_event_inline copy = event;
+		std::memset(&event, 0, sizeof(event));
+		sm_event *e = sm_event_inline_get(&copy);
+		REQUIRE(e->data == copy.payload.bytes);
+		REQUIRE(std::strcmp(static_cast<const char *>(e->data), payload) == 0);
+	}
+
+	SECTION("an event without payload has no data") {
+		sm_event_inline_init(&event, 4, nullptr, 0);
+		REQUIRE(sm_event_inline_get(&event)->data == nullptr);
+	}
+}
@@ -0,0 +1,75 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_fleet.cpp
+ *
+ * \brief		Fleet allocator unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_fleet.h"
+
+#include <cstdint>
+
+namespace {
+uintptr_t address_of(const void *pointer) {
+	return reinterpret_cast<uintptr_t>(pointer);
+}
+} // namespace
+
+TEST_CASE("Fleet") {
+	sm_fleet fleet;
+
+	SECTION("invalid configurations are refused") {
+		sm_fleet_config config = {0, 4, false};
+		REQUIRE(!sm_fleet_init(&fleet, &config));
+		config = {4, 0, false};
+		REQUIRE(!sm_fleet_init(&fleet, &config));
+	}
+
+	SECTION("partitions don't share cache lines") {
+		const sm_fleet_config config = {3, 5, false};
+		REQUIRE(sm_fleet_init(&fleet, &config));
+
+		for (size_t p = 0; p < 3; ++p) {
+			sm_state_machine *partition = sm_fleet_partition(&fleet, p);
+			REQUIRE(address_of(partition) % SM_STATE_MACHINE_CACHE_LINE_SIZE ==
+					0);
+			for (size_t i = 0; i < 5; ++i) {
+				REQUIRE(sm_fleet_get(&fleet, p, i) == &partition[i]);
+				REQUIRE(partition[i].current_state == nullptr);
+			}
+			if (p > 0) {
+				/* The last line of the previous partition ends before */
+				const sm_state_machine *last = sm_fleet_get(&fleet, p - 1, 4);
+				REQUIRE((address_of(last + 1) - 1) /
+							SM_STATE_MACHINE_CACHE_LINE_SIZE <
+						address_of(partition) /
+							SM_STATE_MACHINE_CACHE_LINE_SIZE);
+			}
+		}
+		sm_fleet_deinit(&fleet);
+	}
+
+	SECTION("NUMA local partitions are page aligned") {
+		const sm_fleet_config config = {2, 3, true};
+		REQUIRE(sm_fleet_init(&fleet, &config));
+
+		for (size_t p = 0; p < 2; ++p) {
+			sm_fleet_touch(&fleet, p);
+			REQUIRE(address_of(sm_fleet_partition(&fleet, p)) %
+						SM_STATE_MACHINE_PAGE_SIZE ==
+					0);
+			REQUIRE(sm_fleet_get(&fleet, p, 2)->current_state == nullptr);
+		}
+		sm_fleet_deinit(&fleet);
+	}
+}
@@ -0,0 +1,163 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_generator.cpp
+ *
+ * \brief		Synthetic state machine generator unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_generator.hpp"
+#include "sm_utils.hpp"
+
+#include <algorithm>
+#include <set>
+
+namespace {
+std::size_t depth_of(const sm_generated_machine &machine, std::size_t state) {
+	std::size_t depth = 1;
+	while (machine.model()[state].parent != sm_generated_machine::none) {
+		state = machine.model()[state].parent;
+		++depth;
+	}
+	return depth;
+}
+
+std::size_t count(const std::string &text, const std::string &pattern) {
+	std::size_t n = 0;
+	for (std::size_t pos = text.find(pattern); pos != std::string::npos;
+		 pos = text.find(pattern, pos + 1)) {
+		++n;
+	}
+	return n;
+}
+} // namespace
+
+TEST_CASE("Generator") {
+	sm_generator_options options;
+	options.num_states = 500;
+	options.depth = 4;
+	options.transitions_per_state = 6;
+	options.guard_density = 0.5;
+	options.num_event_types = 8;
+	const sm_generated_machine machine(options);
+	const auto &model = machine.model();
+
+	SECTION("the shape follows the options") {
+		REQUIRE(model.size() == 500);
+		std::size_t max_depth = 0;
+		std::size_t guarded = 0;
+		for (std::size_t i = 0; i < model.size(); ++i) {
+			max_depth = std::max(max_depth, depth_of(machine, i));
+			REQUIRE(model[i].transitions.size() == 6);
+			std::set<int> events;
+			for (const sm_generated_transition &transition :
+				 model[i].transitions) {
+				events.insert(transition.event_type);
+				guarded += transition.guarded;
+				REQUIRE(transition.next_state < model.size());
+			}
+			REQUIRE(events.size() == 6);
+		}
+		REQUIRE(max_depth == 4);
+		REQUIRE(guarded > 500 * 6 / 4);
+		REQUIRE(guarded < 500 * 6 * 3 / 4);
+		REQUIRE(model[machine.initial_state_index()].entry ==
+				sm_generated_machine::none);
+	}
+
+	SECTION("the same seed generates the same state machine") {
+		const sm_generated_machine same(options);
+		REQUIRE(same.c_source("gen", false) == machine.c_source("gen", false));
+		options.seed = 2;
+		const sm_generated_machine other(options);
+		REQUIRE(other.c_source("gen", false) != machine.c_source("gen", false));
+	}
+
+	SECTION("transitions per state are limited by the event types") {
+		options.transitions_per_state = 20;
+		const sm_generated_machine clamped(options);
+		REQUIRE(clamped.options().transitions_per_state == 8);
+		REQUIRE(clamped.model()[0].transitions.size() == 8);
+	}
+
+	SECTION("the source defines every state in either dispatch mode") {
+		const std::string table = machine.c_source("gen", false);
+		REQUIRE(count(table, "SM_STATE_MACHINE_TRANSITION_DEF_START(") == 500);
+		REQUIRE(count(table, "SM_STATE_MACHINE_TRANSITION_ADD(") == 3000);
+		REQUIRE(table.find("#define GEN_INITIAL_STATE gen_state_") !=
+				std::string::npos);
+		REQUIRE(table.find("static bool gen_guard(") != std::string::npos);
+		/* No designated initializer given twice without logs */
+		REQUIRE(table.find("SM_STATE_MACHINE_STATE_NAME") == std::string::npos);
+		REQUIRE(count(table, "#if SM_STATE_MACHINE_ENABLE_LOG\n\t.name = ") ==
+				501);
+
+		const std::string functions = machine.c_source("gen", true);
+		REQUIRE(count(functions, "SM_STATE_MACHINE_TRANSITION_FN_DEF_START(") ==
+				500);
+		REQUIRE(count(functions, "SM_STATE_MACHINE_TRANSITION_FN_ADD(") ==
+				3000);
+	}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	SECTION("the definition in memory is valid") {
+		REQUIRE(sm_verify(machine.initial_state(), machine.error_state(),
+						  machine.states())
+					.empty());
+
+		sm_state_machine state_machine;
+		sm_state_machine_hooks hooks = {};
+		sm_state_machine_init(&state_machine, nullptr, machine.initial_state(),
+							  machine.error_state(), &hooks, nullptr, nullptr);
+		const auto states = machine.states();
+		for (int type : machine.events(1000, 1)) {
+			const sm_event event = {type, nullptr};
+			REQUIRE(sm_state_machine_handle_event(&state_machine, &event) >=
+					0);
+			REQUIRE(std::count(states.begin(), states.end(),
+							   state_machine.current_state) == 1);
+			REQUIRE(state_machine.current_state->entry_state == nullptr);
+		}
+	}
+#endif
+}
+
+TEST_CASE("Generator event distributions") {
+	sm_generator_options options;
+	options.num_event_types = 10;
+
+	SECTION("uniform") {
+		const sm_generated_machine machine(options);
+		std::vector<std::size_t> hits(10);
+		for (int type : machine.events(10000, 3)) {
+			++hits.at(type);
+		}
+		for (std::size_t h : hits) {
+			REQUIRE(h > 800);
+			REQUIRE(h < 1200);
+		}
+	}
+
+	SECTION("Zipf") {
+		options.distribution = sm_event_distribution::zipf;
+		const sm_generated_machine machine(options);
+		std::vector<std::size_t> hits(10);
+		for (int type : machine.events(10000, 3)) {
+			++hits.at(type);
+		}
+		/* 1 / H(10) of the events are the first type */
+		REQUIRE(hits[0] > 3100);
+		REQUIRE(hits[0] < 3700);
+		REQUIRE(hits[0] > 2 * hits[2]);
+		REQUIRE(hits[1] > hits[9]);
+	}
+}
@@ -0,0 +1,190 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_hot_swap.cpp
+ *
+ * \brief		Hot swap of definitions unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_hot_swap.h"
+#include "test_sm.h"
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace {
+enum { event_pause = event_basic_close + 1 };
+
+/* Version 1: the basic idle <-> running. Version 2 adds a paused state, so
+ * that both idle and running are replaced. The error state is shared. */
+struct fixture : test_sm_basic {
+	fixture() {
+		test_sm_basic_init(this);
+		idle2.transitions = &idle2_table;
+		running2.transitions = &running2_table;
+		paused2.transitions = &paused2_table;
+		sm_hot_swap_init(&hot_swap, &v1, 2);
+	}
+	~fixture() { sm_hot_swap_deinit(&hot_swap); }
+
+	int dispatch(sm_hot_swap_instance &instance, int type) {
+		sm_event event = {type, nullptr};
+		return sm_hot_swap_handle_event(&hot_swap, 0, &instance, &event);
+	}
+
+	sm_state idle2 = {};
+	sm_state running2 = {};
+	sm_state paused2 = {};
+	sm_transition idle2_transitions[1] = {
+		{event_basic_start, nullptr, nullptr, &running2}};
+	sm_transition running2_transitions[2] = {
+		{event_basic_stop, nullptr, nullptr, &idle2},
+		{event_pause, nullptr, nullptr, &paused2}};
+	sm_transition paused2_transitions[1] = {
+		{event_basic_start, nullptr, nullptr, &running2}};
+	sm_state_transitions idle2_table = {idle2_transitions, 1};
+	sm_state_transitions running2_table = {running2_transitions, 2};
+	sm_state_transitions paused2_table = {paused2_transitions, 1};
+
+	sm_state_mapping v2_mapping[2] = {{&idle, &idle2}, {&running, &running2}};
+	sm_definition v1 = {1, &idle, &error, nullptr, nullptr, 0};
+	sm_definition v2 = {2, &idle2, &error, &v1, v2_mapping, 2};
+	sm_hot_swap hot_swap;
+};
+} // namespace
+
+TEST_CASE("Hot swap") {
+	fixture f;
+	sm_hot_swap_instance instance;
+	sm_hot_swap_instance_init(&f.hot_swap, &instance, nullptr, &f.hooks,
+							  nullptr, nullptr);
+	REQUIRE(instance.definition == &f.v1);
+	REQUIRE(f.dispatch(instance, event_basic_start) ==
+			sm_state_machine_state_changed);
+	REQUIRE(instance.state_machine.current_state == &f.running);
+
+	SECTION("instances are migrated on their next event") {
+		REQUIRE(sm_hot_swap_publish(&f.hot_swap, &f.v2) == &f.v1);
+		REQUIRE(sm_hot_swap_current(&f.hot_swap) == &f.v2);
+		sm_hot_swap_synchronize(&f.hot_swap);
+		REQUIRE(instance.state_machine.current_state == &f.running);
+
+		/* Unknown to version 1 */
+		REQUIRE(f.dispatch(instance, event_pause) ==
+				sm_state_machine_state_changed);
+		REQUIRE(instance.definition == &f.v2);
+		REQUIRE(instance.state_machine.current_state == &f.paused2);
+		REQUIRE(instance.state_machine.previous_state == &f.running2);
+	}
+
+	SECTION("instances can skip versions") {
+		sm_state paused3 = {};
+		sm_state_mapping v3_mapping[1] = {{&f.paused2, &paused3}};
+		sm_definition v3 = {3, &f.idle2, &f.error, &f.v2, v3_mapping, 1};
+		sm_hot_swap_publish(&f.hot_swap, &f.v2);
+		sm_hot_swap_publish(&f.hot_swap, &v3);
+
+		REQUIRE(sm_hot_swap_migrate(&instance, &v3));
+		REQUIRE(instance.state_machine.current_state == &f.running2);
+		REQUIRE(f.dispatch(instance, event_basic_stop) ==
+				sm_state_machine_state_changed);
+		REQUIRE(instance.state_machine.current_state == &f.idle2);
+	}
+
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+	SECTION("the migrated states are published") {
+		sm_state_machine_snapshot before;
+		sm_state_machine_get_snapshot(&instance.state_machine, &before);
+		REQUIRE(sm_hot_swap_migrate(&instance, &f.v2));
+
+		sm_state_machine_snapshot snapshot;
+		sm_state_machine_get_snapshot(&instance.state_machine, &snapshot);
+		REQUIRE(snapshot.current_state == &f.running2);
+		REQUIRE(snapshot.previous_state == &f.idle2);
+		REQUIRE(snapshot.transitions == before.transitions + 1);
+	}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+	SECTION("instances inside a submachine are migrated once they leave it") {
+		/* idle -> nested, whose submachine has a single state */
+		sm_state inner = {};
+		sm_submachine submachine = {&inner};
+		sm_state nested = {};
+		sm_transition nested_transitions[1] = {
+			{event_basic_stop, nullptr, nullptr, &f.idle}};
+		sm_state_transitions nested_table = {nested_transitions, 1};
+		nested.submachine = &submachine;
+		nested.transitions = &nested_table;
+		sm_transition idle_transitions[1] = {
+			{event_basic_start, nullptr, nullptr, &nested}};
+		sm_state_transitions idle_table = {idle_transitions, 1};
+		sm_state idle = {};
+		idle.transitions = &idle_table;
+		sm_definition v1 = {1, &idle, &f.error, nullptr, nullptr, 0};
+		sm_definition v2 = {2, &f.idle2, &f.error, &v1, nullptr, 0};
+		sm_state_machine_init(&instance.state_machine, nullptr, &idle, &f.error,
+							  &f.hooks, nullptr, nullptr);
+		instance.definition = &v1;
+
+		sm_event event = {event_basic_start, nullptr};
+		sm_state_machine_handle_event(&instance.state_machine, &event);
+		REQUIRE(instance.state_machine.current_state == &inner);
+		REQUIRE(!sm_hot_swap_migrate(&instance, &v2));
+		REQUIRE(instance.definition == &v1);
+
+		event.type = event_basic_stop;
+		REQUIRE(sm_state_machine_handle_event(&instance.state_machine,
+											  &event) ==
+				sm_state_machine_state_changed);
+		REQUIRE(sm_hot_swap_migrate(&instance, &v2));
+		REQUIRE(instance.definition == &v2);
+	}
+#endif
+
+	SECTION("instances of an unrelated version are restarted") {
+		sm_definition other = {7, &f.idle2, &f.error, nullptr, nullptr, 0};
+		REQUIRE(sm_hot_swap_migrate(&instance, &other));
+		REQUIRE(instance.state_machine.current_state == &f.idle2);
+		REQUIRE(instance.state_machine.previous_state == nullptr);
+	}
+}
+
+TEST_CASE("Hot swap grace period") {
+	fixture f;
+	std::atomic<bool> synchronized{false};
+
+	sm_hot_swap_read_lock(&f.hot_swap, 1);
+	REQUIRE(sm_hot_swap_current(&f.hot_swap) == &f.v1);
+	sm_hot_swap_publish(&f.hot_swap, &f.v2);
+	std::thread writer([&f, &synchronized] {
+		sm_hot_swap_synchronize(&f.hot_swap);
+		synchronized = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	/* The reader may still be using version 1 */
+	REQUIRE(!synchronized);
+	sm_hot_swap_read_unlock(&f.hot_swap, 1);
+	writer.join();
+	REQUIRE(synchronized);
+
+	/* Readers outside of their critical section don't delay it */
+	sm_hot_swap_read_lock(&f.hot_swap, 1);
+	REQUIRE(sm_hot_swap_current(&f.hot_swap) == &f.v2);
+	sm_hot_swap_read_unlock(&f.hot_swap, 1);
+	sm_hot_swap_synchronize(&f.hot_swap);
+}
+
+#endif
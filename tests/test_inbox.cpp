@@ -0,0 +1,306 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_inbox.cpp
+ *
+ * \brief		Coalescing inbox unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_dispatcher.h"
+#include "sm_inbox.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace {
+enum {
+	event_command,
+	event_position,
+	event_start,
+	event_tick,
+	num_event_types,
+};
+
+const sm_inbox_policy policies[num_event_types] = {
+	sm_inbox_policy_queue,
+	sm_inbox_policy_keep_latest,
+	sm_inbox_policy_keep_first,
+	sm_inbox_policy_count,
+};
+
+void *payload(uintptr_t value) {
+	return reinterpret_cast<void *>(value);
+}
+
+uintptr_t payload_of(const sm_inbox_entry &entry) {
+	return reinterpret_cast<uintptr_t>(entry.event.data);
+}
+
+void record_discarded(void *context, const sm_inbox_entry *entry) {
+	static_cast<std::vector<sm_inbox_entry> *>(context)->push_back(*entry);
+}
+
+void push(sm_inbox *inbox, uint64_t key, int type, uintptr_t data,
+		  sm_inbox_push_status expected) {
+	sm_event event = {type, payload(data)};
+	REQUIRE(sm_inbox_push(inbox, key, &event) == expected);
+}
+
+sm_inbox_entry pop(sm_inbox *inbox) {
+	sm_inbox_entry entry;
+	REQUIRE(sm_inbox_pop(inbox, &entry));
+	return entry;
+}
+} // namespace
+
+TEST_CASE("Inbox") {
+	/* Too large for the stack */
+	auto inbox = std::make_unique<sm_inbox>();
+	std::vector<sm_inbox_entry> discarded;
+	sm_inbox_config config = {};
+	config.policies = policies;
+	config.num_types = num_event_types;
+	config.discard = record_discarded;
+	config.context = &discarded;
+	sm_inbox_init(inbox.get(), &config);
+
+	SECTION("events without a coalescing policy are queued in order") {
+		for (uintptr_t i = 0; i < 3; ++i) {
+			push(inbox.get(), 1, event_command, i, sm_inbox_queued);
+		}
+		push(inbox.get(), 1, num_event_types, 3, sm_inbox_queued);
+		REQUIRE(sm_inbox_size(inbox.get()) == 4);
+		for (uintptr_t i = 0; i < 4; ++i) {
+			sm_inbox_entry entry = pop(inbox.get());
+			REQUIRE(payload_of(entry) == i);
+			REQUIRE(entry.count == 1);
+		}
+		sm_inbox_entry entry;
+		REQUIRE(!sm_inbox_pop(inbox.get(), &entry));
+		REQUIRE(discarded.empty());
+	}
+
+	SECTION("keep latest supersedes the payload, keeping the position") {
+		push(inbox.get(), 1, event_position, 10, sm_inbox_queued);
+		push(inbox.get(), 1, event_command, 0, sm_inbox_queued);
+		push(inbox.get(), 2, event_position, 20, sm_inbox_queued);
+		push(inbox.get(), 1, event_position, 11, sm_inbox_coalesced);
+		push(inbox.get(), 1, event_position, 12, sm_inbox_coalesced);
+		REQUIRE(sm_inbox_size(inbox.get()) == 3);
+
+		REQUIRE(discarded.size() == 2);
+		REQUIRE(payload_of(discarded[0]) == 10);
+		REQUIRE(payload_of(discarded[1]) == 11);
+
+		sm_inbox_entry entry = pop(inbox.get());
+		REQUIRE(entry.key == 1);
+		REQUIRE(entry.event.type == event_position);
+		REQUIRE(payload_of(entry) == 12);
+		REQUIRE(entry.count == 3);
+		REQUIRE(pop(inbox.get()).event.type == event_command);
+		REQUIRE(payload_of(pop(inbox.get())) == 20);
+
+		/* Once handled, the next event is queued again */
+		push(inbox.get(), 1, event_position, 13, sm_inbox_queued);
+	}
+
+	SECTION("keep first drops the new events") {
+		push(inbox.get(), 1, event_start, 1, sm_inbox_queued);
+		push(inbox.get(), 1, event_start, 2, sm_inbox_coalesced);
+		REQUIRE(discarded.size() == 1);
+		REQUIRE(payload_of(discarded[0]) == 2);
+
+		sm_inbox_entry entry = pop(inbox.get());
+		REQUIRE(payload_of(entry) == 1);
+		REQUIRE(entry.count == 2);
+	}
+
+	SECTION("count merges the events into their number") {
+		for (int i = 0; i < 5; ++i) {
+			push(inbox.get(), 7, event_tick, 0,
+				 i == 0 ? sm_inbox_queued : sm_inbox_coalesced);
+		}
+		push(inbox.get(), 8, event_tick, 0, sm_inbox_queued);
+
+		sm_inbox_entry entry = pop(inbox.get());
+		REQUIRE(entry.key == 7);
+		REQUIRE(payload_of(entry) == 5);
+		REQUIRE(entry.count == 5);
+		REQUIRE(payload_of(pop(inbox.get())) == 1);
+	}
+
+	SECTION("a full inbox refuses new events but still coalesces") {
+		for (uint64_t key = 0; key < SM_STATE_MACHINE_INBOX_SIZE; ++key) {
+			push(inbox.get(), key, event_position, key, sm_inbox_queued);
+		}
+		push(inbox.get(), 0, event_command, 0, sm_inbox_full);
+		push(inbox.get(), 0, event_position, 100, sm_inbox_coalesced);
+
+		pop(inbox.get());
+		push(inbox.get(), 0, event_command, 0, sm_inbox_queued);
+	}
+
+	SECTION("the events of a key can be cancelled") {
+		push(inbox.get(), 1, event_command, 1, sm_inbox_queued);
+		push(inbox.get(), 2, event_command, 2, sm_inbox_queued);
+		push(inbox.get(), 1, event_position, 3, sm_inbox_queued);
+		push(inbox.get(), 1, event_command, 4, sm_inbox_queued);
+
+		REQUIRE(sm_inbox_cancel(inbox.get(), 1) == 3);
+		REQUIRE(sm_inbox_cancel(inbox.get(), 1) == 0);
+		REQUIRE(discarded.size() == 3);
+		REQUIRE(sm_inbox_size(inbox.get()) == 1);
+		REQUIRE(pop(inbox.get()).key == 2);
+
+		/* Cancelled events are not coalesced anymore */
+		push(inbox.get(), 1, event_position, 5, sm_inbox_queued);
+	}
+
+	SECTION("a backlog of a single key drains and refills") {
+		for (uintptr_t i = 0; i < SM_STATE_MACHINE_INBOX_SIZE; ++i) {
+			push(inbox.get(), 1, event_command, i, sm_inbox_queued);
+		}
+		for (uintptr_t i = 0; i < SM_STATE_MACHINE_INBOX_SIZE / 2; ++i) {
+			REQUIRE(payload_of(pop(inbox.get())) == i);
+		}
+		push(inbox.get(), 2, event_command, 0, sm_inbox_queued);
+		push(inbox.get(), 1, event_position, 0, sm_inbox_queued);
+		REQUIRE(sm_inbox_cancel(inbox.get(), 1) ==
+				SM_STATE_MACHINE_INBOX_SIZE / 2 + 1);
+		REQUIRE(sm_inbox_size(inbox.get()) == 1);
+		REQUIRE(pop(inbox.get()).key == 2);
+
+		push(inbox.get(), 1, event_command, 7, sm_inbox_queued);
+		REQUIRE(sm_inbox_cancel(inbox.get(), 1) == 1);
+		REQUIRE(sm_inbox_size(inbox.get()) == 0);
+	}
+}
+
+TEST_CASE("Dispatcher with coalescing inbox") {
+	struct context {
+		std::vector<sm_inbox_entry> handled;
+		sm_dispatcher *dispatcher;
+	} c;
+	sm_inbox_config inbox_config = {};
+	inbox_config.policies = policies;
+	inbox_config.num_types = num_event_types;
+	sm_dispatcher dispatcher;
+	sm_dispatcher_config config = {};
+	config.num_shards = 1;
+	config.num_producers = 2;
+	config.ring_size = 16;
+	config.batch_size = 16;
+	config.resolve = [](void *, size_t, uint64_t) -> sm_state_machine * {
+		return nullptr;
+	};
+	config.handled = [](void *ctx, size_t shard, uint64_t key,
+						const sm_event *event, int) {
+		auto *c = static_cast<context *>(ctx);
+		c->handled.push_back({key, *event, 1});
+		if (event->type == event_command) {
+			/* The state machine is going away */
+			REQUIRE(sm_dispatcher_cancel(c->dispatcher, shard, key) == 1);
+		}
+	};
+	config.context = &c;
+	config.inbox = &inbox_config;
+	c.dispatcher = &dispatcher;
+	REQUIRE(sm_dispatcher_init(&dispatcher, &config));
+
+	for (size_t p = 0; p < 2; ++p) {
+		sm_dispatcher_producer *producer =
+			sm_dispatcher_get_producer(&dispatcher, p);
+		for (int i = 0; i < 4; ++i) {
+			sm_event event = {event_tick, nullptr};
+			sm_dispatcher_post(producer, 1, &event);
+		}
+		sm_event event = {p ? event_start : event_command, nullptr};
+		sm_dispatcher_post(producer, 2 + p, &event);
+		event = {event_position, payload(p)};
+		sm_dispatcher_post(producer, 2, &event);
+		sm_dispatcher_flush(producer);
+	}
+
+	/* Ticks from both producers coalesced into one, the position for key 2
+	 * cancelled by the command */
+	REQUIRE(sm_dispatcher_poll(&dispatcher, 0) == 3);
+	REQUIRE(sm_dispatcher_events_handled(&dispatcher, 0) == 3);
+	REQUIRE(c.handled.size() == 3);
+	REQUIRE(c.handled[0].key == 1);
+	REQUIRE(payload_of(c.handled[0]) == 8);
+	REQUIRE(c.handled[1].key == 2);
+	REQUIRE(c.handled[2].key == 3);
+	REQUIRE(sm_dispatcher_cancel(&dispatcher, 0, 2) == 0);
+	sm_dispatcher_deinit(&dispatcher);
+}
+
+#if SM_STATE_MACHINE_INBOX_LANES >= 3
+TEST_CASE("Inbox priority lanes") {
+	enum { event_routine, event_warning, event_fault };
+	const uint8_t lanes[] = {0, 1, 2};
+	auto inbox = std::make_unique<sm_inbox>();
+	sm_inbox_config config = {};
+	config.lanes = lanes;
+	config.num_types = 3;
+
+	auto fill = [&inbox] {
+		for (uintptr_t i = 0; i < 4; ++i) {
+			push(inbox.get(), 1, event_routine, i, sm_inbox_queued);
+			push(inbox.get(), 1, event_warning, i, sm_inbox_queued);
+		}
+		push(inbox.get(), 1, event_fault, 0, sm_inbox_queued);
+	};
+	auto drain = [&inbox] {
+		std::vector<int> types;
+		sm_inbox_entry entry;
+		while (sm_inbox_pop(inbox.get(), &entry)) {
+			types.push_back(entry.event.type);
+		}
+		return types;
+	};
+
+	SECTION("strict priority drains the urgent lanes first") {
+		sm_inbox_init(inbox.get(), &config);
+		fill();
+		sm_inbox_entry entry = pop(inbox.get());
+		REQUIRE(entry.event.type == event_fault);
+		entry = pop(inbox.get());
+		REQUIRE(entry.event.type == event_warning);
+		REQUIRE(payload_of(entry) == 0);
+		REQUIRE(drain() == std::vector<int>{event_warning, event_warning,
+											event_warning, event_routine,
+											event_routine, event_routine,
+											event_routine});
+	}
+
+	SECTION("weighted round robin doesn't starve the lanes") {
+		const unsigned int weights[] = {1, 2, 4};
+		config.weights = weights;
+		sm_inbox_init(inbox.get(), &config);
+		fill();
+		REQUIRE(drain() == std::vector<int>{event_fault, event_warning,
+											event_warning, event_routine,
+											event_warning, event_warning,
+											event_routine, event_routine,
+											event_routine});
+	}
+
+	SECTION("cancelled events leave their lane") {
+		sm_inbox_init(inbox.get(), &config);
+		fill();
+		push(inbox.get(), 2, event_routine, 0, sm_inbox_queued);
+		REQUIRE(sm_inbox_cancel(inbox.get(), 1) == 9);
+		REQUIRE(drain() == std::vector<int>{event_routine});
+	}
+}
+#endif
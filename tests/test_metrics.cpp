@@ -0,0 +1,153 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_metrics.cpp
+ *
+ * \brief		Metrics unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_metrics.h"
+#include "test_sm.h"
+
+#if SM_STATE_MACHINE_ENABLE_TRACE && !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+struct fixture : test_sm_basic {
+	explicit fixture(size_t num_threads, size_t max_edges = 8) {
+		test_sm_basic_init(this);
+		REQUIRE(sm_metrics_init(&metrics, states, 4, num_threads, max_edges));
+		hooks.tracer = sm_metrics_tracer(&metrics);
+	}
+	~fixture() { sm_metrics_deinit(&metrics); }
+
+	void add(sm_state_machine *state_machine) {
+		test_sm_basic_init_instance(this, state_machine, nullptr);
+		sm_metrics_instance_added(&metrics, &idle);
+	}
+
+	sm_metrics metrics;
+};
+} // namespace
+
+TEST_CASE("Metrics") {
+	SECTION("occupancy, edges and error entries") {
+		fixture f(1);
+		sm_state_machine machines[3];
+		for (auto &machine : machines) {
+			f.add(&machine);
+		}
+		test_sm_basic_dispatch(&machines[0], event_basic_start);
+		test_sm_basic_dispatch(&machines[1], event_basic_start);
+		test_sm_basic_dispatch(&machines[1], event_basic_stop);
+		test_sm_basic_dispatch(&machines[1], event_basic_start);
+		test_sm_basic_dispatch(&machines[1], event_basic_fail);
+
+		REQUIRE(sm_metrics_occupancy(&f.metrics, &f.idle) == 1);
+		REQUIRE(sm_metrics_occupancy(&f.metrics, &f.running) == 1);
+		REQUIRE(sm_metrics_occupancy(&f.metrics, &f.error) == 1);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.idle, &f.running) == 3);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.running, &f.idle) == 1);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.running, &f.error) == 1);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.idle, &f.error) == 0);
+		REQUIRE(sm_metrics_error_entries(&f.metrics) == 1);
+
+		sm_metrics_instance_removed(&f.metrics, &f.error);
+		REQUIRE(sm_metrics_occupancy(&f.metrics, &f.error) == 0);
+	}
+
+	SECTION("threads write their own shard") {
+		constexpr size_t num_threads = 4;
+		constexpr int rounds = 10000;
+		fixture f(num_threads);
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < num_threads; ++i) {
+			threads.emplace_back([&f, i] {
+				sm_metrics_set_thread(i);
+				sm_state_machine machine;
+				f.add(&machine);
+				for (int j = 0; j < rounds; ++j) {
+					test_sm_basic_dispatch(&machine, event_basic_start);
+					test_sm_basic_dispatch(&machine, event_basic_stop);
+				}
+				test_sm_basic_dispatch(&machine, event_basic_start);
+			});
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		REQUIRE(sm_metrics_occupancy(&f.metrics, &f.idle) == 0);
+		REQUIRE(sm_metrics_occupancy(&f.metrics, &f.running) == num_threads);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.idle, &f.running) ==
+				num_threads * (rounds + 1));
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.running, &f.idle) ==
+				num_threads * rounds);
+	}
+
+	SECTION("edges beyond the capacity are dropped") {
+		fixture f(1, 1);
+		sm_state_machine machine;
+		f.add(&machine);
+		test_sm_basic_dispatch(&machine, event_basic_start);
+		test_sm_basic_dispatch(&machine, event_basic_stop);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.idle, &f.running) == 1);
+		REQUIRE(sm_metrics_transitions(&f.metrics, &f.running, &f.idle) == 0);
+		REQUIRE(sm_metrics_dropped_edges(&f.metrics) == 1);
+	}
+
+	SECTION("text exposition") {
+		fixture f(2);
+#if SM_STATE_MACHINE_ENABLE_LOG
+		f.idle.name = "idle";
+		f.running.name = "run\"ning";
+#endif
+		sm_state_machine machines[2];
+		for (size_t i = 0; i < 2; ++i) {
+			sm_metrics_set_thread(i);
+			f.add(&machines[i]);
+			test_sm_basic_dispatch(&machines[i], event_basic_start);
+		}
+		sm_metrics_set_thread(0);
+
+		const int length = sm_metrics_write(&f.metrics, "sm", nullptr, 0);
+		REQUIRE(length > 0);
+		std::string text(length + 1, '\0');
+		REQUIRE(sm_metrics_write(&f.metrics, "sm", text.data(), text.size()) ==
+				length);
+		text.resize(length);
+#if SM_STATE_MACHINE_ENABLE_LOG
+		const std::string idle = "idle";
+		const std::string running = "run\\\"ning";
+#else
+		const std::string idle = "state_0";
+		const std::string running = "state_1";
+#endif
+		REQUIRE(text.find("sm_state_instances{state=\"" + idle + "\"} 0\n") !=
+				std::string::npos);
+		REQUIRE(text.find("sm_state_instances{state=\"" + running +
+						  "\"} 2\n") != std::string::npos);
+		REQUIRE(text.find("sm_transitions_total{from=\"" + idle + "\",to=\"" +
+						  running + "\"} 2\n") != std::string::npos);
+		REQUIRE(text.find("sm_error_entries_total 0\n") != std::string::npos);
+
+		char truncated[16];
+		REQUIRE(sm_metrics_write(&f.metrics, "sm", truncated,
+								 sizeof(truncated)) == length);
+		REQUIRE(std::string(truncated) ==
+				text.substr(0, sizeof(truncated) - 1));
+	}
+}
+
+#endif
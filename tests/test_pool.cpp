@@ -0,0 +1,122 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_pool.cpp
+ *
+ * \brief		Pool unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_pool.h"
+#include "test_sm.h"
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <cstdint>
+
+namespace {
+/* A connection: idle -> running -> closed (final) */
+struct fixture : test_sm_basic {
+	fixture() {
+		test_sm_basic_init(this);
+		sm_state_machine_init(&prototype, "connection", &idle, &error, &hooks,
+							  &user_data, nullptr);
+	}
+
+	int dispatch(sm_state_machine *instance, int type) {
+		sm_event event = {type, nullptr};
+		return sm_pool_handle_event(&pool, instance, &event);
+	}
+
+	int user_data = 0;
+	sm_state_machine prototype;
+	sm_pool pool;
+};
+} // namespace
+
+TEST_CASE("Pool") {
+	fixture f;
+
+	SECTION("invalid capacity") {
+		REQUIRE(!sm_pool_init(&f.pool, &f.prototype, 0));
+	}
+
+	SECTION("bulk initialisation") {
+		REQUIRE(sm_pool_init(&f.pool, &f.prototype, 8));
+		sm_state_machine *instances[10];
+		REQUIRE(sm_pool_acquire_bulk(&f.pool, instances, 6) == 6);
+		REQUIRE(reinterpret_cast<uintptr_t>(instances[0]) %
+					SM_STATE_MACHINE_CACHE_LINE_SIZE ==
+				0);
+		for (size_t i = 0; i < 6; ++i) {
+			REQUIRE(instances[i] == instances[0] + i);
+			REQUIRE(sm_pool_index(&f.pool, instances[i]) == i);
+			REQUIRE(instances[i]->current_state == &f.idle);
+			REQUIRE(instances[i]->user_data == &f.user_data);
+		}
+		REQUIRE(sm_pool_in_use(&f.pool) == 6);
+		/* Only 2 left */
+		REQUIRE(sm_pool_acquire_bulk(&f.pool, instances, 10) == 2);
+		REQUIRE(sm_pool_acquire(&f.pool, nullptr, nullptr) == nullptr);
+		sm_pool_deinit(&f.pool);
+	}
+
+	SECTION("reset") {
+		REQUIRE(sm_pool_init(&f.pool, &f.prototype, 2));
+		int data = 0;
+		sm_state_machine *instance = sm_pool_acquire(&f.pool, &data, &data);
+		REQUIRE(instance->user_data == &data);
+		REQUIRE(f.dispatch(instance, event_basic_start) ==
+				sm_state_machine_state_changed);
+		REQUIRE(instance->previous_state == &f.idle);
+
+		sm_pool_reset(&f.pool, instance);
+		REQUIRE(instance->current_state == &f.idle);
+		REQUIRE(instance->previous_state == nullptr);
+		REQUIRE(instance->user_data == &data);
+		REQUIRE(instance->state_data == &data);
+		REQUIRE(sm_pool_in_use(&f.pool) == 1);
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT
+		/* Published again, not copied from the prototype */
+		sm_state_machine_snapshot snapshot;
+		sm_state_machine_get_snapshot(instance, &snapshot);
+		REQUIRE(snapshot.current_state == &f.idle);
+		REQUIRE(snapshot.previous_state == nullptr);
+		REQUIRE(snapshot.transitions == 3);
+#endif
+		sm_pool_deinit(&f.pool);
+	}
+
+	SECTION("the instances in a final state are recycled") {
+		REQUIRE(sm_pool_init(&f.pool, &f.prototype, 2));
+		sm_state_machine *first = sm_pool_acquire(&f.pool, nullptr, nullptr);
+		sm_state_machine *second = sm_pool_acquire(&f.pool, nullptr, nullptr);
+		REQUIRE(f.dispatch(first, event_basic_start) ==
+				sm_state_machine_state_changed);
+		REQUIRE(f.dispatch(first, event_basic_close) ==
+				sm_state_machine_final_state_reached);
+		REQUIRE(sm_pool_in_use(&f.pool) == 1);
+
+		/* The last released is reused, from its initial state */
+		REQUIRE(sm_pool_acquire(&f.pool, nullptr, nullptr) == first);
+		REQUIRE(first->current_state == &f.idle);
+		REQUIRE(f.dispatch(second, event_basic_close) ==
+				sm_state_machine_no_state_change);
+		REQUIRE(sm_pool_in_use(&f.pool) == 2);
+
+		sm_pool_release(&f.pool, second);
+		sm_pool_release(&f.pool, first);
+		REQUIRE(sm_pool_in_use(&f.pool) == 0);
+		sm_pool_deinit(&f.pool);
+	}
+}
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_shared.cpp
+ *
+ * \brief		Shared memory instances unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_shared.h"
+#include "test_sm.h"
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+/* Built at run time, as each process would */
+struct fixture : test_sm_basic {
+	fixture() : name("/sm_test_shared_" + std::to_string(getpid())) {
+		test_sm_basic_init(this);
+		REQUIRE(sm_shared_definition_init(&definition, states, 4));
+		test_sm_basic_init_instance(this, &local, nullptr);
+		sm_shared_unlink(name.c_str());
+	}
+	~fixture() {
+		sm_shared_unlink(name.c_str());
+		sm_shared_definition_deinit(&definition);
+	}
+
+	/* Run \p body in a child process, returns its success */
+	template <typename Body> bool in_child(Body body) {
+		const pid_t pid = fork();
+		if (pid == 0) {
+			_exit(body() ? 0 : 1);
+		}
+		int status = 0;
+		waitpid(pid, &status, 0);
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+	std::string name;
+	sm_shared_definition definition;
+	sm_state_machine local;
+};
+} // namespace
+
+TEST_CASE("Shared memory instances") {
+	fixture f;
+	sm_shared shared;
+	REQUIRE(sm_shared_create(&shared, f.name.c_str(), &f.definition, 4,
+							 &f.idle));
+	REQUIRE(sm_shared_num_instances(&shared) == 4);
+	REQUIRE(sm_shared_state_id(&f.definition, &f.running) == 1);
+	REQUIRE(sm_shared_state(&f.definition, 2) == &f.error);
+
+	SECTION("a segment can't be created twice") {
+		sm_shared other;
+		REQUIRE(!sm_shared_create(&other, f.name.c_str(), &f.definition, 4,
+								  &f.idle));
+	}
+
+	SECTION("instances are driven by other processes") {
+		REQUIRE(f.in_child([&f] {
+			sm_shared child;
+			sm_event event = {event_basic_start, nullptr};
+			return sm_shared_open(&child, f.name.c_str(), &f.definition) &&
+				   sm_shared_handle_event(&child, 2, &f.local, &event) ==
+					   sm_state_machine_state_changed;
+		}));
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+		/* Left by another instance */
+		f.local.submachine_depth = 1;
+#endif
+		sm_shared_lock(&shared, 2);
+		sm_shared_load(&shared, 2, &f.local);
+		sm_shared_unlock(&shared, 2);
+		REQUIRE(f.local.current_state == &f.running);
+		REQUIRE(f.local.previous_state == &f.idle);
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES
+		REQUIRE(f.local.submachine_depth == 0);
+#endif
+
+		sm_event event = {event_basic_stop, nullptr};
+		REQUIRE(sm_shared_handle_event(&shared, 2, &f.local, &event) ==
+				sm_state_machine_state_changed);
+		REQUIRE(f.in_child([&f] {
+			sm_shared child;
+			sm_state_machine_init(&f.local, nullptr, &f.error, &f.error,
+								  &f.hooks, nullptr, nullptr);
+			if (!sm_shared_open(&child, f.name.c_str(), &f.definition)) {
+				return false;
+			}
+			sm_shared_load(&child, 2, &f.local);
+			sm_shared_close(&child);
+			return f.local.current_state == &f.idle;
+		}));
+	}
+
+	SECTION("a different definition is refused") {
+		const uint64_t hash = sm_shared_definition_hash(&f.definition);
+		f.running_transitions[0].next_state = &f.error;
+		sm_shared_definition other;
+		REQUIRE(sm_shared_definition_init(&other, f.states, 4));
+		REQUIRE(sm_shared_definition_hash(&other) != hash);
+		sm_shared mapping;
+		REQUIRE(!sm_shared_open(&mapping, f.name.c_str(), &other));
+		sm_shared_definition_deinit(&other);
+	}
+
+	SECTION("the lock of a dead process is taken over") {
+		REQUIRE(f.in_child([&f] {
+			sm_shared child;
+			if (!sm_shared_open(&child, f.name.c_str(), &f.definition)) {
+				return false;
+			}
+			sm_shared_lock(&child, 0);
+			return true;
+		}));
+		sm_event event = {event_basic_start, nullptr};
+		REQUIRE(sm_shared_handle_event(&shared, 0, &f.local, &event) ==
+				sm_state_machine_state_changed);
+	}
+
+	sm_shared_close(&shared);
+}
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_simulation.cpp
+ *
+ * \brief		Discrete-event simulation unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_simulation.h"
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+enum { event_tick = 1, event_ping };
+
+struct fixture;
+
+/* A tick is dispatched to an instance: record it and maybe schedule more */
+struct instance_data {
+	fixture *f = nullptr;
+	/* Delay of the next tick, 0 for none */
+	uint64_t period = 0;
+	/* Instance pinged at each tick, or SIZE_MAX */
+	size_t peer = SIZE_MAX;
+};
+
+struct fixture {
+	static constexpr size_t num_instances = 4;
+
+	fixture() {
+		action.fn = on_tick;
+		ping_action.fn = on_ping;
+		waiting.transitions = &waiting_table;
+		for (size_t i = 0; i < num_instances; ++i) {
+			data[i].f = this;
+			sm_state_machine_init(&instances[i], nullptr, &waiting, &error,
+								  &hooks, &data[i], nullptr);
+		}
+		REQUIRE(sm_simulation_init(&simulation, instances, num_instances));
+	}
+	~fixture() { sm_simulation_deinit(&simulation); }
+
+	static void on_tick(void *user_data, const sm_state *, void *,
+						const sm_event *, const sm_state *, void *) {
+		auto *data = static_cast<instance_data *>(user_data);
+		sm_simulation *simulation = &data->f->simulation;
+		const uint64_t now = sm_simulation_now(simulation);
+		const size_t instance = sm_simulation_current_instance(simulation);
+		data->f->log.emplace_back(now, instance);
+		if (data->period) {
+			sm_event tick = {event_tick, nullptr};
+			REQUIRE(sm_simulation_schedule(simulation, now + data->period,
+										   instance, &tick));
+		}
+		if (data->peer != SIZE_MAX) {
+			sm_event ping = {event_ping, nullptr};
+			REQUIRE(sm_simulation_schedule(simulation, now, data->peer, &ping));
+		}
+	}
+
+	static void on_ping(void *user_data, const sm_state *, void *,
+						const sm_event *, const sm_state *, void *) {
+		auto *data = static_cast<instance_data *>(user_data);
+		++data->f->pings;
+	}
+
+	void schedule(uint64_t time, size_t instance) {
+		sm_event tick = {event_tick, nullptr};
+		REQUIRE(sm_simulation_schedule(&simulation, time, instance, &tick));
+	}
+
+	sm_action action = {};
+	sm_action ping_action = {};
+	sm_state waiting = {};
+	sm_state error = {};
+	sm_transition waiting_transitions[2] = {
+		{event_tick, nullptr, &action, &waiting},
+		{event_ping, nullptr, &ping_action, &waiting}};
+	sm_state_transitions waiting_table = {waiting_transitions, 2};
+	sm_state_machine_hooks hooks = {};
+	instance_data data[num_instances];
+	sm_state_machine instances[num_instances];
+	sm_simulation simulation;
+	/* (time, instance) of the ticks, in dispatch order */
+	std::vector<std::pair<uint64_t, size_t>> log;
+	int pings = 0;
+};
+} // namespace
+
+TEST_CASE("Simulation") {
+	fixture f;
+
+	SECTION("the events are dispatched in time order") {
+		f.schedule(30, 0);
+		f.schedule(10, 1);
+		f.schedule(20, 2);
+		f.schedule(10, 3);
+		f.schedule(10, 0);
+		REQUIRE(sm_simulation_pending(&f.simulation) == 5);
+		while (sm_simulation_step(&f.simulation)) {
+		}
+		using entry = std::pair<uint64_t, size_t>;
+		REQUIRE(f.log == std::vector<entry>{
+							 {10, 1}, {10, 3}, {10, 0}, {20, 2}, {30, 0}});
+		REQUIRE(sm_simulation_now(&f.simulation) == 30);
+		REQUIRE(sm_simulation_dispatched(&f.simulation) == 5);
+		REQUIRE(sm_simulation_pending(&f.simulation) == 0);
+	}
+
+	SECTION("the actions schedule the next events") {
+		f.data[0].period = 3;
+		f.data[1].period = 5;
+		f.data[1].peer = 2;
+		f.schedule(0, 0);
+		f.schedule(0, 1);
+
+		REQUIRE(sm_simulation_run(&f.simulation, 10) == 4 + 3 + 3);
+		REQUIRE(sm_simulation_now(&f.simulation) == 10);
+		REQUIRE(f.pings == 3);
+		REQUIRE(f.log.back() == std::make_pair(uint64_t{10}, size_t{1}));
+		/* The next ticks, at 12 and 15 */
+		REQUIRE(sm_simulation_pending(&f.simulation) == 2);
+
+		f.data[0].period = 0;
+		f.data[1].period = 0;
+		REQUIRE(sm_simulation_run(&f.simulation, 100) == 2 + 1);
+		REQUIRE(f.log.back() == std::make_pair(uint64_t{15}, size_t{1}));
+		REQUIRE(sm_simulation_now(&f.simulation) == 100);
+
+		/* After the clock was advanced with no events */
+		f.schedule(100, 3);
+		f.schedule(101, 2);
+		REQUIRE(sm_simulation_step(&f.simulation));
+		REQUIRE(f.log.back() == std::make_pair(uint64_t{100}, size_t{3}));
+	}
+
+	SECTION("many events") {
+		std::mt19937_64 random(42);
+		std::uniform_int_distribution<uint64_t> times(0, 1000000);
+		/* Pending, and in the order expected to be dispatched */
+		std::vector<std::pair<uint64_t, size_t>> expected;
+		std::vector<std::pair<uint64_t, size_t>> order;
+		for (int round = 0; round < 3; ++round) {
+			const uint64_t now = sm_simulation_now(&f.simulation);
+			for (size_t i = 0; i < 10000; ++i) {
+				/* Clustered and spread out times */
+				const uint64_t time = now + (i % 4 ? times(random) % 64
+													: times(random) << round);
+				f.schedule(time, i % fixture::num_instances);
+				expected.emplace_back(time, i % fixture::num_instances);
+			}
+			/* Dispatch a half, so that the queue shrinks and grows again */
+			std::stable_sort(expected.begin(), expected.end(),
+							 [](const auto &a, const auto &b) {
+								 return a.first < b.first;
+							 });
+			const uint64_t until = expected[expected.size() / 2].first;
+			sm_simulation_run(&f.simulation, until);
+			const auto dispatched =
+				std::upper_bound(expected.begin(), expected.end(), until,
+								 [](uint64_t time, const auto &entry) {
+									 return time < entry.first;
+								 });
+			order.insert(order.end(), expected.begin(), dispatched);
+			expected.erase(expected.begin(), dispatched);
+		}
+		while (sm_simulation_step(&f.simulation)) {
+		}
+		order.insert(order.end(), expected.begin(), expected.end());
+		REQUIRE(order.size() == 30000);
+		REQUIRE(f.log == order);
+	}
+}
+
+#endif
@@ -30,21 +30,27 @@
  */
 #include "test_sm.h"
 
-static struct sm_action trans_action1_action =
-	SM_STATE_MACHINE_ACTION(trans_action1);
+SM_STATE_MACHINE_GUARD_DEF(guard1);
+SM_STATE_MACHINE_ACTION_DEF(trans_action1);
 SM_STATE_MACHINE_TRANSITION_DEF_START(s1)
 SM_STATE_MACHINE_TRANSITION_ADD_EX(event_s1_to_s2,
-								   &SM_STATE_MACHINE_GUARD(guard1),
-								   &trans_action1_action, &s2)
+								   SM_STATE_MACHINE_GUARD_REF(guard1),
+								   SM_STATE_MACHINE_ACTION_REF(trans_action1),
+								   &s2)
 SM_STATE_MACHINE_TRANSITION_ADD_EX(event_chain_s1_s2, NULL,
-								   &trans_action1_action, &s2)
+								   SM_STATE_MACHINE_ACTION_REF(trans_action1),
+								   &s2)
 SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s5, NULL, NULL, &s5)
-SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s_guard, guard1, NULL, &s1)
+SM_STATE_MACHINE_TRANSITION_ADD_EX(event_s1_to_s_guard,
+								   SM_STATE_MACHINE_GUARD_REF(guard1), NULL,
+								   &s1)
 SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s_guard, guard2, NULL, &s2)
 SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s_guard, guard3, NULL, &s3)
 SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s_guard, NULL, NULL, &s4)
+SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s7, NULL, NULL, &s7)
+SM_STATE_MACHINE_TRANSITION_ADD(event_s1_to_s9, NULL, NULL, &s9)
 SM_STATE_MACHINE_TRANSITION_DEF_END(s1)
-struct sm_state s1 = {
+const struct sm_state s1 = {
 	SM_STATE_MACHINE_STATE_NAME(s1),
 	.parent_state = NULL,
 	.entry_state = NULL,
@@ -57,7 +63,7 @@ SM_STATE_MACHINE_TRANSITION_DEF_START(s2)
 SM_STATE_MACHINE_TRANSITION_ADD(event_s2_to_s3, NULL, NULL, &s3)
 SM_STATE_MACHINE_TRANSITION_ADD(event_chain_s1_s2, NULL, trans_action2, &s3)
 SM_STATE_MACHINE_TRANSITION_DEF_END(s2)
-struct sm_state s2 = {
+const struct sm_state s2 = {
 	SM_STATE_MACHINE_STATE_NAME(s2),
 	.parent_state = NULL,
 	.entry_state = NULL,
@@ -69,7 +75,7 @@ struct sm_state s2 = {
 SM_STATE_MACHINE_TRANSITION_DEF_START(s3)
 SM_STATE_MACHINE_TRANSITION_ADD(event_s3_to_s4, NULL, NULL, &s4)
 SM_STATE_MACHINE_TRANSITION_DEF_END(s3)
-struct sm_state s3 = {
+const struct sm_state s3 = {
 	SM_STATE_MACHINE_STATE_NAME(s3),
 	.parent_state = NULL,
 	.entry_state = NULL,
@@ -78,7 +84,7 @@ struct sm_state s3 = {
 	.exit_action = &SM_STATE_MACHINE_ACTION(s3_exit_action),
 };
 
-struct sm_state s4 = {
+const struct sm_state s4 = {
 	SM_STATE_MACHINE_STATE_NAME(s4),
 	.parent_state = NULL,
 	.entry_state = NULL,
@@ -87,14 +93,14 @@ struct sm_state s4 = {
 	.exit_action = &SM_STATE_MACHINE_ACTION(s4_exit_action),
 };
 
-struct sm_state s5 = {
+const struct sm_state s5 = {
 	SM_STATE_MACHINE_STATE_NAME(s5),
 	.entry_state = &s5_child,
 	.entry_action = &SM_STATE_MACHINE_ACTION(s5_entry_action),
 	.exit_action = &SM_STATE_MACHINE_ACTION(s5_exit_action),
 };
 
-struct sm_state s5_child = {
+const struct sm_state s5_child = {
 	SM_STATE_MACHINE_STATE_NAME(s5_child),
 	.parent_state = &s5,
 	.entry_state = &s5_child_child,
@@ -102,7 +108,7 @@ struct sm_state s5_child = {
 	.exit_action = &SM_STATE_MACHINE_ACTION(s5_child_exit_action),
 };
 
-struct sm_state s5_child_child = {
+const struct sm_state s5_child_child = {
 	SM_STATE_MACHINE_STATE_NAME(s5_child_child),
 	.parent_state = &s5_child,
 	.transitions = NULL,
@@ -110,14 +116,14 @@ struct sm_state s5_child_child = {
 	.exit_action = &SM_STATE_MACHINE_ACTION(s5_child_child_exit_action),
 };
 
-struct sm_state s6 = {
+const struct sm_state s6 = {
 	SM_STATE_MACHINE_STATE_NAME(s6),
 	.entry_state = &s6_child,
 	.entry_action = &SM_STATE_MACHINE_ACTION(s6_entry_action),
 	.exit_action = &SM_STATE_MACHINE_ACTION(s6_exit_action),
 };
 
-struct sm_state s6_child = {
+const struct sm_state s6_child = {
 	SM_STATE_MACHINE_STATE_NAME(s6_child),
 	.parent_state = &s6,
 	.entry_state = &s6_child,
@@ -125,7 +131,7 @@ struct sm_state s6_child = {
 	.exit_action = &SM_STATE_MACHINE_ACTION(s6_child_exit_action),
 };
 
-struct sm_state s6_child_child = {
+const struct sm_state s6_child_child = {
 	SM_STATE_MACHINE_STATE_NAME(s6_child_child),
 	.parent_state = &s6_child,
 	.transitions = NULL,
@@ -133,7 +139,70 @@ struct sm_state s6_child_child = {
 	.exit_action = &SM_STATE_MACHINE_ACTION(s6_child_child_exit_action),
 };
 
-struct sm_state s_error = {
+SM_STATE_MACHINE_TRANSITION_DEF_START(s7_completion)
+SM_STATE_MACHINE_COMPLETION_TRANSITION_ADD(guard4, trans_action3, &s8)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s7_completion)
+const struct sm_state s7 = {
+	SM_STATE_MACHINE_STATE_NAME(s7),
+	.completion_transitions = &SM_STATE_MACHINE_TRANSITION_GET(s7_completion),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s8_completion)
+SM_STATE_MACHINE_COMPLETION_TRANSITION_ADD(NULL, NULL, &s3)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s8_completion)
+const struct sm_state s8 = {
+	SM_STATE_MACHINE_STATE_NAME(s8),
+	.completion_transitions = &SM_STATE_MACHINE_TRANSITION_GET(s8_completion),
+};
+
+/* s9 and s10 form a livelock made of completion transitions */
+SM_STATE_MACHINE_TRANSITION_DEF_START(s9_completion)
+SM_STATE_MACHINE_COMPLETION_TRANSITION_ADD(NULL, NULL, &s10)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s9_completion)
+const struct sm_state s9 = {
+	SM_STATE_MACHINE_STATE_NAME(s9),
+	.completion_transitions = &SM_STATE_MACHINE_TRANSITION_GET(s9_completion),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s10_completion)
+SM_STATE_MACHINE_COMPLETION_TRANSITION_ADD(NULL, NULL, &s9)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s10_completion)
+const struct sm_state s10 = {
+	SM_STATE_MACHINE_STATE_NAME(s10),
+	.completion_transitions = &SM_STATE_MACHINE_TRANSITION_GET(s10_completion),
+};
+
+/* s11_child_child inherits the transitions of its grandparent, which are
+ * defined as a function even in table mode */
+SM_STATE_MACHINE_TRANSITION_FN_DEF_START(s11)
+SM_STATE_MACHINE_TRANSITION_FN_ADD(event_s11_to_s1, guard2, trans_action2, &s1)
+SM_STATE_MACHINE_TRANSITION_FN_DEF_END(s11)
+const struct sm_state s11 = {
+	SM_STATE_MACHINE_STATE_NAME(s11),
+	.entry_state = &s11_child,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s11),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s11_child)
+SM_STATE_MACHINE_TRANSITION_ADD(event_s2_to_s3, NULL, NULL, &s11_child)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s11_child)
+const struct sm_state s11_child = {
+	SM_STATE_MACHINE_STATE_NAME(s11_child),
+	.parent_state = &s11,
+	.entry_state = &s11_child_child,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s11_child),
+};
+
+SM_STATE_MACHINE_TRANSITION_DEF_START(s11_child_child)
+SM_STATE_MACHINE_TRANSITION_ADD(event_s3_to_s4, NULL, NULL, &s11_child_child)
+SM_STATE_MACHINE_TRANSITION_DEF_END(s11_child_child)
+const struct sm_state s11_child_child = {
+	SM_STATE_MACHINE_STATE_NAME(s11_child_child),
+	.parent_state = &s11_child,
+	.transitions = &SM_STATE_MACHINE_TRANSITION_GET(s11_child_child),
+};
+
+const struct sm_state s_error = {
 	SM_STATE_MACHINE_STATE_NAME(s_error),
 	.entry_action = &SM_STATE_MACHINE_ACTION(s_error_entry_action),
 };
@@ -150,3 +219,34 @@ SM_STATE_MACHINE_STATE_DATA_MAP_FN_ADD(s4)
 SM_STATE_MACHINE_STATE_DATA_MAP_FN_ADD(s5)
 SM_STATE_MACHINE_STATE_DATA_MAP_FN_ADD(s5_child)
 SM_STATE_MACHINE_STATE_DATA_MAP_FN_DEF_END()
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+void test_sm_basic_init(struct test_sm_basic *basic) {
+	*basic = (struct test_sm_basic){
+		.idle_transitions = {{event_basic_start, NULL, NULL, &basic->running}},
+		.running_transitions = {{event_basic_stop, NULL, NULL, &basic->idle},
+								{event_basic_fail, NULL, NULL, &basic->error},
+								{event_basic_poll, NULL, NULL, &basic->running},
+								{event_basic_close, NULL, NULL,
+								 &basic->closed}},
+		.idle_table = {basic->idle_transitions, 1},
+		.running_table = {basic->running_transitions, 4},
+		.states = {&basic->idle, &basic->running, &basic->error,
+				   &basic->closed},
+	};
+	basic->idle.transitions = &basic->idle_table;
+	basic->running.transitions = &basic->running_table;
+}
+
+void test_sm_basic_init_instance(struct test_sm_basic *basic,
+								 struct sm_state_machine *state_machine,
+								 void *user_data) {
+	sm_state_machine_init(state_machine, NULL, &basic->idle, &basic->error,
+						  &basic->hooks, user_data, NULL);
+}
+
+int test_sm_basic_dispatch(struct sm_state_machine *state_machine, int type) {
+	const struct sm_event event = {type, NULL};
+	return sm_state_machine_handle_event(state_machine, &event);
+}
+#endif
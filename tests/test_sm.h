@@ -43,17 +43,24 @@ struct test_sm_state_data {
 	} s5_child;
 };
 
-extern struct sm_state s1;
-extern struct sm_state s2;
-extern struct sm_state s3;
-extern struct sm_state s4;
-extern struct sm_state s5;
-extern struct sm_state s5_child;
-extern struct sm_state s5_child_child;
-extern struct sm_state s6;
-extern struct sm_state s6_child;
-extern struct sm_state s6_child_child;
-extern struct sm_state s_error;
+extern const struct sm_state s1;
+extern const struct sm_state s2;
+extern const struct sm_state s3;
+extern const struct sm_state s4;
+extern const struct sm_state s5;
+extern const struct sm_state s5_child;
+extern const struct sm_state s5_child_child;
+extern const struct sm_state s6;
+extern const struct sm_state s6_child;
+extern const struct sm_state s6_child_child;
+extern const struct sm_state s7;
+extern const struct sm_state s8;
+extern const struct sm_state s9;
+extern const struct sm_state s10;
+extern const struct sm_state s11;
+extern const struct sm_state s11_child;
+extern const struct sm_state s11_child_child;
+extern const struct sm_state s_error;
 
 enum sm_public_event {
 	event_s1_to_s2,
@@ -63,6 +70,9 @@ enum sm_public_event {
 	event_s3_to_s4,
 	event_s5_child_child_to_s6_child_child,
 	event_chain_s1_s2,
+	event_s1_to_s7,
+	event_s1_to_s9,
+	event_s11_to_s1,
 };
 
 void *test_sm_state_data_mapper(const struct sm_state *state,
@@ -184,6 +194,43 @@ void trans_action4(void *sm_user_data, const struct sm_state *current_state,
 				   void *current_state_data, const struct sm_event *event,
 				   const struct sm_state *next_state, void *next_state_data);
 
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+enum test_sm_basic_event {
+	event_basic_start = 1,
+	event_basic_stop,
+	event_basic_fail,
+	event_basic_poll,
+	event_basic_close,
+};
+
+/*
+ * idle <-> running, built at run time, for the tests of the modules that
+ * only need a small state machine. running also polls itself, fails to the
+ * error state and is closed in a final state. C++ fixtures derive from it
+ * and add what their module needs.
+ */
+struct test_sm_basic {
+	struct sm_state idle;
+	struct sm_state running;
+	struct sm_state error;
+	struct sm_state closed;
+	struct sm_transition idle_transitions[1];
+	struct sm_transition running_transitions[4];
+	struct sm_state_transitions idle_table;
+	struct sm_state_transitions running_table;
+	/* idle, running, error and closed, e.g. for sm_shared_definition_init */
+	const struct sm_state *states[4];
+	struct sm_state_machine_hooks hooks;
+};
+
+void test_sm_basic_init(struct test_sm_basic *basic);
+/* Starts in idle, without name nor state data */
+void test_sm_basic_init_instance(struct test_sm_basic *basic,
+								 struct sm_state_machine *state_machine,
+								 void *user_data);
+int test_sm_basic_dispatch(struct sm_state_machine *state_machine, int type);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,92 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_snapshot.cpp
+ *
+ * \brief		State snapshot unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_state_machine.h"
+#include "test_sm.h"
+
+#if SM_STATE_MACHINE_ENABLE_SNAPSHOT && !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <atomic>
+#include <thread>
+
+namespace {
+struct fixture : test_sm_basic {
+	fixture() {
+		test_sm_basic_init(this);
+		test_sm_basic_init_instance(this, &state_machine, nullptr);
+	}
+
+	int dispatch(int type) {
+		return test_sm_basic_dispatch(&state_machine, type);
+	}
+
+	sm_state_machine state_machine;
+};
+} // namespace
+
+TEST_CASE("Snapshot") {
+	fixture f;
+	sm_state_machine_snapshot snapshot;
+	sm_state_machine_get_snapshot(&f.state_machine, &snapshot);
+	REQUIRE(snapshot.current_state == &f.idle);
+	REQUIRE(snapshot.previous_state == nullptr);
+	REQUIRE(snapshot.transitions == 0);
+
+	SECTION("transitions and the error state are published") {
+		f.dispatch(event_basic_start);
+		sm_state_machine_get_snapshot(&f.state_machine, &snapshot);
+		REQUIRE(snapshot.current_state == &f.running);
+		REQUIRE(snapshot.previous_state == &f.idle);
+		REQUIRE(snapshot.transitions == 1);
+
+		REQUIRE(f.dispatch(event_basic_fail) ==
+				sm_state_machine_error_state_reached);
+		sm_state_machine_get_snapshot(&f.state_machine, &snapshot);
+		REQUIRE(snapshot.current_state == &f.error);
+		REQUIRE(snapshot.previous_state == &f.running);
+		REQUIRE(snapshot.transitions == 2);
+	}
+
+	SECTION("observers never see a torn pair") {
+		std::atomic<bool> done{false};
+		bool consistent = true;
+		std::thread observer([&] {
+			unsigned long last = 0;
+			while (!done) {
+				sm_state_machine_snapshot snapshot;
+				sm_state_machine_get_snapshot(&f.state_machine, &snapshot);
+				/* Odd transitions end in running, even ones in idle */
+				const bool odd = snapshot.transitions % 2 == 1;
+				const sm_state *current = odd ? &f.running : &f.idle;
+				const sm_state *previous = odd ? &f.idle : &f.running;
+				consistent = consistent && snapshot.transitions >= last &&
+							 snapshot.current_state == current &&
+							 (snapshot.transitions == 0 ||
+							  snapshot.previous_state == previous);
+				last = snapshot.transitions;
+			}
+		});
+		for (int i = 0; i < 200000; ++i) {
+			f.dispatch(i % 2 ? event_basic_stop : event_basic_start);
+		}
+		done = true;
+		observer.join();
+		REQUIRE(consistent);
+	}
+}
+
+#endif
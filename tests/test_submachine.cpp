@@ -0,0 +1,238 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_submachine.cpp
+ *
+ * \brief		Submachine unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_state_machine.h"
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES && !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <utility>
+#include <vector>
+
+namespace {
+enum {
+	event_start = 1,
+	event_ack,
+	event_next,
+	event_abort,
+	event_session,
+	event_reset,
+	event_deep
+};
+
+bool reject(void *, const sm_state *, void *, const sm_event *,
+			const sm_state *, void *) {
+	return false;
+}
+
+/* '+' for the entry actions, '-' for the exit actions */
+using action_log = std::vector<std::pair<char, const sm_state *>>;
+
+void record_entry(void *user_data, const sm_state *, void *, const sm_event *,
+				  const sm_state *next_state, void *) {
+	static_cast<action_log *>(user_data)->push_back({'+', next_state});
+}
+
+void record_exit(void *user_data, const sm_state *state, void *,
+				 const sm_event *, const sm_state *, void *) {
+	static_cast<action_log *>(user_data)->push_back({'-', state});
+}
+
+/*
+ * handshake: wait -> ready, used by link_a, link_b and, nested in the
+ * session submachine, by session_link. deep uses the recursive submachine,
+ * whose initial state is deep itself.
+ */
+struct fixture {
+	fixture() {
+		guard.fn = reject;
+		entry.fn = record_entry;
+		exit.fn = record_exit;
+		wait.transitions = &wait_table;
+		wait.entry_action = &entry;
+		wait.exit_action = &exit;
+		ready.entry_action = &entry;
+		ready.exit_action = &exit;
+		handshake.initial_state = &wait;
+		link_a.transitions = &link_a_table;
+		link_a.submachine = &handshake;
+		link_a.entry_action = &entry;
+		link_a.exit_action = &exit;
+		link_b.transitions = &link_b_table;
+		link_b.submachine = &handshake;
+		session_link.transitions = &session_link_table;
+		session_link.submachine = &handshake;
+		session.initial_state = &session_link;
+		session_a.transitions = &session_a_table;
+		session_a.submachine = &session;
+		recursive.initial_state = &deep;
+		deep.submachine = &recursive;
+		idle.transitions = &idle_table;
+		sm_state_machine_init(&state_machine, nullptr, &idle, &error, &hooks,
+							  &actions, nullptr);
+	}
+
+	int dispatch(int type) {
+		sm_event event = {type, nullptr};
+		return sm_state_machine_handle_event(&state_machine, &event);
+	}
+
+	std::vector<const sm_state *> nesting() const {
+		size_t depth;
+		const sm_state *const *states =
+			sm_state_machine_submachine_states(&state_machine, &depth);
+		return {states, states + depth};
+	}
+
+	sm_guard guard = {};
+	sm_action entry = {};
+	sm_action exit = {};
+	action_log actions;
+	/* The handshake submachine */
+	sm_state wait = {};
+	sm_state ready = {};
+	sm_transition wait_transitions[1] = {{event_ack, nullptr, nullptr, &ready}};
+	sm_state_transitions wait_table = {wait_transitions, 1};
+	sm_submachine handshake = {};
+	/* The session submachine */
+	sm_state session_link = {};
+	sm_state session_end = {};
+	sm_transition session_link_transitions[1] = {
+		{event_next, nullptr, nullptr, &session_end}};
+	sm_state_transitions session_link_table = {session_link_transitions, 1};
+	sm_submachine session = {};
+	/* The recursive submachine */
+	sm_state deep = {};
+	sm_submachine recursive = {};
+	/* The top level states */
+	sm_state idle = {};
+	sm_state link_a = {};
+	sm_state link_b = {};
+	sm_state session_a = {};
+	sm_state closed = {};
+	sm_state error = {};
+	sm_transition idle_transitions[3] = {
+		{event_start, nullptr, nullptr, &link_a},
+		{event_session, nullptr, nullptr, &session_a},
+		{event_deep, nullptr, nullptr, &deep}};
+	sm_transition link_a_transitions[2] = {
+		{event_next, nullptr, nullptr, &link_b},
+		{event_abort, nullptr, nullptr, &idle}};
+	sm_transition link_b_transitions[2] = {
+		{event_next, nullptr, nullptr, &closed},
+		{event_abort, &guard, nullptr, &idle}};
+	sm_transition session_a_transitions[2] = {
+		{event_abort, nullptr, nullptr, &idle},
+		{event_reset, &guard, nullptr, &idle}};
+	sm_state_transitions idle_table = {idle_transitions, 3};
+	sm_state_transitions link_a_table = {link_a_transitions, 2};
+	sm_state_transitions link_b_table = {link_b_transitions, 2};
+	sm_state_transitions session_a_table = {session_a_transitions, 2};
+	sm_state_machine_hooks hooks = {};
+	sm_state_machine state_machine;
+};
+} // namespace
+
+TEST_CASE("Submachines") {
+	fixture f;
+	REQUIRE(f.nesting().empty());
+
+	SECTION("the submachine states share the states of the submachine") {
+		REQUIRE(f.dispatch(event_start) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.wait);
+		REQUIRE(f.nesting() == std::vector<const sm_state *>{&f.link_a});
+
+		/* Without transitions, but not final */
+		REQUIRE(f.dispatch(event_ack) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.ready);
+		REQUIRE(!sm_state_machine_stopped(&f.state_machine));
+
+		/* Handled by the submachine state */
+		REQUIRE(f.dispatch(event_next) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.wait);
+		REQUIRE(f.nesting() == std::vector<const sm_state *>{&f.link_b});
+
+		REQUIRE(f.dispatch(event_start) == sm_state_machine_no_state_change);
+		REQUIRE(f.dispatch(event_abort) ==
+				sm_state_machine_rejected_by_guard);
+		REQUIRE(f.nesting() == std::vector<const sm_state *>{&f.link_b});
+
+		REQUIRE(f.dispatch(event_next) ==
+				sm_state_machine_final_state_reached);
+		REQUIRE(f.state_machine.current_state == &f.closed);
+		REQUIRE(f.nesting().empty());
+	}
+
+	SECTION("nested submachines") {
+		REQUIRE(f.dispatch(event_session) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.wait);
+		REQUIRE(f.nesting() ==
+				std::vector<const sm_state *>{&f.session_a, &f.session_link});
+
+		REQUIRE(f.dispatch(event_next) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.session_end);
+		REQUIRE(f.nesting() == std::vector<const sm_state *>{&f.session_a});
+
+		REQUIRE(f.dispatch(event_abort) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.idle);
+		REQUIRE(f.nesting().empty());
+	}
+
+	SECTION("leaving several submachines at once") {
+		f.dispatch(event_session);
+		REQUIRE(f.dispatch(event_abort) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.idle);
+		REQUIRE(f.nesting().empty());
+	}
+
+	SECTION("a guard rejecting the transition restores the nesting") {
+		f.dispatch(event_session);
+		/* Handled by session_a, two submachines up */
+		REQUIRE(f.dispatch(event_reset) ==
+				sm_state_machine_rejected_by_guard);
+		REQUIRE(f.state_machine.current_state == &f.wait);
+		REQUIRE(f.nesting() ==
+				std::vector<const sm_state *>{&f.session_a, &f.session_link});
+
+		REQUIRE(f.dispatch(event_next) == sm_state_machine_state_changed);
+		REQUIRE(f.state_machine.current_state == &f.session_end);
+	}
+
+	SECTION("entry and exit actions") {
+		/* The submachine state is entered like a parent state */
+		REQUIRE(f.dispatch(event_start) == sm_state_machine_state_changed);
+		REQUIRE(f.actions == action_log{{'+', &f.link_a}, {'+', &f.wait}});
+
+		f.actions.clear();
+		REQUIRE(f.dispatch(event_ack) == sm_state_machine_state_changed);
+		REQUIRE(f.actions == action_log{{'-', &f.wait}, {'+', &f.ready}});
+
+		/* Like a parent state, the submachine state isn't exited: only the
+		 * current state is */
+		f.actions.clear();
+		REQUIRE(f.dispatch(event_next) == sm_state_machine_state_changed);
+		REQUIRE(f.actions == action_log{{'-', &f.ready}, {'+', &f.wait}});
+	}
+
+	SECTION("too many nested submachines enter the error state") {
+		REQUIRE(f.dispatch(event_deep) ==
+				sm_state_machine_error_state_reached);
+		REQUIRE(f.state_machine.current_state == &f.error);
+		REQUIRE(f.nesting().empty());
+	}
+}
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_timestamps.cpp
+ *
+ * \brief		Time in state unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_metrics.h"
+#include "test_sm.h"
+
+#if SM_STATE_MACHINE_ENABLE_TIMESTAMPS && !SM_STATE_MACHINE_OPTIMIZE_RAM &&   \
+	SM_STATE_MACHINE_TIMESTAMP_CLOCK == SM_STATE_MACHINE_CLOCK_MONOTONIC
+
+#include <bit>
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace {
+/* Margin for the resolution of the coarse clock, in nanoseconds */
+constexpr uint64_t resolution = 10000000;
+
+struct fixture : test_sm_basic {
+	fixture() {
+		test_sm_basic_init(this);
+		test_sm_basic_init_instance(this, &state_machine, nullptr);
+	}
+
+	int dispatch(int type) {
+		return test_sm_basic_dispatch(&state_machine, type);
+	}
+
+	static void sleep(uint64_t nanoseconds) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(nanoseconds));
+	}
+
+	sm_state_machine state_machine;
+};
+} // namespace
+
+TEST_CASE("Time in state") {
+	fixture f;
+	REQUIRE(sm_state_machine_time_in_previous_state(&f.state_machine) == 0);
+	REQUIRE(sm_state_machine_entered_at(&f.state_machine) <=
+			sm_state_machine_timestamp());
+
+	SECTION("the entry in a state is timestamped") {
+		fixture::sleep(3 * resolution);
+		REQUIRE(sm_state_machine_time_in_state(&f.state_machine) >=
+				2 * resolution);
+		f.dispatch(event_basic_start);
+		REQUIRE(sm_state_machine_time_in_state(&f.state_machine) < resolution);
+		REQUIRE(sm_state_machine_time_in_previous_state(&f.state_machine) >=
+				2 * resolution);
+	}
+
+	SECTION("a self loop doesn't enter the state again") {
+		f.dispatch(event_basic_start);
+		const uint64_t entered_at =
+			sm_state_machine_entered_at(&f.state_machine);
+		fixture::sleep(2 * resolution);
+		REQUIRE(f.dispatch(event_basic_poll) == sm_state_machine_self_loop);
+		REQUIRE(sm_state_machine_entered_at(&f.state_machine) == entered_at);
+	}
+
+#if SM_STATE_MACHINE_ENABLE_TRACE
+	SECTION("dwell time histograms") {
+		sm_metrics metrics;
+		REQUIRE(sm_metrics_init(&metrics, f.states, 4, 1, 4));
+		f.state_machine.hooks.tracer = sm_metrics_tracer(&metrics);
+		sm_metrics_instance_added(&metrics, &f.idle);
+
+		f.dispatch(event_basic_start);
+		fixture::sleep(3 * resolution);
+		f.dispatch(event_basic_stop);
+		const uint64_t running_time =
+			sm_state_machine_time_in_previous_state(&f.state_machine);
+		f.dispatch(event_basic_start);
+
+		sm_metrics_histogram histogram;
+		sm_metrics_dwell(&metrics, &f.running, &histogram);
+		REQUIRE(histogram.count == 1);
+		REQUIRE(histogram.sum == running_time);
+		REQUIRE(histogram.buckets[std::bit_width(running_time)] == 1);
+		sm_metrics_dwell(&metrics, &f.idle, &histogram);
+		REQUIRE(histogram.count == 2);
+
+		char text[8192];
+		const int length = sm_metrics_write(&metrics, "sm", text, sizeof(text));
+		REQUIRE(length > 0);
+		REQUIRE(static_cast<size_t>(length) < sizeof(text));
+		const std::string exposition(text);
+		REQUIRE(exposition.find("# TYPE sm_state_dwell histogram\n") !=
+				std::string::npos);
+		REQUIRE(exposition.find("sm_state_dwell_bucket{state=\"state_1\","
+								"le=\"+Inf\"} 1\n") != std::string::npos);
+		REQUIRE(exposition.find("sm_state_dwell_sum{state=\"state_1\"} " +
+								std::to_string(running_time) + "\n") !=
+				std::string::npos);
+		sm_metrics_deinit(&metrics);
+	}
+#endif
+}
+
+#endif
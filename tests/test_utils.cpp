@@ -0,0 +1,311 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_utils.cpp
+ *
+ * \brief		State machine utils unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_utils.hpp"
+#include "test_sm.h"
+
+#include <algorithm>
+
+namespace {
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES && !SM_STATE_MACHINE_OPTIMIZE_RAM
+/* idle -> link_a -> link_b, both using handshake: wait <-> ready */
+struct submachine_fixture {
+	submachine_fixture() {
+		idle.transitions = &idle_table;
+		link_a.transitions = &link_a_table;
+		link_a.submachine = &handshake;
+		link_b.submachine = &handshake;
+		wait.transitions = &wait_table;
+		ready.transitions = &ready_table;
+		handshake.initial_state = &wait;
+#if SM_STATE_MACHINE_ENABLE_LOG
+		idle.name = "idle";
+		link_a.name = "link_a";
+		link_b.name = "link_b";
+		wait.name = "wait";
+		ready.name = "ready";
+#endif
+	}
+
+	sm_state idle = {};
+	sm_state link_a = {};
+	sm_state link_b = {};
+	sm_state wait = {};
+	sm_state ready = {};
+	sm_submachine handshake = {};
+	sm_transition idle_transitions[1] = {{1, nullptr, nullptr, &link_a}};
+	sm_transition link_a_transitions[1] = {{2, nullptr, nullptr, &link_b}};
+	sm_transition wait_transitions[2] = {{3, nullptr, nullptr, &ready},
+										 {4, nullptr, nullptr, &ready}};
+	sm_transition ready_transitions[1] = {{3, nullptr, nullptr, &wait}};
+	sm_state_transitions idle_table = {idle_transitions, 1};
+	sm_state_transitions link_a_table = {link_a_transitions, 1};
+	sm_state_transitions wait_table = {wait_transitions, 2};
+	sm_state_transitions ready_table = {ready_transitions, 1};
+};
+#endif
+
+bool has_issue(const std::vector<sm_verify_issue> &issues,
+			   sm_verify_issue_type type, const sm_state *state,
+			   const sm_transition *transition = nullptr) {
+	return std::any_of(issues.begin(), issues.end(),
+					   [&](const sm_verify_issue &issue) {
+						   return issue.type == type && issue.state == state &&
+								  issue.transition == transition;
+					   });
+}
+} // namespace
+
+TEST_CASE("Verifier") {
+	SECTION("the reachable part of the test state machine is valid") {
+		REQUIRE(sm_verify(&s1, &s_error).empty());
+	}
+
+	SECTION("entry states must be children without cycles") {
+		std::vector<sm_verify_issue> issues = sm_verify(&s6_child, nullptr);
+		REQUIRE(issues.size() == 3);
+		REQUIRE(has_issue(issues, sm_verify_entry_state_not_child, &s6_child));
+		REQUIRE(has_issue(issues, sm_verify_entry_state_cycle, &s6_child));
+		/* The parent of s6_child is entered through the same cycle */
+		REQUIRE(has_issue(issues, sm_verify_entry_state_cycle, &s6));
+	}
+
+	SECTION("parent chains must not contain cycles") {
+		sm_state parent = {};
+		sm_state child = {};
+		parent.parent_state = &child;
+		child.parent_state = &parent;
+		std::vector<sm_verify_issue> issues = sm_verify(&child, nullptr);
+		REQUIRE(has_issue(issues, sm_verify_parent_cycle, &child));
+		REQUIRE(has_issue(issues, sm_verify_parent_cycle, &parent));
+	}
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+	SECTION("unreachable states are reported") {
+		std::vector<sm_verify_issue> issues =
+			sm_verify(&s1, &s_error, {&s1, &s_error, &s6_child_child});
+		REQUIRE(issues.size() == 1);
+		REQUIRE(has_issue(issues, sm_verify_unreachable_state,
+						  &s6_child_child));
+	}
+
+	SECTION("states reached through a function aren't reported") {
+		/* s1 is only reachable through the function of s11 */
+		REQUIRE(sm_verify(&s11_child_child, &s_error,
+						  {&s11_child_child, &s1})
+					.empty());
+	}
+
+	SECTION("transitions must be complete and reachable") {
+		sm_state first = {};
+		sm_state second = {};
+		sm_guard guard = {};
+		guard.fn = guard1;
+		sm_transition transitions[] = {
+			{1, &guard, nullptr, &second},
+			{1, nullptr, nullptr, &second},
+			{1, nullptr, nullptr, &first},
+			{2, nullptr, nullptr, nullptr},
+		};
+		sm_state_transitions table = {transitions, 4};
+		first.transitions = &table;
+
+		std::vector<sm_verify_issue> issues = sm_verify(&first, nullptr);
+		REQUIRE(issues.size() == 2);
+		REQUIRE(has_issue(issues, sm_verify_shadowed_transition, &first,
+						  &transitions[2]));
+		REQUIRE(has_issue(issues, sm_verify_missing_next_state, &first,
+						  &transitions[3]));
+	}
+#endif
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES && !SM_STATE_MACHINE_OPTIMIZE_RAM
+	SECTION("the states of the submachines are verified") {
+		submachine_fixture f;
+		f.wait_transitions[1].next_state = nullptr;
+
+		std::vector<sm_verify_issue> issues =
+			sm_verify(&f.idle, nullptr, {&f.idle, &f.link_a, &f.link_b,
+										 &f.wait, &f.ready});
+		REQUIRE(issues.size() == 1);
+		REQUIRE(has_issue(issues, sm_verify_missing_next_state, &f.wait,
+						  &f.wait_transitions[1]));
+	}
+#endif
+}
+
+#if SM_STATE_MACHINE_ENABLE_LOG
+TEST_CASE("Diagram representations") {
+	SECTION("PlantUML") {
+		std::string diagram = sm_get_plantuml_representation(&s1);
+		REQUIRE(diagram.rfind("@startuml\n", 0) == 0);
+		REQUIRE(diagram.find("state \"s1\" as S0\n") != std::string::npos);
+		REQUIRE(diagram.find("[*] --> S0\n") != std::string::npos);
+		REQUIRE(diagram.find("S0 : entry / s1_entry_action\n") !=
+				std::string::npos);
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+		REQUIRE(diagram.find("state \"s5\" as") != std::string::npos);
+		REQUIRE(diagram.find("state \"s5_child_child\" as") !=
+				std::string::npos);
+		REQUIRE(diagram.find(" : 0 [guard1] / trans_action1\n") !=
+				std::string::npos);
+		/* Completion transitions have no event */
+		REQUIRE(diagram.find(" : [guard4] / trans_action3\n") !=
+				std::string::npos);
+#endif
+	}
+
+	SECTION("Graphviz") {
+		std::string diagram = sm_get_graphviz_representation(&s1);
+		REQUIRE(diagram.rfind("digraph state_machine {\n", 0) == 0);
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+		REQUIRE(diagram.find("subgraph cluster_") != std::string::npos);
+		REQUIRE(diagram.find("label=\"0 [guard1] / trans_action1\"") !=
+				std::string::npos);
+#endif
+	}
+
+#if SM_STATE_MACHINE_ENABLE_SUBMACHINES && !SM_STATE_MACHINE_OPTIMIZE_RAM
+	SECTION("submachines are drawn in each submachine state") {
+		submachine_fixture f;
+		std::string plantuml = sm_get_plantuml_representation(&f.idle);
+		REQUIRE(plantuml.find("state \"link_a\" as S1 {\n"
+							  "\tstate \"wait\" as S1_S2\n"
+							  "\tstate \"ready\" as S1_S3\n"
+							  "\t[*] --> S1_S2\n"
+							  "}\n") != std::string::npos);
+		REQUIRE(plantuml.find("state \"link_b\" as S4 {\n"
+							  "\tstate \"wait\" as S4_S2\n"
+							  "\tstate \"ready\" as S4_S3\n"
+							  "\t[*] --> S4_S2\n"
+							  "}\n") != std::string::npos);
+		/* Not at the top level */
+		REQUIRE(plantuml.find("\nstate \"wait\"") == std::string::npos);
+		REQUIRE(plantuml.find("S1 --> S4 : 2\n") != std::string::npos);
+		REQUIRE(plantuml.find("S1_S2 --> S1_S3 : 3\n") != std::string::npos);
+		REQUIRE(plantuml.find("S4_S3 --> S4_S2 : 3\n") != std::string::npos);
+
+		std::string graphviz = sm_get_graphviz_representation(&f.idle);
+		REQUIRE(graphviz.find("\tsubgraph cluster_S4 {\n") !=
+				std::string::npos);
+		REQUIRE(graphviz.find("\t\tS4_S2 [label=\"wait\"") !=
+				std::string::npos);
+		REQUIRE(graphviz.find("\t\tS4 -> S4_S2;\n") != std::string::npos);
+		REQUIRE(graphviz.find("\tS1 -> S4 [ltail=cluster_S1, "
+							  "lhead=cluster_S4, label=\"2\"];\n") !=
+				std::string::npos);
+		REQUIRE(graphviz.find("\tS4_S3 -> S4_S2 [label=\"3\"];\n") !=
+				std::string::npos);
+	}
+#endif
+}
+
+#if SM_STATE_MACHINE_ENABLE_TRACE && !SM_STATE_MACHINE_OPTIMIZE_RAM
+TEST_CASE("Profiler heatmap") {
+	sm_state idle = {};
+	sm_state running = {};
+	sm_transition idle_transitions[] = {{1, nullptr, nullptr, &running}};
+	sm_transition running_transitions[] = {{2, nullptr, nullptr, &idle}};
+	sm_state_transitions idle_table = {idle_transitions, 1};
+	sm_state_transitions running_table = {running_transitions, 1};
+	idle.name = "idle";
+	idle.transitions = &idle_table;
+	running.name = "running";
+	running.transitions = &running_table;
+
+	sm_profiler profiler;
+	sm_state_machine sm;
+	sm_state_machine_hooks hooks = {};
+	hooks.tracer = profiler.tracer();
+	sm_state_machine_init(&sm, nullptr, &idle, &idle, &hooks, nullptr,
+						  nullptr);
+
+	for (int type : {1, 2, 1, 3}) {
+		sm_event event = {type, nullptr};
+		sm_state_machine_handle_event(&sm, &event);
+	}
+
+	const sm_heatmap &heatmap = profiler.heatmap();
+	REQUIRE(heatmap.states.at(&idle).hits == 2);
+	REQUIRE(heatmap.states.at(&running).hits == 2);
+	REQUIRE(heatmap.transitions.at(&idle_transitions[0]).hits == 2);
+	REQUIRE(heatmap.transitions.at(&running_transitions[0]).hits == 1);
+
+	sm_diagram_options options;
+	options.heatmap = &heatmap;
+	std::string diagram = sm_get_plantuml_representation(&idle, options);
+	REQUIRE(diagram.find("S0 -[#FF0000,bold]-> S1 : 1\\n2 hits") !=
+			std::string::npos);
+	REQUIRE(diagram.find("S0 : 2 hits") != std::string::npos);
+
+	profiler.reset();
+	REQUIRE(profiler.heatmap().states.empty());
+}
+
+TEST_CASE("Profile-guided transition reordering") {
+	enum { event_rare = 1, event_warm, event_hot };
+	sm_state idle = {};
+	sm_state done = {};
+	sm_guard never = {"never",
+					  [](void *, const sm_state *, void *, const sm_event *,
+						 const sm_state *, void *) { return false; }};
+	sm_transition transitions[] = {
+		{event_rare, &never, nullptr, &done},
+		{event_rare, nullptr, nullptr, &idle},
+		{event_warm, nullptr, nullptr, &idle},
+		{event_hot, nullptr, nullptr, &idle},
+	};
+	sm_state_transitions table = {transitions, 4};
+	idle.name = "idle";
+	idle.transitions = &table;
+	done.name = "done";
+
+	sm_profiler profiler;
+	sm_state_machine sm;
+	sm_state_machine_hooks hooks = {};
+	hooks.tracer = profiler.tracer();
+	sm_state_machine_init(&sm, nullptr, &idle, &done, &hooks, nullptr,
+						  nullptr);
+	for (int type : {event_hot, event_warm, event_hot, event_rare, event_hot,
+					 event_warm}) {
+		sm_event event = {type, nullptr};
+		sm_state_machine_handle_event(&sm, &event);
+	}
+
+	REQUIRE(sm_get_hot_event_order(&table, profiler.heatmap()) ==
+			std::vector<int>{event_hot, event_warm, event_rare});
+
+	sm_diagram_options options;
+	options.stringify_event = [](const sm_event *event) -> const char * {
+		return event->type == event_hot ? "event_hot" : nullptr;
+	};
+	/* The guard priority is preserved */
+	REQUIRE(sm_get_transition_tables_source(&idle, profiler.heatmap(), options)
+				.find("SM_STATE_MACHINE_TRANSITION_DEF_START(idle)\n"
+					  "SM_STATE_MACHINE_TRANSITION_ADD_EX(event_hot, NULL, "
+					  "NULL, &idle)\n"
+					  "SM_STATE_MACHINE_TRANSITION_ADD_EX(2, NULL, NULL, "
+					  "&idle)\n"
+					  "SM_STATE_MACHINE_TRANSITION_ADD_EX(1, "
+					  "&SM_STATE_MACHINE_GUARD(never), NULL, &done)\n"
+					  "SM_STATE_MACHINE_TRANSITION_ADD_EX(1, NULL, NULL, "
+					  "&idle)\n"
+					  "SM_STATE_MACHINE_TRANSITION_DEF_END(idle)\n") !=
+			std::string::npos);
+}
+#endif
+#endif
@@ -0,0 +1,212 @@
+/**
+ * \verbatim
+ *                              _  __
+ *                             | |/ /
+ *                             | ' / ___ _ __ _ __
+ *                             |  < / _ \ '__| '__|
+ *                             | . \  __/ |  | |
+ *                             |_|\_\___|_|  |_|
+ * \endverbatim
+ * \file		test_wal.cpp
+ *
+ * \brief		Write-ahead log unit tests
+ *
+ * \copyright	Copyright 2021 Kerr s.r.l. - All Rights Reserved.
+ */
+#include "catch2/catch_test_macros.hpp"
+
+#include "sm_wal.h"
+#include "test_sm.h"
+
+#if !SM_STATE_MACHINE_OPTIMIZE_RAM
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+namespace {
+constexpr size_t num_instances = 4;
+
+/* What the start action saw, per instance */
+struct instance_data {
+	int total = 0;
+	int replayed = 0;
+	const sm_wal *wal = nullptr;
+};
+
+/* The start action adds the payload of the event to the total */
+void add_payload(void *user_data, const sm_state *, void *,
+				 const sm_event *event, const sm_state *, void *) {
+	auto *data = static_cast<instance_data *>(user_data);
+	data->total += *static_cast<const int *>(event->data);
+	data->replayed += sm_wal_replaying(data->wal);
+}
+
+/* Restarted at each open as after a crash */
+struct fixture : test_sm_basic {
+	fixture() {
+		test_sm_basic_init(this);
+		action.fn = add_payload;
+		idle_transitions[0].action = &action;
+		char path[] = "/tmp/sm_test_wal_XXXXXX";
+		REQUIRE(mkdtemp(path));
+		directory = path;
+		REQUIRE(sm_shared_definition_init(&definition, states, 4));
+	}
+	~fixture() {
+		sm_shared_definition_deinit(&definition);
+		std::filesystem::remove_all(directory);
+	}
+
+	bool open() {
+		for (size_t i = 0; i < num_instances; ++i) {
+			data[i] = instance_data{0, 0, &wal};
+			test_sm_basic_init_instance(this, &instances[i], &data[i]);
+		}
+		return sm_wal_open(&wal, directory.c_str(), &definition, instances,
+						   num_instances, 64);
+	}
+
+	uint64_t dispatch(size_t instance, int type, int payload = 0) {
+		sm_event event = {type, &payload};
+		uint64_t sequence;
+		sm_wal_handle_event(&wal, instance, &instances[instance], &event,
+							&payload, sizeof(payload), &sequence);
+		return sequence;
+	}
+
+	size_t count_files(const std::string &prefix) const {
+		size_t count = 0;
+		for (const auto &entry :
+			 std::filesystem::directory_iterator(directory)) {
+			count += entry.path().filename().string().rfind(prefix, 0) == 0;
+		}
+		return count;
+	}
+
+	std::string directory;
+	sm_action action = {};
+	sm_shared_definition definition;
+	instance_data data[num_instances];
+	sm_state_machine instances[num_instances];
+	sm_wal wal;
+};
+} // namespace
+
+TEST_CASE("Write-ahead log") {
+	fixture f;
+	REQUIRE(f.open());
+
+	SECTION("the events are replayed at the next open") {
+		REQUIRE(f.dispatch(1, event_basic_start, 5) == 1);
+		REQUIRE(f.dispatch(1, event_basic_stop) == 2);
+		/* Ignored: not logged */
+		REQUIRE(f.dispatch(2, event_basic_stop) == 0);
+		const uint64_t last = f.dispatch(1, event_basic_start, 7);
+		REQUIRE(f.dispatch(3, event_basic_start, -1) == 4);
+		REQUIRE(sm_wal_sync(&f.wal, last));
+		REQUIRE(sm_wal_close(&f.wal));
+
+		REQUIRE(f.open());
+		REQUIRE(f.instances[0].current_state == &f.idle);
+		REQUIRE(f.instances[1].current_state == &f.running);
+		REQUIRE(f.instances[1].previous_state == &f.idle);
+		REQUIRE(f.instances[3].current_state == &f.running);
+		REQUIRE(f.data[1].total == 12);
+		REQUIRE(f.data[1].replayed == 2);
+		REQUIRE(f.data[3].total == -1);
+		REQUIRE(!sm_wal_replaying(&f.wal));
+		REQUIRE(f.dispatch(0, event_basic_start, 1) == 5);
+	}
+
+	SECTION("a snapshot truncates the log") {
+		f.dispatch(0, event_basic_start, 1);
+		f.dispatch(1, event_basic_start, 2);
+		REQUIRE(sm_wal_snapshot(&f.wal, f.instances));
+		f.dispatch(1, event_basic_stop);
+		f.dispatch(1, event_basic_start, 3);
+		REQUIRE(sm_wal_snapshot(&f.wal, f.instances));
+		f.dispatch(2, event_basic_start, 4);
+		REQUIRE(sm_wal_close(&f.wal));
+		REQUIRE(f.count_files("snapshot-") == 1);
+		REQUIRE(f.count_files("log-") == 1);
+
+		REQUIRE(f.open());
+		REQUIRE(f.instances[0].current_state == &f.running);
+		REQUIRE(f.instances[1].current_state == &f.running);
+		REQUIRE(f.instances[1].previous_state == &f.idle);
+		REQUIRE(f.instances[2].current_state == &f.running);
+		/* Only the event after the snapshot is replayed */
+		REQUIRE(f.data[0].total == 0);
+		REQUIRE(f.data[1].total == 0);
+		REQUIRE(f.data[2].total == 4);
+		REQUIRE(f.dispatch(3, event_basic_start, 5) == 6);
+	}
+
+	SECTION("a partially written commit is discarded") {
+		REQUIRE(sm_wal_sync(&f.wal, f.dispatch(0, event_basic_start, 1)));
+		REQUIRE(sm_wal_close(&f.wal));
+		const auto log = std::filesystem::path(f.directory) /
+						 "log-0000000000000000";
+		const auto size = std::filesystem::file_size(log);
+		{
+			std::ofstream torn(log, std::ios::binary | std::ios::app);
+			torn << "\x20\x01\x02";
+		}
+
+		REQUIRE(f.open());
+		REQUIRE(std::filesystem::file_size(log) == size);
+		REQUIRE(f.instances[0].current_state == &f.running);
+		REQUIRE(sm_wal_sync(&f.wal, f.dispatch(0, event_basic_stop)));
+		REQUIRE(sm_wal_close(&f.wal));
+		REQUIRE(f.open());
+		REQUIRE(f.instances[0].current_state == &f.idle);
+	}
+
+	SECTION("a snapshot of other instances is refused") {
+		REQUIRE(sm_wal_snapshot(&f.wal, f.instances));
+		REQUIRE(sm_wal_close(&f.wal));
+		sm_wal other;
+		REQUIRE(!sm_wal_open(&other, f.directory.c_str(), &f.definition,
+							 f.instances, num_instances - 1, 64));
+		REQUIRE(f.open());
+	}
+
+	SECTION("the threads commit together") {
+		constexpr int rounds = 500;
+		std::atomic<bool> synced{true};
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < num_instances; ++i) {
+			threads.emplace_back([&f, &synced, i] {
+				for (int j = 0; j < rounds; ++j) {
+					f.dispatch(i, event_basic_start, 1);
+					if (!sm_wal_sync(&f.wal, f.dispatch(i, event_basic_stop))) {
+						synced = false;
+					}
+				}
+				f.dispatch(i, event_basic_start, 1);
+			});
+		}
+		for (auto &thread : threads) {
+			thread.join();
+		}
+		REQUIRE(synced);
+		REQUIRE(sm_wal_num_commits(&f.wal) <= num_instances * rounds);
+		REQUIRE(sm_wal_close(&f.wal));
+
+		REQUIRE(f.open());
+		for (size_t i = 0; i < num_instances; ++i) {
+			REQUIRE(f.instances[i].current_state == &f.running);
+			REQUIRE(f.data[i].total == rounds + 1);
+		}
+	}
+
+	REQUIRE(sm_wal_close(&f.wal));
+}
+
+#endif